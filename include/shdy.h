@@ -6,6 +6,10 @@
 #define SHDY_H
 
 #include <stdio.h>
+#include <limits.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <signal.h>
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
 
@@ -23,29 +27,553 @@ typedef struct {
     int fb_height;
     bool fullscreen;
     bool hidden;
+    bool dirty; // Set on resize, expose or input, cleared once a frame is presented.
+    // Cursor position (xy) and position of the last left click (zw) in framebuffer pixels from the bottom left,
+    // zw is negated once the button is released.
+    float mouse[4];
     GLFWwindow *glfw_win;
 } Window;
 
 void window_create(Window *window, const char *title, int width, int height, bool fullscreen, bool hidden);
 void window_destroy(Window *window);
 bool window_is_open(Window *window);
-void window_update(Window *window);
+void window_present(Window *window);
+void window_poll_events(Window *window);
+
+#define WINDOW_DEFAULT_REFRESH_RATE 60
+
+int window_refresh_rate(Window *window);
+
+// Returns the fd of the windowing system connection, or -1 if the platform doesn't expose one.
+int window_native_event_fd();
 
 float get_elapsed_time();
+// Returns a monotonic timestamp in milliseconds, for measuring durations.
+double get_time_ms();
+
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} StrBuf;
+
+// Grows the buffer so len more bytes and the terminator fit.
+void str_buf_reserve(StrBuf *str_buf, size_t len);
+void str_buf_append(StrBuf *str_buf, const char *str, size_t len);
+void str_buf_appendf(StrBuf *str_buf, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+// Empties the buffer but keeps its allocation for reuse.
+void str_buf_clear(StrBuf *str_buf);
+void str_buf_free(StrBuf *str_buf);
+
+// Files smaller than this are read rather than mapped, mapping costs more than copying them.
+#define FILE_MAP_MIN_SIZE (64 * 1024)
+
+// Reads the file at path into out, replacing its contents and reusing its allocation. Returns false and logs the
+// error if the file can't be read, e.g while an editor is saving it, so the caller can retry later.
+bool file_read(const char *path, StrBuf *out);
+
+// A read only view of the contents of a file, mapped unless it's small enough to be read into buf.
+typedef struct {
+    const char *data;
+    size_t len;
+    void *map; // nullptr if the file was read into buf.
+    StrBuf buf; // Kept across opens so small files don't churn the allocator.
+    volatile sig_atomic_t truncated; // The file shrank while mapped, the pages past its end read as zeros.
+} FileView;
+
+// Opens the file at path into view, closing what it held before. Returns false and logs the error if the file
+// can't be read. A thread reads one mapped view at a time, check truncated once done with its data.
+bool file_view_open(FileView *view, const char *path);
+// Unmaps the file, keeping buf for the next open.
+void file_view_close(FileView *view);
+void file_view_free(FileView *view);
+
+// FNV-1a hash of the bytes.
+uint64_t hash_bytes(const char *data, size_t len);
+// Writes the path of the file cached under key to out, e.g $XDG_CACHE_HOME/shdy/DIR_NAME/KEY.EXT or
+// ~/.cache/shdy/DIR_NAME/KEY.EXT, creating the directory if needed. Returns false if there is no home directory.
+bool cache_file_path(const char *dir_name, uint64_t key, const char *ext, char *out);
+
+// Sends all len bytes. A peer that is gone fails the send rather than raising SIGPIPE.
+bool socket_send_all(int fd, const void *data, size_t len);
+// Receives exactly len bytes. Returns false if the other end closed the socket first.
+bool socket_recv_all(int fd, void *data, size_t len);
+
+#define SOURCE_CACHE_MAX_FILES 64
+#define SOURCE_FILE_MAX_INCLUDES 16
+
+typedef struct {
+    size_t start; // Byte offsets of the #include directive line.
+    size_t end;
+    int line;
+    int file_index;
+} SourceInclude;
+
+typedef struct {
+    char *path; // Absolute path, used as the key.
+    StrBuf src; // Kept allocated across reloads.
+    bool readable;
+    uint64_t hash;
+    bool stale;
+    SourceInclude includes[SOURCE_FILE_MAX_INCLUDES];
+    int num_includes;
+} SourceFile;
+
+// Caches the contents of shader sources and the #include graph between them, so only files that changed
+// are read and parsed again.
+typedef struct {
+    SourceFile files[SOURCE_CACHE_MAX_FILES];
+    int num_files;
+} SourceCache;
+
+// A span of consecutive lines of an expanded source that came from the same file.
+typedef struct {
+    int line; // First line of the span in the expanded source, from 1.
+    int file_index;
+    int file_line; // Line of the file the span starts at.
+} SourceLineSpan;
+
+// Maps the lines of an expanded source back to the files and lines they came from, since drivers number the lines
+// of the source they were given, not of the files it was expanded from.
+typedef struct {
+    SourceLineSpan *spans; // Kept allocated across expands.
+    int num_spans;
+    int cap;
+    size_t scanned; // Bytes of the expanded source counted into lines so far.
+    int lines;
+} SourceLineMap;
+
+// Returns false if line is outside of the mapped source.
+bool source_line_map_lookup(const SourceLineMap *line_map, int line, int *out_file_index, int *out_file_line);
+void source_line_map_free(SourceLineMap *line_map);
+
+void source_cache_destroy(SourceCache *source_cache);
+// Returns the index of the file for the given path, adding it if it isn't cached yet. Returns -1 if full.
+int source_cache_add(SourceCache *source_cache, const char *path);
+// Re-reads the file at path if cached. Returns its index if the contents changed, -1 otherwise.
+int source_cache_update(SourceCache *source_cache, const char *path);
+// Writes the file at root with all #include directives resolved to out, and the index of every file it
+// depends on to deps, with root first. Fills line_map, if given, with where each line of out came from. Returns
+// false if any of the files couldn't be read.
+bool source_cache_expand(SourceCache *source_cache, int root, StrBuf *out, int *deps, int *num_deps, int max_deps,
+                         SourceLineMap *line_map);
+
+#define SHADER_MAX_DEPS SOURCE_CACHE_MAX_FILES
+#define SHADER_MAX_DEFINES 32
+#define SHADER_MAX_BUFFERS 4
+// uBufferN is bound to texture unit SHADER_BUFFER_TEXTURE_UNIT + N.
+#define SHADER_BUFFER_TEXTURE_UNIT 1
+// Compute passes run in SHADER_COMPUTE_LOCAL_SIZE^2 workgroups and write to uOutput on this image unit.
+#define SHADER_COMPUTE_LOCAL_SIZE 8
+#define SHADER_OUTPUT_IMAGE_UNIT 0
+// Binding of the storage buffer shared by the compute passes.
+#define SHADER_STORAGE_BINDING 0
+#define SHADER_DEFINE_MAX_NAME 64
+#define SHADER_DEFINE_MAX_VALUE 128
+
+typedef struct {
+    char name[SHADER_DEFINE_MAX_NAME];
+    char value[SHADER_DEFINE_MAX_VALUE];
+} ShaderDefine;
+
+// Parses "NAME" or "NAME=VALUE" into define, VALUE defaults to 1. Returns false if it isn't a valid define.
+bool shader_define_parse(ShaderDefine *define, const char *str);
+
+#define SHADER_MAX_TEXTURES 8
+#define SHADER_TEXTURE_MAX_NAME 64
+// Texture N is bound to texture unit SHADER_TEXTURE_UNIT + N, after the buffers.
+#define SHADER_TEXTURE_UNIT (SHADER_BUFFER_TEXTURE_UNIT + SHADER_MAX_BUFFERS)
+
+// An image file sampled by the shaders as "uniform sampler2D NAME".
+typedef struct {
+    char name[SHADER_TEXTURE_MAX_NAME];
+    char path[PATH_MAX];
+} ShaderTexture;
+
+// Parses "NAME=PATH" into texture. Returns false if NAME isn't a valid identifier or PATH is empty.
+bool shader_texture_parse(ShaderTexture *texture, const char *str);
+
+#define SHADER_MAX_PARAMS 32
+#define SHADER_PARAM_MAX_NAME 64
+
+// A uniform annotated with "// @range MIN MAX", which can be set while the shader runs without recompiling it.
+typedef struct {
+    char name[SHADER_PARAM_MAX_NAME];
+    int components; // 1 for float and int, 2 to 4 for vecN.
+    bool integer;
+    float min;
+    float max;
+    float value[4];
+    int location; // -1 if the uniform isn't active in the program.
+} ShaderParam;
+
+#define SHADER_MAX_UNIFORMS 64
+
+// Location of a uniform of a program loaded from SPIR-V, which GL can't look up by name.
+typedef struct {
+    char name[SHADER_PARAM_MAX_NAME];
+    int location;
+} ShaderUniform;
+
+// Specialization constant ids of the preamble knobs in SPIR-V programs.
+#define SHADER_SPEC_FBM_OCTAVES 0
+
+#define SHADER_MAX_DIAGNOSTICS 32
+#define SHADER_DIAGNOSTIC_MAX_MESSAGE 256
+
+typedef enum {
+    DIAGNOSTIC_ERROR,
+    DIAGNOSTIC_WARNING
+} DiagnosticSeverity;
+
+// A compiler or linker message parsed from the driver's info log, with its location mapped back to the file it's in.
+typedef struct {
+    DiagnosticSeverity severity;
+    int file_index; // Source cache index, -1 if the message is about the preamble or has no location.
+    const char *source_name; // Names the part of the preamble when file_index is -1, nullptr if there's no location.
+    int line; // From 1, 0 if unknown.
+    int column; // From 1, 0 if unknown.
+    char message[SHADER_DIAGNOSTIC_MAX_MESSAGE];
+} ShaderDiagnostic;
+
+// A compile waiting on the validation of its source, see shader_compile_start().
+typedef struct ShaderCompile ShaderCompile;
 
 typedef struct {
     const char *user_frag_shader_path;
+    SourceCache *source_cache;
+    bool compute; // A compute pass rather than a fragment shader drawn over a quad.
+    bool spirv; // Programs are loaded from SPIR-V compiled by glslang, rather than compiled from GLSL by the driver.
+    const ShaderDefine *cli_defines; // Take precedence over any #pragma shdy define in the source.
+    int num_cli_defines;
+    StrBuf defines_src; // #define lines injected ahead of the preamble in the current program.
+    StrBuf expanded_src; // Scratch space for the expanded user source, reused by every compile.
+    char buffer_paths[SHADER_MAX_BUFFERS][PATH_MAX]; // From #pragma shdy buffer/compute N PATH.
+    bool buffer_compute[SHADER_MAX_BUFFERS];
+    ShaderTexture textures[SHADER_MAX_TEXTURES]; // From #pragma shdy texture NAME PATH.
+    int num_textures;
+    ShaderParam params[SHADER_MAX_PARAMS]; // Keep their values across recompiles if the name and type match.
+    int num_params;
+    int deps[SHADER_MAX_DEPS]; // Source cache indices of the user shader and everything it includes.
+    int num_deps;
+    SourceLineMap line_map; // Of expanded_src.
+    ShaderDiagnostic diagnostics[SHADER_MAX_DIAGNOSTICS]; // Of the latest compile, errors and warnings.
+    int num_diagnostics;
+    bool failed; // The latest compile failed, the previous program is kept if there is one.
+    bool outdated;
+    ShaderCompile *pending; // In flight, nullptr otherwise.
     unsigned int vert_shader;
     unsigned int program;
+    ShaderUniform uniforms[SHADER_MAX_UNIFORMS]; // Of the program, if it's loaded from SPIR-V.
+    int num_uniforms;
     bool compiled;
-    int uniform_resolution_loc;
-    int uniform_elapsed_time_loc;
+    bool time_varying; // False when the program reads no time-varying inputs, so frames can be reused.
+    int uniform_noise_texture_loc;
+    int uniform_buffer_locs[SHADER_MAX_BUFFERS];
 } Shader;
 
-void shader_create(Shader *shader, const char *user_frag_shader_path);
-void shader_compile(Shader *shader);
-void shader_set_uniform_resolution(Shader *shader, int width, int height);
-void shader_set_uniform_elapsed_time(Shader *shader, float elapsed_time);
+typedef struct {
+    double compile_ms;
+    double link_ms;
+} ShaderBuildStats;
+
+void shader_create(Shader *shader, SourceCache *source_cache, const char *user_frag_shader_path,
+                   const ShaderDefine *cli_defines, int num_cli_defines, bool compute, bool spirv);
+void shader_destroy(Shader *shader);
+// Returns false and keeps the current program if the shader fails to compile.
+bool shader_compile(Shader *shader);
+// Starts a compile like shader_compile(), but glslang validates the source on the validation threads and the program
+// is built by shader_compile_finish() once it's done. Returns true if the compile is already over, e.g the source
+// failed to parse or its program is cached, and failed tells whether it succeeded.
+bool shader_compile_start(Shader *shader);
+// Builds the program of the pending compile if its validation has finished, waiting for it if wait is set. Returns
+// false while it's still validating, otherwise true and failed tells whether the compile succeeded.
+bool shader_compile_finish(Shader *shader, bool wait);
+// Writes a #define line to out for each -D option and each "#pragma shdy define NAME VALUE" in the expanded user
+// source. Returns false if a pragma is malformed or there are too many defines.
+bool shader_build_defines(Shader *shader, const char *user_src, StrBuf *out);
+// Compiles and links the expanded user source into a new program, with defines_src ahead of the preamble. The
+// preamble definitions are compiled into the user shader if inline_preamble is set, otherwise the shared
+// preamble shader object for the define set is linked in.
+bool shader_build_program(Shader *shader, const char *defines_src, const char *user_src, bool inline_preamble,
+                          unsigned int *out_program, ShaderBuildStats *out_stats);
+bool shader_depends_on(Shader *shader, int file_index);
+// Returns the path of the file the diagnostic is in, the name of the preamble part, or nullptr if it has no location.
+const char *shader_diagnostic_path(const Shader *shader, const ShaderDiagnostic *diagnostic);
+// Returns the location of the uniform in the current program, or -1 if it isn't active.
+int shader_uniform_location(const Shader *shader, const char *name);
+// Returns the param with the given name, or nullptr if the shader doesn't declare it.
+ShaderParam *shader_find_param(Shader *shader, const char *name);
+// Clamps values to the range of param and sets them on the program, they apply from the next draw.
+void shader_set_param(Shader *shader, ShaderParam *param, const float *values);
+
+// Built-in inputs shared by every program and pass, matching the std140 layout of the ShdyInputs uniform block
+// declared in shdy.frag.
+typedef struct {
+    float mouse[4];
+    float date[4]; // Year, month (0-11), day (1-31) and seconds since midnight.
+    float resolution[2];
+    float tile_offset[2];
+    float time;
+    float time_delta;
+    int32_t frame;
+    float padding;
+} ShaderInputs;
+
+#define SHADER_INPUTS_BINDING 0
+// Number of frames of inputs that can be in flight before an update waits for the GPU.
+#define SHADER_INPUTS_RING_SIZE 3
+
+// Writes inputs to the next slot of the persistently mapped inputs buffer and binds it to SHADER_INPUTS_BINDING.
+// The previous slot is fenced first, so call it once per frame before the draws reading the inputs.
+void shader_inputs_update(const ShaderInputs *inputs);
+// Fills the wall clock fields of inputs.
+void shader_inputs_set_date(ShaderInputs *inputs);
+
+typedef enum {
+    GLSL_STAGE_VERTEX,
+    GLSL_STAGE_FRAGMENT,
+    GLSL_STAGE_COMPUTE
+} GlslStage;
+
+// Returns true if shdy is built with glslang (GLSLANG=1). Otherwise glsl_validate() accepts any source and
+// glsl_compile_spirv() always fails.
+bool glslang_available();
+// Parses src with glslang. Returns false and appends glslang's info log to out_log if it's invalid. Safe to call from
+// any thread.
+bool glsl_validate(const char *src, GlslStage stage, StrBuf *out_log);
+// A source being validated with glslang on the validation threads.
+typedef struct GlslValidation GlslValidation;
+
+// Starts validating a copy of the len bytes of src on the validation threads. Returns nullptr if it can't be queued.
+GlslValidation *glsl_validation_start(const char *src, size_t len, GlslStage stage);
+// Returns true once the validation has finished.
+bool glsl_validation_done(const GlslValidation *validation);
+// Takes the result of a finished validation and frees it. Returns false and appends glslang's info log to out_log if
+// the source is invalid.
+bool glsl_validation_finish(GlslValidation *validation, StrBuf *out_log);
+// Frees the validation, once it has finished if it's still running.
+void glsl_validation_cancel(GlslValidation *validation);
+// Returns an fd that is readable once any validation finishes.
+int glsl_validation_event_fd();
+// Clears the event fd, waiting for a validation to finish first if wait is set.
+void glsl_validation_clear_events(bool wait);
+// Compiles src to SPIR-V for OpenGL and appends its words to out_spirv, glslang assigns the locations and bindings the
+// source doesn't set. Returns false and appends glslang's info log to out_log if it fails.
+bool glsl_compile_spirv(const char *src, GlslStage stage, StrBuf *out_spirv, StrBuf *out_log);
+
+#define SPIRV_MAGIC 0x07230203
+
+// Returns true and reads the SPIR-V cached under key into out, if there is any.
+bool spirv_cache_load(uint64_t key, StrBuf *out);
+// Caches spirv under key in $XDG_CACHE_HOME/shdy/spirv, or ~/.cache/shdy/spirv. Failures are logged and ignored.
+void spirv_cache_store(uint64_t key, const StrBuf *spirv);
+// Writes the name and location of the uniforms outside a block in the SPIR-V module to out, from its debug names.
+// Returns their count.
+int spirv_reflect_uniforms(const StrBuf *spirv, ShaderUniform *out, int max);
+
+// A shader translated to C++ and compiled into a shared object, for rendering prints without a GPU.
+typedef struct CpuProgram CpuProgram;
+
+// Appends the GLSL src translated to C++ to out, ready to compile against the CPU runtime (shdy_cpu.hpp). Line N of
+// src stays line N of the "shdy" file the compiler reports errors in.
+void cpu_translate(const char *src, StrBuf *out);
+// Translates src and compiles it with $CXX, or c++, into a shared object cached in $XDG_CACHE_HOME/shdy/cpu, then
+// loads it. Returns nullptr and appends the compiler's errors to out_log if it fails.
+CpuProgram *cpu_program_create(const char *src, StrBuf *out_log);
+void cpu_program_destroy(CpuProgram *program);
+// Set and get the values of a uniform. Return false if the program has no uniform with that name and number of
+// components.
+bool cpu_program_set_uniform(CpuProgram *program, const char *name, const float *values, int count);
+bool cpu_program_get_uniform(CpuProgram *program, const char *name, float *out_values, int count);
+// Points the sampler2D to RGBA float texels, rows bottom up, which have to outlive the renders using them.
+bool cpu_program_set_texture(CpuProgram *program, const char *name, const float *texels, int width, int height);
+// Renders width x height pixels on num_threads threads, or one per core if 0, and writes them to out_rgb as RGB8,
+// rows bottom up like glReadPixels().
+void cpu_program_render(CpuProgram *program, int width, int height, int num_threads, uint8_t *out_rgb);
+
+#define NOISE_TEXTURE_SIZE 256
+// Number of gradient and Worley noise cells across the texture, it tiles every NOISE_TEXTURE_CELLS cells.
+#define NOISE_TEXTURE_CELLS 32
+#define NOISE_TEXTURE_UNIT 0
+
+// Fills out_rgba (NOISE_TEXTURE_SIZE^2 texels) with tileable value lattice (R), gradient noise (G) and Worley
+// F1, F2 distances (B, A), across all cores.
+void noise_texture_generate(float *out_rgba);
+// Returns the noise texture sampled by the shdy*Tex preamble functions, generating it on first use.
+unsigned int noise_texture_get();
+
+#define THREAD_POOL_MAX_THREADS 16
+#define THREAD_POOL_MAX_JOBS 64
+
+typedef void (*ThreadPoolFn)(void *arg);
+
+typedef struct {
+    ThreadPoolFn fn;
+    void *arg;
+} ThreadPoolJob;
+
+// A fixed set of worker threads running jobs from a queue in submission order.
+typedef struct {
+    pthread_t threads[THREAD_POOL_MAX_THREADS];
+    int num_threads;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    ThreadPoolJob jobs[THREAD_POOL_MAX_JOBS];
+    int head;
+    int num_jobs;
+    bool stopping;
+} ThreadPool;
+
+// Starts num_threads workers, or one per core if 0.
+void thread_pool_create(ThreadPool *thread_pool, int num_threads);
+// Waits for the queued jobs to finish and stops the workers.
+void thread_pool_destroy(ThreadPool *thread_pool);
+// Queues fn(arg) to run on one of the workers. Returns false if the queue is full.
+bool thread_pool_submit(ThreadPool *thread_pool, ThreadPoolFn fn, void *arg);
+
+// Jobs run off the render thread whose results it picks up once they finish, e.g texture decodes. Each kind of job
+// has its own queue, with a thread pool started by the first job and an eventfd the render thread can poll.
+typedef struct {
+    ThreadPool pool;
+    bool started;
+    int event_fd;
+} AsyncQueue;
+
+#define ASYNC_QUEUE_INIT {{}, false, -1}
+
+typedef struct AsyncJob AsyncJob;
+typedef void (*AsyncJobFn)(AsyncJob *job);
+
+// Embedded first in the struct of each job, which its functions cast it back to.
+struct AsyncJob {
+    AsyncQueue *queue;
+    AsyncJobFn run; // Called on the queue's threads.
+    AsyncJobFn free; // Called once the job is both finished and taken or cancelled, on either thread.
+    int state; // Switched atomically between the queue's threads and the render thread.
+};
+
+// Queues job->run on the threads of queue, starting them if needed. Returns false if the queue is full, the job is
+// then still the caller's to free.
+bool async_job_start(AsyncQueue *queue, AsyncJob *job, AsyncJobFn run, AsyncJobFn free);
+// Returns true once the job has run, its results can then be read on the render thread.
+bool async_job_done(const AsyncJob *job);
+// Frees the job, once it has finished if it's still running.
+void async_job_cancel(AsyncJob *job);
+// Returns an fd that is readable once any job of queue finishes.
+int async_queue_event_fd(AsyncQueue *queue);
+// Clears the event fd of queue, waiting for a job to finish first if wait is set.
+void async_queue_clear_events(AsyncQueue *queue, bool wait);
+
+#define TILE_SCHEDULER_MAX_THREADS THREAD_POOL_MAX_THREADS
+
+// A rectangle of an image in pixels, from the bottom left like OpenGL.
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} Tile;
+
+// Called on the thread running each scheduler thread's tiles: begin once before its first tile, draw for each tile
+// and end once after its last. begin and end may be nullptr.
+typedef struct {
+    void (*begin)(void *arg, int thread);
+    void (*draw)(void *arg, int thread, const Tile *tile);
+    void (*end)(void *arg, int thread);
+} TileFns;
+
+// The tiles a thread has left, [head, tail) of the scheduler's tiles. The thread takes them from the head, idle
+// threads steal from the tail.
+typedef struct {
+    pthread_mutex_t mutex;
+    int head;
+    int tail;
+    int num_drawn;
+    int num_stolen; // Tiles taken from other threads.
+    double busy_ms; // Time spent in draw.
+} TileQueue;
+
+// Splits an image into tiles and draws them on several threads, each thread starts with a contiguous run of tiles
+// and steals half of the busiest thread's remaining tiles once it runs out, so shaders whose cost varies across the
+// image still keep every thread busy.
+typedef struct {
+    Tile *tiles;
+    int num_tiles;
+    TileQueue queues[TILE_SCHEDULER_MAX_THREADS];
+    int num_threads;
+    const TileFns *fns;
+    void *arg;
+    double elapsed_ms; // Wall time of the last run.
+} TileScheduler;
+
+// Splits a width x height image into tiles of at most tile_width x tile_height, row by row from the bottom, for
+// num_threads threads, or one per core if 0.
+void tile_scheduler_create(TileScheduler *scheduler, int width, int height, int tile_width, int tile_height,
+                           int num_threads);
+void tile_scheduler_destroy(TileScheduler *scheduler);
+// Draws every tile with fns and returns once they're all drawn.
+void tile_scheduler_run(TileScheduler *scheduler, const TileFns *fns, void *arg);
+// Logs the tiles drawn, stolen and the utilization of each thread in the last run.
+void tile_scheduler_report(const TileScheduler *scheduler);
+
+typedef enum {
+    IMAGE_RGBA8 = 0,
+    IMAGE_RGBA32F
+} ImageFormat;
+
+// Decoded pixels, rows are stored bottom up to match OpenGL.
+typedef struct {
+    int width;
+    int height;
+    ImageFormat format;
+    void *pixels;
+} Image;
+
+// Decodes the PNG, JPEG or Radiance HDR file at path, detected from its contents. HDR images decode to float.
+bool image_load(Image *image, const char *path);
+void image_free(Image *image);
+size_t image_row_size(const Image *image);
+
+// Encodes an RGB8 PNG a few rows at a time, so images too large to hold whole can be written as they're drawn.
+typedef struct PngWriter PngWriter;
+
+// Creates the file at path and writes the PNG header. Returns nullptr and logs the error if it fails.
+PngWriter *png_writer_open(const char *path, int width, int height);
+// Appends num_rows rows of RGB8 pixels, stored top down. Returns false if the encode fails.
+bool png_writer_write_rows(PngWriter *writer, const uint8_t *rgb, int num_rows);
+// Finishes the PNG once every row is written and frees the writer. Returns false if the file is incomplete.
+bool png_writer_close(PngWriter *writer);
+// Frees the writer without finishing the PNG, e.g when its rows couldn't be drawn.
+void png_writer_discard(PngWriter *writer);
+
+// Bytes of decoded rows uploaded per call to texture_load_update, so a large image streams in over several
+// frames instead of stalling one.
+#define TEXTURE_UPLOAD_BUDGET (16 * 1024 * 1024)
+
+// An image being decoded on the loader threads and then uploaded on the render thread.
+typedef struct TextureLoad TextureLoad;
+
+typedef enum {
+    TEXTURE_LOAD_DECODING = 0,
+    TEXTURE_LOAD_UPLOADING,
+    TEXTURE_LOAD_DONE,
+    TEXTURE_LOAD_FAILED
+} TextureLoadState;
+
+// Starts decoding the image at path on the texture loader threads. Returns nullptr if it can't be queued.
+TextureLoad *texture_load_start(const char *path);
+// Uploads up to *budget bytes of the decoded image through a pixel buffer, subtracting what was uploaded from
+// *budget, and returns the state of the load.
+TextureLoadState texture_load_update(TextureLoad *load, size_t *budget);
+// Takes the texture of a TEXTURE_LOAD_DONE load, with mipmaps, and frees the load.
+unsigned int texture_load_finish(TextureLoad *load, int *out_width, int *out_height);
+// Frees the load, once its decode is finished if it's still running.
+void texture_load_cancel(TextureLoad *load);
+// Returns an fd that is readable once any decode finishes.
+int texture_load_event_fd();
+// Clears the event fd, waiting for a decode to finish first if wait is set.
+void texture_load_clear_events(bool wait);
 
 typedef enum {
     PRINTING_DISABLED = 0,
@@ -58,37 +586,325 @@ typedef enum {
 } PrintSize;
 
 void print_size_get_dimensions(PrintSize print_size, int *out_width, int *out_height);
+// Parses the name of a print size, e.g 4k, or WIDTHxHEIGHT. Returns false if it's neither.
+bool print_size_parse(const char *str, int *out_width, int *out_height);
+
+// Size in bytes of the storage buffer shared by the compute passes.
+#define RENDER_STORAGE_SIZE (16 * 1024 * 1024)
+
+// A pass rendering into a pair of float textures, one holding the previous frame while the other is drawn to.
+typedef struct {
+    bool active;
+    char path[PATH_MAX];
+    Shader shader;
+    unsigned int fbos[2];
+    unsigned int textures[2];
+    int current; // Index of the texture holding the latest output.
+} RenderBuffer;
+
+// A texture input, which keeps showing the previous image while a new one loads.
+typedef struct {
+    bool active;
+    ShaderTexture decl;
+    unsigned int texture; // 0 until the first load finishes.
+    int width;
+    int height;
+    TextureLoad *load; // In flight, nullptr otherwise.
+} RenderTexture;
 
 typedef struct {
     int width;
     int height;
     unsigned int vao;
-    unsigned int vbo;
-    unsigned int ebo;
-    Shader shader;
+    unsigned int output_fbo; // Framebuffer the image pass is drawn to.
+    unsigned int output_texture; // Attached to output_fbo when drawing off screen, 0 until then.
+    int output_width; // Size output_texture was allocated with.
+    int output_height;
+    SourceCache source_cache;
+    const ShaderDefine *defines;
+    int num_defines;
+    const ShaderTexture *cli_textures; // Take precedence over any #pragma shdy texture of the same name.
+    int num_cli_textures;
+    bool spirv; // See Shader.
+    Shader shader; // The image pass, drawn after the buffer passes.
+    RenderBuffer buffers[SHADER_MAX_BUFFERS];
+    RenderTexture textures[SHADER_MAX_TEXTURES];
+    float mouse[4]; // Window mouse state, see Window.
+    float last_elapsed_time;
+    int buffer_width; // Size the buffer textures were allocated with.
+    int buffer_height;
+    unsigned int storage_buffer; // Shared by the compute passes, 0 until one is added.
+    int frame;
+    CpuProgram *cpu_program; // The image pass, when rendering on the CPU.
+    // Threads a print is drawn on in tiles, 0 for one per core. If -1 GL prints are only tiled on software renderers.
+    int print_threads;
+    ShaderInputs print_inputs; // Of the print being drawn with shader_renderer_print_tile().
 } ShaderRenderer;
 
-void shader_renderer_create(ShaderRenderer *shader_renderer, const char *frag_shader_path);
+void shader_renderer_create(ShaderRenderer *shader_renderer, const char *frag_shader_path,
+                            const ShaderDefine *defines, int num_defines, const ShaderTexture *textures,
+                            int num_textures, bool spirv);
+// Creates a renderer that draws prints on the CPU, without a GL context. The shader can't have buffer passes.
+void shader_renderer_create_cpu(ShaderRenderer *shader_renderer, const char *frag_shader_path,
+                                const ShaderDefine *defines, int num_defines, const ShaderTexture *textures,
+                                int num_textures);
+// Frees the passes, textures and GL objects of a renderer made with shader_renderer_create().
+void shader_renderer_destroy(ShaderRenderer *shader_renderer);
+// Draws each buffer pass in order and then the image pass.
 void shader_renderer_draw(ShaderRenderer *shader_renderer, float elapsed_time);
+// Returns false if every pass renders the same image each frame.
+bool shader_renderer_time_varying(ShaderRenderer *shader_renderer);
+// Uploads the next part of the decoded textures, or all of them if wait is set, waiting for the decodes in flight.
+// Returns true if any texture finished loading.
+bool shader_renderer_update_textures(ShaderRenderer *shader_renderer, bool wait);
+// Returns true while any texture is being decoded or uploaded.
+bool shader_renderer_loading_textures(ShaderRenderer *shader_renderer);
 void shader_renderer_draw_to_print(ShaderRenderer *shader_renderer, const char *output_path);
-void shader_renderer_reload(ShaderRenderer *shader_renderer);
+// Prepares to draw a print of the renderer's size one tile at a time: waits for the textures, draws the buffer
+// passes for the whole print and binds the image pass. Exits if the shader didn't compile.
+void shader_renderer_print_tiles_begin(ShaderRenderer *shader_renderer);
+// Draws the image pass over the tile of the print and reads it back to out_rgb, rows bottom up.
+void shader_renderer_print_tile(ShaderRenderer *shader_renderer, const Tile *tile, uint8_t *out_rgb);
+// Draws one frame at elapsed_time off screen at the renderer's size, restarting the buffer passes from frame 0, and
+// reads it back to out_rgb, rows bottom up. Returns false if the read back fails.
+bool shader_renderer_draw_to_image(ShaderRenderer *shader_renderer, float elapsed_time, uint8_t *out_rgb);
+// Writes the diagnostics of the latest compile of every pass as one line of JSON to path, or to stdout if path is
+// "-". The file is replaced atomically, so editors watching it never read it half written.
+void shader_renderer_write_diagnostics(ShaderRenderer *shader_renderer, const char *path);
+// Validates the shader at path and its buffer passes with glslang, without a GL context, each pass on its own thread.
+// Writes their diagnostics to diagnostics_path, if given, like shader_renderer_write_diagnostics(). Returns false if
+// any of them is invalid.
+bool shader_renderer_check(const char *frag_shader_path, const ShaderDefine *defines, int num_defines,
+                           const char *diagnostics_path);
+// Re-reads the file at path and marks the shaders that depend on it as outdated if it changed, or reloads the
+// textures loaded from it.
+void shader_renderer_invalidate(ShaderRenderer *shader_renderer, const char *path);
+// Recompiles outdated shaders, validating their sources on the validation threads. Unless wait is set, the passes
+// still validating are built by a later call once glsl_validation_event_fd() is readable. Returns true if any
+// compile finished.
+bool shader_renderer_reload(ShaderRenderer *shader_renderer, bool wait);
+// Sets the param with the given name in every pass declaring it. Returns false if no pass declares it or the
+// number of values doesn't match its type.
+bool shader_renderer_set_param(ShaderRenderer *shader_renderer, const char *name, const float *values, int count);
+// Applies each "NAME VALUE..." line of src, skipping blank lines and # comments. Returns true if any param was set.
+bool shader_renderer_load_params(ShaderRenderer *shader_renderer, const char *src);
+// Writes the path of the params file next to the shader to out, the shader path with a .params extension.
+void params_sidecar_path(const char *frag_shader_path, char *out);
+// Applies the params file at path, if there is one. Returns true if any param was set.
+bool shader_renderer_load_params_file(ShaderRenderer *shader_renderer, const char *path);
+
+#define PARAMS_INPUT_BUFFER_SIZE 4096
+
+// Reads param lines from a pipe or terminal as they arrive, e.g stdin.
+typedef struct {
+    int fd;
+    char buffer[PARAMS_INPUT_BUFFER_SIZE];
+    size_t len;
+    bool eof;
+} ParamsInput;
 
+void params_input_create(ParamsInput *params_input, int fd);
+// Reads what is available on the fd and applies the complete lines. Returns true if any param was set.
+bool params_input_read(ParamsInput *params_input, ShaderRenderer *shader_renderer);
+
+// Side of the tiles a print is split into when drawn in tiles.
+#define PRINT_TILE_SIZE 256
+#define PRINT_WORKERS_MAX 16
+// Tiles queued on a worker, so it starts the next one while the coordinator reads the last.
+#define PRINT_WORKER_MAX_TILES 2
+
+// A worker process drawing print tiles for the coordinator, over a Unix domain socket.
 typedef struct {
-    const char *filepath;
+    pid_t pid;
+    int fd; // -1 once the worker has exited.
+    Tile tiles[PRINT_WORKER_MAX_TILES]; // Sent but not returned yet, in the order they were sent.
+    int tile_indices[PRINT_WORKER_MAX_TILES];
+    int num_tiles;
+    int num_drawn;
+} PrintWorker;
+
+typedef struct {
+    PrintWorker workers[PRINT_WORKERS_MAX];
+    int num_workers;
+} PrintWorkers;
+
+// Forks num_workers processes, each connected to this one by a Unix domain socket. Returns the socket in the workers,
+// which go on to create their own context and draw the tiles sent on it with print_worker_serve(), and -1 in the
+// coordinator. Call it before creating a context or any threads.
+int print_workers_fork(PrintWorkers *print_workers, int num_workers);
+// Sends the tiles of a width x height print to the workers and writes the rows to output_path as a PNG, from the
+// top, as soon as every tile of them is back. The tiles of a worker that dies are sent to the others. Returns false
+// if every worker died before the print was done.
+bool print_workers_render(PrintWorkers *print_workers, int width, int height, const char *output_path);
+// Draws the print tiles requested on fd until the coordinator closes it.
+void print_worker_serve(ShaderRenderer *shader_renderer, int fd);
+
+#define SERVER_MAX_RENDERERS 8
+#define SERVER_MAX_JOBS THREAD_POOL_MAX_THREADS
+#define SERVER_MAX_QUEUE THREAD_POOL_MAX_JOBS
+// Longest request header and inline shader source a client can send, in bytes.
+#define SERVER_MAX_REQUEST (16 * 1024)
+#define SERVER_MAX_SOURCE (1024 * 1024)
+#define SERVER_MAX_DIMENSION 16384
+// A client has this long to send its whole request.
+#define SERVER_REQUEST_TIMEOUT_MS 5000
+#define SERVER_JPEG_QUALITY 90
+
+typedef enum {
+    SERVER_FORMAT_PNG = 0,
+    SERVER_FORMAT_JPEG
+} ServerFormat;
+
+typedef struct Server Server;
+
+// A render request, from being read off its connection until the image has been sent back on it.
+typedef struct {
+    Server *server;
     int fd;
+    char shader_path[PATH_MAX];
+    ShaderDefine defines[SHADER_MAX_DEFINES];
+    int num_defines;
+    int width;
+    int height;
+    float time;
+    ServerFormat format;
+    uint8_t *rgb; // Rows bottom up, nullptr until drawn.
+} ServerJob;
+
+// A renderer kept warm for the shader and defines it was created with.
+typedef struct {
+    bool active;
+    char shader_path[PATH_MAX];
+    ShaderDefine defines[SHADER_MAX_DEFINES]; // The renderer's defines point here.
+    int num_defines;
+    unsigned long last_used;
+    ShaderRenderer renderer;
+} ServerRenderer;
+
+// Draws the requests read off a Unix domain socket by the acceptor thread on the context of the thread running
+// server_run(), one at a time, and encodes and sends back the images on a pool of threads.
+struct Server {
+    char socket_path[PATH_MAX];
+    int listen_fd;
+    int signal_fd; // Readable on SIGINT or SIGTERM.
+    const ShaderTexture *textures;
+    int num_textures;
+    bool spirv;
+    int num_jobs;
+    int max_queue;
+    pthread_t acceptor;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    ServerJob *queue[SERVER_MAX_QUEUE]; // Waiting to be drawn, in the order they arrived.
+    int queue_head;
+    int num_queued;
+    int num_pending; // Accepted and not answered yet, whether queued, drawing or encoding.
+    bool stopping;
+    ServerRenderer renderers[SERVER_MAX_RENDERERS]; // Only used by the thread running server_run().
+    unsigned long num_drawn;
+    ThreadPool encoders;
+};
+
+// Listens on socket_path, replacing a stale socket but refusing to start if another server answers on it. Up to
+// num_jobs images are encoded at once and requests beyond max_queue unanswered ones are turned away. Call it before
+// creating a context or any threads, it blocks SIGINT and SIGTERM so server_run() can stop cleanly on them.
+void server_create(Server *server, const char *socket_path, int num_jobs, int max_queue,
+                   const ShaderTexture *textures, int num_textures, bool spirv);
+// Serves requests on the current context until SIGINT or SIGTERM, then answers the queued ones with an error and
+// waits for the images being sent.
+void server_run(Server *server);
+void server_destroy(Server *server);
+// Asks the server on socket_path to render the shader at a width x height size and writes the image it sends back
+// to output_path, as a JPEG if it ends in .jpg or .jpeg and otherwise as a PNG. Returns false if the server answers
+// with an error or can't be reached.
+bool server_request(const char *socket_path, const char *shader_path, int width, int height,
+                    const ShaderDefine *defines, int num_defines, const char *output_path);
+
+#define FILE_WATCHER_MAX_FILES 64
+#define FILE_WATCHER_MAX_DIRS 16
+// Events for tracked files are coalesced until none have arrived for this long.
+#define FILE_WATCHER_DEBOUNCE_MS 30
+
+typedef struct {
+    char path[PATH_MAX];
+    char name[NAME_MAX + 1];
+    int dir_index;
+    bool pending;
+    bool changed;
+} WatchedFile;
+
+typedef struct {
+    char path[PATH_MAX];
     int wd;
+} WatchedDir;
+
+// Watches the parent directories of a set of tracked files.
+typedef struct {
+    int fd;
+    int debounce_fd;
+    WatchedFile files[FILE_WATCHER_MAX_FILES];
+    int num_files;
+    WatchedDir dirs[FILE_WATCHER_MAX_DIRS];
+    int num_dirs;
     bool modified;
 } FileWatcher;
 
-void file_watcher_create(FileWatcher *file_watcher, const char *filepath);
+void file_watcher_create(FileWatcher *file_watcher);
 void file_watcher_destroy(FileWatcher *file_watcher);
-void file_watcher_poll(FileWatcher *file_watcher);
+// Starts tracking the given file, returns its index in files or -1 on failure.
+int file_watcher_add(FileWatcher *file_watcher, const char *filepath);
+// Reads pending inotify events and restarts the debounce timer if any tracked file was touched.
+void file_watcher_read(FileWatcher *file_watcher);
+// Called once the debounce timer expires, marks the touched files as changed and sets modified.
+void file_watcher_flush(FileWatcher *file_watcher);
+void file_watcher_clear(FileWatcher *file_watcher);
+
+typedef enum {
+    EVENT_NONE = 0,
+    EVENT_WINDOW = 1 << 0,
+    EVENT_FILE = 1 << 1,
+    EVENT_FRAME = 1 << 2,
+    EVENT_FILE_SETTLED = 1 << 3,
+    EVENT_INPUT = 1 << 4,
+    EVENT_TEXTURE = 1 << 5,
+    EVENT_VALIDATE = 1 << 6
+} EventFlags;
+
+// Used when the windowing system connection can't be waited on directly (e.g Wayland).
+#define EVENT_LOOP_WINDOW_FALLBACK_TIMEOUT_MS 250
+
+// Waits on the window connection, the file watcher and a frame timer together so the live loop only wakes
+// up for real events.
+typedef struct {
+    int epoll_fd;
+    int timer_fd;
+    int window_fd;
+    int input_fd;
+    long frame_interval_ns;
+} EventLoop;
+
+// input_fd is reported as EVENT_INPUT, or -1 for none.
+void event_loop_create(EventLoop *event_loop, FileWatcher *file_watcher, int input_fd);
+void event_loop_destroy(EventLoop *event_loop);
+// Adds fd to the fds waited on, reported as the given EventFlags.
+void event_loop_add_fd(EventLoop *event_loop, int fd, unsigned int event);
+// Stops waiting on the input fd, e.g once it reaches the end of file.
+void event_loop_remove_input(EventLoop *event_loop);
+// Arms the frame timer with the given interval, or disarms it if 0.
+void event_loop_set_frame_interval(EventLoop *event_loop, long interval_ns);
+// Blocks until at least one event is ready, returns a combination of EventFlags.
+unsigned int event_loop_wait(EventLoop *event_loop, Window *window);
 
 #define CLI_OPTS_DEFAULT_WIDTH 1280
 #define CLI_OPTS_DEFAULT_HEIGHT 720
 #define CLI_OPTS_DEFAULT_FULLSCREEN false
 #define CLI_OPTS_DEFAULT_PRINT_SIZE PRINTING_DISABLED
 #define CLI_OPTS_DEFAULT_OUTPUT_IMAGE_PATH "shdy_print.png"
+#define CLI_OPTS_DEFAULT_BENCHMARK false
+#define CLI_OPTS_DEFAULT_TILE_THREADS -1
+#define CLI_OPTS_DEFAULT_WORKERS 0
+#define CLI_OPTS_DEFAULT_SERVER_JOBS 2
+#define CLI_OPTS_DEFAULT_SERVER_QUEUE 16
 
 typedef struct {
     const char *frag_shader_path;  // required
@@ -98,8 +914,34 @@ typedef struct {
 
     PrintSize print_size;          // optional
     const char *output_image_path; // optional
+
+    bool benchmark;                // optional
+
+    ShaderDefine defines[SHADER_MAX_DEFINES]; // optional
+    int num_defines;
+
+    const char *params_path;       // optional, nullptr for the sidecar next to the shader, "-" for stdin
+
+    ShaderTexture textures[SHADER_MAX_TEXTURES]; // optional
+    int num_textures;
+
+    const char *diagnostics_path;  // optional, "-" for stdout
+    bool check;                    // optional
+    bool spirv;                    // optional
+    bool cpu;                      // optional
+    int tile_threads;              // optional, see ShaderRenderer
+    int workers;                   // optional, 0 draws the print in this process
+    const char *server_path;       // optional, socket to serve render requests on
+    int server_jobs;               // optional
+    int server_queue;              // optional
+    const char *connect_path;      // optional, socket of a server to render the print with
 } CliOpts;
 
 void cli_opts_parse(CliOpts *cli_opts, int argc, char **argv);
 
+#define BENCHMARK_ITERATIONS 20
+
+// Returns false if any shdy_math.h function doesn't match the preamble.
+bool benchmark_run(ShaderRenderer *shader_renderer);
+
 #endif //SHDY_H
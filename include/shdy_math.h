@@ -0,0 +1,826 @@
+// C++ mirror of the functions of the shdy preamble (shdy.frag and shdy_lib.frag), for tools that place elements or
+// precompute masks on the CPU and need the values the shaders see. Header only, needs GCC or Clang.
+//
+// Each function is a template over its lane type: float evaluates one point, ShdyF32xN evaluates SHDY_MATH_LANES
+// points at once with the GCC vector extensions, which the compiler lowers to the SIMD of the target. Points are
+// passed as structs of lanes, e.g ShdyVec2xN holds the x and the y of each point in its own vector. The _batch
+// functions evaluate arrays of points of any length. Everything has internal linkage, so translation units built
+// for different targets, and so with different lane counts, can be linked together.
+//
+// The operations are the ones of the GLSL, in the same order, so the results match the GPU up to the precision of
+// its sin(), cos() and texture filtering. --benchmark compares them against GPU readbacks. On targets with FMA the
+// compiler may fuse multiplies and adds differently in the float and the lane code, build with -ffp-contract=off
+// for them to match exactly. shdy_rand_2d() amplifies a one ulp difference into a different value.
+
+#ifndef SHDY_MATH_H
+#define SHDY_MATH_H
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// One register of the widest SIMD the target is built for: 16 lanes with AVX-512, 8 with AVX2 and 4 with SSE or
+// NEON. Wider than the registers still works, e.g 8 lanes on NEON run as pairs of registers.
+#ifndef SHDY_MATH_LANES
+#if defined(__AVX512F__)
+#define SHDY_MATH_LANES 16
+#elif defined(__AVX__)
+#define SHDY_MATH_LANES 8
+#else
+#define SHDY_MATH_LANES 4
+#endif
+#endif
+
+// Octave count of shdy_frac_noise_2d(p) and shdy_frac_noise_2d_tex(p), the default of the preamble.
+#ifndef SHDY_FBM_OCTAVES
+#define SHDY_FBM_OCTAVES 6
+#endif
+
+// Size and cell count of the noise texture sampled by the _tex functions, see noise_texture_generate().
+#define SHDY_NOISE_TEX_SIZE 256
+#define SHDY_NOISE_TEX_CELLS 32
+
+typedef float ShdyF32xN __attribute__((vector_size(4 * SHDY_MATH_LANES)));
+typedef int32_t ShdyI32xN __attribute__((vector_size(4 * SHDY_MATH_LANES)));
+typedef uint32_t ShdyU32xN __attribute__((vector_size(4 * SHDY_MATH_LANES)));
+
+// 8 lanes whatever the target, for data laid out 8 values at a time. Lowered to whatever SIMD the target supports,
+// e.g 2x SSE or 1x AVX on x86, 2x NEON on ARM.
+typedef float ShdyF32x8 __attribute__((vector_size(32)));
+typedef int32_t ShdyI32x8 __attribute__((vector_size(32)));
+
+// The float, int and uint lane types of each lane type.
+template<typename T> struct ShdyLanes;
+template<> struct ShdyLanes<float> { typedef float F; typedef int32_t I; typedef uint32_t U; };
+template<> struct ShdyLanes<int32_t> { typedef float F; typedef int32_t I; typedef uint32_t U; };
+template<> struct ShdyLanes<uint32_t> { typedef float F; typedef int32_t I; typedef uint32_t U; };
+template<> struct ShdyLanes<ShdyF32xN> { typedef ShdyF32xN F; typedef ShdyI32xN I; typedef ShdyU32xN U; };
+template<> struct ShdyLanes<ShdyI32xN> { typedef ShdyF32xN F; typedef ShdyI32xN I; typedef ShdyU32xN U; };
+template<> struct ShdyLanes<ShdyU32xN> { typedef ShdyF32xN F; typedef ShdyI32xN I; typedef ShdyU32xN U; };
+
+template<typename T> struct ShdyV2 { T x, y; };
+template<typename T> struct ShdyV3 { T x, y, z; };
+template<typename T> struct ShdyV4 { T x, y, z, w; };
+// Column major like GLSL.
+template<typename T> struct ShdyM2 { ShdyV2<T> c0, c1; };
+
+typedef ShdyV2<float> ShdyVec2;
+typedef ShdyV3<float> ShdyVec3;
+typedef ShdyV4<float> ShdyVec4;
+typedef ShdyV2<int32_t> ShdyIvec2;
+typedef ShdyV3<int32_t> ShdyIvec3;
+typedef ShdyV4<int32_t> ShdyIvec4;
+typedef ShdyV2<uint32_t> ShdyUvec2;
+typedef ShdyV3<uint32_t> ShdyUvec3;
+typedef ShdyV4<uint32_t> ShdyUvec4;
+typedef ShdyM2<float> ShdyMat2;
+
+typedef ShdyV2<ShdyF32xN> ShdyVec2xN;
+typedef ShdyV3<ShdyF32xN> ShdyVec3xN;
+typedef ShdyV4<ShdyF32xN> ShdyVec4xN;
+typedef ShdyV2<ShdyI32xN> ShdyIvec2xN;
+typedef ShdyV3<ShdyI32xN> ShdyIvec3xN;
+typedef ShdyV4<ShdyI32xN> ShdyIvec4xN;
+typedef ShdyV2<ShdyU32xN> ShdyUvec2xN;
+typedef ShdyV3<ShdyU32xN> ShdyUvec3xN;
+typedef ShdyV4<ShdyU32xN> ShdyUvec4xN;
+typedef ShdyM2<ShdyF32xN> ShdyMat2xN;
+
+// Lane helpers, the GLSL built-ins and conversions the preamble uses.
+
+static inline ShdyF32xN shdy_splat(float v) {
+    return ShdyF32xN{} + v;
+}
+
+static inline ShdyF32xN shdy_load(const float *src) {
+    ShdyF32xN v;
+    memcpy(&v, src, sizeof(v));
+    return v;
+}
+
+static inline void shdy_store(float *dst, ShdyF32xN v) {
+    memcpy(dst, &v, sizeof(v));
+}
+
+static inline float shdy_floor(float x) {
+    return floorf(x);
+}
+
+static inline ShdyF32xN shdy_floor(ShdyF32xN x) {
+    ShdyF32xN t = __builtin_convertvector(__builtin_convertvector(x, ShdyI32xN), ShdyF32xN);
+    t = x < t ? t - 1.0f : t;
+    // Floats past 2^23 are already integers and may not fit in an int.
+    return ((x < 8388608.0f) & (x > -8388608.0f)) ? t : x;
+}
+
+static inline float shdy_sin(float x) {
+    return sinf(x);
+}
+
+static inline ShdyF32xN shdy_sin(ShdyF32xN x) {
+    for (int i = 0; i < SHDY_MATH_LANES; i++) {
+        x[i] = sinf(x[i]);
+    }
+    return x;
+}
+
+static inline float shdy_cos(float x) {
+    return cosf(x);
+}
+
+static inline ShdyF32xN shdy_cos(ShdyF32xN x) {
+    for (int i = 0; i < SHDY_MATH_LANES; i++) {
+        x[i] = cosf(x[i]);
+    }
+    return x;
+}
+
+// floatBitsToUint().
+static inline uint32_t shdy_float_bits(float x) {
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    return bits;
+}
+
+static inline ShdyU32xN shdy_float_bits(ShdyF32xN x) {
+    return (ShdyU32xN)x;
+}
+
+// int(), truncating toward zero.
+static inline int32_t shdy_to_int(float x) {
+    return (int32_t)x;
+}
+
+static inline ShdyI32xN shdy_to_int(ShdyF32xN x) {
+    return __builtin_convertvector(x, ShdyI32xN);
+}
+
+// uint() of an int, keeping its bits.
+static inline uint32_t shdy_to_uint(int32_t x) {
+    return (uint32_t)x;
+}
+
+static inline ShdyU32xN shdy_to_uint(ShdyI32xN x) {
+    return (ShdyU32xN)x;
+}
+
+static inline float shdy_to_float(uint32_t x) {
+    return (float)x;
+}
+
+static inline ShdyF32xN shdy_to_float(ShdyU32xN x) {
+    return __builtin_convertvector(x, ShdyF32xN);
+}
+
+template<typename F> static inline F shdy_fract(F x) {
+    return x - shdy_floor(x);
+}
+
+template<typename F> static inline F shdy_min(F a, F b) {
+    return b < a ? b : a;
+}
+
+template<typename F> static inline F shdy_max(F a, F b) {
+    return a < b ? b : a;
+}
+
+template<typename F> static inline F shdy_clamp(F x, F lo, F hi) {
+    return shdy_min(shdy_max(x, lo), hi);
+}
+
+template<typename F> static inline F shdy_mix(F a, F b, F t) {
+    return a * (1.0f - t) + b * t;
+}
+
+// step(edge, x).
+template<typename F> static inline F shdy_step(F edge, F x) {
+    F zero = x - x;
+    return x < edge ? zero : zero + 1.0f;
+}
+
+// smoothstep(0.0, 1.0, x), the only edges the preamble uses.
+template<typename F> static inline F shdy_smoothstep01(F x) {
+    F zero = x - x;
+    F t = shdy_clamp(x, zero, zero + 1.0f);
+    return t * t * (3.0f - 2.0f * t);
+}
+
+template<typename F> static inline F shdy_dot(ShdyV2<F> a, ShdyV2<F> b) {
+    return a.x * b.x + a.y * b.y;
+}
+
+template<typename F> static inline F shdy_dot(ShdyV3<F> a, ShdyV3<F> b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+template<typename F> static inline F shdy_dot(ShdyV4<F> a, ShdyV4<F> b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+}
+
+// Transforms the given fragCoord from pixels into a normalized form for a landscape orientation.
+// The normalized form is in the range Y = [-1.0..+1.0] and X will differ based on the width.
+template<typename F> static inline ShdyV2<F> shdy_norm_coord_landscape(ShdyV2<F> frag_coord, ShdyVec2 resolution) {
+    return {2.0f * (frag_coord.x - 0.5f * resolution.x) / resolution.y,
+            2.0f * (frag_coord.y - 0.5f * resolution.y) / resolution.y};
+}
+
+// Transforms the given fragCoord from pixels into a normalized form for a portrait orientation.
+// The normalized form is in the range X = [-1.0..+1.0] and Y will differ based on the height.
+template<typename F> static inline ShdyV2<F> shdy_norm_coord_portrait(ShdyV2<F> frag_coord, ShdyVec2 resolution) {
+    return {2.0f * (frag_coord.x - 0.5f * resolution.x) / resolution.x,
+            2.0f * (frag_coord.y - 0.5f * resolution.y) / resolution.x};
+}
+
+// 2d transformations.
+
+template<typename F> static inline ShdyV2<F> shdy_translate_2d(ShdyV2<F> p, ShdyV2<F> t) {
+    return {p.x - t.x, p.y - t.y};
+}
+
+template<typename F> static inline ShdyM2<F> shdy_rot_mat_2d(F angle) {
+    F c = shdy_cos(angle);
+    F s = shdy_sin(angle);
+    return {{c, s}, {-s, c}};
+}
+
+// p*m, the row vector p times m.
+template<typename F> static inline ShdyV2<F> shdy_mul(ShdyV2<F> p, ShdyM2<F> m) {
+    return {shdy_dot(p, m.c0), shdy_dot(p, m.c1)};
+}
+
+// m*p, m times the column vector p.
+template<typename F> static inline ShdyV2<F> shdy_mul(ShdyM2<F> m, ShdyV2<F> p) {
+    return {m.c0.x * p.x + m.c1.x * p.y, m.c0.y * p.x + m.c1.y * p.y};
+}
+
+template<typename F> static inline ShdyV2<F> shdy_rotate_2d(ShdyV2<F> p, F angle) {
+    return shdy_mul(p, shdy_rot_mat_2d(angle));
+}
+
+template<typename F> static inline ShdyM2<F> shdy_scale_mat_2d(ShdyV2<F> scale) {
+    F zero = scale.x - scale.x;
+    return {{scale.x, zero}, {zero, scale.y}};
+}
+
+template<typename F> static inline ShdyV2<F> shdy_scale_2d(ShdyV2<F> p, ShdyV2<F> scale) {
+    return shdy_mul(p, shdy_scale_mat_2d(scale));
+}
+
+// RNG and noise functions.
+
+// Returns a pseudorandom float from a given 2d point.
+template<typename F> static inline F shdy_rand_2d(ShdyV2<F> p) {
+    F freq = p.x * 12.9898f + p.y * 78.233f;
+    return shdy_fract(shdy_sin(freq) * 43758.5453f);
+}
+
+// Returns 2d value noise.
+template<typename F> static inline F shdy_noise_2d(ShdyV2<F> p) {
+    ShdyV2<F> i = {shdy_floor(p.x), shdy_floor(p.y)};
+    ShdyV2<F> f = {shdy_smoothstep01(shdy_fract(p.x)), shdy_smoothstep01(shdy_fract(p.y))};
+
+    F bl = shdy_rand_2d(i);
+    F br = shdy_rand_2d(ShdyV2<F>{i.x + 1.0f, i.y});
+    F b = shdy_mix(bl, br, f.x);
+
+    F tl = shdy_rand_2d(ShdyV2<F>{i.x, i.y + 1.0f});
+    F tr = shdy_rand_2d(ShdyV2<F>{i.x + 1.0f, i.y + 1.0f});
+    F t = shdy_mix(tl, tr, f.x);
+
+    return shdy_mix(b, t, f.y);
+}
+
+// Returns 2d fractal value noise.
+template<typename F> static inline F shdy_frac_noise_2d(ShdyV2<F> p, int octaves) {
+    F v = p.x - p.x;
+    float a = 0.5f;
+    ShdyMat2 rot = shdy_rot_mat_2d(0.5f);
+
+    for (int i = 0; i < octaves; i++) {
+        v += a * shdy_noise_2d(p);
+        p = {(rot.c0.x * p.x + rot.c1.x * p.y) * 2.0f + 100.0f, (rot.c0.y * p.x + rot.c1.y * p.y) * 2.0f + 100.0f};
+        a *= 0.5f;
+    }
+
+    return v;
+}
+
+template<typename F> static inline F shdy_frac_noise_2d(ShdyV2<F> p) {
+    return shdy_frac_noise_2d(p, SHDY_FBM_OCTAVES);
+}
+
+// Integer hashes, see "Hash Functions for GPU Rendering" by Jarzynski and Olano.
+
+template<typename U> static inline U shdy_pcg(U v) {
+    U state = v * 747796405u + 2891336453u;
+    U word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+template<typename U> static inline ShdyV2<U> shdy_pcg_2d(ShdyV2<U> v) {
+    v.x = v.x * 1664525u + 1013904223u;
+    v.y = v.y * 1664525u + 1013904223u;
+    v.x += v.y * 1664525u;
+    v.y += v.x * 1664525u;
+    v.x ^= v.x >> 16u;
+    v.y ^= v.y >> 16u;
+    v.x += v.y * 1664525u;
+    v.y += v.x * 1664525u;
+    v.x ^= v.x >> 16u;
+    v.y ^= v.y >> 16u;
+    return v;
+}
+
+template<typename U> static inline ShdyV3<U> shdy_pcg_3d(ShdyV3<U> v) {
+    v.x = v.x * 1664525u + 1013904223u;
+    v.y = v.y * 1664525u + 1013904223u;
+    v.z = v.z * 1664525u + 1013904223u;
+    v.x += v.y * v.z;
+    v.y += v.z * v.x;
+    v.z += v.x * v.y;
+    v.x ^= v.x >> 16u;
+    v.y ^= v.y >> 16u;
+    v.z ^= v.z >> 16u;
+    v.x += v.y * v.z;
+    v.y += v.z * v.x;
+    v.z += v.x * v.y;
+    return v;
+}
+
+template<typename U> static inline ShdyV4<U> shdy_pcg_4d(ShdyV4<U> v) {
+    v.x = v.x * 1664525u + 1013904223u;
+    v.y = v.y * 1664525u + 1013904223u;
+    v.z = v.z * 1664525u + 1013904223u;
+    v.w = v.w * 1664525u + 1013904223u;
+    v.x += v.y * v.w;
+    v.y += v.z * v.x;
+    v.z += v.x * v.y;
+    v.w += v.y * v.z;
+    v.x ^= v.x >> 16u;
+    v.y ^= v.y >> 16u;
+    v.z ^= v.z >> 16u;
+    v.w ^= v.w >> 16u;
+    v.x += v.y * v.w;
+    v.y += v.z * v.x;
+    v.z += v.x * v.y;
+    v.w += v.y * v.z;
+    return v;
+}
+
+// Maps the top 24 bits of a hash to [0.0..1.0), exactly representable as a float.
+template<typename U> static inline typename ShdyLanes<U>::F shdy_uint_to_unit(U v) {
+    return shdy_to_float(v >> 8u) * (1.0f / 16777216.0f);
+}
+
+template<typename F> static inline F shdy_hash_1d(F p) {
+    return shdy_uint_to_unit(shdy_pcg(shdy_float_bits(p)));
+}
+
+template<typename F> static inline F shdy_hash_2d(ShdyV2<F> p) {
+    typedef typename ShdyLanes<F>::U U;
+    return shdy_uint_to_unit(shdy_pcg_2d(ShdyV2<U>{shdy_float_bits(p.x), shdy_float_bits(p.y)}).x);
+}
+
+template<typename F> static inline F shdy_hash_3d(ShdyV3<F> p) {
+    typedef typename ShdyLanes<F>::U U;
+    return shdy_uint_to_unit(
+            shdy_pcg_3d(ShdyV3<U>{shdy_float_bits(p.x), shdy_float_bits(p.y), shdy_float_bits(p.z)}).x);
+}
+
+template<typename F> static inline F shdy_hash_4d(ShdyV4<F> p) {
+    typedef typename ShdyLanes<F>::U U;
+    return shdy_uint_to_unit(shdy_pcg_4d(ShdyV4<U>{shdy_float_bits(p.x), shdy_float_bits(p.y),
+                                                   shdy_float_bits(p.z), shdy_float_bits(p.w)}).x);
+}
+
+// Hash based noise. Lattice points are hashed as integers so the result is stable at any coordinate.
+// The gradient and simplex noise results are scaled by factors measured over many samples so the output
+// spans roughly [-1.0..+1.0].
+
+template<typename F> static inline F shdy_value_noise_2d(ShdyV2<F> p) {
+    typedef typename ShdyLanes<F>::U U;
+    ShdyV2<F> f = {shdy_smoothstep01(shdy_fract(p.x)), shdy_smoothstep01(shdy_fract(p.y))};
+    ShdyV2<U> c = {shdy_to_uint(shdy_to_int(shdy_floor(p.x))), shdy_to_uint(shdy_to_int(shdy_floor(p.y)))};
+
+    F bl = shdy_uint_to_unit(shdy_pcg_2d(c).x);
+    F br = shdy_uint_to_unit(shdy_pcg_2d(ShdyV2<U>{c.x + 1u, c.y}).x);
+    F tl = shdy_uint_to_unit(shdy_pcg_2d(ShdyV2<U>{c.x, c.y + 1u}).x);
+    F tr = shdy_uint_to_unit(shdy_pcg_2d(ShdyV2<U>{c.x + 1u, c.y + 1u}).x);
+
+    return shdy_mix(shdy_mix(bl, br, f.x), shdy_mix(tl, tr, f.x), f.y);
+}
+
+// Pseudorandom gradients with components in the range [-1.0..+1.0], of the lattice point i as an int or uint.
+template<typename T> static inline ShdyV2<typename ShdyLanes<T>::F> shdy_gradient_2d(ShdyV2<T> i) {
+    typedef typename ShdyLanes<T>::U U;
+    ShdyV2<U> h = shdy_pcg_2d(ShdyV2<U>{(U)i.x, (U)i.y});
+    return {shdy_uint_to_unit(h.x) * 2.0f - 1.0f, shdy_uint_to_unit(h.y) * 2.0f - 1.0f};
+}
+
+template<typename T> static inline ShdyV3<typename ShdyLanes<T>::F> shdy_gradient_3d(ShdyV3<T> i) {
+    typedef typename ShdyLanes<T>::U U;
+    ShdyV3<U> h = shdy_pcg_3d(ShdyV3<U>{(U)i.x, (U)i.y, (U)i.z});
+    return {shdy_uint_to_unit(h.x) * 2.0f - 1.0f, shdy_uint_to_unit(h.y) * 2.0f - 1.0f,
+            shdy_uint_to_unit(h.z) * 2.0f - 1.0f};
+}
+
+template<typename T> static inline ShdyV4<typename ShdyLanes<T>::F> shdy_gradient_4d(ShdyV4<T> i) {
+    typedef typename ShdyLanes<T>::U U;
+    ShdyV4<U> h = shdy_pcg_4d(ShdyV4<U>{(U)i.x, (U)i.y, (U)i.z, (U)i.w});
+    return {shdy_uint_to_unit(h.x) * 2.0f - 1.0f, shdy_uint_to_unit(h.y) * 2.0f - 1.0f,
+            shdy_uint_to_unit(h.z) * 2.0f - 1.0f, shdy_uint_to_unit(h.w) * 2.0f - 1.0f};
+}
+
+// Quintic fade curve of the gradient noises.
+template<typename F> static inline F shdy_fade(F f) {
+    return f * f * f * (f * (f * 6.0f - 15.0f) + 10.0f);
+}
+
+template<typename F> static inline F shdy_grad_noise_2d(ShdyV2<F> p) {
+    typedef typename ShdyLanes<F>::U U;
+    ShdyV2<F> f = {shdy_fract(p.x), shdy_fract(p.y)};
+    ShdyV2<F> u = {shdy_fade(f.x), shdy_fade(f.y)};
+    ShdyV2<U> c = {shdy_to_uint(shdy_to_int(shdy_floor(p.x))), shdy_to_uint(shdy_to_int(shdy_floor(p.y)))};
+
+    F bl = shdy_dot(shdy_gradient_2d(c), f);
+    F br = shdy_dot(shdy_gradient_2d(ShdyV2<U>{c.x + 1u, c.y}), ShdyV2<F>{f.x - 1.0f, f.y});
+    F tl = shdy_dot(shdy_gradient_2d(ShdyV2<U>{c.x, c.y + 1u}), ShdyV2<F>{f.x, f.y - 1.0f});
+    F tr = shdy_dot(shdy_gradient_2d(ShdyV2<U>{c.x + 1u, c.y + 1u}), ShdyV2<F>{f.x - 1.0f, f.y - 1.0f});
+
+    return 1.2f * shdy_mix(shdy_mix(bl, br, u.x), shdy_mix(tl, tr, u.x), u.y);
+}
+
+template<typename F> static inline F shdy_grad_noise_3d(ShdyV3<F> p) {
+    typedef typename ShdyLanes<F>::U U;
+    ShdyV3<F> f = {shdy_fract(p.x), shdy_fract(p.y), shdy_fract(p.z)};
+    ShdyV3<F> u = {shdy_fade(f.x), shdy_fade(f.y), shdy_fade(f.z)};
+    ShdyV3<U> c = {shdy_to_uint(shdy_to_int(shdy_floor(p.x))), shdy_to_uint(shdy_to_int(shdy_floor(p.y))),
+                   shdy_to_uint(shdy_to_int(shdy_floor(p.z)))};
+
+    // Weighted sum over the corners of the cell, mix(1.0 - u, u, o) picks u where the corner offset o is 1.
+    F v = p.x - p.x;
+    for (int j = 0; j < 8; j++) {
+        int ox = j & 1, oy = (j >> 1) & 1, oz = (j >> 2) & 1;
+        F wx = ox ? u.x : 1.0f - u.x;
+        F wy = oy ? u.y : 1.0f - u.y;
+        F wz = oz ? u.z : 1.0f - u.z;
+        ShdyV3<F> g = shdy_gradient_3d(ShdyV3<U>{c.x + (uint32_t)ox, c.y + (uint32_t)oy, c.z + (uint32_t)oz});
+        v += wx * wy * wz * shdy_dot(g, ShdyV3<F>{f.x - (float)ox, f.y - (float)oy, f.z - (float)oz});
+    }
+
+    return 1.2f * v;
+}
+
+template<typename F> static inline F shdy_grad_noise_4d(ShdyV4<F> p) {
+    typedef typename ShdyLanes<F>::U U;
+    ShdyV4<F> f = {shdy_fract(p.x), shdy_fract(p.y), shdy_fract(p.z), shdy_fract(p.w)};
+    ShdyV4<F> u = {shdy_fade(f.x), shdy_fade(f.y), shdy_fade(f.z), shdy_fade(f.w)};
+    ShdyV4<U> c = {shdy_to_uint(shdy_to_int(shdy_floor(p.x))), shdy_to_uint(shdy_to_int(shdy_floor(p.y))),
+                   shdy_to_uint(shdy_to_int(shdy_floor(p.z))), shdy_to_uint(shdy_to_int(shdy_floor(p.w)))};
+
+    F v = p.x - p.x;
+    for (int j = 0; j < 16; j++) {
+        int ox = j & 1, oy = (j >> 1) & 1, oz = (j >> 2) & 1, ow = (j >> 3) & 1;
+        F wx = ox ? u.x : 1.0f - u.x;
+        F wy = oy ? u.y : 1.0f - u.y;
+        F wz = oz ? u.z : 1.0f - u.z;
+        F ww = ow ? u.w : 1.0f - u.w;
+        ShdyV4<F> g = shdy_gradient_4d(ShdyV4<U>{c.x + (uint32_t)ox, c.y + (uint32_t)oy, c.z + (uint32_t)oz,
+                                                 c.w + (uint32_t)ow});
+        v += wx * wy * wz * ww * shdy_dot(g, ShdyV4<F>{f.x - (float)ox, f.y - (float)oy, f.z - (float)oz,
+                                                          f.w - (float)ow});
+    }
+
+    return 1.15f * v;
+}
+
+// Simplex noise, based on "Simplex noise demystified" by Stefan Gustavson with the permutation table
+// replaced by the integer hash.
+
+template<typename F> static inline F shdy_simplex_noise_2d(ShdyV2<F> p) {
+    typedef typename ShdyLanes<F>::U U;
+    const float F2 = 0.366025403784f; // (sqrt(3) - 1) / 2
+    const float G2 = 0.211324865405f; // (3 - sqrt(3)) / 6
+
+    F s = p.x * F2 + p.y * F2;
+    ShdyV2<F> i = {shdy_floor(p.x + s), shdy_floor(p.y + s)};
+    F t = i.x * G2 + i.y * G2;
+    ShdyV2<F> x0 = {p.x - i.x + t, p.y - i.y + t};
+    F zero = p.x - p.x;
+    F ox = x0.x > x0.y ? zero + 1.0f : zero;
+    F oy = x0.x > x0.y ? zero : zero + 1.0f;
+    ShdyV2<F> x1 = {x0.x - ox + G2, x0.y - oy + G2};
+    ShdyV2<F> x2 = {x0.x - 1.0f + 2.0f * G2, x0.y - 1.0f + 2.0f * G2};
+    ShdyV2<U> c = {shdy_to_uint(shdy_to_int(i.x)), shdy_to_uint(shdy_to_int(i.y))};
+
+    F t0 = shdy_max(0.5f - shdy_dot(x0, x0), zero);
+    F t1 = shdy_max(0.5f - shdy_dot(x1, x1), zero);
+    F t2 = shdy_max(0.5f - shdy_dot(x2, x2), zero);
+    t0 *= t0;
+    t1 *= t1;
+    t2 *= t2;
+    t0 *= t0;
+    t1 *= t1;
+    t2 *= t2;
+    F n0 = shdy_dot(shdy_gradient_2d(c), x0);
+    F n1 = shdy_dot(shdy_gradient_2d(ShdyV2<U>{c.x + shdy_to_uint(shdy_to_int(ox)),
+                                               c.y + shdy_to_uint(shdy_to_int(oy))}), x1);
+    F n2 = shdy_dot(shdy_gradient_2d(ShdyV2<U>{c.x + 1u, c.y + 1u}), x2);
+
+    return 72.0f * (t0 * n0 + t1 * n1 + t2 * n2);
+}
+
+template<typename F> static inline F shdy_simplex_noise_3d(ShdyV3<F> p) {
+    typedef typename ShdyLanes<F>::U U;
+    const float F3 = 1.0f / 3.0f;
+    const float G3 = 1.0f / 6.0f;
+
+    F s = p.x * F3 + p.y * F3 + p.z * F3;
+    ShdyV3<F> i = {shdy_floor(p.x + s), shdy_floor(p.y + s), shdy_floor(p.z + s)};
+    F t = i.x * G3 + i.y * G3 + i.z * G3;
+    ShdyV3<F> x0 = {p.x - i.x + t, p.y - i.y + t, p.z - i.z + t};
+
+    // g = step(x0.yzx, x0.xyz), l = 1.0 - g, i1 = min(g.xyz, l.zxy) and i2 = max(g.xyz, l.zxy).
+    ShdyV3<F> g = {shdy_step(x0.y, x0.x), shdy_step(x0.z, x0.y), shdy_step(x0.x, x0.z)};
+    ShdyV3<F> l = {1.0f - g.x, 1.0f - g.y, 1.0f - g.z};
+    ShdyV3<F> i1 = {shdy_min(g.x, l.z), shdy_min(g.y, l.x), shdy_min(g.z, l.y)};
+    ShdyV3<F> i2 = {shdy_max(g.x, l.z), shdy_max(g.y, l.x), shdy_max(g.z, l.y)};
+
+    ShdyV3<F> x1 = {x0.x - i1.x + G3, x0.y - i1.y + G3, x0.z - i1.z + G3};
+    ShdyV3<F> x2 = {x0.x - i2.x + 2.0f * G3, x0.y - i2.y + 2.0f * G3, x0.z - i2.z + 2.0f * G3};
+    ShdyV3<F> x3 = {x0.x - 1.0f + 3.0f * G3, x0.y - 1.0f + 3.0f * G3, x0.z - 1.0f + 3.0f * G3};
+    ShdyV3<U> c = {shdy_to_uint(shdy_to_int(i.x)), shdy_to_uint(shdy_to_int(i.y)), shdy_to_uint(shdy_to_int(i.z))};
+
+    F zero = p.x - p.x;
+    F t0 = shdy_max(0.6f - shdy_dot(x0, x0), zero);
+    F t1 = shdy_max(0.6f - shdy_dot(x1, x1), zero);
+    F t2 = shdy_max(0.6f - shdy_dot(x2, x2), zero);
+    F t3 = shdy_max(0.6f - shdy_dot(x3, x3), zero);
+    t0 *= t0;
+    t1 *= t1;
+    t2 *= t2;
+    t3 *= t3;
+    t0 *= t0;
+    t1 *= t1;
+    t2 *= t2;
+    t3 *= t3;
+    F n0 = shdy_dot(shdy_gradient_3d(c), x0);
+    F n1 = shdy_dot(shdy_gradient_3d(ShdyV3<U>{c.x + shdy_to_uint(shdy_to_int(i1.x)),
+                                               c.y + shdy_to_uint(shdy_to_int(i1.y)),
+                                               c.z + shdy_to_uint(shdy_to_int(i1.z))}), x1);
+    F n2 = shdy_dot(shdy_gradient_3d(ShdyV3<U>{c.x + shdy_to_uint(shdy_to_int(i2.x)),
+                                               c.y + shdy_to_uint(shdy_to_int(i2.y)),
+                                               c.z + shdy_to_uint(shdy_to_int(i2.z))}), x2);
+    F n3 = shdy_dot(shdy_gradient_3d(ShdyV3<U>{c.x + 1u, c.y + 1u, c.z + 1u}), x3);
+
+    return 26.0f * (t0 * n0 + t1 * n1 + t2 * n2 + t3 * n3);
+}
+
+template<typename F> static inline F shdy_simplex_noise_4d(ShdyV4<F> p) {
+    typedef typename ShdyLanes<F>::U U;
+    const float F4 = 0.309016994375f; // (sqrt(5) - 1) / 4
+    const float G4 = 0.138196601125f; // (5 - sqrt(5)) / 20
+
+    F s = p.x * F4 + p.y * F4 + p.z * F4 + p.w * F4;
+    ShdyV4<F> i = {shdy_floor(p.x + s), shdy_floor(p.y + s), shdy_floor(p.z + s), shdy_floor(p.w + s)};
+    F t = i.x * G4 + i.y * G4 + i.z * G4 + i.w * G4;
+    ShdyV4<F> x0 = {p.x - i.x + t, p.y - i.y + t, p.z - i.z + t, p.w - i.w + t};
+
+    // Rank the components of x0 to find which simplex the point is in.
+    ShdyV3<F> is_x = {shdy_step(x0.y, x0.x), shdy_step(x0.z, x0.x), shdy_step(x0.w, x0.x)};
+    ShdyV3<F> is_yz = {shdy_step(x0.z, x0.y), shdy_step(x0.w, x0.y), shdy_step(x0.w, x0.z)};
+    ShdyV4<F> rank;
+    rank.x = is_x.x + is_x.y + is_x.z;
+    rank.y = 1.0f - is_x.x;
+    rank.z = 1.0f - is_x.y;
+    rank.w = 1.0f - is_x.z;
+    rank.y += is_yz.x + is_yz.y;
+    rank.z += 1.0f - is_yz.x;
+    rank.w += 1.0f - is_yz.y;
+    rank.z += is_yz.z;
+    rank.w += 1.0f - is_yz.z;
+
+    F zero = p.x - p.x;
+    F one = zero + 1.0f;
+    ShdyV4<F> i3 = {shdy_clamp(rank.x, zero, one), shdy_clamp(rank.y, zero, one), shdy_clamp(rank.z, zero, one),
+                    shdy_clamp(rank.w, zero, one)};
+    ShdyV4<F> i2 = {shdy_clamp(rank.x - 1.0f, zero, one), shdy_clamp(rank.y - 1.0f, zero, one),
+                    shdy_clamp(rank.z - 1.0f, zero, one), shdy_clamp(rank.w - 1.0f, zero, one)};
+    ShdyV4<F> i1 = {shdy_clamp(rank.x - 2.0f, zero, one), shdy_clamp(rank.y - 2.0f, zero, one),
+                    shdy_clamp(rank.z - 2.0f, zero, one), shdy_clamp(rank.w - 2.0f, zero, one)};
+
+    ShdyV4<F> x1 = {x0.x - i1.x + G4, x0.y - i1.y + G4, x0.z - i1.z + G4, x0.w - i1.w + G4};
+    ShdyV4<F> x2 = {x0.x - i2.x + 2.0f * G4, x0.y - i2.y + 2.0f * G4, x0.z - i2.z + 2.0f * G4,
+                    x0.w - i2.w + 2.0f * G4};
+    ShdyV4<F> x3 = {x0.x - i3.x + 3.0f * G4, x0.y - i3.y + 3.0f * G4, x0.z - i3.z + 3.0f * G4,
+                    x0.w - i3.w + 3.0f * G4};
+    ShdyV4<F> x4 = {x0.x - 1.0f + 4.0f * G4, x0.y - 1.0f + 4.0f * G4, x0.z - 1.0f + 4.0f * G4,
+                    x0.w - 1.0f + 4.0f * G4};
+    ShdyV4<U> c = {shdy_to_uint(shdy_to_int(i.x)), shdy_to_uint(shdy_to_int(i.y)), shdy_to_uint(shdy_to_int(i.z)),
+                   shdy_to_uint(shdy_to_int(i.w))};
+
+    F t0 = shdy_max(0.6f - shdy_dot(x0, x0), zero);
+    F t1 = shdy_max(0.6f - shdy_dot(x1, x1), zero);
+    F t2 = shdy_max(0.6f - shdy_dot(x2, x2), zero);
+    F t3 = shdy_max(0.6f - shdy_dot(x3, x3), zero);
+    F t4 = shdy_max(0.6f - shdy_dot(x4, x4), zero);
+    t0 *= t0;
+    t1 *= t1;
+    t2 *= t2;
+    t3 *= t3;
+    t4 *= t4;
+    t0 *= t0;
+    t1 *= t1;
+    t2 *= t2;
+    t3 *= t3;
+    t4 *= t4;
+    ShdyV4<U> c1 = {c.x + shdy_to_uint(shdy_to_int(i1.x)), c.y + shdy_to_uint(shdy_to_int(i1.y)),
+                    c.z + shdy_to_uint(shdy_to_int(i1.z)), c.w + shdy_to_uint(shdy_to_int(i1.w))};
+    ShdyV4<U> c2 = {c.x + shdy_to_uint(shdy_to_int(i2.x)), c.y + shdy_to_uint(shdy_to_int(i2.y)),
+                    c.z + shdy_to_uint(shdy_to_int(i2.z)), c.w + shdy_to_uint(shdy_to_int(i2.w))};
+    ShdyV4<U> c3 = {c.x + shdy_to_uint(shdy_to_int(i3.x)), c.y + shdy_to_uint(shdy_to_int(i3.y)),
+                    c.z + shdy_to_uint(shdy_to_int(i3.z)), c.w + shdy_to_uint(shdy_to_int(i3.w))};
+    F n0 = shdy_dot(shdy_gradient_4d(c), x0);
+    F n1 = shdy_dot(shdy_gradient_4d(c1), x1);
+    F n2 = shdy_dot(shdy_gradient_4d(c2), x2);
+    F n3 = shdy_dot(shdy_gradient_4d(c3), x3);
+    F n4 = shdy_dot(shdy_gradient_4d(ShdyV4<U>{c.x + 1u, c.y + 1u, c.z + 1u, c.w + 1u}), x4);
+
+    return 25.0f * ((t0 * n0 + t1 * n1 + t2 * n2) + (t3 * n3 + t4 * n4));
+}
+
+// Texture backed noise, sampling the texels filled by noise_texture_generate() (SHDY_NOISE_TEX_SIZE^2 RGBA floats,
+// rows bottom up) with bilinear filtering and repeat wrapping like the GPU.
+
+static inline float shdy_sample_noise_tex(const float *noise_rgba, float u, float v, int channel) {
+    float x = u * (float)SHDY_NOISE_TEX_SIZE - 0.5f;
+    float y = v * (float)SHDY_NOISE_TEX_SIZE - 0.5f;
+    float fx = floorf(x);
+    float fy = floorf(y);
+    int x0 = (int)fx & (SHDY_NOISE_TEX_SIZE - 1);
+    int y0 = (int)fy & (SHDY_NOISE_TEX_SIZE - 1);
+    int x1 = (x0 + 1) & (SHDY_NOISE_TEX_SIZE - 1);
+    int y1 = (y0 + 1) & (SHDY_NOISE_TEX_SIZE - 1);
+    float ax = x - fx;
+    float ay = y - fy;
+
+    float bl = noise_rgba[4 * (y0 * SHDY_NOISE_TEX_SIZE + x0) + channel];
+    float br = noise_rgba[4 * (y0 * SHDY_NOISE_TEX_SIZE + x1) + channel];
+    float tl = noise_rgba[4 * (y1 * SHDY_NOISE_TEX_SIZE + x0) + channel];
+    float tr = noise_rgba[4 * (y1 * SHDY_NOISE_TEX_SIZE + x1) + channel];
+
+    return shdy_mix(shdy_mix(bl, br, ax), shdy_mix(tl, tr, ax), ay);
+}
+
+// Texture lookups are gathers, so the lanes are sampled one at a time.
+static inline ShdyF32xN shdy_sample_noise_tex(const float *noise_rgba, ShdyF32xN u, ShdyF32xN v, int channel) {
+    ShdyF32xN r;
+    for (int i = 0; i < SHDY_MATH_LANES; i++) {
+        r[i] = shdy_sample_noise_tex(noise_rgba, u[i], v[i], channel);
+    }
+    return r;
+}
+
+template<typename F> static inline F shdy_noise_2d_tex(const float *noise_rgba, ShdyV2<F> p) {
+    // The texture holds one random value per texel. Offsetting the lookup by the smoothed fraction lets the
+    // bilinear filter do the smoothstep interpolation of value noise in a single fetch.
+    ShdyV2<F> i = {shdy_floor(p.x), shdy_floor(p.y)};
+    ShdyV2<F> f = {shdy_smoothstep01(shdy_fract(p.x)), shdy_smoothstep01(shdy_fract(p.y))};
+    return shdy_sample_noise_tex(noise_rgba, (i.x + f.x + 0.5f) / (float)SHDY_NOISE_TEX_SIZE,
+                                 (i.y + f.y + 0.5f) / (float)SHDY_NOISE_TEX_SIZE, 0);
+}
+
+template<typename F> static inline F shdy_frac_noise_2d_tex(const float *noise_rgba, ShdyV2<F> p, int octaves) {
+    F v = p.x - p.x;
+    float a = 0.5f;
+    ShdyMat2 rot = shdy_rot_mat_2d(0.5f);
+
+    for (int i = 0; i < octaves; i++) {
+        v += a * shdy_noise_2d_tex(noise_rgba, p);
+        p = {(rot.c0.x * p.x + rot.c1.x * p.y) * 2.0f + 100.0f, (rot.c0.y * p.x + rot.c1.y * p.y) * 2.0f + 100.0f};
+        a *= 0.5f;
+    }
+
+    return v;
+}
+
+template<typename F> static inline F shdy_frac_noise_2d_tex(const float *noise_rgba, ShdyV2<F> p) {
+    return shdy_frac_noise_2d_tex(noise_rgba, p, SHDY_FBM_OCTAVES);
+}
+
+template<typename F> static inline F shdy_grad_noise_2d_tex(const float *noise_rgba, ShdyV2<F> p) {
+    return shdy_sample_noise_tex(noise_rgba, p.x / (float)SHDY_NOISE_TEX_CELLS, p.y / (float)SHDY_NOISE_TEX_CELLS, 1);
+}
+
+template<typename F> static inline ShdyV2<F> shdy_worley_2d_tex(const float *noise_rgba, ShdyV2<F> p) {
+    F u = p.x / (float)SHDY_NOISE_TEX_CELLS;
+    F v = p.y / (float)SHDY_NOISE_TEX_CELLS;
+    return {shdy_sample_noise_tex(noise_rgba, u, v, 2), shdy_sample_noise_tex(noise_rgba, u, v, 3)};
+}
+
+// Batches, evaluating count points given as arrays of their components, SHDY_MATH_LANES at a time. The points
+// past the last full group are padded with zeros.
+
+// Loads the lanes of the group of points at first, of which count are valid.
+static inline ShdyF32xN shdy_load_partial(const float *src, int first, int count) {
+    if (count - first >= SHDY_MATH_LANES) {
+        return shdy_load(src + first);
+    }
+    ShdyF32xN v = {};
+    for (int i = 0; first + i < count; i++) {
+        v[i] = src[first + i];
+    }
+    return v;
+}
+
+static inline void shdy_store_partial(float *dst, int first, int count, ShdyF32xN v) {
+    if (count - first >= SHDY_MATH_LANES) {
+        shdy_store(dst + first, v);
+        return;
+    }
+    for (int i = 0; first + i < count; i++) {
+        dst[first + i] = v[i];
+    }
+}
+
+#define SHDY_MATH_BATCH_2D(fn) \
+    static inline void fn##_batch(const float *x, const float *y, float *out, int count) { \
+        for (int i = 0; i < count; i += SHDY_MATH_LANES) { \
+            ShdyVec2xN p = {shdy_load_partial(x, i, count), shdy_load_partial(y, i, count)}; \
+            shdy_store_partial(out, i, count, fn(p)); \
+        } \
+    }
+
+#define SHDY_MATH_BATCH_3D(fn) \
+    static inline void fn##_batch(const float *x, const float *y, const float *z, float *out, int count) { \
+        for (int i = 0; i < count; i += SHDY_MATH_LANES) { \
+            ShdyVec3xN p = {shdy_load_partial(x, i, count), shdy_load_partial(y, i, count), \
+                            shdy_load_partial(z, i, count)}; \
+            shdy_store_partial(out, i, count, fn(p)); \
+        } \
+    }
+
+#define SHDY_MATH_BATCH_4D(fn) \
+    static inline void fn##_batch(const float *x, const float *y, const float *z, const float *w, float *out, \
+                                  int count) { \
+        for (int i = 0; i < count; i += SHDY_MATH_LANES) { \
+            ShdyVec4xN p = {shdy_load_partial(x, i, count), shdy_load_partial(y, i, count), \
+                            shdy_load_partial(z, i, count), shdy_load_partial(w, i, count)}; \
+            shdy_store_partial(out, i, count, fn(p)); \
+        } \
+    }
+
+SHDY_MATH_BATCH_2D(shdy_rand_2d)
+SHDY_MATH_BATCH_2D(shdy_noise_2d)
+SHDY_MATH_BATCH_2D(shdy_frac_noise_2d)
+SHDY_MATH_BATCH_2D(shdy_hash_2d)
+SHDY_MATH_BATCH_2D(shdy_value_noise_2d)
+SHDY_MATH_BATCH_2D(shdy_grad_noise_2d)
+SHDY_MATH_BATCH_2D(shdy_simplex_noise_2d)
+SHDY_MATH_BATCH_3D(shdy_hash_3d)
+SHDY_MATH_BATCH_3D(shdy_grad_noise_3d)
+SHDY_MATH_BATCH_3D(shdy_simplex_noise_3d)
+SHDY_MATH_BATCH_4D(shdy_hash_4d)
+SHDY_MATH_BATCH_4D(shdy_grad_noise_4d)
+SHDY_MATH_BATCH_4D(shdy_simplex_noise_4d)
+
+static inline void shdy_norm_coord_landscape_batch(const float *x, const float *y, float *out_x, float *out_y,
+                                                   int count, ShdyVec2 resolution) {
+    for (int i = 0; i < count; i += SHDY_MATH_LANES) {
+        ShdyVec2xN p = {shdy_load_partial(x, i, count), shdy_load_partial(y, i, count)};
+        p = shdy_norm_coord_landscape(p, resolution);
+        shdy_store_partial(out_x, i, count, p.x);
+        shdy_store_partial(out_y, i, count, p.y);
+    }
+}
+
+static inline void shdy_norm_coord_portrait_batch(const float *x, const float *y, float *out_x, float *out_y,
+                                                  int count, ShdyVec2 resolution) {
+    for (int i = 0; i < count; i += SHDY_MATH_LANES) {
+        ShdyVec2xN p = {shdy_load_partial(x, i, count), shdy_load_partial(y, i, count)};
+        p = shdy_norm_coord_portrait(p, resolution);
+        shdy_store_partial(out_x, i, count, p.x);
+        shdy_store_partial(out_y, i, count, p.y);
+    }
+}
+
+static inline void shdy_rotate_2d_batch(const float *x, const float *y, float *out_x, float *out_y, int count,
+                                        float angle) {
+    ShdyMat2 m = shdy_rot_mat_2d(angle);
+    ShdyMat2xN mn = {{shdy_splat(m.c0.x), shdy_splat(m.c0.y)}, {shdy_splat(m.c1.x), shdy_splat(m.c1.y)}};
+    for (int i = 0; i < count; i += SHDY_MATH_LANES) {
+        ShdyVec2xN p = {shdy_load_partial(x, i, count), shdy_load_partial(y, i, count)};
+        p = shdy_mul(p, mn);
+        shdy_store_partial(out_x, i, count, p.x);
+        shdy_store_partial(out_y, i, count, p.y);
+    }
+}
+
+static inline void shdy_frac_noise_2d_batch(const float *x, const float *y, float *out, int count, int octaves) {
+    for (int i = 0; i < count; i += SHDY_MATH_LANES) {
+        ShdyVec2xN p = {shdy_load_partial(x, i, count), shdy_load_partial(y, i, count)};
+        shdy_store_partial(out, i, count, shdy_frac_noise_2d(p, octaves));
+    }
+}
+
+#endif //SHDY_MATH_H
@@ -0,0 +1,573 @@
+#include "shdy.h"
+#include "shdy_math.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <glad/glad.h>
+
+static_assert(SHDY_NOISE_TEX_SIZE == NOISE_TEXTURE_SIZE && SHDY_NOISE_TEX_CELLS == NOISE_TEXTURE_CELLS,
+              "shdy_math.h must sample the noise texture the way the preamble does.");
+
+// Compares rebuilding the user shader with the preamble definitions compiled inline against linking the
+// shared preamble shader object, which is what a reload costs in each case.
+static void benchmark_compile(ShaderRenderer *shader_renderer) {
+    Shader *shader = &shader_renderer->shader;
+
+    int root = source_cache_add(shader->source_cache, shader->user_frag_shader_path);
+    StrBuf src = {};
+    int deps[SHADER_MAX_DEPS];
+    int num_deps;
+    if (root < 0 ||
+        !source_cache_expand(shader->source_cache, root, &src, deps, &num_deps, SHADER_MAX_DEPS, nullptr)) {
+        ERRORF("Failed to read shader %s.\n", shader->user_frag_shader_path);
+        str_buf_free(&src);
+        return;
+    }
+    size_t user_len = src.len;
+
+    StrBuf defines_src = {};
+    if (!shader_build_defines(shader, src.data, &defines_src)) {
+        str_buf_free(&defines_src);
+        str_buf_free(&src);
+        return;
+    }
+
+    const char *mode_names[] = {"preamble object", "inline preamble"};
+    double mean_ms[2];
+
+    for (int mode = 0; mode < 2; mode++) {
+        bool inline_preamble = mode == 1;
+        double total_ms = 0.0;
+        double min_ms = 0.0;
+        double min_compile_ms = 0.0;
+        double min_link_ms = 0.0;
+
+        for (int i = 0; i < BENCHMARK_ITERATIONS; i++) {
+            // A unique comment stops drivers from answering from their in-memory shader cache.
+            src.len = user_len;
+            str_buf_appendf(&src, "\n// shdy benchmark %d %d\n", mode, i);
+
+            unsigned int program;
+            ShaderBuildStats stats;
+            if (!shader_build_program(shader, defines_src.data, src.data, inline_preamble, &program, &stats)) {
+                str_buf_free(&defines_src);
+                str_buf_free(&src);
+                return;
+            }
+            glDeleteProgram(program);
+
+            double ms = stats.compile_ms + stats.link_ms;
+            total_ms += ms;
+            if (i == 0 || ms < min_ms) {
+                min_ms = ms;
+                min_compile_ms = stats.compile_ms;
+                min_link_ms = stats.link_ms;
+            }
+        }
+
+        mean_ms[mode] = total_ms / BENCHMARK_ITERATIONS;
+        INFOF("Compile with %s: mean %.2fms, min %.2fms (compile %.2fms, link %.2fms) over %d builds.\n",
+              mode_names[mode], mean_ms[mode], min_ms, min_compile_ms, min_link_ms, BENCHMARK_ITERATIONS);
+    }
+
+    INFOF("Preamble object saves %.2fms (%.1f%%) per reload.\n", mean_ms[1] - mean_ms[0],
+          100.0 * (mean_ms[1] - mean_ms[0]) / mean_ms[1]);
+
+    str_buf_free(&defines_src);
+    str_buf_free(&src);
+}
+
+static void benchmark_update_inputs(int width, int height, float time) {
+    ShaderInputs inputs = {};
+    inputs.resolution[0] = (float)width;
+    inputs.resolution[1] = (float)height;
+    inputs.time = time;
+    shader_inputs_update(&inputs);
+}
+
+typedef struct {
+    const char *name;
+    const char *expr; // Evaluated with p, a vec4 that changes on each iteration.
+} NoiseBenchmark;
+
+static const NoiseBenchmark s_noise_benchmarks[] = {
+    {"shdyRand2d", "shdyRand2d(p.xy)"},
+    {"shdyHash2d", "shdyHash2d(p.xy)"},
+    {"shdyNoise2d", "shdyNoise2d(p.xy)"},
+    {"shdyValueNoise2d", "shdyValueNoise2d(p.xy)"},
+    {"shdyGradNoise2d", "shdyGradNoise2d(p.xy)"},
+    {"shdySimplexNoise2d", "shdySimplexNoise2d(p.xy)"},
+    {"shdyGradNoise3d", "shdyGradNoise3d(p.xyz)"},
+    {"shdySimplexNoise3d", "shdySimplexNoise3d(p.xyz)"},
+    {"shdyGradNoise4d", "shdyGradNoise4d(p)"},
+    {"shdySimplexNoise4d", "shdySimplexNoise4d(p)"},
+    {"shdyFracNoise2d (6 octaves)", "shdyFracNoise2d(p.xy, 6)"},
+    {"shdyFracNoise2d (SHDY_FBM_OCTAVES 6)", "shdyFracNoise2d(p.xy)"},
+    {"shdyNoise2dTex", "shdyNoise2dTex(p.xy)"},
+    {"shdyGradNoise2dTex", "shdyGradNoise2dTex(p.xy)"},
+    {"shdyWorley2dTex", "shdyWorley2dTex(p.xy).x"},
+    {"shdyFracNoise2dTex (6 octaves)", "shdyFracNoise2dTex(p.xy, 6)"},
+    {"shdyFracNoise2dTex (SHDY_FBM_OCTAVES 6)", "shdyFracNoise2dTex(p.xy)"},
+};
+
+static const char *s_noise_benchmark_fmt =
+        "void main() {\n"
+        "    vec4 p = vec4(gl_FragCoord.xy*0.01, uTime, 0.5);\n"
+        "    float v = 0.0;\n"
+        "    for (int i = 0; i < %d; i++) {\n"
+        "        v += %s;\n"
+        "        p += vec4(1.37, 0.71, 0.13, 0.29);\n"
+        "    }\n"
+        "    fragColor = vec4(v);\n"
+        "}\n";
+
+// Number of evaluations per pixel, large enough that the cost of the noise function dominates the pass.
+#define NOISE_BENCHMARK_EVALS 16
+#define NOISE_BENCHMARK_WIDTH 1920
+#define NOISE_BENCHMARK_HEIGHT 1080
+
+// Draws a pass per noise function that evaluates it NOISE_BENCHMARK_EVALS times per pixel and measures the time
+// to finish the draws, giving the throughput and the cost relative to the shdyRand2d hash. Wall time around
+// glFinish() is used rather than timer queries, as some drivers (e.g llvmpipe) report those before the
+// rasterization has actually finished.
+static void benchmark_noise(ShaderRenderer *shader_renderer) {
+    int width = NOISE_BENCHMARK_WIDTH;
+    int height = NOISE_BENCHMARK_HEIGHT;
+
+    unsigned int fbo;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+    unsigned int tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+
+    glViewport(0, 0, width, height);
+    glBindVertexArray(shader_renderer->vao);
+
+    double baseline_ns = 0.0;
+
+    for (int i = 0; i < ARRAY_LEN(s_noise_benchmarks); i++) {
+        const NoiseBenchmark *benchmark = &s_noise_benchmarks[i];
+
+        StrBuf src = {};
+        str_buf_appendf(&src, s_noise_benchmark_fmt, NOISE_BENCHMARK_EVALS, benchmark->expr);
+
+        unsigned int program;
+        // Built without any -D or pragma defines, so every function is timed with the default preamble.
+        bool built = shader_build_program(&shader_renderer->shader, "", src.data, false, &program, nullptr);
+        str_buf_free(&src);
+        if (!built) {
+            continue;
+        }
+
+        glUseProgram(program);
+
+        int noise_texture_loc = glGetUniformLocation(program, "uShdyNoiseTex");
+        if (noise_texture_loc != -1) {
+            glUniform1i(noise_texture_loc, NOISE_TEXTURE_UNIT);
+            glActiveTexture(GL_TEXTURE0 + NOISE_TEXTURE_UNIT);
+            glBindTexture(GL_TEXTURE_2D, noise_texture_get());
+        }
+
+        // Warm up, so the driver has finished any deferred compilation before timing.
+        benchmark_update_inputs(width, height, 0.0f);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glFinish();
+
+        double start = get_time_ms();
+        for (int frame = 0; frame < BENCHMARK_ITERATIONS; frame++) {
+            benchmark_update_inputs(width, height, (float)frame);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        glFinish();
+        double elapsed_ms = get_time_ms() - start;
+
+        glDeleteProgram(program);
+
+        double frame_ms = elapsed_ms / BENCHMARK_ITERATIONS;
+        double evals = (double)width * height * NOISE_BENCHMARK_EVALS * BENCHMARK_ITERATIONS;
+        double eval_ns = elapsed_ms * 1000000.0 / evals;
+        // The ratios are against the first function that built, normally shdyRand2d.
+        if (baseline_ns == 0.0) {
+            baseline_ns = eval_ns;
+        }
+
+        INFOF("%-40s %8.3fms/frame %10.1f Mevals/s %6.2fx cost of shdyRand2d\n", benchmark->name, frame_ms,
+              1000.0 / eval_ns, eval_ns / baseline_ns);
+    }
+
+    glDeleteTextures(1, &tex);
+    glDeleteFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+#define MATH_BENCHMARK_WIDTH 320
+#define MATH_BENCHMARK_HEIGHT 192
+
+// A preamble function evaluated at p on the GPU and with shdy_math.h, one point and SHDY_MATH_LANES points at a time.
+typedef struct {
+    const char *name;
+    const char *expr; // GLSL of p, a vec4.
+    float (*eval)(ShdyVec4 p, const float *noise_rgba);
+    ShdyF32xN (*eval_lanes)(ShdyVec4xN p, const float *noise_rgba);
+    float tolerance;
+    float outliers; // Fraction of the points allowed past the tolerance.
+} MathBenchmark;
+
+#define MATH_BENCHMARK_FN(fn, ...) \
+    template<typename F> static F fn(ShdyV4<F> p, const float *noise_rgba) { \
+        (void)noise_rgba; \
+        return __VA_ARGS__; \
+    }
+
+MATH_BENCHMARK_FN(math_norm_coord_landscape,
+                  shdy_norm_coord_landscape(ShdyV2<F>{p.x, p.y},
+                                            ShdyVec2{MATH_BENCHMARK_WIDTH, MATH_BENCHMARK_HEIGHT}).x)
+MATH_BENCHMARK_FN(math_norm_coord_portrait,
+                  shdy_norm_coord_portrait(ShdyV2<F>{p.x, p.y},
+                                           ShdyVec2{MATH_BENCHMARK_WIDTH, MATH_BENCHMARK_HEIGHT}).y)
+MATH_BENCHMARK_FN(math_translate_2d, shdy_translate_2d(ShdyV2<F>{p.x, p.y}, ShdyV2<F>{p.z, p.w}).x)
+MATH_BENCHMARK_FN(math_rotate_2d, shdy_rotate_2d(ShdyV2<F>{p.x, p.y}, p.z).x)
+MATH_BENCHMARK_FN(math_scale_2d, shdy_scale_2d(ShdyV2<F>{p.x, p.y}, ShdyV2<F>{p.z, p.w}).y)
+MATH_BENCHMARK_FN(math_rand_2d, shdy_rand_2d(ShdyV2<F>{p.x, p.y}))
+MATH_BENCHMARK_FN(math_noise_2d, shdy_noise_2d(ShdyV2<F>{p.x, p.y}))
+MATH_BENCHMARK_FN(math_frac_noise_2d, shdy_frac_noise_2d(ShdyV2<F>{p.x, p.y}, 6))
+MATH_BENCHMARK_FN(math_hash_1d, shdy_hash_1d(p.x))
+MATH_BENCHMARK_FN(math_hash_2d, shdy_hash_2d(ShdyV2<F>{p.x, p.y}))
+MATH_BENCHMARK_FN(math_hash_3d, shdy_hash_3d(ShdyV3<F>{p.x, p.y, p.z}))
+MATH_BENCHMARK_FN(math_hash_4d, shdy_hash_4d(p))
+MATH_BENCHMARK_FN(math_value_noise_2d, shdy_value_noise_2d(ShdyV2<F>{p.x, p.y}))
+MATH_BENCHMARK_FN(math_grad_noise_2d, shdy_grad_noise_2d(ShdyV2<F>{p.x, p.y}))
+MATH_BENCHMARK_FN(math_grad_noise_3d, shdy_grad_noise_3d(ShdyV3<F>{p.x, p.y, p.z}))
+MATH_BENCHMARK_FN(math_grad_noise_4d, shdy_grad_noise_4d(p))
+MATH_BENCHMARK_FN(math_simplex_noise_2d, shdy_simplex_noise_2d(ShdyV2<F>{p.x, p.y}))
+MATH_BENCHMARK_FN(math_simplex_noise_3d, shdy_simplex_noise_3d(ShdyV3<F>{p.x, p.y, p.z}))
+MATH_BENCHMARK_FN(math_simplex_noise_4d, shdy_simplex_noise_4d(p))
+MATH_BENCHMARK_FN(math_noise_2d_tex, shdy_noise_2d_tex(noise_rgba, ShdyV2<F>{p.x, p.y}))
+MATH_BENCHMARK_FN(math_frac_noise_2d_tex, shdy_frac_noise_2d_tex(noise_rgba, ShdyV2<F>{p.x, p.y}, 6))
+MATH_BENCHMARK_FN(math_grad_noise_2d_tex, shdy_grad_noise_2d_tex(noise_rgba, ShdyV2<F>{p.x, p.y}))
+MATH_BENCHMARK_FN(math_worley_2d_tex, shdy_worley_2d_tex(noise_rgba, ShdyV2<F>{p.x, p.y}).y)
+
+#define MATH_BENCHMARK(name, expr, fn, tolerance, outliers) \
+    {name, expr, fn<float>, fn<ShdyF32xN>, tolerance, outliers}
+
+// The tolerances allow for the GPU fusing multiplies and adds, which can also flip the corners simplex noise picks
+// for points on the edges between simplices. GLSL leaves the precision of sin() and cos() to the implementation,
+// and shdyRand2d() scales the error of sin() by 43758, so the functions built on it are allowed a few outliers.
+// Texture filtering weights may be fixed point.
+static const MathBenchmark s_math_benchmarks[] = {
+    MATH_BENCHMARK("shdyNormCoordLandscape", "shdyNormCoordLandscape(p.xy).x", math_norm_coord_landscape, 1e-6f, 0.0f),
+    MATH_BENCHMARK("shdyNormCoordPortrait", "shdyNormCoordPortrait(p.xy).y", math_norm_coord_portrait, 1e-6f, 0.0f),
+    MATH_BENCHMARK("shdyTranslate2d", "shdyTranslate2d(p.xy, p.zw).x", math_translate_2d, 1e-6f, 0.0f),
+    MATH_BENCHMARK("shdyRotate2d", "shdyRotate2d(p.xy, p.z).x", math_rotate_2d, 1e-4f, 0.0f),
+    MATH_BENCHMARK("shdyScale2d", "shdyScale2d(p.xy, p.zw).y", math_scale_2d, 1e-5f, 0.0f),
+    MATH_BENCHMARK("shdyRand2d", "shdyRand2d(p.xy)", math_rand_2d, 1e-2f, 0.01f),
+    MATH_BENCHMARK("shdyNoise2d", "shdyNoise2d(p.xy)", math_noise_2d, 1e-2f, 0.01f),
+    MATH_BENCHMARK("shdyFracNoise2d", "shdyFracNoise2d(p.xy, 6)", math_frac_noise_2d, 1e-2f, 0.01f),
+    MATH_BENCHMARK("shdyHash1d", "shdyHash1d(p.x)", math_hash_1d, 0.0f, 0.0f),
+    MATH_BENCHMARK("shdyHash2d", "shdyHash2d(p.xy)", math_hash_2d, 0.0f, 0.0f),
+    MATH_BENCHMARK("shdyHash3d", "shdyHash3d(p.xyz)", math_hash_3d, 0.0f, 0.0f),
+    MATH_BENCHMARK("shdyHash4d", "shdyHash4d(p)", math_hash_4d, 0.0f, 0.0f),
+    MATH_BENCHMARK("shdyValueNoise2d", "shdyValueNoise2d(p.xy)", math_value_noise_2d, 1e-5f, 0.0f),
+    MATH_BENCHMARK("shdyGradNoise2d", "shdyGradNoise2d(p.xy)", math_grad_noise_2d, 1e-5f, 0.0f),
+    MATH_BENCHMARK("shdyGradNoise3d", "shdyGradNoise3d(p.xyz)", math_grad_noise_3d, 1e-5f, 0.0f),
+    MATH_BENCHMARK("shdyGradNoise4d", "shdyGradNoise4d(p)", math_grad_noise_4d, 1e-5f, 0.0f),
+    MATH_BENCHMARK("shdySimplexNoise2d", "shdySimplexNoise2d(p.xy)", math_simplex_noise_2d, 1e-2f, 0.0f),
+    MATH_BENCHMARK("shdySimplexNoise3d", "shdySimplexNoise3d(p.xyz)", math_simplex_noise_3d, 1e-2f, 0.0f),
+    MATH_BENCHMARK("shdySimplexNoise4d", "shdySimplexNoise4d(p)", math_simplex_noise_4d, 1e-2f, 0.0f),
+    MATH_BENCHMARK("shdyNoise2dTex", "shdyNoise2dTex(p.xy)", math_noise_2d_tex, 1e-2f, 0.0f),
+    MATH_BENCHMARK("shdyFracNoise2dTex", "shdyFracNoise2dTex(p.xy, 6)", math_frac_noise_2d_tex, 1e-2f, 0.0f),
+    MATH_BENCHMARK("shdyGradNoise2dTex", "shdyGradNoise2dTex(p.xy)", math_grad_noise_2d_tex, 1e-2f, 0.0f),
+    MATH_BENCHMARK("shdyWorley2dTex", "shdyWorley2dTex(p.xy).y", math_worley_2d_tex, 1e-2f, 0.0f),
+};
+
+// Points with few enough significant bits that computing them can't round, so the hashes of their bits see the
+// same points on both sides.
+static const char *s_math_benchmark_fmt =
+        "void main() {\n"
+        "    vec4 p = vec4(gl_FragCoord.xy*0.0625 - 8.0, gl_FragCoord.yx*0.03125 - 2.0);\n"
+        "    fragColor = vec4(%s, 0.0, 0.0, 1.0);\n"
+        "}\n";
+
+// Checks shdy_math.h against the preamble: draws a pass per function into a float target, reads it back and
+// compares it with the function evaluated on the CPU for every pixel, one point and SHDY_MATH_LANES points at a
+// time. Also reports the CPU throughput of both.
+// Returns the number of functions that failed to build or don't match the GPU.
+static int benchmark_math(ShaderRenderer *shader_renderer) {
+    const int width = MATH_BENCHMARK_WIDTH;
+    const int height = MATH_BENCHMARK_HEIGHT;
+    const int count = width * height;
+    static_assert(MATH_BENCHMARK_WIDTH % SHDY_MATH_LANES == 0, "Rows must be whole groups of lanes.");
+
+    float *points = (float *)malloc(sizeof(float) * 4 * count);
+    float *gpu = (float *)malloc(sizeof(float) * count);
+    float *cpu = (float *)malloc(sizeof(float) * count);
+    float *cpu_lanes = (float *)malloc(sizeof(float) * count);
+    float *noise_rgba = (float *)malloc(sizeof(float) * 4 * NOISE_TEXTURE_SIZE * NOISE_TEXTURE_SIZE);
+    if (points == nullptr || gpu == nullptr || cpu == nullptr || cpu_lanes == nullptr || noise_rgba == nullptr) {
+        ERRORF("Failed to malloc() math benchmark buffers.\n");
+        exit(EXIT_FAILURE);
+    }
+    noise_texture_generate(noise_rgba);
+
+    // The components of the points are stored in their own rows, so groups of lanes load with one copy.
+    float *px = points;
+    float *py = points + count;
+    float *pz = points + 2 * count;
+    float *pw = points + 3 * count;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            int i = y * width + x;
+            px[i] = ((float)x + 0.5f) * 0.0625f - 8.0f;
+            py[i] = ((float)y + 0.5f) * 0.0625f - 8.0f;
+            pz[i] = ((float)y + 0.5f) * 0.03125f - 2.0f;
+            pw[i] = ((float)x + 0.5f) * 0.03125f - 2.0f;
+        }
+    }
+
+    unsigned int fbo;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+    unsigned int tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+
+    glViewport(0, 0, width, height);
+    glBindVertexArray(shader_renderer->vao);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    int num_failed = 0;
+    for (int i = 0; i < ARRAY_LEN(s_math_benchmarks); i++) {
+        const MathBenchmark *benchmark = &s_math_benchmarks[i];
+
+        StrBuf src = {};
+        str_buf_appendf(&src, s_math_benchmark_fmt, benchmark->expr);
+        unsigned int program;
+        bool built = shader_build_program(&shader_renderer->shader, "", src.data, false, &program, nullptr);
+        str_buf_free(&src);
+        if (!built) {
+            num_failed++;
+            continue;
+        }
+
+        glUseProgram(program);
+        int noise_texture_loc = glGetUniformLocation(program, "uShdyNoiseTex");
+        if (noise_texture_loc != -1) {
+            glUniform1i(noise_texture_loc, NOISE_TEXTURE_UNIT);
+            glActiveTexture(GL_TEXTURE0 + NOISE_TEXTURE_UNIT);
+            glBindTexture(GL_TEXTURE_2D, noise_texture_get());
+        }
+        benchmark_update_inputs(width, height, 0.0f);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glReadPixels(0, 0, width, height, GL_RED, GL_FLOAT, gpu);
+        glDeleteProgram(program);
+
+        double start = get_time_ms();
+        for (int iteration = 0; iteration < BENCHMARK_ITERATIONS; iteration++) {
+            for (int j = 0; j < count; j++) {
+                cpu[j] = benchmark->eval(ShdyVec4{px[j], py[j], pz[j], pw[j]}, noise_rgba);
+            }
+        }
+        double scalar_ms = get_time_ms() - start;
+
+        start = get_time_ms();
+        for (int iteration = 0; iteration < BENCHMARK_ITERATIONS; iteration++) {
+            for (int j = 0; j < count; j += SHDY_MATH_LANES) {
+                ShdyVec4xN p = {shdy_load(px + j), shdy_load(py + j), shdy_load(pz + j), shdy_load(pw + j)};
+                shdy_store(cpu_lanes + j, benchmark->eval_lanes(p, noise_rgba));
+            }
+        }
+        double lanes_ms = get_time_ms() - start;
+
+        float max_error = 0.0f;
+        int num_over = 0;
+        int num_lanes_differ = 0;
+        for (int j = 0; j < count; j++) {
+            float error = fabsf(cpu[j] - gpu[j]);
+            max_error = error > max_error ? error : max_error;
+            num_over += error > benchmark->tolerance;
+            num_lanes_differ += cpu_lanes[j] != cpu[j];
+        }
+
+        double evals = (double)count * BENCHMARK_ITERATIONS;
+        INFOF("%-24s max error %.1e, %6.2f%% over %.0e, %7.1f Mevals/s, %7.1f Mevals/s %d lanes (%.1fx)\n",
+              benchmark->name, max_error, 100.0 * num_over / count, benchmark->tolerance,
+              evals / (scalar_ms * 1000.0), evals / (lanes_ms * 1000.0), SHDY_MATH_LANES, scalar_ms / lanes_ms);
+        if (num_over > benchmark->outliers * count) {
+            ERRORF("%s doesn't match the GPU at %d of %d points.\n", benchmark->name, num_over, count);
+            num_failed++;
+        }
+        if (num_lanes_differ > 0) {
+            ERRORF("%s differs between one point and %d lanes at %d points.\n", benchmark->name, SHDY_MATH_LANES,
+                   num_lanes_differ);
+            num_failed++;
+        }
+    }
+
+    if (num_failed == 0) {
+        INFOF("shdy_math.h matches the preamble within tolerance for all %d functions.\n",
+              ARRAY_LEN(s_math_benchmarks));
+    }
+
+    glDeleteTextures(1, &tex);
+    glDeleteFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    free(noise_rgba);
+    free(cpu_lanes);
+    free(cpu);
+    free(gpu);
+    free(points);
+    return num_failed;
+}
+
+// Vertex shader for the two triangle quad the renderer used to draw, for comparison with the fullscreen triangle.
+static const char *s_quad_vert_shader_src =
+        "#version 330\n"
+        "const vec2 verts[6] = vec2[6](vec2(1.0, 1.0), vec2(1.0, -1.0), vec2(-1.0, 1.0),\n"
+        "                              vec2(1.0, -1.0), vec2(-1.0, -1.0), vec2(-1.0, 1.0));\n"
+        "void main()\n"
+        "{\n"
+        "    gl_Position = vec4(verts[gl_VertexID], 0.0, 1.0);\n"
+        "}\n";
+
+static const char *s_overdraw_benchmark_src =
+        "void main() {\n"
+        "    vec2 p = gl_FragCoord.xy*0.01;\n"
+        "    fragColor = vec4(shdyFracNoise2d(p + uTime, 4));\n"
+        "}\n";
+
+static const PrintSize s_overdraw_benchmark_sizes[] = {PRINT_SIZE_1080P, PRINT_SIZE_4K, PRINT_SIZE_A3_300DPI};
+
+static bool has_gl_extension(const char *name) {
+    int num_extensions = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+    for (int i = 0; i < num_extensions; i++) {
+        if (strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), name) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Draws a cheap noise shader over the fullscreen triangle and over the old two triangle quad at large sizes,
+// counting fragment shader invocations with a pipeline statistics query where supported. The invocations past
+// the pixel count are the overdraw of 2x2 fragment quads straddling the quad's diagonal.
+static void benchmark_overdraw(ShaderRenderer *shader_renderer) {
+    bool has_stats = GLAD_GL_VERSION_4_6 || has_gl_extension("GL_ARB_pipeline_statistics_query");
+    if (!has_stats) {
+        INFOF("Pipeline statistics queries aren't supported, only timing the fullscreen triangle against the quad.\n");
+    }
+
+    unsigned int quad_vert_shader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(quad_vert_shader, 1, &s_quad_vert_shader_src, nullptr);
+    glCompileShader(quad_vert_shader);
+
+    // shader_build_program() links the vertex shader of the given shader, so a copy builds the quad program.
+    static Shader quad_shader;
+    quad_shader = shader_renderer->shader;
+    quad_shader.compute = false;
+    quad_shader.vert_shader = quad_vert_shader;
+
+    unsigned int programs[2];
+    if (!shader_build_program(&quad_shader, "", s_overdraw_benchmark_src, false, &programs[0], nullptr)) {
+        glDeleteShader(quad_vert_shader);
+        return;
+    }
+    quad_shader.vert_shader = shader_renderer->shader.vert_shader;
+    if (!shader_build_program(&quad_shader, "", s_overdraw_benchmark_src, false, &programs[1], nullptr)) {
+        glDeleteProgram(programs[0]);
+        glDeleteShader(quad_vert_shader);
+        return;
+    }
+    glDeleteShader(quad_vert_shader);
+
+    const char *mode_names[] = {"quad", "triangle"};
+    const int mode_verts[] = {6, 3};
+
+    unsigned int query;
+    glGenQueries(1, &query);
+    glBindVertexArray(shader_renderer->vao);
+
+    for (int i = 0; i < ARRAY_LEN(s_overdraw_benchmark_sizes); i++) {
+        int width, height;
+        print_size_get_dimensions(s_overdraw_benchmark_sizes[i], &width, &height);
+
+        unsigned int fbo;
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+        unsigned int tex;
+        glGenTextures(1, &tex);
+        glBindTexture(GL_TEXTURE_2D, tex);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+        glViewport(0, 0, width, height);
+
+        double pixels = (double)width * height;
+        double frame_ms[2];
+        double invocations[2] = {0.0, 0.0};
+
+        for (int mode = 0; mode < 2; mode++) {
+            glUseProgram(programs[mode]);
+            benchmark_update_inputs(width, height, 0.0f);
+
+            if (has_stats) {
+                glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS, query);
+                glDrawArrays(GL_TRIANGLES, 0, mode_verts[mode]);
+                glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS);
+                GLuint64 result = 0;
+                glGetQueryObjectui64v(query, GL_QUERY_RESULT, &result);
+                invocations[mode] = (double)result;
+            } else {
+                glDrawArrays(GL_TRIANGLES, 0, mode_verts[mode]);
+            }
+            glFinish();
+
+            double start = get_time_ms();
+            for (int frame = 0; frame < BENCHMARK_ITERATIONS; frame++) {
+                benchmark_update_inputs(width, height, (float)frame);
+                glDrawArrays(GL_TRIANGLES, 0, mode_verts[mode]);
+            }
+            glFinish();
+            frame_ms[mode] = (get_time_ms() - start) / BENCHMARK_ITERATIONS;
+
+            if (has_stats) {
+                INFOF("%dx%d %-8s %8.3fms/frame %12.0f fragment invocations (%+.3f%% of pixels)\n", width, height,
+                      mode_names[mode], frame_ms[mode], invocations[mode],
+                      100.0 * (invocations[mode] - pixels) / pixels);
+            } else {
+                INFOF("%dx%d %-8s %8.3fms/frame\n", width, height, mode_names[mode], frame_ms[mode]);
+            }
+        }
+
+        if (has_stats) {
+            INFOF("%dx%d fullscreen triangle saves %.0f invocations and %.3fms per frame.\n", width, height,
+                  invocations[0] - invocations[1], frame_ms[0] - frame_ms[1]);
+        } else {
+            INFOF("%dx%d fullscreen triangle saves %.3fms per frame.\n", width, height, frame_ms[0] - frame_ms[1]);
+        }
+
+        glDeleteTextures(1, &tex);
+        glDeleteFramebuffers(1, &fbo);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteQueries(1, &query);
+    glDeleteProgram(programs[0]);
+    glDeleteProgram(programs[1]);
+}
+
+bool benchmark_run(ShaderRenderer *shader_renderer) {
+    benchmark_compile(shader_renderer);
+    benchmark_noise(shader_renderer);
+    int num_failed = benchmark_math(shader_renderer);
+    benchmark_overdraw(shader_renderer);
+    return num_failed == 0;
+}
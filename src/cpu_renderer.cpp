@@ -0,0 +1,1058 @@
+#include "shdy.h"
+#include "shdy_math.h"
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <dlfcn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Types and built-in functions of the translated shaders, ahead of every translation.
+static const char *s_cpu_runtime_src =
+#include "shdy_cpu.hpp"
+;
+
+// The translated shader becomes the members of a struct, so its globals are reset for each pixel and its functions
+// can be called before they're defined. Errors are reported against the "shdy" file, on the line of the GLSL source.
+static const char *s_cpu_header_src =
+        "namespace shdy_cpu {\n"
+        "struct ShdyShader : ShdyBuiltins {\n"
+        "#line 1 \"shdy\"\n";
+
+static const char *s_cpu_footer_src =
+        "};\n"
+        "}\n"
+        "extern \"C\" bool shdy_cpu_bind(const char *shdy_name, float *shdy_values, int shdy_count, bool shdy_get,\n"
+        "                                const float *shdy_texels, int shdy_width, int shdy_height) {\n"
+        "    shdy_cpu::ShdyBinder shdy_binder = {shdy_name, shdy_values, shdy_count, shdy_get, shdy_texels,\n"
+        "                                        shdy_width, shdy_height, false};\n"
+        "    shdy_cpu::ShdyShader::shdy_bind_all(shdy_binder);\n"
+        "    return shdy_binder.found;\n"
+        "}\n"
+        "extern \"C\" void shdy_cpu_render(int shdy_width, int shdy_y_begin, int shdy_y_end, float *shdy_out) {\n"
+        "    shdy_cpu::shdy_render<shdy_cpu::ShdyShader>(shdy_width, shdy_y_begin, shdy_y_end, shdy_out);\n"
+        "}\n";
+
+static const char *s_cpu_compile_flags[] = {
+        "-std=c++17", "-O2", "-march=native", "-fPIC", "-shared", "-fwrapv", "-fno-math-errno", "-Wno-narrowing",
+        "-w", "-fno-show-column"
+};
+
+// Bumped when the translation changes without the runtime changing, so stale shared objects aren't loaded.
+#define CPU_CACHE_VERSION 1
+
+// Rows per tile, small enough that the threads finish together even if some rows are far more expensive.
+#define CPU_RENDER_BAND_ROWS 4
+
+// Words of $CXX, e.g "ccache g++" runs ccache with g++ as its first argument.
+#define CPU_MAX_COMPILER_WORDS 8
+
+#define CPU_MAX_NAMES 512
+#define CPU_MAX_PAREN_DEPTH 64
+
+typedef bool (*CpuBindFn)(const char *name, float *values, int count, bool get, const float *texels, int width,
+                          int height);
+typedef void (*CpuRenderFn)(int width, int y_begin, int y_end, float *out_rgba);
+
+struct CpuProgram {
+    void *handle;
+    CpuBindFn bind;
+    CpuRenderFn render;
+};
+
+typedef enum {
+    CPU_TOKEN_SPACE, // Whitespace and comments.
+    CPU_TOKEN_DIRECTIVE, // A whole preprocessor line, with its continuations.
+    CPU_TOKEN_IDENT,
+    CPU_TOKEN_NUMBER,
+    CPU_TOKEN_PUNCT
+} CpuTokenType;
+
+typedef struct {
+    CpuTokenType type;
+    const char *str;
+    int len;
+} CpuToken;
+
+typedef struct {
+    const char *str;
+    int len;
+} CpuName;
+
+typedef struct {
+    const CpuToken *tokens;
+    int num_tokens;
+    StrBuf *out;
+    CpuName *struct_names; // Shared with the translators of the directives.
+    int *num_struct_names;
+    CpuName *member_names; // Of the structs, which aren't swizzles even if they look like one.
+    int *num_member_names;
+    int *num_uniforms;
+    bool brace_parens[CPU_MAX_PAREN_DEPTH]; // Parens of constructors translated to braces.
+    int paren_depth;
+    int prev; // Index of the last token that isn't a space.
+} CpuTranslator;
+
+// Qualifiers without a C++ equivalent, dropped wherever they are.
+static const char *s_dropped_qualifiers[] = {
+        "highp", "mediump", "lowp", "flat", "smooth", "noperspective", "centroid", "invariant", "precise",
+        "readonly", "writeonly", "coherent", "volatile", "restrict"
+};
+
+// C++ keywords that are plain identifiers in GLSL, prefixed with shdy_ so they can still be used as names.
+static const char *s_cpp_keywords[] = {
+        "alignas", "alignof", "and", "and_eq", "asm", "auto", "bitand", "bitor", "catch", "char", "char16_t",
+        "char32_t", "class", "compl", "constexpr", "const_cast", "decltype", "delete", "double", "dynamic_cast",
+        "enum", "explicit", "export", "extern", "friend", "goto", "inline", "long", "mutable", "namespace", "new",
+        "noexcept", "not", "not_eq", "nullptr", "operator", "or", "or_eq", "private", "protected", "public",
+        "register", "reinterpret_cast", "short", "signed", "sizeof", "static", "static_assert", "static_cast",
+        "template", "this", "thread_local", "throw", "try", "typeid", "typename", "union", "unsigned", "using",
+        "virtual", "wchar_t", "xor", "xor_eq"
+};
+
+static const char *s_builtin_types[] = {
+        "float", "int", "uint", "bool", "vec2", "vec3", "vec4", "ivec2", "ivec3", "ivec4", "uvec2", "uvec3", "uvec4",
+        "bvec2", "bvec3", "bvec4", "mat2", "mat3", "mat4", "mat2x2", "mat3x3", "mat4x4"
+};
+
+static const char *s_assign_ops[] = {"=", "+=", "-=", "*=", "/=", "%=", "&=", "|=", "^=", "<<=", ">>="};
+
+static const char *s_punct_3[] = {"<<=", ">>="};
+static const char *s_punct_2[] = {
+        "<<", ">>", "<=", ">=", "==", "!=", "&&", "||", "^^", "++", "--", "+=", "-=", "*=", "/=", "%=", "&=", "|=",
+        "^=", "##"
+};
+
+static bool token_is(const CpuToken *token, const char *str) {
+    return (int)strlen(str) == token->len && strncmp(token->str, str, token->len) == 0;
+}
+
+static bool token_in(const CpuToken *token, const char **strs, int count) {
+    for (int i = 0; i < count; i++) {
+        if (token_is(token, strs[i])) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool name_in(const CpuToken *token, const CpuName *names, int count) {
+    for (int i = 0; i < count; i++) {
+        if (names[i].len == token->len && strncmp(names[i].str, token->str, token->len) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void name_add(const CpuToken *token, CpuName *names, int *count) {
+    if (*count < CPU_MAX_NAMES && !name_in(token, names, *count)) {
+        names[(*count)++] = {token->str, token->len};
+    }
+}
+
+static void tokens_push(CpuToken **tokens, int *count, int *cap, CpuTokenType type, const char *str, int len) {
+    if (*count == *cap) {
+        *cap = *cap == 0 ? 1024 : *cap * 2;
+        *tokens = (CpuToken *)realloc(*tokens, *cap * sizeof(CpuToken));
+        if (*tokens == nullptr) {
+            ERRORF("Failed to realloc() tokens.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    (*tokens)[(*count)++] = {type, str, len};
+}
+
+// Splits src into tokens, which together cover all of it. The caller frees *out.
+static void cpu_tokenize(const char *src, size_t len, CpuToken **out, int *out_count) {
+    *out = nullptr;
+    *out_count = 0;
+    int cap = 0;
+    const char *end = src + len;
+    bool line_start = true;
+
+    for (const char *str = src; str < end;) {
+        const char *start = str;
+        if (isspace((unsigned char)*str)) {
+            for (; str < end && isspace((unsigned char)*str); str++) {
+                line_start = line_start || *str == '\n';
+            }
+            tokens_push(out, out_count, &cap, CPU_TOKEN_SPACE, start, (int)(str - start));
+            continue;
+        }
+
+        if (str + 1 < end && str[0] == '/' && str[1] == '/') {
+            while (str < end && *str != '\n') {
+                str++;
+            }
+            tokens_push(out, out_count, &cap, CPU_TOKEN_SPACE, start, (int)(str - start));
+            continue;
+        }
+        if (str + 1 < end && str[0] == '/' && str[1] == '*') {
+            const char *close = strstr(str + 2, "*/");
+            str = close != nullptr && close + 2 <= end ? close + 2 : end;
+            tokens_push(out, out_count, &cap, CPU_TOKEN_SPACE, start, (int)(str - start));
+            continue;
+        }
+
+        if (*str == '#' && line_start) {
+            while (str < end && *str != '\n') {
+                str += str[0] == '\\' && str + 1 < end && str[1] == '\n' ? 2 : 1;
+            }
+            tokens_push(out, out_count, &cap, CPU_TOKEN_DIRECTIVE, start, (int)(str - start));
+            continue;
+        }
+        line_start = false;
+
+        if (isalpha((unsigned char)*str) || *str == '_') {
+            while (str < end && (isalnum((unsigned char)*str) || *str == '_')) {
+                str++;
+            }
+            tokens_push(out, out_count, &cap, CPU_TOKEN_IDENT, start, (int)(str - start));
+            continue;
+        }
+
+        if (isdigit((unsigned char)*str) || (*str == '.' && str + 1 < end && isdigit((unsigned char)str[1]))) {
+            bool hex = str + 1 < end && str[0] == '0' && (str[1] == 'x' || str[1] == 'X');
+            while (str < end) {
+                bool exponent_sign = (*str == '+' || *str == '-') && !hex && (str[-1] == 'e' || str[-1] == 'E');
+                if (!isalnum((unsigned char)*str) && *str != '.' && *str != '_' && !exponent_sign) {
+                    break;
+                }
+                str++;
+            }
+            tokens_push(out, out_count, &cap, CPU_TOKEN_NUMBER, start, (int)(str - start));
+            continue;
+        }
+
+        int punct_len = 1;
+        for (int i = 0; i < ARRAY_LEN(s_punct_3) && punct_len == 1; i++) {
+            punct_len = end - str >= 3 && strncmp(str, s_punct_3[i], 3) == 0 ? 3 : 1;
+        }
+        for (int i = 0; i < ARRAY_LEN(s_punct_2) && punct_len == 1; i++) {
+            punct_len = end - str >= 2 && strncmp(str, s_punct_2[i], 2) == 0 ? 2 : 1;
+        }
+        str += punct_len;
+        tokens_push(out, out_count, &cap, CPU_TOKEN_PUNCT, start, punct_len);
+    }
+}
+
+static void emit(CpuTranslator *t, const char *str) {
+    str_buf_append(t->out, str, strlen(str));
+}
+
+static void emit_token(CpuTranslator *t, const CpuToken *token) {
+    str_buf_append(t->out, token->str, token->len);
+}
+
+// Emits only the newlines of the token, so dropping it doesn't move the lines after it.
+static void emit_newlines(CpuTranslator *t, const CpuToken *token) {
+    for (int i = 0; i < token->len; i++) {
+        if (token->str[i] == '\n') {
+            str_buf_append(t->out, "\n", 1);
+        }
+    }
+}
+
+static int skip_spaces(const CpuTranslator *t, int i) {
+    while (i < t->num_tokens && t->tokens[i].type == CPU_TOKEN_SPACE) {
+        i++;
+    }
+
+    return i;
+}
+
+// Returns the index of the token closing the bracket at open, or the last token if it isn't closed.
+static int find_close(const CpuTranslator *t, int open) {
+    int depth = 0;
+    for (int i = open; i < t->num_tokens; i++) {
+        const CpuToken *token = &t->tokens[i];
+        if (token->type != CPU_TOKEN_PUNCT) {
+            continue;
+        }
+        if (token_is(token, "(") || token_is(token, "[") || token_is(token, "{")) {
+            depth++;
+        } else if ((token_is(token, ")") || token_is(token, "]") || token_is(token, "}")) && --depth == 0) {
+            return i;
+        }
+    }
+
+    return t->num_tokens - 1;
+}
+
+static void cpu_translate_range(CpuTranslator *t, int begin, int end);
+
+// Keeps the directive, except the ones with no meaning in C++, translating the rest of the line like code.
+static void cpu_translate_directive(CpuTranslator *t, const CpuToken *token) {
+    const char *str = token->str + 1;
+    const char *end = token->str + token->len;
+    while (str < end && (*str == ' ' || *str == '\t')) {
+        str++;
+    }
+    const char *name = str;
+    while (str < end && isalpha((unsigned char)*str)) {
+        str++;
+    }
+    CpuToken directive = {CPU_TOKEN_IDENT, name, (int)(str - name)};
+    if (token_is(&directive, "version") || token_is(&directive, "extension") || token_is(&directive, "pragma") ||
+        token_is(&directive, "line")) {
+        emit_newlines(t, token);
+        return;
+    }
+
+    str_buf_append(t->out, token->str, str - token->str);
+    CpuToken *tokens;
+    int num_tokens;
+    cpu_tokenize(str, end - str, &tokens, &num_tokens);
+    CpuTranslator body = *t;
+    body.tokens = tokens;
+    body.num_tokens = num_tokens;
+    body.paren_depth = 0;
+    body.prev = -1;
+    cpu_translate_range(&body, 0, num_tokens);
+    free(tokens);
+}
+
+// Translates the identifier after a '.', the components of a swizzle are mapped to x, y, z and w. Swizzles of more
+// than one component are functions of the vector, assignable ones if they're assigned to.
+static void cpu_translate_member(CpuTranslator *t, int i) {
+    const CpuToken *token = &t->tokens[i];
+    static const char *sets[] = {"xyzw", "rgba", "stpq"};
+    int set = -1;
+    for (int j = 0; j < ARRAY_LEN(sets) && set < 0; j++) {
+        set = (int)strspn(token->str, sets[j]) >= token->len ? j : -1;
+    }
+    if (set < 0 || token->len > 4 || name_in(token, t->member_names, *t->num_member_names)) {
+        emit_token(t, token);
+        return;
+    }
+
+    if (token->len == 1) {
+        char component[2] = {"xyzw"[strchr(sets[set], token->str[0]) - sets[set]], '\0'};
+        emit(t, component);
+        return;
+    }
+
+    int next = skip_spaces(t, i + 1);
+    bool assigned = next < t->num_tokens && t->tokens[next].type == CPU_TOKEN_PUNCT &&
+                    token_in(&t->tokens[next], s_assign_ops, ARRAY_LEN(s_assign_ops));
+    emit(t, assigned ? "swz_ref<" : "swz<");
+    for (int j = 0; j < token->len; j++) {
+        str_buf_appendf(t->out, j > 0 ? ",%d" : "%d", (int)(strchr(sets[set], token->str[j]) - sets[set]));
+    }
+    emit(t, ">()");
+}
+
+static bool is_type_name(const CpuTranslator *t, const CpuToken *token) {
+    return token->type == CPU_TOKEN_IDENT && (token_in(token, s_builtin_types, ARRAY_LEN(s_builtin_types)) ||
+                                              name_in(token, t->struct_names, *t->num_struct_names));
+}
+
+static void open_paren(CpuTranslator *t, bool brace) {
+    if (t->paren_depth < CPU_MAX_PAREN_DEPTH) {
+        t->brace_parens[t->paren_depth] = brace;
+    }
+    t->paren_depth++;
+    emit(t, brace ? "{" : "(");
+}
+
+// Translates the token at i with the rules of expressions and returns the index of the next token.
+static int cpu_translate_token(CpuTranslator *t, int i) {
+    const CpuToken *token = &t->tokens[i];
+    int prev = t->prev;
+    if (token->type != CPU_TOKEN_SPACE) {
+        t->prev = i;
+    }
+
+    switch (token->type) {
+        case CPU_TOKEN_SPACE:
+            emit_token(t, token);
+            return i + 1;
+        case CPU_TOKEN_DIRECTIVE:
+            cpu_translate_directive(t, token);
+            return i + 1;
+        case CPU_TOKEN_NUMBER: {
+            // Float literals are doubles in C++, they're made floats like in GLSL.
+            bool hex = token->len > 1 && (token->str[1] == 'x' || token->str[1] == 'X');
+            bool is_float = !hex && strcspn(token->str, ".eE") < (size_t)token->len;
+            if (!is_float) {
+                emit_token(t, token);
+                return i + 1;
+            }
+            int len = token->len;
+            while (len > 0 && (token->str[len - 1] == 'f' || token->str[len - 1] == 'F' ||
+                               token->str[len - 1] == 'l' || token->str[len - 1] == 'L')) {
+                len--;
+            }
+            str_buf_append(t->out, token->str, len);
+            emit(t, "f");
+            return i + 1;
+        }
+        case CPU_TOKEN_IDENT:
+            break;
+        case CPU_TOKEN_PUNCT:
+            if (token_is(token, "(")) {
+                bool constructor = prev >= 0 && name_in(&t->tokens[prev], t->struct_names, *t->num_struct_names);
+                open_paren(t, constructor);
+            } else if (token_is(token, ")")) {
+                t->paren_depth--;
+                bool brace = t->paren_depth >= 0 && t->paren_depth < CPU_MAX_PAREN_DEPTH &&
+                             t->brace_parens[t->paren_depth];
+                emit(t, brace ? "}" : ")");
+            } else if (token_is(token, "^^")) {
+                emit(t, "!=");
+            } else {
+                emit_token(t, token);
+            }
+            return i + 1;
+    }
+
+    if (prev >= 0 && token_is(&t->tokens[prev], ".")) {
+        cpu_translate_member(t, i);
+        return i + 1;
+    }
+    if (token_in(token, s_dropped_qualifiers, ARRAY_LEN(s_dropped_qualifiers))) {
+        t->prev = prev;
+        return i + 1;
+    }
+    if (token_is(token, "layout")) {
+        int open = skip_spaces(t, i + 1);
+        if (open < t->num_tokens && token_is(&t->tokens[open], "(")) {
+            int close = find_close(t, open);
+            for (int j = i + 1; j <= close; j++) {
+                emit_newlines(t, &t->tokens[j]);
+            }
+            t->prev = prev;
+            return close + 1;
+        }
+    }
+    if (token_is(token, "discard")) {
+        emit(t, "throw ShdyDiscard()");
+        return i + 1;
+    }
+    if (token_in(token, s_cpp_keywords, ARRAY_LEN(s_cpp_keywords))) {
+        emit(t, "shdy_");
+        emit_token(t, token);
+        return i + 1;
+    }
+
+    // Array constructors, e.g float[3](a, b, c), become initializer lists.
+    int open = skip_spaces(t, i + 1);
+    if (is_type_name(t, token) && open < t->num_tokens && token_is(&t->tokens[open], "[")) {
+        int close = find_close(t, open);
+        int paren = skip_spaces(t, close + 1);
+        if (paren < t->num_tokens && token_is(&t->tokens[paren], "(")) {
+            for (int j = i + 1; j < paren; j++) {
+                emit_newlines(t, &t->tokens[j]);
+            }
+            t->prev = paren;
+            open_paren(t, true);
+            return paren + 1;
+        }
+    }
+
+    emit_token(t, token);
+    return i + 1;
+}
+
+static void cpu_translate_range(CpuTranslator *t, int begin, int end) {
+    for (int i = begin; i < end;) {
+        i = cpu_translate_token(t, i);
+    }
+}
+
+// Drops the tokens, keeping their newlines and any directive among them.
+static void cpu_drop_range(CpuTranslator *t, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+        if (t->tokens[i].type == CPU_TOKEN_DIRECTIVE) {
+            cpu_translate_directive(t, &t->tokens[i]);
+        } else {
+            emit_newlines(t, &t->tokens[i]);
+        }
+    }
+}
+
+// Returns the index of the ';' or '{' ending the statement starting at begin, outside of any parens.
+static int statement_end(const CpuTranslator *t, int begin) {
+    int depth = 0;
+    for (int i = begin; i < t->num_tokens; i++) {
+        const CpuToken *token = &t->tokens[i];
+        if (token->type != CPU_TOKEN_PUNCT) {
+            continue;
+        }
+        if (token_is(token, "(") || token_is(token, "[")) {
+            depth++;
+        } else if (token_is(token, ")") || token_is(token, "]")) {
+            depth--;
+        } else if (depth <= 0 && (token_is(token, ";") || token_is(token, "{") || token_is(token, "}"))) {
+            return i;
+        }
+    }
+
+    return t->num_tokens - 1;
+}
+
+// Returns the index of the first token in [begin, end) equal to str outside of parens, or -1. Layout qualifiers are
+// skipped, they're the only parens of a declaration that aren't part of a function or an initializer.
+static int find_top_level(const CpuTranslator *t, int begin, int end, const char *str) {
+    for (int i = begin; i < end; i++) {
+        const CpuToken *token = &t->tokens[i];
+        if (token_is(token, str)) {
+            return i;
+        }
+        if (token_is(token, "(") || token_is(token, "[")) {
+            i = find_close(t, i);
+        }
+    }
+
+    return -1;
+}
+
+static int find_paren(const CpuTranslator *t, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+        if (token_is(&t->tokens[i], "layout")) {
+            int open = skip_spaces(t, i + 1);
+            i = open < end && token_is(&t->tokens[open], "(") ? find_close(t, open) : i;
+        } else if (token_is(&t->tokens[i], "(")) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// A uniform declaration becomes a static member, shared by all pixels, followed on the same line by the function
+// binding its declarators by name. Any qualifier before the type is dropped.
+static void cpu_translate_uniform(CpuTranslator *t, int begin, int end) {
+    int type = -1;
+    for (int i = begin; i < end && type < 0; i++) {
+        const CpuToken *token = &t->tokens[i];
+        if (token_is(token, "layout")) {
+            int open = skip_spaces(t, i + 1);
+            if (open < end && token_is(&t->tokens[open], "(")) {
+                cpu_drop_range(t, i, find_close(t, open) + 1);
+                i = find_close(t, open);
+                continue;
+            }
+        }
+        if (token->type == CPU_TOKEN_IDENT && !token_is(token, "uniform") && !token_is(token, "const") &&
+            !token_in(token, s_dropped_qualifiers, ARRAY_LEN(s_dropped_qualifiers))) {
+            type = i;
+            break;
+        }
+        cpu_drop_range(t, i, i + 1);
+    }
+    if (type < 0) {
+        cpu_translate_range(t, end, end + 1);
+        return;
+    }
+
+    emit(t, "static inline ");
+    cpu_translate_range(t, type, end + 1);
+
+    int index = (*t->num_uniforms)++;
+    str_buf_appendf(t->out, " static void shdy_bind(ShdyTag<%d>, ShdyBinder &shdy_binder) {", index);
+    bool declarator = true;
+    for (int i = skip_spaces(t, type + 1); i < end; i = skip_spaces(t, i + 1)) {
+        const CpuToken *token = &t->tokens[i];
+        if (declarator && token->type == CPU_TOKEN_IDENT) {
+            bool keyword = token_in(token, s_cpp_keywords, ARRAY_LEN(s_cpp_keywords));
+            str_buf_appendf(t->out, " shdy_binder.bind(\"%.*s\", %s%.*s);", token->len, token->str,
+                            keyword ? "shdy_" : "", token->len, token->str);
+        }
+        declarator = token_is(token, ",");
+        if (token_is(token, "(") || token_is(token, "[") || token_is(token, "{")) {
+            i = find_close(t, i);
+        }
+    }
+    emit(t, " }");
+}
+
+// Translates the parameters of a function definition, in is dropped and out and inout become references.
+static void cpu_translate_params(CpuTranslator *t, int open, int close) {
+    emit(t, "(");
+    bool reference = false;
+    for (int i = open + 1; i < close; i++) {
+        const CpuToken *token = &t->tokens[i];
+        if (token_is(token, "in")) {
+            continue;
+        }
+        if (token_is(token, "out") || token_is(token, "inout")) {
+            reference = true;
+            continue;
+        }
+        i = cpu_translate_token(t, i) - 1;
+        if (reference && is_type_name(t, token)) {
+            emit(t, " &");
+            reference = false;
+        }
+    }
+    emit(t, ")");
+}
+
+// Translates the statement at begin at the top level of the source, returns the index of the token after it.
+static int cpu_translate_statement(CpuTranslator *t, int begin) {
+    int end = statement_end(t, begin);
+    const CpuToken *last = &t->tokens[end];
+    int paren = find_paren(t, begin, end);
+    int assign = find_top_level(t, begin, end, "=");
+
+    if (token_is(&t->tokens[begin], "precision")) {
+        cpu_drop_range(t, begin, end + 1);
+        return end + 1;
+    }
+
+    if (find_top_level(t, begin, end, "uniform") >= 0) {
+        if (token_is(last, ";")) {
+            cpu_translate_uniform(t, begin, end);
+            return end + 1;
+        }
+
+        // Members of an anonymous block are uniforms of their own.
+        int close = find_close(t, end);
+        int after = statement_end(t, close + 1);
+        bool instance = false;
+        for (int i = close + 1; i < after; i++) {
+            instance = instance || t->tokens[i].type == CPU_TOKEN_IDENT;
+        }
+        if (instance) {
+            emit(t, "static_assert(false, \"uniform blocks with an instance name aren't supported on the CPU\");");
+            cpu_drop_range(t, begin, after + 1);
+            return after + 1;
+        }
+
+        cpu_drop_range(t, begin, end + 1);
+        for (int i = end + 1; i < close;) {
+            int member = skip_spaces(t, i);
+            cpu_drop_range(t, i, member);
+            i = member;
+            if (i >= close) {
+                break;
+            }
+            if (t->tokens[i].type == CPU_TOKEN_DIRECTIVE) {
+                cpu_translate_directive(t, &t->tokens[i++]);
+                continue;
+            }
+            int member_end = statement_end(t, i);
+            cpu_translate_uniform(t, i, member_end);
+            i = member_end + 1;
+        }
+        cpu_drop_range(t, close, after + 1);
+        return after + 1;
+    }
+
+    // Function definitions keep their body, prototypes aren't needed since members can be used before they're
+    // defined.
+    if (paren >= 0 && (assign < 0 || paren < assign)) {
+        if (token_is(last, ";")) {
+            cpu_drop_range(t, begin, end + 1);
+            return end + 1;
+        }
+        if (token_is(last, "{")) {
+            int close = find_close(t, paren);
+            cpu_translate_range(t, begin, paren);
+            cpu_translate_params(t, paren, close);
+            cpu_translate_range(t, close + 1, end);
+            int body_end = find_close(t, end);
+            cpu_translate_range(t, end, body_end + 1);
+            return body_end + 1;
+        }
+    }
+
+    // Structs, up to the ';' after their body, or initializer lists.
+    if (token_is(last, "{")) {
+        int close = find_close(t, end);
+        int after = statement_end(t, close + 1);
+        if (assign < 0) {
+            cpu_translate_range(t, begin, after + 1);
+            return after + 1;
+        }
+        end = after;
+    }
+
+    // Constants are the same for every pixel, the other globals are reset for each one. Inputs and outputs are
+    // globals like the others.
+    for (int i = begin; i < end; i = skip_spaces(t, i + 1)) {
+        const CpuToken *token = &t->tokens[i];
+        if (token_is(token, "const")) {
+            emit(t, "static inline ");
+            break;
+        }
+        if (token_is(token, "in") || token_is(token, "out")) {
+            cpu_drop_range(t, begin, i + 1);
+            begin = i + 1;
+            break;
+        }
+        if (token_is(token, "layout")) {
+            int open = skip_spaces(t, i + 1);
+            i = open < end && token_is(&t->tokens[open], "(") ? find_close(t, open) : i;
+            continue;
+        }
+        if (token->type != CPU_TOKEN_IDENT || is_type_name(t, token)) {
+            break;
+        }
+    }
+    cpu_translate_range(t, begin, end + 1);
+
+    return end + 1;
+}
+
+// Records the names of the structs and of their members, anywhere in the source.
+static void cpu_collect_structs(CpuTranslator *t) {
+    for (int i = 0; i < t->num_tokens; i++) {
+        if (!token_is(&t->tokens[i], "struct")) {
+            continue;
+        }
+        int name = skip_spaces(t, i + 1);
+        int open = skip_spaces(t, name + 1);
+        if (open >= t->num_tokens || !token_is(&t->tokens[open], "{")) {
+            continue;
+        }
+        name_add(&t->tokens[name], t->struct_names, t->num_struct_names);
+
+        int close = find_close(t, open);
+        for (int j = open + 1; j < close; j++) {
+            int next = skip_spaces(t, j + 1);
+            if (t->tokens[j].type == CPU_TOKEN_IDENT && next < close &&
+                (token_is(&t->tokens[next], ";") || token_is(&t->tokens[next], ",") ||
+                 token_is(&t->tokens[next], "["))) {
+                name_add(&t->tokens[j], t->member_names, t->num_member_names);
+            }
+        }
+    }
+}
+
+void cpu_translate(const char *src, StrBuf *out) {
+    CpuToken *tokens;
+    int num_tokens;
+    cpu_tokenize(src, strlen(src), &tokens, &num_tokens);
+
+    auto *struct_names = (CpuName *)malloc(CPU_MAX_NAMES * sizeof(CpuName));
+    auto *member_names = (CpuName *)malloc(CPU_MAX_NAMES * sizeof(CpuName));
+    if (struct_names == nullptr || member_names == nullptr) {
+        ERRORF("Failed to malloc() translator names.\n");
+        exit(EXIT_FAILURE);
+    }
+    int num_struct_names = 0;
+    int num_member_names = 0;
+    int num_uniforms = 0;
+
+    CpuTranslator t = {};
+    t.tokens = tokens;
+    t.num_tokens = num_tokens;
+    t.out = out;
+    t.struct_names = struct_names;
+    t.num_struct_names = &num_struct_names;
+    t.member_names = member_names;
+    t.num_member_names = &num_member_names;
+    t.num_uniforms = &num_uniforms;
+    t.prev = -1;
+    cpu_collect_structs(&t);
+
+    str_buf_append(out, s_cpu_runtime_src, strlen(s_cpu_runtime_src));
+    str_buf_append(out, s_cpu_header_src, strlen(s_cpu_header_src));
+    for (int i = 0; i < num_tokens;) {
+        if (tokens[i].type == CPU_TOKEN_SPACE || tokens[i].type == CPU_TOKEN_DIRECTIVE) {
+            i = cpu_translate_token(&t, i);
+        } else {
+            i = cpu_translate_statement(&t, i);
+        }
+    }
+
+    // Declarations in inactive preprocessor branches have no binding function, the template stands in for them.
+    str_buf_appendf(out, "\ntemplate<int I> static void shdy_bind(ShdyTag<I>, ShdyBinder &) {}\n"
+                         "static void shdy_bind_all(ShdyBinder &shdy_binder) {\n");
+    for (int i = 0; i < num_uniforms; i++) {
+        str_buf_appendf(out, "    shdy_bind(ShdyTag<%d>(), shdy_binder);\n", i);
+    }
+    str_buf_appendf(out, "}\n");
+    str_buf_append(out, s_cpu_footer_src, strlen(s_cpu_footer_src));
+
+    free(member_names);
+    free(struct_names);
+    free(tokens);
+}
+
+static const char *cpu_compiler() {
+    const char *cxx = getenv("CXX");
+    return cxx != nullptr && cxx[0] != '\0' ? cxx : "c++";
+}
+
+// Hashes what identifies the CPU in /proc/cpuinfo, since -march=native builds for the CPU the compiler runs on. A
+// cache directory shared between machines would otherwise hand out objects using instructions the CPU lacks.
+static uint64_t cpu_target_hash() {
+    static const char *keys[] = {"vendor_id", "model name", "flags", "CPU implementer", "CPU part", "Features"};
+
+    uint64_t hash = 0;
+    FILE *file = fopen("/proc/cpuinfo", "r");
+    if (file == nullptr) {
+        return hash;
+    }
+    // Only the first processor is read, the blank line ends its block.
+    char line[4096];
+    while (fgets(line, sizeof(line), file) != nullptr && line[0] != '\n') {
+        for (int i = 0; i < ARRAY_LEN(keys); i++) {
+            size_t key_len = strlen(keys[i]);
+            if (strncmp(line, keys[i], key_len) == 0 && (line[key_len] == '\t' || line[key_len] == ':')) {
+                hash = hash * 0x100000001b3ULL ^ hash_bytes(line, strlen(line));
+            }
+        }
+    }
+    fclose(file);
+
+    return hash;
+}
+
+// Runs the compiler on src_path, writing the shared object to so_path. Appends the errors it prints to out_log.
+static bool cpu_compile(const char *src_path, const char *so_path, StrBuf *out_log) {
+    char compiler[PATH_MAX];
+    snprintf(compiler, sizeof(compiler), "%s", cpu_compiler());
+    const char *argv[CPU_MAX_COMPILER_WORDS + ARRAY_LEN(s_cpu_compile_flags) + 4];
+    int argc = 0;
+    char *save;
+    for (char *word = strtok_r(compiler, " \t", &save); word != nullptr; word = strtok_r(nullptr, " \t", &save)) {
+        if (argc == CPU_MAX_COMPILER_WORDS) {
+            ERRORF("The compiler %s has too many words, the maximum is %d.\n", cpu_compiler(),
+                   CPU_MAX_COMPILER_WORDS);
+            return false;
+        }
+        argv[argc++] = word;
+    }
+    if (argc == 0) {
+        ERRORF("The compiler is empty.\n");
+        return false;
+    }
+    for (int i = 0; i < ARRAY_LEN(s_cpu_compile_flags); i++) {
+        argv[argc++] = s_cpu_compile_flags[i];
+    }
+    argv[argc++] = src_path;
+    argv[argc++] = "-o";
+    argv[argc++] = so_path;
+    argv[argc] = nullptr;
+
+    int fds[2];
+    if (pipe(fds) != 0) {
+        ERRORF("Failed to create a pipe for the compiler: %s.\n", strerror(errno));
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execvp(argv[0], (char *const *)argv);
+        fprintf(stderr, "error: failed to run %s: %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        ERRORF("Failed to fork() the compiler: %s.\n", strerror(errno));
+        close(fds[0]);
+        return false;
+    }
+
+    StrBuf log = {};
+    char buffer[4096];
+    ssize_t len;
+    while ((len = read(fds[0], buffer, sizeof(buffer))) != 0) {
+        if (len < 0 && errno != EINTR) {
+            break;
+        }
+        if (len > 0) {
+            str_buf_append(&log, buffer, len);
+        }
+    }
+    close(fds[0]);
+
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    // Only the errors are kept, the context and notes around them don't map to diagnostics.
+    for (const char *line = log.data; !ok && line != nullptr && *line != '\0';) {
+        const char *newline = strchr(line, '\n');
+        size_t line_len = newline != nullptr ? (size_t)(newline - line) : strlen(line);
+        const char *error = strstr(line, "error:");
+        if (error != nullptr && error < line + line_len) {
+            str_buf_append(out_log, line, line_len);
+            str_buf_append(out_log, "\n", 1);
+        }
+        line = newline != nullptr ? newline + 1 : nullptr;
+    }
+    str_buf_free(&log);
+
+    return ok;
+}
+
+CpuProgram *cpu_program_create(const char *glsl_src, StrBuf *out_log) {
+    StrBuf src = {};
+    cpu_translate(glsl_src, &src);
+
+    // The compiler, its flags and the CPU it targets are part of the key, the same source built differently is
+    // another object.
+    uint64_t key = hash_bytes(src.data, src.len) ^ hash_bytes(cpu_compiler(), strlen(cpu_compiler())) * 31;
+    for (int i = 0; i < ARRAY_LEN(s_cpu_compile_flags); i++) {
+        key = key * 0x100000001b3ULL ^ hash_bytes(s_cpu_compile_flags[i], strlen(s_cpu_compile_flags[i]));
+    }
+    key = key * 0x100000001b3ULL ^ cpu_target_hash();
+    key ^= (uint64_t)CPU_CACHE_VERSION * 0x9e3779b97f4a7c15ULL;
+
+    // Built next to the cache entry and renamed into it, so other shdy instances never load a partial object.
+    // Without a cache directory it's built in a private directory of /tmp, removed once the object is loaded, so
+    // no other user can swap the object before it's loaded.
+    char so_path[PATH_MAX];
+    char tmp_dir[] = "/tmp/shdy-cpu-XXXXXX";
+    bool has_cache = cache_file_path("cpu", key, "so", so_path);
+    if (!has_cache) {
+        if (mkdtemp(tmp_dir) == nullptr) {
+            ERRORF("Failed to create a directory in /tmp: %s.\n", strerror(errno));
+            str_buf_free(&src);
+            return nullptr;
+        }
+        snprintf(so_path, sizeof(so_path), "%s/shader.so", tmp_dir);
+    }
+    if (!has_cache || access(so_path, R_OK) != 0) {
+        char tmp_so_path[PATH_MAX + 16];
+        char tmp_src_path[PATH_MAX + 16];
+        snprintf(tmp_so_path, sizeof(tmp_so_path), "%s.%d.tmp", so_path, (int)getpid());
+        snprintf(tmp_src_path, sizeof(tmp_src_path), "%s.%d.cpp", so_path, (int)getpid());
+
+        FILE *file = fopen(tmp_src_path, "wb");
+        bool written = file != nullptr && fwrite(src.data, 1, src.len, file) == src.len;
+        if (file == nullptr || fclose(file) != 0 || !written) {
+            ERRORF("Failed to write %s: %s.\n", tmp_src_path, strerror(errno));
+            unlink(tmp_src_path);
+            if (!has_cache) {
+                rmdir(tmp_dir);
+            }
+            str_buf_free(&src);
+            return nullptr;
+        }
+
+        bool compiled = cpu_compile(tmp_src_path, tmp_so_path, out_log);
+        unlink(tmp_src_path);
+        if (!compiled || rename(tmp_so_path, so_path) != 0) {
+            unlink(tmp_so_path);
+            if (!has_cache) {
+                rmdir(tmp_dir);
+            }
+            str_buf_free(&src);
+            return nullptr;
+        }
+    }
+    str_buf_free(&src);
+
+    void *handle = dlopen(so_path, RTLD_NOW | RTLD_LOCAL);
+    if (!has_cache) {
+        unlink(so_path);
+        rmdir(tmp_dir);
+    }
+    if (handle == nullptr) {
+        ERRORF("Failed to load %s: %s.\n", so_path, dlerror());
+        return nullptr;
+    }
+
+    auto *program = (CpuProgram *)malloc(sizeof(CpuProgram));
+    if (program == nullptr) {
+        ERRORF("Failed to malloc() CPU program.\n");
+        exit(EXIT_FAILURE);
+    }
+    program->handle = handle;
+    program->bind = (CpuBindFn)dlsym(handle, "shdy_cpu_bind");
+    program->render = (CpuRenderFn)dlsym(handle, "shdy_cpu_render");
+    if (program->bind == nullptr || program->render == nullptr) {
+        ERRORF("Invalid CPU program %s, it's missing its entry points.\n", so_path);
+        cpu_program_destroy(program);
+        return nullptr;
+    }
+
+    return program;
+}
+
+void cpu_program_destroy(CpuProgram *program) {
+    dlclose(program->handle);
+    free(program);
+}
+
+bool cpu_program_set_uniform(CpuProgram *program, const char *name, const float *values, int count) {
+    return program->bind(name, (float *)values, count, false, nullptr, 0, 0);
+}
+
+bool cpu_program_get_uniform(CpuProgram *program, const char *name, float *out_values, int count) {
+    return program->bind(name, out_values, count, true, nullptr, 0, 0);
+}
+
+bool cpu_program_set_texture(CpuProgram *program, const char *name, const float *texels, int width, int height) {
+    return program->bind(name, nullptr, 0, false, texels, width, height);
+}
+
+typedef struct {
+    CpuProgram *program;
+    int width;
+    uint8_t *out_rgb;
+    float *rgba[TILE_SCHEDULER_MAX_THREADS]; // Rows of each thread, before they're packed into out_rgb.
+} CpuRender;
+
+// Converts count RGBA float pixels to RGB8 like a unorm framebuffer, rounding the clamped values to nearest.
+static void pack_rgb8(const float *rgba, int count, uint8_t *out_rgb) {
+    int i = 0;
+    for (; i + 2 <= count; i += 2) {
+        ShdyF32x8 v;
+        memcpy(&v, rgba + i * 4, sizeof(v));
+        // NaNs fail both comparisons and end up as 0.
+        v = v > 0.0f ? v : 0.0f;
+        v = v < 1.0f ? v : 1.0f;
+        ShdyI32x8 bytes = __builtin_convertvector(v * 255.0f + 0.5f, ShdyI32x8);
+        for (int j = 0; j < 3; j++) {
+            out_rgb[i * 3 + j] = (uint8_t)bytes[j];
+            out_rgb[i * 3 + 3 + j] = (uint8_t)bytes[4 + j];
+        }
+    }
+    for (; i < count; i++) {
+        for (int j = 0; j < 3; j++) {
+            float v = rgba[i * 4 + j];
+            v = v > 0.0f ? v : 0.0f;
+            v = v < 1.0f ? v : 1.0f;
+            out_rgb[i * 3 + j] = (uint8_t)(v * 255.0f + 0.5f);
+        }
+    }
+}
+
+static void cpu_render_begin(void *arg, int thread) {
+    auto *render = (CpuRender *)arg;
+    render->rgba[thread] = (float *)malloc((size_t)render->width * CPU_RENDER_BAND_ROWS * 4 * sizeof(float));
+    if (render->rgba[thread] == nullptr) {
+        ERRORF("Failed to malloc() CPU render rows.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void cpu_render_draw(void *arg, int thread, const Tile *tile) {
+    auto *render = (CpuRender *)arg;
+    render->program->render(render->width, tile->y, tile->y + tile->height, render->rgba[thread]);
+    pack_rgb8(render->rgba[thread], render->width * tile->height,
+              render->out_rgb + (size_t)tile->y * render->width * 3);
+}
+
+static void cpu_render_end(void *arg, int thread) {
+    auto *render = (CpuRender *)arg;
+    free(render->rgba[thread]);
+}
+
+void cpu_program_render(CpuProgram *program, int width, int height, int num_threads, uint8_t *out_rgb) {
+    CpuRender render = {program, width, out_rgb, {}};
+
+    // The bands span the width of the image, the generated code renders whole rows.
+    static const TileFns fns = {cpu_render_begin, cpu_render_draw, cpu_render_end};
+    TileScheduler scheduler;
+    tile_scheduler_create(&scheduler, width, height, width, CPU_RENDER_BAND_ROWS, num_threads);
+    tile_scheduler_run(&scheduler, &fns, &render);
+    tile_scheduler_report(&scheduler);
+    tile_scheduler_destroy(&scheduler);
+}
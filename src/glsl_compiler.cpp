@@ -0,0 +1,184 @@
+#include "shdy.h"
+#include <cstdlib>
+#include <cstring>
+
+#ifdef SHDY_GLSLANG
+
+#include <glslang/Include/glslang_c_interface.h>
+#include <glslang/Public/resource_limits_c.h>
+
+static pthread_once_t s_glslang_once = PTHREAD_ONCE_INIT;
+
+// glslang keeps process wide state, e.g its built-in symbol tables, which is set up once and shared by every thread.
+static void glslang_init() {
+    glslang_initialize_process();
+}
+
+bool glslang_available() {
+    return true;
+}
+
+static glslang_stage_t glslang_stage(GlslStage stage) {
+    switch (stage) {
+        case GLSL_STAGE_VERTEX:
+            return GLSLANG_STAGE_VERTEX;
+        case GLSL_STAGE_COMPUTE:
+            return GLSLANG_STAGE_COMPUTE;
+        default:
+            return GLSLANG_STAGE_FRAGMENT;
+    }
+}
+
+static glslang_input_t glslang_input(const char *src, GlslStage stage, bool spirv) {
+    glslang_input_t input = {};
+    input.language = GLSLANG_SOURCE_GLSL;
+    input.stage = glslang_stage(stage);
+    // Validating without a client checks the source as plain GLSL for OpenGL, without the rules of a SPIR-V target
+    // (e.g explicit uniform locations).
+    input.client = spirv ? GLSLANG_CLIENT_OPENGL : GLSLANG_CLIENT_NONE;
+    input.client_version = GLSLANG_TARGET_OPENGL_450;
+    input.target_language = spirv ? GLSLANG_TARGET_SPV : GLSLANG_TARGET_NONE;
+    input.target_language_version = GLSLANG_TARGET_SPV_1_0;
+    input.code = src;
+    input.default_version = 330;
+    input.default_profile = GLSLANG_CORE_PROFILE;
+    input.force_default_version_and_profile = false;
+    input.forward_compatible = false;
+    input.messages = spirv ? GLSLANG_MSG_SPV_RULES_BIT : GLSLANG_MSG_DEFAULT_BIT;
+    input.resource = glslang_default_resource();
+
+    return input;
+}
+
+bool glsl_validate(const char *src, GlslStage stage, StrBuf *out_log) {
+    pthread_once(&s_glslang_once, glslang_init);
+
+    // Only the front end runs, the sources aren't linked so the preamble prototypes needn't be defined.
+    glslang_input_t input = glslang_input(src, stage, false);
+    glslang_shader_t *shader = glslang_shader_create(&input);
+    bool valid = glslang_shader_preprocess(shader, &input) && glslang_shader_parse(shader, &input);
+    if (!valid) {
+        const char *info_log = glslang_shader_get_info_log(shader);
+        str_buf_append(out_log, info_log, strlen(info_log));
+    }
+    glslang_shader_delete(shader);
+
+    return valid;
+}
+
+bool glsl_compile_spirv(const char *src, GlslStage stage, StrBuf *out_spirv, StrBuf *out_log) {
+    pthread_once(&s_glslang_once, glslang_init);
+
+    glslang_input_t input = glslang_input(src, stage, true);
+    glslang_shader_t *shader = glslang_shader_create(&input);
+    // GL needs a location for every uniform outside a block, which GLSL 3.30 sources don't give.
+    glslang_shader_set_options(shader, GLSLANG_SHADER_AUTO_MAP_LOCATIONS | GLSLANG_SHADER_AUTO_MAP_BINDINGS);
+    if (!glslang_shader_preprocess(shader, &input) || !glslang_shader_parse(shader, &input)) {
+        const char *info_log = glslang_shader_get_info_log(shader);
+        str_buf_append(out_log, info_log, strlen(info_log));
+        glslang_shader_delete(shader);
+        return false;
+    }
+
+    glslang_program_t *program = glslang_program_create();
+    glslang_program_add_shader(program, shader);
+    bool linked = glslang_program_link(program, input.messages) && glslang_program_map_io(program);
+    if (linked) {
+        glslang_program_SPIRV_generate(program, input.stage);
+        size_t size = glslang_program_SPIRV_get_size(program) * sizeof(unsigned int);
+        str_buf_reserve(out_spirv, size);
+        glslang_program_SPIRV_get(program, (unsigned int *)(out_spirv->data + out_spirv->len));
+        out_spirv->len += size;
+        out_spirv->data[out_spirv->len] = '\0';
+    } else {
+        const char *info_log = glslang_program_get_info_log(program);
+        str_buf_append(out_log, info_log, strlen(info_log));
+    }
+    glslang_program_delete(program);
+    glslang_shader_delete(shader);
+
+    return linked;
+}
+
+#else
+
+bool glslang_available() {
+    return false;
+}
+
+bool glsl_validate(const char *, GlslStage, StrBuf *) {
+    return true;
+}
+
+bool glsl_compile_spirv(const char *, GlslStage, StrBuf *, StrBuf *out_log) {
+    str_buf_appendf(out_log, "error: shdy is built without glslang, build it with GLSLANG=1 for SPIR-V.\n");
+
+    return false;
+}
+
+#endif
+
+struct GlslValidation {
+    AsyncJob job;
+    StrBuf src;
+    GlslStage stage;
+    bool valid; // Written by the validation thread before the job is done, like log.
+    StrBuf log;
+};
+
+static AsyncQueue s_validation_queue = ASYNC_QUEUE_INIT;
+
+int glsl_validation_event_fd() {
+    return async_queue_event_fd(&s_validation_queue);
+}
+
+void glsl_validation_clear_events(bool wait) {
+    async_queue_clear_events(&s_validation_queue, wait);
+}
+
+static void glsl_validation_free(AsyncJob *job) {
+    auto *validation = (GlslValidation *)job;
+    str_buf_free(&validation->src);
+    str_buf_free(&validation->log);
+    free(validation);
+}
+
+static void glsl_validation_run(AsyncJob *job) {
+    auto *validation = (GlslValidation *)job;
+    validation->valid = glsl_validate(validation->src.data, validation->stage, &validation->log);
+}
+
+GlslValidation *glsl_validation_start(const char *src, size_t len, GlslStage stage) {
+    auto *validation = (GlslValidation *)calloc(1, sizeof(GlslValidation));
+    if (validation == nullptr) {
+        ERRORF("Failed to calloc() a validation.\n");
+        return nullptr;
+    }
+    str_buf_append(&validation->src, src, len);
+    validation->stage = stage;
+
+    if (!async_job_start(&s_validation_queue, &validation->job, glsl_validation_run, glsl_validation_free)) {
+        glsl_validation_free(&validation->job);
+        return nullptr;
+    }
+
+    return validation;
+}
+
+bool glsl_validation_done(const GlslValidation *validation) {
+    return async_job_done(&validation->job);
+}
+
+bool glsl_validation_finish(GlslValidation *validation, StrBuf *out_log) {
+    bool valid = validation->valid;
+    if (!valid && validation->log.data != nullptr) {
+        str_buf_append(out_log, validation->log.data, validation->log.len);
+    }
+    glsl_validation_free(&validation->job);
+
+    return valid;
+}
+
+void glsl_validation_cancel(GlslValidation *validation) {
+    async_job_cancel(&validation->job);
+}
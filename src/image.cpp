@@ -0,0 +1,339 @@
+#include "shdy.h"
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <csetjmp>
+#include <cerrno>
+#include <png.h>
+#include <jpeglib.h>
+
+static bool image_alloc(Image *image, int width, int height, ImageFormat format) {
+    image->width = width;
+    image->height = height;
+    image->format = format;
+    image->pixels = malloc(image_row_size(image) * height);
+    if (image->pixels == nullptr) {
+        ERRORF("Failed to malloc() %dx%d image.\n", width, height);
+        return false;
+    }
+
+    return true;
+}
+
+static bool load_png(Image *image, const FileView *view, const char *path) {
+    png_image png = {};
+    png.version = PNG_IMAGE_VERSION;
+    if (!png_image_begin_read_from_memory(&png, view->data, view->len)) {
+        ERRORF("Failed to read PNG %s: %s.\n", path, png.message);
+        return false;
+    }
+
+    png.format = PNG_FORMAT_RGBA;
+    if (!image_alloc(image, (int)png.width, (int)png.height, IMAGE_RGBA8)) {
+        png_image_free(&png);
+        return false;
+    }
+
+    // A negative stride writes the rows bottom up.
+    if (!png_image_finish_read(&png, nullptr, image->pixels, -(png_int_32)image_row_size(image), nullptr)) {
+        ERRORF("Failed to decode PNG %s: %s.\n", path, png.message);
+        image_free(image);
+        return false;
+    }
+
+    return true;
+}
+
+typedef struct {
+    struct jpeg_error_mgr mgr;
+    jmp_buf jmp;
+} JpegError;
+
+static void jpeg_error_exit(j_common_ptr cinfo) {
+    char msg[JMSG_LENGTH_MAX];
+    (*cinfo->err->format_message)(cinfo, msg);
+    ERRORF("Failed to decode JPEG: %s.\n", msg);
+    longjmp(((JpegError *)cinfo->err)->jmp, 1);
+}
+
+static bool load_jpeg(Image *image, const FileView *view) {
+    struct jpeg_decompress_struct cinfo;
+    JpegError err;
+    cinfo.err = jpeg_std_error(&err.mgr);
+    err.mgr.error_exit = jpeg_error_exit;
+
+    image->pixels = nullptr;
+    if (setjmp(err.jmp)) {
+        jpeg_destroy_decompress(&cinfo);
+        image_free(image);
+        return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, (unsigned char *)view->data, view->len);
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.out_color_space = JCS_EXT_RGBA;
+    jpeg_start_decompress(&cinfo);
+
+    if (!image_alloc(image, (int)cinfo.output_width, (int)cinfo.output_height, IMAGE_RGBA8)) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    size_t row_size = image_row_size(image);
+    while (cinfo.output_scanline < cinfo.output_height) {
+        JSAMPROW row = (JSAMPROW)image->pixels + (image->height - 1 - (int)cinfo.output_scanline) * row_size;
+        jpeg_read_scanlines(&cinfo, &row, 1);
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+
+    return true;
+}
+
+// Reads one RGBE scanline at *cursor, either flat or in the run length encoding of newer Radiance files.
+static bool read_hdr_scanline(const uint8_t **cursor, const uint8_t *end, uint8_t *rgbe, int width) {
+    const uint8_t *str = *cursor;
+    if (end - str < 4) {
+        return false;
+    }
+
+    bool encoded = width >= 8 && width < 0x8000 && str[0] == 2 && str[1] == 2 && (str[2] << 8 | str[3]) == width;
+    if (!encoded) {
+        if ((size_t)(end - str) < (size_t)width * 4) {
+            return false;
+        }
+        memcpy(rgbe, str, width * 4);
+        *cursor = str + width * 4;
+        return true;
+    }
+    str += 4;
+
+    // Each channel of the scanline is encoded separately as runs and literals.
+    for (int channel = 0; channel < 4; channel++) {
+        for (int x = 0; x < width;) {
+            if (str == end) {
+                return false;
+            }
+            int count = *str++;
+            bool run = count > 128;
+            if (run) {
+                count -= 128;
+            }
+            if (count == 0 || x + count > width || end - str < (run ? 1 : count)) {
+                return false;
+            }
+            for (int i = 0; i < count; i++) {
+                rgbe[(x++) * 4 + channel] = run ? *str : str[i];
+            }
+            str += run ? 1 : count;
+        }
+    }
+
+    *cursor = str;
+    return true;
+}
+
+// Returns the line at *cursor without its newline and moves past it, or returns false at the end of the data.
+static bool read_hdr_line(const uint8_t **cursor, const uint8_t *end, char *out, size_t out_size) {
+    const uint8_t *str = *cursor;
+    if (str == end) {
+        return false;
+    }
+    const auto *newline = (const uint8_t *)memchr(str, '\n', end - str);
+    const uint8_t *line_end = newline != nullptr ? newline : end;
+    snprintf(out, out_size, "%.*s", (int)(line_end - str), (const char *)str);
+    *cursor = newline != nullptr ? newline + 1 : end;
+
+    return true;
+}
+
+static bool load_hdr(Image *image, const FileView *view, const char *path) {
+    const auto *str = (const uint8_t *)view->data;
+    const uint8_t *end = str + view->len;
+
+    // The header is a list of lines ended by a blank one, followed by the resolution, e.g "-Y 512 +X 768".
+    char line[256];
+    bool rgbe = false;
+    while (read_hdr_line(&str, end, line, sizeof(line)) && line[0] != '\0') {
+        rgbe = rgbe || strcmp(line, "FORMAT=32-bit_rle_rgbe") == 0;
+    }
+    int width, height;
+    if (!rgbe || !read_hdr_line(&str, end, line, sizeof(line)) || sscanf(line, "-Y %d +X %d", &height, &width) != 2 ||
+        width <= 0 || height <= 0) {
+        ERRORF("Unsupported HDR %s, expected a 32-bit_rle_rgbe image stored top down.\n", path);
+        return false;
+    }
+
+    auto *rgbe_row = (uint8_t *)malloc(width * 4);
+    if (rgbe_row == nullptr || !image_alloc(image, width, height, IMAGE_RGBA32F)) {
+        free(rgbe_row);
+        return false;
+    }
+
+    for (int y = 0; y < height; y++) {
+        if (!read_hdr_scanline(&str, end, rgbe_row, width)) {
+            ERRORF("Failed to decode HDR %s, scanline %d is truncated or malformed.\n", path, y);
+            free(rgbe_row);
+            image_free(image);
+            return false;
+        }
+
+        float *out = (float *)image->pixels + (size_t)(height - 1 - y) * width * 4;
+        for (int x = 0; x < width; x++) {
+            const uint8_t *texel = rgbe_row + x * 4;
+            float scale = texel[3] == 0 ? 0.0f : ldexpf(1.0f, texel[3] - (128 + 8));
+            out[x * 4] = texel[0] * scale;
+            out[x * 4 + 1] = texel[1] * scale;
+            out[x * 4 + 2] = texel[2] * scale;
+            out[x * 4 + 3] = 1.0f;
+        }
+    }
+
+    free(rgbe_row);
+
+    return true;
+}
+
+bool image_load(Image *image, const char *path) {
+    image->pixels = nullptr;
+
+    // Decoded straight from the mapped file, large scans aren't copied before decoding.
+    FileView view = {};
+    if (!file_view_open(&view, path)) {
+        file_view_free(&view);
+        return false;
+    }
+
+    const auto *magic = (const uint8_t *)view.data;
+    bool ok;
+    if (view.len >= 8 && png_sig_cmp(magic, 0, 8) == 0) {
+        ok = load_png(image, &view, path);
+    } else if (view.len >= 3 && magic[0] == 0xff && magic[1] == 0xd8 && magic[2] == 0xff) {
+        ok = load_jpeg(image, &view);
+    } else if (view.len >= 2 && magic[0] == '#' && magic[1] == '?') {
+        ok = load_hdr(image, &view, path);
+    } else {
+        ERRORF("Unsupported image %s, expected a PNG, JPEG or Radiance HDR file.\n", path);
+        ok = false;
+    }
+    if (ok && view.truncated) {
+        ERRORF("Image %s was truncated while decoding it.\n", path);
+        image_free(image);
+        ok = false;
+    }
+
+    file_view_free(&view);
+
+    return ok;
+}
+
+void image_free(Image *image) {
+    free(image->pixels);
+    image->pixels = nullptr;
+}
+
+size_t image_row_size(const Image *image) {
+    return (size_t)image->width * (image->format == IMAGE_RGBA32F ? 4 * sizeof(float) : 4);
+}
+
+struct PngWriter {
+    png_structp png;
+    png_infop info;
+    FILE *file;
+    int width;
+};
+
+static void png_writer_error(png_structp png, png_const_charp msg) {
+    ERRORF("Failed to encode PNG: %s.\n", msg);
+    png_longjmp(png, 1);
+}
+
+static void png_writer_free(PngWriter *writer) {
+    png_destroy_write_struct(&writer->png, &writer->info);
+    if (writer->file != nullptr) {
+        fclose(writer->file);
+    }
+    free(writer);
+}
+
+// Kept out of png_writer_open() like png_writer_end(), so nothing it changes after setjmp() is read after a longjmp().
+static bool png_writer_write_info(PngWriter *writer, int height) {
+    if (setjmp(png_jmpbuf(writer->png))) {
+        return false;
+    }
+
+    png_init_io(writer->png, writer->file);
+    png_set_IHDR(writer->png, writer->info, (png_uint_32)writer->width, (png_uint_32)height, 8, PNG_COLOR_TYPE_RGB,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(writer->png, writer->info);
+    return true;
+}
+
+PngWriter *png_writer_open(const char *path, int width, int height) {
+    auto *writer = (PngWriter *)calloc(1, sizeof(PngWriter));
+    if (writer == nullptr) {
+        ERRORF("Failed to calloc() PNG writer.\n");
+        return nullptr;
+    }
+    writer->width = width;
+
+    writer->file = fopen(path, "wb");
+    if (writer->file == nullptr) {
+        ERRORF("Failed to open %s for writing: %s.\n", path, strerror(errno));
+        free(writer);
+        return nullptr;
+    }
+
+    writer->png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, png_writer_error, nullptr);
+    writer->info = writer->png != nullptr ? png_create_info_struct(writer->png) : nullptr;
+    if (writer->info == nullptr) {
+        ERRORF("Failed to create the PNG writer of %s.\n", path);
+        png_writer_free(writer);
+        return nullptr;
+    }
+    if (!png_writer_write_info(writer, height)) {
+        png_writer_free(writer);
+        return nullptr;
+    }
+
+    return writer;
+}
+
+bool png_writer_write_rows(PngWriter *writer, const uint8_t *rgb, int num_rows) {
+    if (setjmp(png_jmpbuf(writer->png))) {
+        return false;
+    }
+
+    for (int i = 0; i < num_rows; i++) {
+        png_write_row(writer->png, rgb + (size_t)i * writer->width * 3);
+    }
+
+    return true;
+}
+
+static bool png_writer_end(PngWriter *writer) {
+    if (setjmp(png_jmpbuf(writer->png))) {
+        return false;
+    }
+
+    png_write_end(writer->png, nullptr);
+    return true;
+}
+
+bool png_writer_close(PngWriter *writer) {
+    bool ok = png_writer_end(writer);
+    if (fclose(writer->file) != 0) {
+        ERRORF("Failed to close the PNG file: %s.\n", strerror(errno));
+        ok = false;
+    }
+    writer->file = nullptr;
+    png_writer_free(writer);
+
+    return ok;
+}
+
+void png_writer_discard(PngWriter *writer) {
+    png_writer_free(writer);
+}
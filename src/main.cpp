@@ -4,13 +4,42 @@
 
 #include "shdy.h"
 #include <cstdlib>
+#include <cstring>
+#include <unistd.h>
 
 static Window s_window;
 static FileWatcher s_file_watcher;
+static EventLoop s_event_loop;
+// Set once the file watcher and the event loop are created, prints and servers never create them.
+static bool s_event_loop_created = false;
+static ParamsInput s_params_input;
+
+static void watch_shader_deps(ShaderRenderer *shader_renderer, Shader *shader) {
+    for (int i = 0; i < shader->num_deps; i++) {
+        file_watcher_add(&s_file_watcher, shader_renderer->source_cache.files[shader->deps[i]].path);
+    }
+}
+
+static void watch_shader_sources(ShaderRenderer *shader_renderer) {
+    watch_shader_deps(shader_renderer, &shader_renderer->shader);
+    for (int i = 0; i < SHADER_MAX_BUFFERS; i++) {
+        if (shader_renderer->buffers[i].active) {
+            watch_shader_deps(shader_renderer, &shader_renderer->buffers[i].shader);
+        }
+    }
+    for (int i = 0; i < SHADER_MAX_TEXTURES; i++) {
+        if (shader_renderer->textures[i].active) {
+            file_watcher_add(&s_file_watcher, shader_renderer->textures[i].decl.path);
+        }
+    }
+}
 
 void exit_callback() {
     window_destroy(&s_window);
-    file_watcher_destroy(&s_file_watcher);
+    if (s_event_loop_created) {
+        event_loop_destroy(&s_event_loop);
+        file_watcher_destroy(&s_file_watcher);
+    }
 }
 
 int main(int argc, char **argv) {
@@ -21,6 +50,84 @@ int main(int argc, char **argv) {
 
     bool print_mode = cli_opts.print_size != PRINTING_DISABLED;
 
+    if (cli_opts.server_path != nullptr) {
+        if (print_mode || cli_opts.benchmark || cli_opts.check || cli_opts.cpu || cli_opts.workers > 0 ||
+            cli_opts.connect_path != nullptr) {
+            ERRORF("--server only serves render requests, use it without --print-size, --benchmark, --check, "
+                   "--cpu, --workers or --connect.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        // The socket is bound before the context is created, so the driver's threads don't take the signals.
+        static Server server;
+        server_create(&server, cli_opts.server_path, cli_opts.server_jobs, cli_opts.server_queue, cli_opts.textures,
+                      cli_opts.num_textures, cli_opts.spirv);
+        window_create(&s_window, "shdy: server", cli_opts.win_width, cli_opts.win_height, false, true);
+        server_run(&server);
+        server_destroy(&server);
+        return EXIT_SUCCESS;
+    }
+
+    if (cli_opts.connect_path != nullptr) {
+        if (!print_mode || cli_opts.benchmark || cli_opts.check || cli_opts.cpu || cli_opts.workers > 0) {
+            ERRORF("--connect only renders prints, use it with --print-size and without --benchmark, --check, "
+                   "--cpu or --workers.\n");
+            exit(EXIT_FAILURE);
+        }
+
+        int print_w, print_h;
+        print_size_get_dimensions(cli_opts.print_size, &print_w, &print_h);
+        bool ok = server_request(cli_opts.connect_path, cli_opts.frag_shader_path, print_w, print_h,
+                                 cli_opts.defines, cli_opts.num_defines, cli_opts.output_image_path);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    // With glslang, broken shaders fail prints and benchmarks before any context or print-size target is created.
+    if (cli_opts.check && !glslang_available()) {
+        ERRORF("--check needs shdy to be built with glslang, e.g make GLSLANG=1.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (cli_opts.check || ((print_mode || cli_opts.benchmark) && glslang_available())) {
+        if (!shader_renderer_check(cli_opts.frag_shader_path, cli_opts.defines, cli_opts.num_defines,
+                                   cli_opts.diagnostics_path)) {
+            exit(EXIT_FAILURE);
+        }
+        if (cli_opts.check) {
+            return EXIT_SUCCESS;
+        }
+    }
+
+    if (cli_opts.cpu && (!print_mode || cli_opts.benchmark)) {
+        ERRORF("--cpu only renders prints, use it with --print-size.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bool params_stdin = cli_opts.params_path != nullptr && strcmp(cli_opts.params_path, "-") == 0;
+    if (cli_opts.workers > 0 && (!print_mode || cli_opts.benchmark || cli_opts.cpu || params_stdin)) {
+        ERRORF("--workers only renders GL prints, use it with --print-size and without --cpu or --params -.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // The coordinator of a print drawn by worker processes never creates a context, each worker creates its own and
+    // goes on like a print in a single process until it's time to draw.
+    int worker_fd = -1;
+    if (cli_opts.workers > 0) {
+        static PrintWorkers print_workers;
+        worker_fd = print_workers_fork(&print_workers, cli_opts.workers);
+        if (worker_fd == -1) {
+            int print_w, print_h;
+            print_size_get_dimensions(cli_opts.print_size, &print_w, &print_h);
+            bool ok = print_workers_render(&print_workers, print_w, print_h, cli_opts.output_image_path);
+            return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    if (cli_opts.benchmark) {
+        // Compile timings are meaningless if the driver answers from its on-disk shader cache.
+        setenv("MESA_SHADER_CACHE_DISABLE", "true", 0);
+        setenv("__GL_SHADER_DISK_CACHE", "0", 0);
+    }
+
     char *abs_path = realpath(cli_opts.frag_shader_path, nullptr);
     const char *title_fmt = "shdy: %s";
     int buf_size = snprintf(nullptr, 0, title_fmt, abs_path);
@@ -28,33 +135,128 @@ int main(int argc, char **argv) {
     snprintf(title, buf_size + 1, title_fmt, abs_path);
     free(abs_path);
 
-    window_create(&s_window, title, cli_opts.win_width, cli_opts.win_height, cli_opts.fullscreen, print_mode);
+    // CPU prints don't need a context, so they also work without a display or GPU.
+    static ShaderRenderer shader_renderer;
+    if (cli_opts.cpu) {
+        shader_renderer_create_cpu(&shader_renderer, cli_opts.frag_shader_path, cli_opts.defines,
+                                   cli_opts.num_defines, cli_opts.textures, cli_opts.num_textures);
+    } else {
+        window_create(&s_window, title, cli_opts.win_width, cli_opts.win_height, cli_opts.fullscreen,
+                      print_mode || cli_opts.benchmark);
+        shader_renderer_create(&shader_renderer, cli_opts.frag_shader_path, cli_opts.defines, cli_opts.num_defines,
+                               cli_opts.textures, cli_opts.num_textures, cli_opts.spirv);
+    }
+    if (cli_opts.diagnostics_path != nullptr) {
+        shader_renderer_write_diagnostics(&shader_renderer, cli_opts.diagnostics_path);
+    }
+
+    char params_path[PATH_MAX];
+    if (cli_opts.params_path != nullptr) {
+        snprintf(params_path, sizeof(params_path), "%s", cli_opts.params_path);
+    } else {
+        params_sidecar_path(cli_opts.frag_shader_path, params_path);
+    }
 
-    ShaderRenderer shader_renderer;
-    shader_renderer_create(&shader_renderer, cli_opts.frag_shader_path);
+    if (params_stdin) {
+        params_input_create(&s_params_input, STDIN_FILENO);
+    } else {
+        shader_renderer_load_params_file(&shader_renderer, params_path);
+    }
 
-    if (print_mode) {
+    // Prints and benchmarks take every param piped in before drawing, the live loop applies them as they arrive.
+    if (params_stdin && (print_mode || cli_opts.benchmark)) {
+        while (!s_params_input.eof) {
+            params_input_read(&s_params_input, &shader_renderer);
+        }
+    }
+
+    if (cli_opts.benchmark) {
+        if (!benchmark_run(&shader_renderer)) {
+            exit(EXIT_FAILURE);
+        }
+    } else if (print_mode) {
         int print_w, print_h;
         print_size_get_dimensions(cli_opts.print_size, &print_w, &print_h);
 
         shader_renderer.width = print_w;
         shader_renderer.height = print_h;
+        shader_renderer.print_threads = cli_opts.tile_threads;
 
-        shader_renderer_draw_to_print(&shader_renderer, cli_opts.output_image_path);
+        if (worker_fd != -1) {
+            print_worker_serve(&shader_renderer, worker_fd);
+        } else {
+            shader_renderer_draw_to_print(&shader_renderer, cli_opts.output_image_path);
+        }
     } else {
-        file_watcher_create(&s_file_watcher, cli_opts.frag_shader_path);
+        file_watcher_create(&s_file_watcher);
+        file_watcher_add(&s_file_watcher, cli_opts.frag_shader_path);
+        watch_shader_sources(&shader_renderer);
+        int params_file = params_stdin ? -1 : file_watcher_add(&s_file_watcher, params_path);
+        event_loop_create(&s_event_loop, &s_file_watcher, params_stdin ? STDIN_FILENO : -1);
+        event_loop_add_fd(&s_event_loop, texture_load_event_fd(), EVENT_TEXTURE);
+        event_loop_add_fd(&s_event_loop, glsl_validation_event_fd(), EVENT_VALIDATE);
+        s_event_loop_created = true;
+
+        long frame_interval_ns = 1000000000L / window_refresh_rate(&s_window);
 
+        bool redraw = true;
         while (window_is_open(&s_window)) {
-            shader_renderer.width = s_window.fb_width;
-            shader_renderer.height = s_window.fb_height;
+            // Decoded textures are uploaded a part per frame, finished ones replace the previous image.
+            redraw = shader_renderer_update_textures(&shader_renderer, false) || redraw;
+            bool time_varying = shader_renderer_time_varying(&shader_renderer);
+            bool loading = shader_renderer_loading_textures(&shader_renderer);
 
-            shader_renderer_draw(&shader_renderer, get_elapsed_time());
+            if (redraw || time_varying || s_window.dirty) {
+                shader_renderer.width = s_window.fb_width;
+                shader_renderer.height = s_window.fb_height;
+                memcpy(shader_renderer.mouse, s_window.mouse, sizeof(shader_renderer.mouse));
 
-            window_update(&s_window);
+                shader_renderer_draw(&shader_renderer, get_elapsed_time());
 
-            file_watcher_poll(&s_file_watcher);
-            if (s_file_watcher.modified) {
-                shader_renderer_reload(&shader_renderer);
+                window_present(&s_window);
+                redraw = false;
+            }
+
+            // Animated shaders and texture uploads are paced by the frame timer, static shaders disarm it and only
+            // wake up for input, a resize, a file change or a decoded texture.
+            event_loop_set_frame_interval(&s_event_loop, time_varying || loading ? frame_interval_ns : 0);
+
+            unsigned int events = event_loop_wait(&s_event_loop, &s_window);
+            if (events & EVENT_INPUT) {
+                // Params only change uniform values, so they apply on the next frame without a compile.
+                redraw = params_input_read(&s_params_input, &shader_renderer) || redraw;
+                if (s_params_input.eof) {
+                    event_loop_remove_input(&s_event_loop);
+                }
+            }
+            if (events & EVENT_FILE) {
+                file_watcher_read(&s_file_watcher);
+            }
+            bool params_changed = false;
+            if (events & EVENT_FILE_SETTLED) {
+                file_watcher_flush(&s_file_watcher);
+                for (int i = 0; i < s_file_watcher.num_files; i++) {
+                    if (s_file_watcher.files[i].changed) {
+                        shader_renderer_invalidate(&shader_renderer, s_file_watcher.files[i].path);
+                    }
+                }
+                params_changed = params_file >= 0 && s_file_watcher.files[params_file].changed;
+                file_watcher_clear(&s_file_watcher);
+            }
+            // glslang validates the changed sources off this thread, their programs are built once it's done so
+            // the window keeps drawing the previous ones meanwhile.
+            if ((events & (EVENT_FILE_SETTLED | EVENT_VALIDATE)) && shader_renderer_reload(&shader_renderer, false)) {
+                if (cli_opts.diagnostics_path != nullptr) {
+                    shader_renderer_write_diagnostics(&shader_renderer, cli_opts.diagnostics_path);
+                }
+                watch_shader_sources(&shader_renderer);
+                redraw = true;
+                // Recompiled shaders keep their param values, but params they didn't declare before still have to
+                // be picked up from the file.
+                params_changed = params_file >= 0;
+            }
+            if (params_changed) {
+                redraw = shader_renderer_load_params_file(&shader_renderer, params_path) || redraw;
             }
         }
     }
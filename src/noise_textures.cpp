@@ -0,0 +1,156 @@
+#include "shdy.h"
+#include "shdy_math.h"
+#include <cstdlib>
+#include <cmath>
+#include <thread>
+#include <vector>
+#include <glad/glad.h>
+
+static_assert(NOISE_TEXTURE_SIZE / NOISE_TEXTURE_CELLS == 8,
+              "Gradient and Worley noise are generated 8 texels (one cell) at a time.");
+
+static unsigned int s_noise_texture = 0;
+
+// Same PCG hash as shdyPcg2d in the preamble.
+static void pcg2d(uint32_t *x, uint32_t *y) {
+    uint32_t vx = *x * 1664525u + 1013904223u;
+    uint32_t vy = *y * 1664525u + 1013904223u;
+    vx += vy * 1664525u;
+    vy += vx * 1664525u;
+    vx ^= vx >> 16u;
+    vy ^= vy >> 16u;
+    vx += vy * 1664525u;
+    vy += vx * 1664525u;
+    vx ^= vx >> 16u;
+    vy ^= vy >> 16u;
+    *x = vx;
+    *y = vy;
+}
+
+static float uint_to_unit(uint32_t v) {
+    return (float)(v >> 8u) * (1.0f / 16777216.0f);
+}
+
+// Returns a random 2d vector in [0..1) for the lattice point, wrapped so the noise tiles.
+static void lattice_random(int x, int y, int period, float *out_x, float *out_y) {
+    uint32_t hx = (uint32_t)((x % period + period) % period);
+    uint32_t hy = (uint32_t)((y % period + period) % period);
+    pcg2d(&hx, &hy);
+    *out_x = uint_to_unit(hx);
+    *out_y = uint_to_unit(hy);
+}
+
+// Fills one cell wide run of 8 texels of the gradient (G) and Worley (B, A) channels.
+static void generate_cell_run(float *out_rgba, int tex_x, int tex_y) {
+    const int texels_per_cell = NOISE_TEXTURE_SIZE / NOISE_TEXTURE_CELLS;
+    const int period = NOISE_TEXTURE_CELLS;
+
+    int cell_x = tex_x / texels_per_cell;
+    int cell_y = tex_y / texels_per_cell;
+
+    // Texel centers relative to the cell origin, in cell units.
+    const ShdyI32x8 lane = {0, 1, 2, 3, 4, 5, 6, 7};
+    ShdyF32x8 fx = (__builtin_convertvector(lane, ShdyF32x8) + 0.5f) / (float)texels_per_cell;
+    float fy = ((float)(tex_y - cell_y * texels_per_cell) + 0.5f) / (float)texels_per_cell;
+
+    // Gradient noise, the same construction as shdyGradNoise2d.
+    ShdyF32x8 ux = fx * fx * fx * (fx * (fx * 6.0f - 15.0f) + 10.0f);
+    float uy = fy * fy * fy * (fy * (fy * 6.0f - 15.0f) + 10.0f);
+
+    ShdyF32x8 corners[4];
+    for (int i = 0; i < 4; i++) {
+        int ox = i & 1;
+        int oy = i >> 1;
+        float gx, gy;
+        lattice_random(cell_x + ox, cell_y + oy, period, &gx, &gy);
+        gx = gx * 2.0f - 1.0f;
+        gy = gy * 2.0f - 1.0f;
+        corners[i] = gx * (fx - (float)ox) + gy * (fy - (float)oy);
+    }
+    ShdyF32x8 bottom = corners[0] + (corners[1] - corners[0]) * ux;
+    ShdyF32x8 top = corners[2] + (corners[3] - corners[2]) * ux;
+    ShdyF32x8 grad = 1.2f * (bottom + (top - bottom) * uy);
+
+    // Worley noise, the distances to the closest (F1) and second closest (F2) feature points, one per cell.
+    ShdyF32x8 f1 = {8.0f, 8.0f, 8.0f, 8.0f, 8.0f, 8.0f, 8.0f, 8.0f};
+    ShdyF32x8 f2 = f1;
+    for (int ny = -1; ny <= 1; ny++) {
+        for (int nx = -1; nx <= 1; nx++) {
+            float px, py;
+            lattice_random(cell_x + nx, cell_y + ny, period, &px, &py);
+            ShdyF32x8 dx = (float)nx + px - fx;
+            float dy = (float)ny + py - fy;
+            ShdyF32x8 d = dx * dx + dy * dy;
+            ShdyF32x8 f1_or_d = f1 > d ? f1 : d;
+            f2 = f2 < f1_or_d ? f2 : f1_or_d;
+            f1 = f1 < d ? f1 : d;
+        }
+    }
+
+    float *texel = out_rgba + 4 * (tex_y * NOISE_TEXTURE_SIZE + tex_x);
+    for (int i = 0; i < 8; i++) {
+        texel[4 * i + 1] = grad[i];
+        texel[4 * i + 2] = sqrtf(f1[i]);
+        texel[4 * i + 3] = sqrtf(f2[i]);
+    }
+}
+
+static void generate_rows(float *out_rgba, int row_begin, int row_end) {
+    for (int y = row_begin; y < row_end; y++) {
+        // Value noise lattice, one random value per texel, interpolated by the sampler.
+        for (int x = 0; x < NOISE_TEXTURE_SIZE; x++) {
+            float r, unused;
+            lattice_random(x, y, NOISE_TEXTURE_SIZE, &r, &unused);
+            out_rgba[4 * (y * NOISE_TEXTURE_SIZE + x)] = r;
+        }
+
+        for (int x = 0; x < NOISE_TEXTURE_SIZE; x += 8) {
+            generate_cell_run(out_rgba, x, y);
+        }
+    }
+}
+
+void noise_texture_generate(float *out_rgba) {
+    int num_threads = (int)std::thread::hardware_concurrency();
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+
+    std::vector<std::thread> threads;
+    int rows_per_thread = (NOISE_TEXTURE_SIZE + num_threads - 1) / num_threads;
+    for (int row = 0; row < NOISE_TEXTURE_SIZE; row += rows_per_thread) {
+        int row_end = row + rows_per_thread < NOISE_TEXTURE_SIZE ? row + rows_per_thread : NOISE_TEXTURE_SIZE;
+        threads.emplace_back(generate_rows, out_rgba, row, row_end);
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+unsigned int noise_texture_get() {
+    if (s_noise_texture != 0) {
+        return s_noise_texture;
+    }
+
+    double start = get_time_ms();
+
+    auto *rgba = (float *)malloc(sizeof(float) * 4 * NOISE_TEXTURE_SIZE * NOISE_TEXTURE_SIZE);
+    if (rgba == nullptr) {
+        ERRORF("Failed to malloc() noise texture.\n");
+        exit(EXIT_FAILURE);
+    }
+    noise_texture_generate(rgba);
+
+    glGenTextures(1, &s_noise_texture);
+    glBindTexture(GL_TEXTURE_2D, s_noise_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, NOISE_TEXTURE_SIZE, NOISE_TEXTURE_SIZE, 0, GL_RGBA, GL_FLOAT, rgba);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    free(rgba);
+
+    INFOF("Generated noise textures in %.2fms.\n", get_time_ms() - start);
+
+    return s_noise_texture;
+}
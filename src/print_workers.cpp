@@ -0,0 +1,329 @@
+#include "shdy.h"
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+int print_workers_fork(PrintWorkers *print_workers, int num_workers) {
+    // Anything still buffered would otherwise be printed again by every worker.
+    fflush(stdout);
+    fflush(stderr);
+
+    print_workers->num_workers = 0;
+    for (int i = 0; i < num_workers; i++) {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+            ERRORF("Failure in call to socketpair(): %s.\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            ERRORF("Failure in call to fork(): %s.\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+        if (pid == 0) {
+            for (int j = 0; j < print_workers->num_workers; j++) {
+                close(print_workers->workers[j].fd);
+            }
+            close(fds[0]);
+            return fds[1];
+        }
+
+        close(fds[1]);
+        PrintWorker *worker = &print_workers->workers[print_workers->num_workers++];
+        worker->pid = pid;
+        worker->fd = fds[0];
+        worker->num_tiles = 0;
+        worker->num_drawn = 0;
+    }
+
+    return -1;
+}
+
+// The print is assembled in bands of PRINT_TILE_SIZE rows from the top, each band is written out and freed once all
+// of its tiles are back.
+typedef struct {
+    int width;
+    int height;
+    int cols;
+    int num_bands;
+    Tile *tiles; // Band by band from the top, left to right.
+    int num_tiles;
+    bool *sent; // To a worker that is still running, or already returned.
+    int next_tile; // No tile before it is waiting to be sent.
+    uint8_t **bands; // Rows top down, allocated when the first tile of the band is back.
+    int *band_tiles_left;
+    int next_band; // Bands before it are written.
+    PngWriter *png;
+} PrintAssembly;
+
+static void print_assembly_create(PrintAssembly *assembly, int width, int height) {
+    assembly->width = width;
+    assembly->height = height;
+    assembly->cols = (width + PRINT_TILE_SIZE - 1) / PRINT_TILE_SIZE;
+    assembly->num_bands = (height + PRINT_TILE_SIZE - 1) / PRINT_TILE_SIZE;
+    assembly->num_tiles = assembly->cols * assembly->num_bands;
+    assembly->tiles = (Tile *)malloc(assembly->num_tiles * sizeof(Tile));
+    assembly->sent = (bool *)calloc(assembly->num_tiles, sizeof(bool));
+    assembly->bands = (uint8_t **)calloc(assembly->num_bands, sizeof(uint8_t *));
+    assembly->band_tiles_left = (int *)malloc(assembly->num_bands * sizeof(int));
+    if (assembly->tiles == nullptr || assembly->sent == nullptr || assembly->bands == nullptr ||
+        assembly->band_tiles_left == nullptr) {
+        ERRORF("Failed to allocate the print tiles.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int band = 0; band < assembly->num_bands; band++) {
+        int top = band * PRINT_TILE_SIZE;
+        int rows = top + PRINT_TILE_SIZE < height ? PRINT_TILE_SIZE : height - top;
+        for (int col = 0; col < assembly->cols; col++) {
+            Tile *tile = &assembly->tiles[band * assembly->cols + col];
+            tile->x = col * PRINT_TILE_SIZE;
+            tile->y = height - top - rows;
+            tile->width = tile->x + PRINT_TILE_SIZE < width ? PRINT_TILE_SIZE : width - tile->x;
+            tile->height = rows;
+        }
+        assembly->band_tiles_left[band] = assembly->cols;
+    }
+    assembly->next_tile = 0;
+    assembly->next_band = 0;
+    assembly->png = nullptr;
+}
+
+static void print_assembly_destroy(PrintAssembly *assembly) {
+    for (int i = 0; i < assembly->num_bands; i++) {
+        free(assembly->bands[i]);
+    }
+    free(assembly->band_tiles_left);
+    free(assembly->bands);
+    free(assembly->sent);
+    free(assembly->tiles);
+}
+
+// Returns the index of the first tile that isn't sent, or -1 if they all are.
+static int print_assembly_take_tile(PrintAssembly *assembly) {
+    while (assembly->next_tile < assembly->num_tiles && assembly->sent[assembly->next_tile]) {
+        assembly->next_tile++;
+    }
+    if (assembly->next_tile == assembly->num_tiles) {
+        return -1;
+    }
+
+    assembly->sent[assembly->next_tile] = true;
+    return assembly->next_tile++;
+}
+
+// Copies the rows of a tile, bottom up, into its band and writes out the bands at the top that are complete.
+static bool print_assembly_add_tile(PrintAssembly *assembly, int index, const uint8_t *rgb) {
+    int band = index / assembly->cols;
+    const Tile *tile = &assembly->tiles[index];
+    size_t row_size = (size_t)assembly->width * 3;
+    if (assembly->bands[band] == nullptr) {
+        assembly->bands[band] = (uint8_t *)malloc(row_size * tile->height);
+        if (assembly->bands[band] == nullptr) {
+            ERRORF("Failed to malloc() print rows.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int row = 0; row < tile->height; row++) {
+        memcpy(assembly->bands[band] + (tile->height - 1 - row) * row_size + (size_t)tile->x * 3,
+               rgb + (size_t)row * tile->width * 3, (size_t)tile->width * 3);
+    }
+    assembly->band_tiles_left[band]--;
+
+    while (assembly->next_band < assembly->num_bands && assembly->band_tiles_left[assembly->next_band] == 0) {
+        int rows = assembly->tiles[assembly->next_band * assembly->cols].height;
+        if (!png_writer_write_rows(assembly->png, assembly->bands[assembly->next_band], rows)) {
+            return false;
+        }
+        free(assembly->bands[assembly->next_band]);
+        assembly->bands[assembly->next_band] = nullptr;
+        assembly->next_band++;
+    }
+
+    return true;
+}
+
+// Reaps a worker whose socket failed and puts the tiles it didn't return back in line for the others.
+static void print_worker_lost(PrintWorker *worker, int index, PrintAssembly *assembly) {
+    close(worker->fd);
+    worker->fd = -1;
+
+    int status = 0;
+    while (waitpid(worker->pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    if (WIFSIGNALED(status)) {
+        ERRORF("Print worker %d (pid %d) was killed by signal %d, sending its %d tile(s) to the others.\n", index,
+               (int)worker->pid, WTERMSIG(status), worker->num_tiles);
+    } else {
+        ERRORF("Print worker %d (pid %d) exited with status %d, sending its %d tile(s) to the others.\n", index,
+               (int)worker->pid, WEXITSTATUS(status), worker->num_tiles);
+    }
+
+    for (int i = 0; i < worker->num_tiles; i++) {
+        int tile_index = worker->tile_indices[i];
+        assembly->sent[tile_index] = false;
+        if (tile_index < assembly->next_tile) {
+            assembly->next_tile = tile_index;
+        }
+    }
+    worker->num_tiles = 0;
+}
+
+// Receives the oldest tile sent to the worker. Returns false if the worker is gone or sent something else.
+static bool print_worker_receive(PrintWorker *worker, uint8_t *rgb) {
+    Tile tile;
+    if (!socket_recv_all(worker->fd, &tile, sizeof(tile))) {
+        return false;
+    }
+    if (memcmp(&tile, &worker->tiles[0], sizeof(tile)) != 0) {
+        ERRORF("Print worker (pid %d) returned a tile it wasn't sent.\n", (int)worker->pid);
+        return false;
+    }
+
+    return socket_recv_all(worker->fd, rgb, (size_t)tile.width * tile.height * 3);
+}
+
+bool print_workers_render(PrintWorkers *print_workers, int width, int height, const char *output_path) {
+    double start_ms = get_time_ms();
+    PrintAssembly assembly;
+    print_assembly_create(&assembly, width, height);
+    INFOF("Rendering shader for print with dimensions %dx%d in %d tiles on %d worker processes...\n", width, height,
+          assembly.num_tiles, print_workers->num_workers);
+
+    assembly.png = png_writer_open(output_path, width, height);
+    if (assembly.png == nullptr) {
+        exit(EXIT_FAILURE);
+    }
+    auto *rgb = (uint8_t *)malloc(PRINT_TILE_SIZE * PRINT_TILE_SIZE * 3);
+    if (rgb == nullptr) {
+        ERRORF("Failed to malloc() for print tile.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bool ok = true;
+    while (ok && assembly.next_band < assembly.num_bands) {
+        struct pollfd fds[PRINT_WORKERS_MAX];
+        int workers[PRINT_WORKERS_MAX];
+        int num_fds = 0;
+        for (int i = 0; i < print_workers->num_workers; i++) {
+            PrintWorker *worker = &print_workers->workers[i];
+            while (worker->fd != -1 && worker->num_tiles < PRINT_WORKER_MAX_TILES) {
+                int index = print_assembly_take_tile(&assembly);
+                if (index == -1) {
+                    break;
+                }
+                worker->tiles[worker->num_tiles] = assembly.tiles[index];
+                worker->tile_indices[worker->num_tiles] = index;
+                worker->num_tiles++;
+                if (!socket_send_all(worker->fd, &assembly.tiles[index], sizeof(Tile))) {
+                    print_worker_lost(worker, i, &assembly);
+                }
+            }
+            if (worker->fd != -1 && worker->num_tiles > 0) {
+                fds[num_fds].fd = worker->fd;
+                fds[num_fds].events = POLLIN;
+                workers[num_fds] = i;
+                num_fds++;
+            }
+        }
+
+        if (num_fds == 0) {
+            int num_drawn = 0;
+            for (int i = 0; i < print_workers->num_workers; i++) {
+                num_drawn += print_workers->workers[i].num_drawn;
+            }
+            ERRORF("Every print worker exited, %d of %d tiles were drawn.\n", num_drawn, assembly.num_tiles);
+            ok = false;
+            break;
+        }
+        if (poll(fds, num_fds, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ERRORF("Failure in call to poll(): %s.\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        for (int i = 0; i < num_fds && ok; i++) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            PrintWorker *worker = &print_workers->workers[workers[i]];
+            if (!print_worker_receive(worker, rgb)) {
+                print_worker_lost(worker, workers[i], &assembly);
+                continue;
+            }
+
+            int index = worker->tile_indices[0];
+            worker->num_tiles--;
+            memmove(worker->tiles, worker->tiles + 1, worker->num_tiles * sizeof(Tile));
+            memmove(worker->tile_indices, worker->tile_indices + 1, worker->num_tiles * sizeof(int));
+            worker->num_drawn++;
+            ok = print_assembly_add_tile(&assembly, index, rgb);
+        }
+    }
+
+    // Closing the sockets tells the workers there's nothing left to draw.
+    for (int i = 0; i < print_workers->num_workers; i++) {
+        PrintWorker *worker = &print_workers->workers[i];
+        if (worker->fd != -1) {
+            close(worker->fd);
+            worker->fd = -1;
+            while (waitpid(worker->pid, nullptr, 0) < 0 && errno == EINTR) {
+            }
+        }
+    }
+
+    if (ok) {
+        ok = png_writer_close(assembly.png);
+    } else {
+        png_writer_discard(assembly.png);
+    }
+    if (ok) {
+        for (int i = 0; i < print_workers->num_workers; i++) {
+            INFOF("Print worker %d drew %d tiles.\n", i, print_workers->workers[i].num_drawn);
+        }
+        INFOF("Print written to %s successfully in %.3fms!\n", output_path, get_time_ms() - start_ms);
+    } else {
+        unlink(output_path);
+    }
+
+    free(rgb);
+    print_assembly_destroy(&assembly);
+
+    return ok;
+}
+
+void print_worker_serve(ShaderRenderer *shader_renderer, int fd) {
+    shader_renderer_print_tiles_begin(shader_renderer);
+
+    auto *rgb = (uint8_t *)malloc(PRINT_TILE_SIZE * PRINT_TILE_SIZE * 3);
+    if (rgb == nullptr) {
+        ERRORF("Failed to malloc() for print tile.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    Tile tile;
+    while (socket_recv_all(fd, &tile, sizeof(tile))) {
+        if (tile.x < 0 || tile.y < 0 || tile.width <= 0 || tile.height <= 0 || tile.width > PRINT_TILE_SIZE ||
+            tile.height > PRINT_TILE_SIZE || tile.x + tile.width > shader_renderer->width ||
+            tile.y + tile.height > shader_renderer->height) {
+            ERRORF("Invalid print tile %dx%d at %d,%d.\n", tile.width, tile.height, tile.x, tile.y);
+            exit(EXIT_FAILURE);
+        }
+
+        shader_renderer_print_tile(shader_renderer, &tile, rgb);
+        if (!socket_send_all(fd, &tile, sizeof(tile)) ||
+            !socket_send_all(fd, rgb, (size_t)tile.width * tile.height * 3)) {
+            break;
+        }
+    }
+
+    free(rgb);
+    close(fd);
+}
@@ -0,0 +1,702 @@
+#include "shdy.h"
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <glad/glad.h>
+#include <stb_image_write.h>
+
+static const char *server_format_names[] = {
+        "png", // SERVER_FORMAT_PNG
+        "jpeg" // SERVER_FORMAT_JPEG
+};
+
+static bool server_socket_address(const char *socket_path, struct sockaddr_un *out) {
+    *out = {};
+    out->sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(out->sun_path)) {
+        ERRORF("Socket path %s is too long, the maximum is %d characters.\n", socket_path,
+               (int)sizeof(out->sun_path) - 1);
+        return false;
+    }
+    strcpy(out->sun_path, socket_path);
+
+    return true;
+}
+
+// Sends "ERROR message" and closes the connection.
+static void server_send_error(int fd, const char *message) {
+    char line[SHADER_DIAGNOSTIC_MAX_MESSAGE + PATH_MAX + 64];
+    int len = snprintf(line, sizeof(line), "ERROR %s\n", message);
+    socket_send_all(fd, line, (size_t)len < sizeof(line) ? (size_t)len : sizeof(line) - 1);
+    close(fd);
+}
+
+// Writes the inline source of a request to the server's cache directory, named after its hash so resending the
+// same source finds the renderer it was drawn with.
+static bool server_write_source(const char *src, size_t len, char *out_path) {
+    if (!cache_file_path("server", hash_bytes(src, len), "frag", out_path)) {
+        return false;
+    }
+    if (access(out_path, R_OK) == 0) {
+        return true;
+    }
+
+    char tmp_path[PATH_MAX + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", out_path);
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == nullptr) {
+        ERRORF("Failed to open %s: %s.\n", tmp_path, strerror(errno));
+        return false;
+    }
+    bool ok = fwrite(src, 1, len, file) == len;
+    ok = fclose(file) == 0 && ok;
+    if (!ok || rename(tmp_path, out_path) != 0) {
+        ERRORF("Failed to write %s: %s.\n", out_path, strerror(errno));
+        unlink(tmp_path);
+        return false;
+    }
+
+    return true;
+}
+
+// Receives up to len bytes like recv(), but waits no later than deadline_ms, on the get_time_ms() clock. Returns 0,
+// as if the other end closed the socket, once the deadline has passed.
+static ssize_t server_recv(int fd, void *data, size_t len, double deadline_ms) {
+    while (true) {
+        double remaining_ms = deadline_ms - get_time_ms();
+        if (remaining_ms <= 0.0) {
+            return 0;
+        }
+        struct pollfd pfd = {fd, POLLIN, 0};
+        int ready = poll(&pfd, 1, (int)remaining_ms + 1);
+        if (ready < 0 && errno != EINTR) {
+            return -1;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+        ssize_t received = recv(fd, data, len, MSG_DONTWAIT);
+        if (received >= 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            return received;
+        }
+    }
+}
+
+// Receives exactly len bytes before deadline_ms. Returns false if the other end closed the socket or was too slow.
+static bool server_recv_all(int fd, void *data, size_t len, double deadline_ms) {
+    auto *bytes = (uint8_t *)data;
+    while (len > 0) {
+        ssize_t received = server_recv(fd, bytes, len, deadline_ms);
+        if (received <= 0) {
+            return false;
+        }
+        bytes += received;
+        len -= (size_t)received;
+    }
+
+    return true;
+}
+
+// Parses the KEY=VALUE lines of a request header into job, and reads the source that follows it if there is one.
+// rest holds the bytes already received past the header, the source has to arrive before deadline_ms. Returns false
+// with the reason in error.
+static bool server_parse_request(ServerJob *job, char *header, const char *rest, size_t rest_len, double deadline_ms,
+                                 char *error, size_t error_size) {
+    long source_len = -1;
+    bool has_shader = false;
+    bool has_size = false;
+    char *save;
+    for (char *line = strtok_r(header, "\n", &save); line != nullptr; line = strtok_r(nullptr, "\n", &save)) {
+        char *value = strchr(line, '=');
+        if (value == nullptr) {
+            snprintf(error, error_size, "Invalid request line: %s", line);
+            return false;
+        }
+        *value++ = '\0';
+
+        if (strcmp(line, "shader") == 0) {
+            if (realpath(value, job->shader_path) == nullptr || access(job->shader_path, R_OK) != 0) {
+                snprintf(error, error_size, "Can't read shader %s", value);
+                return false;
+            }
+            has_shader = true;
+        } else if (strcmp(line, "source") == 0) {
+            char *end;
+            source_len = strtol(value, &end, 10);
+            if (end == value || *end != '\0' || source_len <= 0 || source_len > SERVER_MAX_SOURCE) {
+                snprintf(error, error_size, "Invalid source length %s, must be from 1 to %d", value,
+                         SERVER_MAX_SOURCE);
+                return false;
+            }
+        } else if (strcmp(line, "size") == 0) {
+            if (!print_size_parse(value, &job->width, &job->height) || job->width > SERVER_MAX_DIMENSION ||
+                job->height > SERVER_MAX_DIMENSION) {
+                snprintf(error, error_size, "Invalid size %s, must be a print size or WIDTHxHEIGHT up to %d",
+                         value, SERVER_MAX_DIMENSION);
+                return false;
+            }
+            has_size = true;
+        } else if (strcmp(line, "time") == 0) {
+            char *end;
+            job->time = strtof(value, &end);
+            if (end == value || *end != '\0') {
+                snprintf(error, error_size, "Invalid time %s", value);
+                return false;
+            }
+        } else if (strcmp(line, "format") == 0) {
+            if (strcmp(value, "png") == 0) {
+                job->format = SERVER_FORMAT_PNG;
+            } else if (strcmp(value, "jpeg") == 0 || strcmp(value, "jpg") == 0) {
+                job->format = SERVER_FORMAT_JPEG;
+            } else {
+                snprintf(error, error_size, "Invalid format %s, must be png or jpeg", value);
+                return false;
+            }
+        } else if (strcmp(line, "define") == 0) {
+            if (job->num_defines == SHADER_MAX_DEFINES) {
+                snprintf(error, error_size, "Too many defines, the maximum is %d", SHADER_MAX_DEFINES);
+                return false;
+            }
+            if (!shader_define_parse(&job->defines[job->num_defines], value)) {
+                snprintf(error, error_size, "Invalid define %s, must be NAME or NAME=VALUE", value);
+                return false;
+            }
+            job->num_defines++;
+        } else {
+            snprintf(error, error_size, "Unknown request key %s", line);
+            return false;
+        }
+    }
+
+    if (has_shader == (source_len > 0)) {
+        snprintf(error, error_size, "The request needs either shader or source");
+        return false;
+    }
+    if (!has_size) {
+        snprintf(error, error_size, "The request needs a size");
+        return false;
+    }
+    if (source_len < 0) {
+        return true;
+    }
+
+    if (rest_len > (size_t)source_len) {
+        snprintf(error, error_size, "Received more source than the %ld bytes announced", source_len);
+        return false;
+    }
+    char *src = (char *)malloc((size_t)source_len);
+    if (src == nullptr) {
+        snprintf(error, error_size, "Out of memory");
+        return false;
+    }
+    memcpy(src, rest, rest_len);
+    bool ok = server_recv_all(job->fd, src + rest_len, (size_t)source_len - rest_len, deadline_ms);
+    if (!ok) {
+        snprintf(error, error_size, "The %ld bytes of source weren't received in time", source_len);
+    } else if (!server_write_source(src, (size_t)source_len, job->shader_path)) {
+        snprintf(error, error_size, "Failed to store the source");
+        ok = false;
+    }
+    free(src);
+
+    return ok;
+}
+
+// Reads the request on a new connection and queues it, or answers it with an error.
+static void server_accept(Server *server, int fd) {
+    // Requests are read one at a time, so however slowly a client trickles its request in it only holds up the
+    // others until the deadline.
+    double deadline_ms = get_time_ms() + SERVER_REQUEST_TIMEOUT_MS;
+
+    char buffer[SERVER_MAX_REQUEST + 1];
+    size_t len = 0;
+    char *header_end = nullptr;
+    while (header_end == nullptr && len < SERVER_MAX_REQUEST) {
+        ssize_t received = server_recv(fd, buffer + len, SERVER_MAX_REQUEST - len, deadline_ms);
+        if (received <= 0) {
+            close(fd);
+            return;
+        }
+        len += (size_t)received;
+        buffer[len] = '\0';
+        header_end = strstr(buffer, "\n\n");
+    }
+    if (header_end == nullptr) {
+        server_send_error(fd, "The request header is too long or isn't ended by an empty line");
+        return;
+    }
+    *header_end = '\0';
+    const char *rest = header_end + 2;
+
+    auto *job = (ServerJob *)calloc(1, sizeof(ServerJob));
+    if (job == nullptr) {
+        server_send_error(fd, "Out of memory");
+        return;
+    }
+    job->server = server;
+    job->fd = fd;
+    job->time = 1.0f;
+    job->format = SERVER_FORMAT_PNG;
+
+    char error[SHADER_DIAGNOSTIC_MAX_MESSAGE + PATH_MAX];
+    if (!server_parse_request(job, buffer, rest, len - (size_t)(rest - buffer), deadline_ms, error, sizeof(error))) {
+        server_send_error(fd, error);
+        free(job);
+        return;
+    }
+
+    pthread_mutex_lock(&server->mutex);
+    bool busy = server->num_pending >= server->max_queue;
+    if (!busy) {
+        server->queue[(server->queue_head + server->num_queued) % SERVER_MAX_QUEUE] = job;
+        server->num_queued++;
+        server->num_pending++;
+        pthread_cond_signal(&server->cond);
+    }
+    pthread_mutex_unlock(&server->mutex);
+
+    if (busy) {
+        server_send_error(fd, "busy");
+        free(job);
+    }
+}
+
+static void *server_acceptor_run(void *arg) {
+    auto *server = (Server *)arg;
+
+    struct pollfd fds[2] = {
+            {server->listen_fd, POLLIN, 0},
+            {server->signal_fd, POLLIN, 0}
+    };
+    while (true) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ERRORF("Failure in call to poll(): %s.\n", strerror(errno));
+            break;
+        }
+        if (fds[1].revents != 0) {
+            struct signalfd_siginfo info;
+            if (read(server->signal_fd, &info, sizeof(info)) == sizeof(info)) {
+                INFOF("Received signal %d, stopping the server.\n", (int)info.ssi_signo);
+            }
+            break;
+        }
+        if (fds[0].revents != 0) {
+            int fd = accept4(server->listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd >= 0) {
+                server_accept(server, fd);
+            } else if (errno != EINTR && errno != ECONNABORTED) {
+                ERRORF("Failure in call to accept4(): %s.\n", strerror(errno));
+            }
+        }
+    }
+
+    pthread_mutex_lock(&server->mutex);
+    server->stopping = true;
+    pthread_cond_broadcast(&server->cond);
+    pthread_mutex_unlock(&server->mutex);
+
+    return nullptr;
+}
+
+// Frees a job once it has been answered, making room for another.
+static void server_job_finish(ServerJob *job) {
+    Server *server = job->server;
+    if (job->fd >= 0) {
+        close(job->fd);
+    }
+    free(job->rgb);
+    free(job);
+
+    pthread_mutex_lock(&server->mutex);
+    server->num_pending--;
+    pthread_mutex_unlock(&server->mutex);
+}
+
+static void server_job_fail(ServerJob *job, const char *message) {
+    server_send_error(job->fd, message);
+    job->fd = -1;
+    server_job_finish(job);
+}
+
+typedef struct {
+    int fd;
+    bool ok;
+} ServerStream;
+
+static void server_stream_write(void *context, void *data, int size) {
+    auto *stream = (ServerStream *)context;
+    stream->ok = stream->ok && socket_send_all(stream->fd, data, (size_t)size);
+}
+
+static void server_encode_run(void *arg) {
+    auto *job = (ServerJob *)arg;
+
+    char header[64];
+    int len = snprintf(header, sizeof(header), "OK %s %d %d\n", server_format_names[job->format], job->width,
+                       job->height);
+    ServerStream stream = {job->fd, socket_send_all(job->fd, header, (size_t)len)};
+
+    if (job->format == SERVER_FORMAT_JPEG) {
+        stbi_write_jpg_to_func(server_stream_write, &stream, job->width, job->height, 3, job->rgb,
+                               SERVER_JPEG_QUALITY);
+    } else {
+        stbi_write_png_to_func(server_stream_write, &stream, job->width, job->height, 3, job->rgb, 3 * job->width);
+    }
+    if (!stream.ok) {
+        ERRORF("Client went away before the %dx%d image of %s was sent.\n", job->width, job->height,
+               job->shader_path);
+    }
+
+    server_job_finish(job);
+}
+
+static void server_copy_line(char *out, size_t size, const char *str) {
+    snprintf(out, size, "%s", str);
+    for (char *ch = out; *ch != '\0'; ch++) {
+        if (*ch == '\n' || *ch == '\r') {
+            *ch = ' ';
+        }
+    }
+}
+
+// Writes the first error of the latest compile of shader to out. Returns false if the shader has a program to draw.
+static bool server_shader_error(Shader *shader, char *out, size_t size) {
+    if (shader->compiled && !shader->failed) {
+        return false;
+    }
+
+    for (int i = 0; i < shader->num_diagnostics; i++) {
+        const ShaderDiagnostic *diagnostic = &shader->diagnostics[i];
+        if (diagnostic->severity != DIAGNOSTIC_ERROR) {
+            continue;
+        }
+        const char *path = shader_diagnostic_path(shader, diagnostic);
+        char line[SHADER_DIAGNOSTIC_MAX_MESSAGE + PATH_MAX + 32];
+        snprintf(line, sizeof(line), "%s:%d:%d: %s", path != nullptr ? path : shader->user_frag_shader_path,
+                 diagnostic->line, diagnostic->column, diagnostic->message);
+        server_copy_line(out, size, line);
+        return true;
+    }
+
+    snprintf(out, size, "%s failed to compile", shader->user_frag_shader_path);
+    return true;
+}
+
+// Returns the warm renderer for the shader and defines of job, bringing it up to date with the files on disk, or
+// creates one in place of the least recently used.
+static ShaderRenderer *server_get_renderer(Server *server, const ServerJob *job) {
+    ServerRenderer *entry = nullptr;
+    for (int i = 0; i < SERVER_MAX_RENDERERS && entry == nullptr; i++) {
+        ServerRenderer *renderer = &server->renderers[i];
+        if (renderer->active && strcmp(renderer->shader_path, job->shader_path) == 0 &&
+            renderer->num_defines == job->num_defines &&
+            memcmp(renderer->defines, job->defines, job->num_defines * sizeof(ShaderDefine)) == 0) {
+            entry = renderer;
+        }
+    }
+
+    if (entry != nullptr) {
+        ShaderRenderer *shader_renderer = &entry->renderer;
+        for (int i = 0; i < shader_renderer->source_cache.num_files; i++) {
+            shader_renderer_invalidate(shader_renderer, shader_renderer->source_cache.files[i].path);
+        }
+        // The request can't be drawn without the programs, but the passes are still validated in parallel.
+        shader_renderer_reload(shader_renderer, true);
+    } else {
+        entry = &server->renderers[0];
+        for (int i = 0; i < SERVER_MAX_RENDERERS; i++) {
+            ServerRenderer *renderer = &server->renderers[i];
+            if (!renderer->active) {
+                entry = renderer;
+                break;
+            }
+            if (renderer->last_used < entry->last_used) {
+                entry = renderer;
+            }
+        }
+        if (entry->active) {
+            INFOF("Evicting the renderer of %s.\n", entry->shader_path);
+            shader_renderer_destroy(&entry->renderer);
+        }
+
+        memcpy(entry->shader_path, job->shader_path, PATH_MAX);
+        memcpy(entry->defines, job->defines, job->num_defines * sizeof(ShaderDefine));
+        entry->num_defines = job->num_defines;
+        entry->active = true;
+        shader_renderer_create(&entry->renderer, entry->shader_path, entry->defines, entry->num_defines,
+                               server->textures, server->num_textures, server->spirv);
+    }
+    entry->last_used = ++server->num_drawn;
+
+    char params_path[PATH_MAX];
+    params_sidecar_path(entry->shader_path, params_path);
+    shader_renderer_load_params_file(&entry->renderer, params_path);
+
+    return &entry->renderer;
+}
+
+// Draws the image of job on the current context and hands it to the encoders, or answers with an error.
+static void server_draw(Server *server, ServerJob *job, int max_size) {
+    double start_ms = get_time_ms();
+    ShaderRenderer *shader_renderer = server_get_renderer(server, job);
+
+    char error[SHADER_DIAGNOSTIC_MAX_MESSAGE + PATH_MAX + 32];
+    bool failed = server_shader_error(&shader_renderer->shader, error, sizeof(error));
+    for (int i = 0; i < SHADER_MAX_BUFFERS && !failed; i++) {
+        RenderBuffer *buffer = &shader_renderer->buffers[i];
+        failed = buffer->active && server_shader_error(&buffer->shader, error, sizeof(error));
+    }
+    if (failed) {
+        server_job_fail(job, error);
+        return;
+    }
+    if (job->width > max_size || job->height > max_size) {
+        snprintf(error, sizeof(error), "Size %dx%d is larger than the maximum of %d", job->width, job->height,
+                 max_size);
+        server_job_fail(job, error);
+        return;
+    }
+
+    job->rgb = (uint8_t *)malloc((size_t)job->width * job->height * 3);
+    if (job->rgb == nullptr) {
+        server_job_fail(job, "Out of memory");
+        return;
+    }
+
+    shader_renderer->width = job->width;
+    shader_renderer->height = job->height;
+    if (!shader_renderer_draw_to_image(shader_renderer, job->time, job->rgb)) {
+        server_job_fail(job, "Failed to read back the image");
+        return;
+    }
+    INFOF("Drew %s at %dx%d in %.3fms.\n", job->shader_path, job->width, job->height, get_time_ms() - start_ms);
+
+    // There are never more jobs in flight than fit in the pool's queue.
+    thread_pool_submit(&server->encoders, server_encode_run, job);
+}
+
+void server_create(Server *server, const char *socket_path, int num_jobs, int max_queue,
+                   const ShaderTexture *textures, int num_textures, bool spirv) {
+    struct sockaddr_un addr;
+    if (!server_socket_address(socket_path, &addr)) {
+        exit(EXIT_FAILURE);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        ERRORF("Failure in call to socket(): %s.\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // A socket nobody answers on is left over from a server that didn't stop cleanly.
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        ERRORF("Another server is listening on %s.\n", socket_path);
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    if (errno == ECONNREFUSED && stat(socket_path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(socket_path);
+    }
+    close(fd);
+
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, max_queue) != 0) {
+        ERRORF("Failed to listen on %s: %s.\n", socket_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // Blocked in every thread started from now on, the acceptor reads them from the signalfd instead.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    server->signal_fd = signalfd(-1, &signals, SFD_CLOEXEC);
+    if (server->signal_fd < 0) {
+        ERRORF("Failure in call to signalfd(): %s.\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    snprintf(server->socket_path, sizeof(server->socket_path), "%s", socket_path);
+    server->listen_fd = fd;
+    server->textures = textures;
+    server->num_textures = num_textures;
+    server->spirv = spirv;
+    server->num_jobs = num_jobs;
+    server->max_queue = max_queue;
+    pthread_mutex_init(&server->mutex, nullptr);
+    pthread_cond_init(&server->cond, nullptr);
+    server->queue_head = 0;
+    server->num_queued = 0;
+    server->num_pending = 0;
+    server->stopping = false;
+    for (int i = 0; i < SERVER_MAX_RENDERERS; i++) {
+        server->renderers[i].active = false;
+    }
+    server->num_drawn = 0;
+}
+
+void server_run(Server *server) {
+    int max_size;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+
+    // The log is usually redirected to a file, it should still show each request as it's served.
+    setvbuf(stdout, nullptr, _IOLBF, 0);
+
+    // The images are read back bottom up. The flag is global to stb, so it's set before the encoders start.
+    stbi_flip_vertically_on_write(true);
+    thread_pool_create(&server->encoders, server->num_jobs);
+    if (pthread_create(&server->acceptor, nullptr, server_acceptor_run, server) != 0) {
+        ERRORF("Failed to create the acceptor thread.\n");
+        exit(EXIT_FAILURE);
+    }
+    INFOF("Serving render requests on %s, encoding %d at once with up to %d waiting.\n", server->socket_path,
+          server->num_jobs, server->max_queue);
+
+    while (true) {
+        pthread_mutex_lock(&server->mutex);
+        while (server->num_queued == 0 && !server->stopping) {
+            pthread_cond_wait(&server->cond, &server->mutex);
+        }
+        if (server->stopping) {
+            pthread_mutex_unlock(&server->mutex);
+            break;
+        }
+        ServerJob *job = server->queue[server->queue_head];
+        server->queue_head = (server->queue_head + 1) % SERVER_MAX_QUEUE;
+        server->num_queued--;
+        pthread_mutex_unlock(&server->mutex);
+
+        server_draw(server, job, max_size);
+    }
+
+    pthread_join(server->acceptor, nullptr);
+    while (server->num_queued > 0) {
+        ServerJob *job = server->queue[server->queue_head];
+        server->queue_head = (server->queue_head + 1) % SERVER_MAX_QUEUE;
+        server->num_queued--;
+        server_job_fail(job, "The server is stopping");
+    }
+    thread_pool_destroy(&server->encoders);
+}
+
+void server_destroy(Server *server) {
+    for (int i = 0; i < SERVER_MAX_RENDERERS; i++) {
+        if (server->renderers[i].active) {
+            shader_renderer_destroy(&server->renderers[i].renderer);
+            server->renderers[i].active = false;
+        }
+    }
+    close(server->listen_fd);
+    close(server->signal_fd);
+    unlink(server->socket_path);
+    pthread_mutex_destroy(&server->mutex);
+    pthread_cond_destroy(&server->cond);
+}
+
+static bool path_has_ext(const char *path, const char *ext) {
+    const char *dot = strrchr(path, '.');
+    return dot != nullptr && strcasecmp(dot + 1, ext) == 0;
+}
+
+bool server_request(const char *socket_path, const char *shader_path, int width, int height,
+                    const ShaderDefine *defines, int num_defines, const char *output_path) {
+    struct sockaddr_un addr;
+    if (!server_socket_address(socket_path, &addr)) {
+        return false;
+    }
+    char abs_path[PATH_MAX];
+    if (realpath(shader_path, abs_path) == nullptr) {
+        ERRORF("Failed to resolve the path of %s: %s.\n", shader_path, strerror(errno));
+        return false;
+    }
+
+    // The server resolves paths against its own working directory, so it's sent the absolute path.
+    StrBuf request = {};
+    bool jpeg = path_has_ext(output_path, "jpg") || path_has_ext(output_path, "jpeg");
+    str_buf_appendf(&request, "shader=%s\nsize=%dx%d\nformat=%s\n", abs_path, width, height,
+                    server_format_names[jpeg ? SERVER_FORMAT_JPEG : SERVER_FORMAT_PNG]);
+    for (int i = 0; i < num_defines; i++) {
+        str_buf_appendf(&request, "define=%s=%s\n", defines[i].name, defines[i].value);
+    }
+    str_buf_append(&request, "\n", 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        ERRORF("Failed to connect to the server on %s: %s.\n", socket_path, strerror(errno));
+        str_buf_free(&request);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    bool sent = socket_send_all(fd, request.data, request.len);
+    str_buf_free(&request);
+
+    // The server may answer before reading the whole request, e.g when it's busy, so read the answer regardless.
+    char line[SHADER_DIAGNOSTIC_MAX_MESSAGE + PATH_MAX + 64];
+    size_t len = 0;
+    while (len < sizeof(line) - 1 && socket_recv_all(fd, &line[len], 1) && line[len] != '\n') {
+        len++;
+    }
+    line[len] = '\0';
+
+    int image_width, image_height;
+    char format[8];
+    if (strncmp(line, "ERROR ", 6) == 0) {
+        ERRORF("The server failed to render %s: %s\n", shader_path, line + 6);
+        close(fd);
+        return false;
+    }
+    if (sscanf(line, "OK %7s %d %d", format, &image_width, &image_height) != 3) {
+        ERRORF("Invalid answer from the server on %s%s.\n", socket_path, sent ? "" : ", the request wasn't sent");
+        close(fd);
+        return false;
+    }
+
+    FILE *file = fopen(output_path, "wb");
+    if (file == nullptr) {
+        ERRORF("Failed to open %s: %s.\n", output_path, strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    // The image is sent as it's encoded and ends when the server closes the connection.
+    bool ok = true;
+    size_t total = 0;
+    char buffer[64 * 1024];
+    while (ok) {
+        ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            ok = received == 0 && total > 0;
+            break;
+        }
+        ok = fwrite(buffer, 1, (size_t)received, file) == (size_t)received;
+        total += (size_t)received;
+    }
+    ok = fclose(file) == 0 && ok;
+    close(fd);
+    if (!ok) {
+        ERRORF("Failed to receive the image from the server on %s.\n", socket_path);
+        unlink(output_path);
+        return false;
+    }
+
+    INFOF("Print of %dx%d received from the server and written to %s.\n", image_width, image_height, output_path);
+    return true;
+}
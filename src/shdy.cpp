@@ -3,7 +3,6 @@
 //
 
 // TODO:
-// - Better shader error output.
 // - Draw compile status and frame metrics on screen.
 
 #include "shdy.h"
@@ -12,19 +11,106 @@
 #include <getopt.h>
 #include <cctype>
 #include <cstring>
+#include <strings.h>
 #include <sys/inotify.h>
-#include <sys/ioctl.h>
-#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 #include <cerrno>
+#include <cstdint>
+#include <climits>
+#include <cstdarg>
+#include <ctime>
+#include <cstddef>
+#include <cmath>
+#include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <glad/glad.h>
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include <stb_image_write.h>
 
-static const char * s_shared_shader_src =
+#define STRINGIFY_(x) #x
+#define STRINGIFY(x) STRINGIFY_(x)
+
+static const char *s_glsl_version_src = "#version 330\n";
+
+// Compute passes need GLSL 4.30, SHDY_COMPUTE switches the preamble declarations to the compute stage.
+static const char *s_glsl_compute_version_src =
+        "#version 430\n"
+        "#define SHDY_COMPUTE 1\n"
+        "#define SHDY_LOCAL_SIZE " STRINGIFY(SHADER_COMPUTE_LOCAL_SIZE) "\n"
+        "#define SHDY_OUTPUT_IMAGE_UNIT " STRINGIFY(SHADER_OUTPUT_IMAGE_UNIT) "\n";
+
+// Starts the sources of CPU programs, in place of the version.
+static const char *s_glsl_cpu_src = "#define SHDY_CPU 1\n";
+
+// Follows the version in SPIR-V programs. GL can't look their blocks up by name, so the inputs block is bound in the
+// shader, and the preamble knobs are specialization constants so every value shares one cached module.
+static const char *s_glsl_spirv_src =
+        "#extension GL_ARB_shading_language_420pack : enable\n"
+        "#define SHDY_SPIRV 1\n"
+        "#define SHDY_INPUTS_BINDING " STRINGIFY(SHADER_INPUTS_BINDING) "\n"
+        "#define SHDY_FBM_OCTAVES_ID " STRINGIFY(SHADER_SPEC_FBM_OCTAVES) "\n";
+
+// Uniforms, constants and function prototypes seen by the user shader.
+static const char *s_preamble_decls_src =
 #include "shdy.frag"
 ;
 
+// Definitions of the preamble functions, compiled once per stage and define set into s_preamble_cache.
+static const char *s_preamble_lib_src =
+#include "shdy_lib.frag"
+;
+
+// Names of the parts of the preamble in diagnostics.
+#define PREAMBLE_DEFINES_NAME "<shdy defines>"
+#define PREAMBLE_DECLS_NAME "<shdy.frag>"
+#define PREAMBLE_LIB_NAME "<shdy_lib.frag>"
+#define VERTEX_SHADER_NAME "<shdy vertex>"
+
+// Bumped when the SPIR-V compile options change, so modules cached by an older shdy aren't loaded.
+#define SPIRV_CACHE_VERSION 1
+
+#define PREAMBLE_CACHE_SIZE 8
+
+typedef struct {
+    GLenum type;
+    char *defines_src;
+    unsigned int shader;
+} PreambleCacheEntry;
+
+static PreambleCacheEntry s_preamble_cache[PREAMBLE_CACHE_SIZE];
+static int s_preamble_cache_next = 0;
+
+// Programs are kept once their shader moves on to another source, so going back to it, e.g undoing an edit or
+// switching between shaders, doesn't compile it again. The least recently used ones are deleted past either limit.
+#define PROGRAM_CACHE_MAX_PROGRAMS 32
+#define PROGRAM_CACHE_MAX_BYTES (64 * 1024 * 1024)
+
+typedef struct {
+    char *defines_src; // nullptr if the entry is free.
+    uint64_t src_hash; // Of the expanded user source.
+    bool compute;
+    bool spirv;
+    unsigned int program;
+    size_t size; // Length of the program binary, an estimate of the memory it holds on to.
+    ShaderUniform uniforms[SHADER_MAX_UNIFORMS]; // See Shader.
+    int num_uniforms;
+    // Values the params start from, read when the program was built since other values may have been set on it since.
+    float param_values[SHADER_MAX_PARAMS][4];
+    bool in_use; // By a shader, which is then the only one setting its uniforms.
+    unsigned long last_used;
+} ProgramCacheEntry;
+
+// Only used on the thread with the context.
+static ProgramCacheEntry s_program_cache[PROGRAM_CACHE_MAX_PROGRAMS];
+static size_t s_program_cache_size = 0;
+static unsigned long s_program_cache_clock = 0;
+
 static void glfw_error_callback(int error, const char *description) {
     ERRORF("GLFW error %d: %s\n", error, description);
 }
@@ -39,6 +125,40 @@ static void glfw_framebuffer_size_callback(GLFWwindow *win, int w, int h) {
     auto *window = (Window*)glfwGetWindowUserPointer(win);
     window->fb_width = w;
     window->fb_height = h;
+    window->dirty = true;
+}
+
+static void glfw_window_refresh_callback(GLFWwindow *win) {
+    auto *window = (Window*)glfwGetWindowUserPointer(win);
+    window->dirty = true;
+}
+
+static void glfw_key_callback(GLFWwindow *win, int, int, int, int) {
+    auto *window = (Window*)glfwGetWindowUserPointer(win);
+    window->dirty = true;
+}
+
+static void glfw_mouse_button_callback(GLFWwindow *win, int button, int action, int) {
+    auto *window = (Window*)glfwGetWindowUserPointer(win);
+    // The click position is kept once the button is released, only its sign changes.
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) {
+        window->mouse[2] = window->mouse[0];
+        window->mouse[3] = window->mouse[1];
+    } else if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_RELEASE) {
+        window->mouse[2] = -fabsf(window->mouse[2]);
+        window->mouse[3] = -fabsf(window->mouse[3]);
+    }
+    window->dirty = true;
+}
+
+static void glfw_cursor_pos_callback(GLFWwindow *win, double x, double y) {
+    auto *window = (Window*)glfwGetWindowUserPointer(win);
+    // Cursor positions are in screen coordinates from the top left, which differ from pixels on HiDPI displays.
+    float scale_x = window->win_width > 0 ? (float)window->fb_width / (float)window->win_width : 1.0f;
+    float scale_y = window->win_height > 0 ? (float)window->fb_height / (float)window->win_height : 1.0f;
+    window->mouse[0] = (float)x * scale_x;
+    window->mouse[1] = (float)window->fb_height - (float)y * scale_y;
+    window->dirty = true;
 }
 
 static void APIENTRY gl_error_callback(GLenum source,
@@ -164,11 +284,19 @@ void window_create(Window *window, const char *title, int width, int height, boo
     window->fb_height = fb_height;
     window->fullscreen = fullscreen;
     window->hidden = hidden;
+    window->dirty = true;
+    for (int i = 0; i < 4; i++) {
+        window->mouse[i] = 0.0f;
+    }
     window->glfw_win = glfw_win;
 
     glfwSetWindowUserPointer(glfw_win, window);
     glfwSetWindowSizeCallback(glfw_win, glfw_window_size_callback);
     glfwSetFramebufferSizeCallback(glfw_win, glfw_framebuffer_size_callback);
+    glfwSetWindowRefreshCallback(glfw_win, glfw_window_refresh_callback);
+    glfwSetKeyCallback(glfw_win, glfw_key_callback);
+    glfwSetMouseButtonCallback(glfw_win, glfw_mouse_button_callback);
+    glfwSetCursorPosCallback(glfw_win, glfw_cursor_pos_callback);
 
     INFOF("Rendering with OpenGL. Version: %d.%d, vendor: %s, renderer: %s.\n",
           GLVersion.major, GLVersion.minor, glGetString(GL_VENDOR), glGetString(GL_RENDERER));
@@ -188,50 +316,57 @@ bool window_is_open(Window *window) {
     return !glfwWindowShouldClose(window->glfw_win);
 }
 
-void window_update(Window *window) {
+void window_present(Window *window) {
     assert(window->glfw_win != nullptr);
 
-    glfwPollEvents();
     glfwSwapBuffers(window->glfw_win);
+    window->dirty = false;
 }
 
-float get_elapsed_time() {
-    return (float)glfwGetTime();
+void window_poll_events(Window *window) {
+    assert(window->glfw_win != nullptr);
+
+    glfwPollEvents();
 }
 
-static const char* s_vert_shader_src =
-        "#version 330\n"
-        "layout (location = 0) in vec2 vPos;\n"
-        "void main()\n"
-        "{\n"
-        "    gl_Position = vec4(vPos, 0.0, 1.0);\n"
-        "}\n";
+int window_refresh_rate(Window *window) {
+    assert(window->glfw_win != nullptr);
 
-static void log_shader_error(const char *msg, unsigned int id) {
-    int info_log_length = 0;
-    int max_len = info_log_length;
+    GLFWmonitor *monitor = glfwGetWindowMonitor(window->glfw_win);
+    if (monitor == nullptr) {
+        monitor = glfwGetPrimaryMonitor();
+    }
 
-    if (glIsShader(id)) {
-        glGetShaderiv(id, GL_INFO_LOG_LENGTH, &max_len);
-    } else if (glIsProgram(id)) {
-        glGetProgramiv(id, GL_INFO_LOG_LENGTH, &max_len);
-    } else {
-        return;
+    const GLFWvidmode *mode = monitor != nullptr ? glfwGetVideoMode(monitor) : nullptr;
+    if (mode == nullptr || mode->refreshRate <= 0) {
+        return WINDOW_DEFAULT_REFRESH_RATE;
     }
 
-    char info_log_buffer[max_len];
+    return mode->refreshRate;
+}
+
+float get_elapsed_time() {
+    return (float)glfwGetTime();
+}
 
-    if (glIsShader(id)) {
-        glGetShaderInfoLog(id, max_len, &info_log_length, info_log_buffer);
-    } else {
-        glGetProgramInfoLog(id, max_len, &info_log_length, info_log_buffer);
-    }
+double get_time_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
 
-    if (info_log_length > 0) {
-        ERRORF("%s:\n%s", msg, info_log_buffer);
-    }
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
 }
 
+// Covers the viewport with a single triangle with vertices at (-1,-1), (3,-1) and (-1,3), generated from
+// gl_VertexID so no vertex buffers are needed. Unlike a two triangle quad there's no shared diagonal, where
+// fragments would be shaded twice.
+static const char* s_vert_shader_src =
+        "#version 330\n"
+        "void main()\n"
+        "{\n"
+        "    vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+        "    gl_Position = vec4(pos*2.0 - 1.0, 0.0, 1.0);\n"
+        "}\n";
+
 static bool compile_shader(GLenum type, const char *src[], unsigned int count, unsigned int *out) {
     unsigned int shader = glCreateShader(type);
     glShaderSource(shader, count, src, nullptr);
@@ -248,334 +383,3914 @@ static bool compile_shader(GLenum type, const char *src[], unsigned int count, u
     return true;
 }
 
-static char *read_file(const char *filepath) {
-    FILE *fp = fopen(filepath, "rb");
-    if (fp == nullptr) {
-        ERRORF("Failed to fopen() file %s.\n", filepath);
-        exit(EXIT_FAILURE);
-    }
+// The source strings given to the driver, to map the lines of its info log back to the files they came from.
+typedef struct {
+    const char *const *srcs;
+    const char *const *names; // Of each part of the preamble, nullptr for the expanded user source.
+    int count;
+} LogSources;
 
-    if (fseek(fp, 0, SEEK_END) < 0) {
-        ERRORF("Failed to fseek() to end of file %s.\n", filepath);
-        exit(EXIT_FAILURE);
-    }
-    long file_size = ftell(fp);
-    if (file_size == -1L) {
-        ERRORF("Failed to ftell() file %s.\n", filepath);
-        exit(EXIT_FAILURE);
+const char *shader_diagnostic_path(const Shader *shader, const ShaderDiagnostic *diagnostic) {
+    if (diagnostic->file_index >= 0) {
+        return shader->source_cache->files[diagnostic->file_index].path;
     }
-    rewind(fp);
 
-    char *buffer = (char *)calloc(file_size + 1, sizeof(char));
-    if (buffer == nullptr) {
-        ERRORF("Failed to malloc() file contents for %s.\n", filepath);
-        exit(EXIT_FAILURE);
-    }
+    return diagnostic->source_name;
+}
 
-    size_t result = fread(buffer, 1, file_size, fp);
-    if ((long)result != file_size) {
-        ERRORF("Failed to fread() file %s.\n", filepath);
-        exit(EXIT_FAILURE);
+static void log_diagnostic(const Shader *shader, const ShaderDiagnostic *diagnostic) {
+    char location[PATH_MAX + 32] = "";
+    const char *path = shader_diagnostic_path(shader, diagnostic);
+    if (path != nullptr && diagnostic->column > 0) {
+        snprintf(location, sizeof(location), "%s:%d:%d: ", path, diagnostic->line, diagnostic->column);
+    } else if (path != nullptr && diagnostic->line > 0) {
+        snprintf(location, sizeof(location), "%s:%d: ", path, diagnostic->line);
+    } else if (path != nullptr) {
+        snprintf(location, sizeof(location), "%s: ", path);
     }
 
-    fclose(fp);
-    return buffer;
+    if (diagnostic->severity == DIAGNOSTIC_WARNING) {
+        INFOF("%swarning: %s\n", location, diagnostic->message);
+    } else {
+        ERRORF("%serror: %s\n", location, diagnostic->message);
+    }
 }
 
-void shader_create(Shader *shader, const char *user_frag_shader_path) {
-    unsigned int vert_shader;
-    if (!compile_shader(GL_VERTEX_SHADER, (const GLchar **)&s_vert_shader_src, 1, &vert_shader)) {
-        log_shader_error("Failed to compile vertex shader.", vert_shader);
-        exit(EXIT_FAILURE);
+// Logs the diagnostic and adds it to shader, the ones past SHADER_MAX_DIAGNOSTICS are only logged.
+static void shader_add_diagnostic(Shader *shader, const ShaderDiagnostic *diagnostic) {
+    log_diagnostic(shader, diagnostic);
+    if (shader->num_diagnostics < SHADER_MAX_DIAGNOSTICS) {
+        shader->diagnostics[shader->num_diagnostics++] = *diagnostic;
     }
-
-    shader->user_frag_shader_path = user_frag_shader_path;
-    shader->vert_shader = vert_shader;
-    shader->compiled = false;
-
-    shader_compile(shader);
 }
 
-static void link_program(unsigned int program, unsigned int vert_shader, unsigned int frag_shader) {
-    glAttachShader(program, vert_shader);
-    glAttachShader(program, frag_shader);
+// Adds an error that doesn't come from the driver, e.g a file that can't be read. file_index is -1 and line 0 if
+// it has no location.
+static void shader_add_error(Shader *shader, int file_index, int line, const char *fmt, ...)
+        __attribute__((format(printf, 4, 5)));
 
-    glLinkProgram(program);
-    int linked = GL_TRUE;
-    glGetProgramiv(program, GL_LINK_STATUS, &linked);
-    if (linked != GL_TRUE) {
-        log_shader_error("Failed to link shader program.", program);
-        exit(EXIT_FAILURE);
-    }
+static void shader_add_error(Shader *shader, int file_index, int line, const char *fmt, ...) {
+    ShaderDiagnostic diagnostic = {DIAGNOSTIC_ERROR, file_index, nullptr, line, 0, ""};
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(diagnostic.message, sizeof(diagnostic.message), fmt, args);
+    va_end(args);
+
+    shader_add_diagnostic(shader, &diagnostic);
 }
 
-void shader_compile(Shader *shader) {
-    char *user_frag_shader_src = read_file(shader->user_frag_shader_path);
-    const char *frag_shader_srcs[] = {
-        s_shared_shader_src,
-        user_frag_shader_src
-    };
-    unsigned int frag_shader;
-    if (!compile_shader(GL_FRAGMENT_SHADER, frag_shader_srcs, 2, &frag_shader)) {
-        log_shader_error("Failed to compile fragment shader.", frag_shader);
-        free(user_frag_shader_src);
-        return;
+// Parses one line of an info log, in the format of Mesa ("0:12(5): error: msg"), NVIDIA ("0(12) : error C1008: msg"),
+// AMD and most other drivers ("ERROR: 0:12: msg") or GCC and Clang without columns ("shdy:12: error: msg"), or a
+// message without a location ("error: msg"). Returns false if the line is in none of them.
+static bool parse_info_log_line(const char *line, DiagnosticSeverity *out_severity, int *out_line, int *out_column,
+                                const char **out_message) {
+    int string_num;
+    int line_num = 0;
+    int column = 0;
+    char severity[16];
+    int len = 0;
+    bool matched = sscanf(line, "%d:%d(%d): %15[a-z]: %n", &string_num, &line_num, &column, severity, &len) == 4 &&
+                   len > 0;
+    if (!matched) {
+        column = 0;
+        matched = sscanf(line, "%d(%d) : %15[a-z] %n", &string_num, &line_num, severity, &len) == 3 && len > 0;
+        // Skip the error code, e.g "C1008:".
+        int code_len = 0;
+        char code[16];
+        if (matched && sscanf(line + len, "%15[A-Z0-9]: %n", code, &code_len) == 1 && code_len > 0) {
+            len += code_len;
+        }
     }
-    free(user_frag_shader_src);
-
-    INFOF("Shader %s compiled successfully.\n", shader->user_frag_shader_path);
-
-    if (shader->compiled) {
-        glDeleteProgram(shader->program);
-        shader->compiled = false;
+    if (!matched) {
+        matched = sscanf(line, "%15[A-Z]: %d:%d: %n", severity, &string_num, &line_num, &len) == 3 && len > 0;
+    }
+    if (!matched) {
+        matched = sscanf(line, "%*[^:]:%d: %15[a-z]: %n", &line_num, severity, &len) == 2 && len > 0;
+    }
+    if (!matched) {
+        line_num = 0;
+        matched = sscanf(line, "%15[a-zA-Z]: %n", severity, &len) == 1 && len > 0 &&
+                  (strcasecmp(severity, "error") == 0 || strcasecmp(severity, "warning") == 0);
+    }
+    if (!matched) {
+        return false;
     }
 
-    unsigned int program = glCreateProgram();
-    link_program(program, shader->vert_shader, frag_shader);
-
-    glDeleteShader(frag_shader);
+    *out_severity = strcasecmp(severity, "warning") == 0 ? DIAGNOSTIC_WARNING : DIAGNOSTIC_ERROR;
+    *out_line = line_num;
+    *out_column = column;
+    *out_message = line + len;
 
-    shader->uniform_resolution_loc = glGetUniformLocation(program, "uResolution");
-    shader->uniform_elapsed_time_loc = glGetUniformLocation(program, "uTime");
-    shader->program = program;
-    shader->compiled = true;
+    return true;
 }
 
-void shader_set_uniform_resolution(Shader *shader, int width, int height) {
-    assert(shader->compiled);
+// Finds the source string that line of the concatenated sources falls in, drivers number the lines of all the strings
+// as one source without #line directives, and maps it to the file or part of the preamble it came from.
+static void map_log_line(const Shader *shader, const LogSources *sources, int line, ShaderDiagnostic *diagnostic) {
+    int start = 1;
+    for (int i = 0; i < sources->count; i++) {
+        int lines = 0;
+        for (const char *str = strchr(sources->srcs[i], '\n'); str != nullptr; str = strchr(str + 1, '\n')) {
+            lines++;
+        }
 
-    glUniform2f(shader->uniform_resolution_loc, (float)width, (float)height);
+        if (line < start + lines || i == sources->count - 1) {
+            int src_line = line - start + 1;
+            if (sources->names[i] != nullptr) {
+                diagnostic->source_name = sources->names[i];
+                diagnostic->line = src_line;
+            } else if (!source_line_map_lookup(&shader->line_map, src_line, &diagnostic->file_index,
+                                               &diagnostic->line)) {
+                diagnostic->line = 0;
+                diagnostic->column = 0;
+            }
+            return;
+        }
+        start += lines;
+    }
 }
 
-void shader_set_uniform_elapsed_time(Shader *shader, float elapsed_time) {
-    assert(shader->compiled);
+// Parses info_log into diagnostics of shader, modifying it. Lines that aren't in a known format, e.g the continuation
+// of a message, are kept without a location.
+static void shader_add_info_log(Shader *shader, char *info_log, const LogSources *sources) {
+    DiagnosticSeverity severity = DIAGNOSTIC_ERROR;
+    char *line = info_log;
+    while (*line != '\0') {
+        char *newline = strchr(line, '\n');
+        char *next = newline != nullptr ? newline + 1 : line + strlen(line);
+        char *end = newline != nullptr ? newline : next;
+        while (end > line && isspace((unsigned char)end[-1])) {
+            end--;
+        }
+        *end = '\0';
 
-    glUniform1f(shader->uniform_elapsed_time_loc, elapsed_time);
-}
+        int log_line;
+        int column;
+        const char *message;
+        if (!parse_info_log_line(line, &severity, &log_line, &column, &message)) {
+            log_line = 0;
+            column = 0;
+            message = line;
+            while (isspace((unsigned char)*message)) {
+                message++;
+            }
+        }
 
-static const char *print_size_str_tbl[] = {
-        "",             // PRINTING_DISABLED
-        "720p",         // PRINT_SIZE_720P
-        "1080p",        // PRINT_SIZE_1080P
-        "4k",           // PRINT_SIZE_4K
-        "5k",           // PRINT_SIZE_5K
-        "A3-150dpi",    // PRINT_SIZE_A3_150DPI
-        "A3-300dpi"     // PRINT_SIZE_A3_300DPI
-};
+        // glslang and AMD end the log with a count, e.g "ERROR: 2 compilation errors.  No code generated."
+        int count;
+        char summary[16];
+        bool is_summary = log_line == 0 && sscanf(message, "%d compilation %15s", &count, summary) == 2;
 
-static PrintSize print_size_from_str(const char *str) {
-    for (int i = 0; i < ARRAY_LEN(print_size_str_tbl); i++) {
-        if (strcmp(str, print_size_str_tbl[i]) == 0) {
-            return (PrintSize)i;
+        if (*message != '\0' && !is_summary) {
+            ShaderDiagnostic diagnostic = {severity, -1, nullptr, 0, column, ""};
+            snprintf(diagnostic.message, sizeof(diagnostic.message), "%s", message);
+            if (log_line > 0) {
+                map_log_line(shader, sources, log_line, &diagnostic);
+            }
+            shader_add_diagnostic(shader, &diagnostic);
         }
+
+        line = next;
     }
+}
 
-    ERRORF("Print size %s is not valid.\n", str);
+// Parses the info log of the shader or program id into diagnostics of shader.
+static void shader_add_log_diagnostics(Shader *shader, unsigned int id, const LogSources *sources) {
+    int max_len = 0;
+    if (glIsShader(id)) {
+        glGetShaderiv(id, GL_INFO_LOG_LENGTH, &max_len);
+    } else {
+        glGetProgramiv(id, GL_INFO_LOG_LENGTH, &max_len);
+    }
+    if (max_len <= 1) {
+        return;
+    }
 
-    return PRINTING_DISABLED;
+    char *info_log = (char *)malloc(max_len);
+    if (info_log == nullptr) {
+        ERRORF("Failed to malloc() info log.\n");
+        return;
+    }
+    if (glIsShader(id)) {
+        glGetShaderInfoLog(id, max_len, nullptr, info_log);
+    } else {
+        glGetProgramInfoLog(id, max_len, nullptr, info_log);
+    }
+    shader_add_info_log(shader, info_log, sources);
+    free(info_log);
 }
 
-void print_size_get_dimensions(PrintSize print_size, int *out_width, int *out_height) {
-    switch (print_size) {
-        case PRINT_SIZE_720p:
-            *out_width = 1280;
-            *out_height = 720;
-            break;
-        case PRINT_SIZE_1080P:
-            *out_width = 1920;
-            *out_height = 1080;
-            break;
-        case PRINT_SIZE_4K:
-            *out_width = 3840;
-            *out_height = 2160;
-            break;
-        case PRINT_SIZE_5K:
-            *out_width = 5120;
-            *out_height = 2160;
-            break;
-        case PRINT_SIZE_A3_150DPI:
-            *out_width = 2480;
-            *out_height = 1754;
-            break;
-        case PRINT_SIZE_A3_300DPI:
-            *out_width = 4960;
-            *out_height = 3508;
-            break;
-        case PRINTING_DISABLED:
-        default:
-            *out_width = 0;
-            *out_height = 0;
-            break;
+void str_buf_reserve(StrBuf *str_buf, size_t len) {
+    if (str_buf->len + len + 1 > str_buf->cap) {
+        size_t cap = str_buf->cap == 0 ? 4096 : str_buf->cap;
+        while (str_buf->len + len + 1 > cap) {
+            cap *= 2;
+        }
+
+        char *data = (char *)realloc(str_buf->data, cap);
+        if (data == nullptr) {
+            ERRORF("Failed to realloc() string buffer.\n");
+            exit(EXIT_FAILURE);
+        }
+        str_buf->data = data;
+        str_buf->cap = cap;
     }
 }
 
-static const float s_quad_verts[] = {
-    1.0f, 1.0f,   // top-right
-    1.0f, -1.0f,  // bottom-right
-    -1.0f, -1.0f, // bottom-left
-    -1.0f, 1.0f   // top-left
-};
+void str_buf_append(StrBuf *str_buf, const char *str, size_t len) {
+    str_buf_reserve(str_buf, len);
+    memcpy(str_buf->data + str_buf->len, str, len);
+    str_buf->len += len;
+    str_buf->data[str_buf->len] = '\0';
+}
 
-static const unsigned int s_quad_elements[] = {
-    0, 1, 3, // first triangle
-    1, 2, 3  // second triangle
-};
+void str_buf_appendf(StrBuf *str_buf, const char *fmt, ...) {
+    char buffer[256];
 
-void shader_renderer_create(ShaderRenderer *shader_renderer, const char *frag_shader_path) {
-    unsigned int vao;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
 
-    unsigned int vbo;
-    glGenBuffers(1, &vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(s_quad_verts), s_quad_verts, GL_STATIC_DRAW);
+    if (len < 0) {
+        return;
+    }
+    if ((size_t)len < sizeof(buffer)) {
+        str_buf_append(str_buf, buffer, len);
+        return;
+    }
 
-    unsigned int ebo;
-    glGenBuffers(1, &ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(s_quad_elements), s_quad_elements, GL_STATIC_DRAW);
+    char *large_buffer = (char *)malloc(len + 1);
+    if (large_buffer == nullptr) {
+        ERRORF("Failed to malloc() string buffer.\n");
+        exit(EXIT_FAILURE);
+    }
+    va_start(args, fmt);
+    vsnprintf(large_buffer, len + 1, fmt, args);
+    va_end(args);
+    str_buf_append(str_buf, large_buffer, len);
+    free(large_buffer);
+}
 
-    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GL_FLOAT), (void*)0);
-    glEnableVertexAttribArray(0);
+void str_buf_clear(StrBuf *str_buf) {
+    str_buf->len = 0;
+    if (str_buf->data != nullptr) {
+        str_buf->data[0] = '\0';
+    }
+}
 
-    shader_renderer->vao = vao;
-    shader_renderer->vbo = vbo;
-    shader_renderer->ebo = ebo;
-    shader_create(&shader_renderer->shader, frag_shader_path);
+void str_buf_free(StrBuf *str_buf) {
+    free(str_buf->data);
+    str_buf->data = nullptr;
+    str_buf->len = 0;
+    str_buf->cap = 0;
 }
 
-static void shader_renderer_print_begin(ShaderRenderer *shader_renderer) {
-    INFOF("Rendering shader for print with dimensions %dx%d...\n", shader_renderer->width, shader_renderer->height);
+// Opens the file at path, returning its fd and size, or -1 if it can't be opened.
+static int open_file(const char *path, size_t *out_size) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        ERRORF("Failed to open() %s: %s.\n", path, strerror(errno));
+        return -1;
+    }
 
-    unsigned int fbo;
-    glGenFramebuffers(1, &fbo);
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        ERRORF("Failed to fstat() %s: %s.\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        ERRORF("Failed to read %s, it isn't a regular file.\n", path);
+        close(fd);
+        return -1;
+    }
 
-    unsigned int tbo;
-    glGenTextures(1, &tbo);
-    glBindTexture(GL_TEXTURE_2D, tbo);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, shader_renderer->width, shader_renderer->height, 0,
-                 GL_RGB, GL_UNSIGNED_BYTE, nullptr);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tbo, 0);
+    *out_size = (size_t)st.st_size;
+    return fd;
+}
 
-    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-        ERRORF("Failure in call to glCheckFrameBufferStatus() returned framebuffer not complete\n");
-        exit(EXIT_FAILURE);
+// Appends the rest of fd to out. Reads until the end of file rather than size bytes, in case the file grew since it
+// was opened.
+static bool read_fd(int fd, const char *path, size_t size, StrBuf *out) {
+    str_buf_reserve(out, size + 1);
+    while (true) {
+        if (out->len + 1 == out->cap) {
+            str_buf_reserve(out, out->cap);
+        }
+        ssize_t len = read(fd, out->data + out->len, out->cap - out->len - 1);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ERRORF("Failed to read() %s: %s.\n", path, strerror(errno));
+            return false;
+        }
+        if (len == 0) {
+            break;
+        }
+        out->len += len;
     }
+    out->data[out->len] = '\0';
+
+    return true;
 }
 
-static void shader_renderer_print_end(ShaderRenderer *shader_renderer, const char *output_path) {
-    glFinish();
+// Maps size bytes of fd read only, or returns nullptr.
+static void *map_fd(int fd, const char *path, size_t size) {
+    void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        ERRORF("Failed to mmap() %s: %s.\n", path, strerror(errno));
+        return nullptr;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
 
-    int width = shader_renderer->width;
-    int height = shader_renderer->height;
-    int num_comp = 3;
-    int stride = num_comp * width;
+    return map;
+}
 
-    char *buffer = (char *)calloc(num_comp, width * height);
-    if (buffer == nullptr) {
-        ERRORF("Failed to calloc() for image buffer.\n");
-        exit(EXIT_FAILURE);
-    }
+bool file_read(const char *path, StrBuf *out) {
+    str_buf_clear(out);
 
-    glGetTexImage(GL_TEXTURE_2D, 0, GL_RGB, GL_UNSIGNED_BYTE, buffer);
-    GLenum err = glGetError();
-    if (err != GL_NO_ERROR) {
-      ERRORF("glReadPixels() failed with code: %d\n", err);
-      exit(EXIT_FAILURE);
+    size_t size;
+    int fd = open_file(path, &size);
+    if (fd < 0) {
+        return false;
     }
 
-    INFOF("Print rendering complete, writing pixel data to %s...\n", output_path);
-    stbi_flip_vertically_on_write(true);
-    int ret = stbi_write_png(output_path, width, height, num_comp, buffer, stride);
-    if (ret == 0) {
-        ERRORF("stbi_write_png() failed to write image to: %s\n", output_path);
-        free(buffer);
-        exit(EXIT_FAILURE);
+    // Mapping would only save the copy into out, which happens anyway.
+    bool ok = read_fd(fd, path, size, out);
+    close(fd);
+
+    if (!ok) {
+        str_buf_clear(out);
     }
 
-    free(buffer);
-    INFOF("Print written to %s successfully!\n", output_path);
+    return ok;
 }
 
-void shader_renderer_draw(ShaderRenderer *shader_renderer, float elapsed_time) {
-    glViewport(0, 0, shader_renderer->width, shader_renderer->height);
-    glClear(GL_COLOR_BUFFER_BIT);
+// The mapped view being read on each thread.
+static thread_local FileView *s_mapped_view = nullptr;
+static pthread_once_t s_sigbus_once = PTHREAD_ONCE_INIT;
+static uintptr_t s_page_size;
 
-    glUseProgram(shader_renderer->shader.program);
-    shader_set_uniform_resolution(&shader_renderer->shader, shader_renderer->width, shader_renderer->height);
-    shader_set_uniform_elapsed_time(&shader_renderer->shader, elapsed_time);
+// A mapped file that is truncated while it's read, e.g by an editor saving it in place, raises SIGBUS on the pages
+// past its new end. Those pages are replaced with zeros so the read can finish, and the view is marked truncated so
+// the reader fails and retries on the next change. Any other SIGBUS is left to crash as usual.
+static void file_view_sigbus_handler(int, siginfo_t *info, void *) {
+    FileView *view = s_mapped_view;
+    auto *addr = (const char *)info->si_addr;
+    if (view == nullptr || addr < view->data || addr >= view->data + view->len) {
+        signal(SIGBUS, SIG_DFL);
+        return;
+    }
 
-    glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+    void *page = (void *)((uintptr_t)addr & ~(s_page_size - 1));
+    if (mmap(page, s_page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        signal(SIGBUS, SIG_DFL);
+        return;
+    }
+    view->truncated = 1;
 }
 
-void shader_renderer_draw_to_print(ShaderRenderer *shader_renderer, const char *output_path) {
-    assert(output_path != nullptr);
+static void file_view_init_sigbus() {
+    s_page_size = (uintptr_t)sysconf(_SC_PAGESIZE);
 
-    shader_renderer_print_begin(shader_renderer);
-    shader_renderer_draw(shader_renderer, 1.0f);
-    shader_renderer_print_end(shader_renderer, output_path);
+    struct sigaction action = {};
+    action.sa_sigaction = file_view_sigbus_handler;
+    action.sa_flags = SA_SIGINFO;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGBUS, &action, nullptr);
 }
 
-void shader_renderer_reload(ShaderRenderer *shader_renderer) {
-    shader_compile(&shader_renderer->shader);
-}
+bool file_view_open(FileView *view, const char *path) {
+    file_view_close(view);
+    str_buf_clear(&view->buf);
+    view->truncated = 0;
 
-void file_watcher_create(FileWatcher *file_watcher, const char *filepath) {
-    int fd = inotify_init1(IN_NONBLOCK);
+    size_t size;
+    int fd = open_file(path, &size);
     if (fd < 0) {
-        ERRORF("Failure in call to inotify_init(): %s.\n", strerror(errno));
-        exit(EXIT_FAILURE);
+        return false;
     }
 
-    int wd = inotify_add_watch(fd, filepath, IN_CLOSE_WRITE);
-    if (wd < 0) {
-        ERRORF("Failure in call to inotify_add_watch(): %s.\n", strerror(errno));
-        exit(EXIT_FAILURE);
+    bool ok;
+    if (size < FILE_MAP_MIN_SIZE) {
+        ok = read_fd(fd, path, size, &view->buf);
+        view->data = view->buf.data;
+        view->len = view->buf.len;
+    } else {
+        pthread_once(&s_sigbus_once, file_view_init_sigbus);
+        view->map = map_fd(fd, path, size);
+        ok = view->map != nullptr;
+        view->data = (const char *)view->map;
+        view->len = ok ? size : 0;
+        if (ok) {
+            s_mapped_view = view;
+        }
     }
+    close(fd);
 
-    file_watcher->filepath = filepath;
-    file_watcher->fd = fd;
-    file_watcher->wd = wd;
-    file_watcher->modified = false;
+    return ok;
+}
+
+void file_view_close(FileView *view) {
+    if (view->map != nullptr) {
+        munmap(view->map, view->len);
+        view->map = nullptr;
+        if (s_mapped_view == view) {
+            s_mapped_view = nullptr;
+        }
+    }
+    view->data = nullptr;
+    view->len = 0;
+}
+
+void file_view_free(FileView *view) {
+    file_view_close(view);
+    str_buf_free(&view->buf);
+}
+
+// 64 bit FNV-1a.
+uint64_t hash_bytes(const char *data, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+bool cache_file_path(const char *dir_name, uint64_t key, const char *ext, char *out) {
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char dir[PATH_MAX];
+    if (cache_home != nullptr && cache_home[0] == '/') {
+        snprintf(dir, sizeof(dir), "%s/shdy/%s", cache_home, dir_name);
+    } else if (home != nullptr && home[0] != '\0') {
+        snprintf(dir, sizeof(dir), "%s/.cache/shdy/%s", home, dir_name);
+    } else {
+        return false;
+    }
+
+    // Create each missing directory along the path, like mkdir -p.
+    for (char *slash = strchr(dir + 1, '/');; slash = strchr(slash + 1, '/')) {
+        if (slash != nullptr) {
+            *slash = '\0';
+        }
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            ERRORF("Failed to create cache directory %s: %s.\n", dir, strerror(errno));
+            return false;
+        }
+        if (slash == nullptr) {
+            break;
+        }
+        *slash = '/';
+    }
+
+    return snprintf(out, PATH_MAX, "%s/%016llx.%s", dir, (unsigned long long)key, ext) < PATH_MAX;
+}
+
+bool socket_send_all(int fd, const void *data, size_t len) {
+    const auto *bytes = (const uint8_t *)data;
+    while (len > 0) {
+        ssize_t sent = send(fd, bytes, len, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        bytes += sent;
+        len -= (size_t)sent;
+    }
+
+    return true;
+}
+
+bool socket_recv_all(int fd, void *data, size_t len) {
+    auto *bytes = (uint8_t *)data;
+    while (len > 0) {
+        ssize_t received = recv(fd, bytes, len, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        bytes += received;
+        len -= (size_t)received;
+    }
+
+    return true;
+}
+
+// Splits path into its directory, written to out_dirpath, and its file name.
+static const char *split_path(const char *path, char *out_dirpath) {
+    const char *slash = strrchr(path, '/');
+    if (slash == nullptr) {
+        snprintf(out_dirpath, PATH_MAX, ".");
+        return path;
+    }
+
+    if (slash == path) {
+        snprintf(out_dirpath, PATH_MAX, "/");
+    } else {
+        snprintf(out_dirpath, PATH_MAX, "%.*s", (int)(slash - path), path);
+    }
+
+    return slash + 1;
+}
+
+// Resolves path to an absolute path. Files that don't exist yet are resolved through their directory so
+// they still get a stable key.
+static void resolve_path(const char *path, char *out) {
+    if (realpath(path, out) != nullptr) {
+        return;
+    }
+
+    char dirpath[PATH_MAX];
+    const char *name = split_path(path, dirpath);
+
+    char abs_dirpath[PATH_MAX];
+    size_t name_len = strlen(name);
+    if (realpath(dirpath, abs_dirpath) == nullptr || strlen(abs_dirpath) + name_len + 2 > PATH_MAX) {
+        snprintf(out, PATH_MAX, "%s", path);
+        return;
+    }
+
+    size_t dir_len = strcmp(abs_dirpath, "/") == 0 ? 0 : strlen(abs_dirpath);
+    memcpy(out, abs_dirpath, dir_len);
+    out[dir_len] = '/';
+    memcpy(out + dir_len + 1, name, name_len + 1);
+}
+
+void source_cache_destroy(SourceCache *source_cache) {
+    for (int i = 0; i < source_cache->num_files; i++) {
+        free(source_cache->files[i].path);
+        str_buf_free(&source_cache->files[i].src);
+    }
+    source_cache->num_files = 0;
+}
+
+static int source_cache_find(SourceCache *source_cache, const char *abs_path) {
+    for (int i = 0; i < source_cache->num_files; i++) {
+        if (strcmp(source_cache->files[i].path, abs_path) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+int source_cache_add(SourceCache *source_cache, const char *path) {
+    char abs_path[PATH_MAX];
+    resolve_path(path, abs_path);
+
+    int index = source_cache_find(source_cache, abs_path);
+    if (index >= 0) {
+        return index;
+    }
+
+    if (source_cache->num_files == SOURCE_CACHE_MAX_FILES) {
+        ERRORF("Unable to add source %s, limit of %d files reached.\n", path, SOURCE_CACHE_MAX_FILES);
+        return -1;
+    }
+
+    SourceFile *file = &source_cache->files[source_cache->num_files];
+    file->path = strdup(abs_path);
+    file->src = {};
+    file->readable = false;
+    file->hash = 0;
+    file->stale = true;
+    file->num_includes = 0;
+
+    return source_cache->num_files++;
+}
+
+// Finds the #include "file" directives in the file and adds the included files to the cache.
+static void source_cache_parse_includes(SourceCache *source_cache, int index) {
+    SourceFile *file = &source_cache->files[index];
+    file->num_includes = 0;
+
+    const char *src = file->src.data;
+    size_t len = file->src.len;
+    int line = 1;
+    for (size_t start = 0; start < len; line++) {
+        const char *newline = (const char *)memchr(src + start, '\n', len - start);
+        size_t end = newline != nullptr ? (size_t)(newline - src) + 1 : len;
+
+        const char *ptr = src + start;
+        while (*ptr == ' ' || *ptr == '\t') ptr++;
+        if (*ptr == '#') {
+            ptr++;
+            while (*ptr == ' ' || *ptr == '\t') ptr++;
+            if (strncmp(ptr, "include", 7) == 0) {
+                ptr += 7;
+                while (*ptr == ' ' || *ptr == '\t') ptr++;
+                const char *name_end = *ptr == '"' ? strchr(ptr + 1, '"') : nullptr;
+
+                if (name_end == nullptr || name_end > src + end) {
+                    ERRORF("Malformed #include in %s on line %d.\n", file->path, line);
+                } else if (file->num_includes == SOURCE_FILE_MAX_INCLUDES) {
+                    ERRORF("Too many #include directives in %s, limit is %d.\n", file->path,
+                           SOURCE_FILE_MAX_INCLUDES);
+                } else {
+                    // Included files are relative to the directory of the including file.
+                    char include_path[PATH_MAX];
+                    const char *slash = strrchr(file->path, '/');
+                    int name_len = (int)(name_end - ptr - 1);
+                    if (ptr[1] == '/') {
+                        snprintf(include_path, sizeof(include_path), "%.*s", name_len, ptr + 1);
+                    } else {
+                        snprintf(include_path, sizeof(include_path), "%.*s/%.*s", (int)(slash - file->path),
+                                 file->path, name_len, ptr + 1);
+                    }
+
+                    SourceInclude *include = &file->includes[file->num_includes++];
+                    include->start = start;
+                    include->end = end;
+                    include->line = line;
+                    include->file_index = source_cache_add(source_cache, include_path);
+                }
+            }
+        }
+
+        start = end;
+    }
+}
+
+static bool source_cache_load(SourceCache *source_cache, int index) {
+    SourceFile *file = &source_cache->files[index];
+    if (!file->stale) {
+        return file->readable;
+    }
+
+    file->hash = 0;
+    file->num_includes = 0;
+    file->stale = false;
+
+    // A failed read leaves the file unreadable until the next change to it, e.g once an editor finishes saving.
+    file->readable = file_read(file->path, &file->src);
+    if (!file->readable) {
+        return false;
+    }
+
+    file->hash = hash_bytes(file->src.data, file->src.len);
+    source_cache_parse_includes(source_cache, index);
+
+    return true;
+}
+
+int source_cache_update(SourceCache *source_cache, const char *path) {
+    char abs_path[PATH_MAX];
+    resolve_path(path, abs_path);
+
+    int index = source_cache_find(source_cache, abs_path);
+    if (index < 0) {
+        return -1;
+    }
+
+    SourceFile *file = &source_cache->files[index];
+    bool was_readable = file->readable;
+    uint64_t prev_hash = file->hash;
+
+    file->stale = true;
+    bool readable = source_cache_load(source_cache, index);
+
+    // Editors often touch a file without changing it, there is nothing to reload in that case.
+    if (readable == was_readable && file->hash == prev_hash) {
+        return -1;
+    }
+
+    return index;
+}
+
+// Counts the lines of out scanned since the last call.
+static void source_line_map_scan(SourceLineMap *line_map, const StrBuf *out) {
+    const char *end = out->data + out->len;
+    for (const char *str = out->data + line_map->scanned; str < end; str++) {
+        str = (const char *)memchr(str, '\n', end - str);
+        if (str == nullptr) {
+            break;
+        }
+        line_map->lines++;
+    }
+    line_map->scanned = out->len;
+}
+
+// Starts a span at the end of out, where line file_line of the file is about to be appended.
+static void source_line_map_add(SourceLineMap *line_map, const StrBuf *out, int file_index, int file_line) {
+    if (line_map == nullptr) {
+        return;
+    }
+    source_line_map_scan(line_map, out);
+
+    // An empty span, e.g of an empty included file, is replaced by the one following it.
+    int line = line_map->lines + 1;
+    if (line_map->num_spans > 0 && line_map->spans[line_map->num_spans - 1].line == line) {
+        line_map->num_spans--;
+    }
+
+    if (line_map->num_spans == line_map->cap) {
+        int cap = line_map->cap == 0 ? 16 : line_map->cap * 2;
+        auto *spans = (SourceLineSpan *)realloc(line_map->spans, cap * sizeof(SourceLineSpan));
+        if (spans == nullptr) {
+            ERRORF("Failed to realloc() source line map.\n");
+            exit(EXIT_FAILURE);
+        }
+        line_map->spans = spans;
+        line_map->cap = cap;
+    }
+    line_map->spans[line_map->num_spans++] = {line, file_index, file_line};
+}
+
+bool source_line_map_lookup(const SourceLineMap *line_map, int line, int *out_file_index, int *out_file_line) {
+    // The last line may not end with a newline.
+    if (line < 1 || line > line_map->lines + 1) {
+        return false;
+    }
+
+    for (int i = line_map->num_spans - 1; i >= 0; i--) {
+        const SourceLineSpan *span = &line_map->spans[i];
+        if (span->line <= line) {
+            *out_file_index = span->file_index;
+            *out_file_line = span->file_line + line - span->line;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void source_line_map_free(SourceLineMap *line_map) {
+    free(line_map->spans);
+    *line_map = {};
+}
+
+static bool source_cache_expand_file(SourceCache *source_cache, int index, StrBuf *out, int *deps, int *num_deps,
+                                     int max_deps, SourceLineMap *line_map) {
+    if (*num_deps == max_deps) {
+        ERRORF("Too many source dependencies, limit is %d.\n", max_deps);
+        return false;
+    }
+
+    deps[(*num_deps)++] = index;
+
+    if (!source_cache_load(source_cache, index)) {
+        return false;
+    }
+
+    const SourceFile *file = &source_cache->files[index];
+    bool ok = true;
+
+    // Lines are mapped back to their files rather than with #line directives, which drivers disagree on, e.g
+    // whether the number applies to the directive's own line or the next one.
+    source_line_map_add(line_map, out, index, 1);
+
+    size_t offset = 0;
+    for (int i = 0; i < file->num_includes; i++) {
+        const SourceInclude *include = &file->includes[i];
+        str_buf_append(out, file->src.data + offset, include->start - offset);
+        offset = include->end;
+
+        if (include->file_index < 0) {
+            ok = false;
+            str_buf_append(out, "\n", 1);
+            continue;
+        }
+
+        // Each file is only included once, like #pragma once.
+        bool included = false;
+        for (int j = 0; j < *num_deps; j++) {
+            included = included || deps[j] == include->file_index;
+        }
+        if (included) {
+            str_buf_append(out, "\n", 1);
+            continue;
+        }
+
+        if (!source_cache_expand_file(source_cache, include->file_index, out, deps, num_deps, max_deps, line_map)) {
+            ERRORF("Failed to include %s from %s on line %d.\n", source_cache->files[include->file_index].path,
+                   file->path, include->line);
+            ok = false;
+        }
+        if (out->len > 0 && out->data[out->len - 1] != '\n') {
+            str_buf_append(out, "\n", 1);
+        }
+        source_line_map_add(line_map, out, index, include->line + 1);
+    }
+    str_buf_append(out, file->src.data + offset, file->src.len - offset);
+
+    return ok;
+}
+
+bool source_cache_expand(SourceCache *source_cache, int root, StrBuf *out, int *deps, int *num_deps, int max_deps,
+                         SourceLineMap *line_map) {
+    *num_deps = 0;
+    if (line_map != nullptr) {
+        line_map->num_spans = 0;
+        line_map->scanned = out->len;
+        line_map->lines = 0;
+    }
+
+    bool ok = source_cache_expand_file(source_cache, root, out, deps, num_deps, max_deps, line_map);
+    if (line_map != nullptr) {
+        source_line_map_scan(line_map, out);
+    }
+
+    return ok;
+}
+
+// Writes the SPIR-V of the concatenated sources to out, loaded from the cache or compiled with glslang and then cached.
+// The cache is keyed by the source rather than the driver, so unlike program binaries it survives driver updates.
+// Returns false and adds the errors to the diagnostics of shader if it fails to compile.
+static bool spirv_get(Shader *shader, GlslStage stage, const LogSources *sources, StrBuf *out) {
+    StrBuf src = {};
+    for (int i = 0; i < sources->count; i++) {
+        str_buf_append(&src, sources->srcs[i], strlen(sources->srcs[i]));
+    }
+    uint64_t salt = (uint64_t)SPIRV_CACHE_VERSION << 8 | stage;
+    uint64_t key = hash_bytes(src.data, src.len) ^ salt * 0x9e3779b97f4a7c15ULL;
+
+    bool ok = true;
+    if (!spirv_cache_load(key, out)) {
+        double start = get_time_ms();
+        StrBuf log = {};
+        ok = glsl_compile_spirv(src.data, stage, out, &log);
+        if (ok) {
+            INFOF("Compiled %s to SPIR-V in %.2fms.\n", shader->user_frag_shader_path, get_time_ms() - start);
+            spirv_cache_store(key, out);
+        } else {
+            ERRORF("Failed to compile %s to SPIR-V.\n", shader->user_frag_shader_path);
+            shader_add_info_log(shader, log.data != nullptr ? log.data : (char *)"", sources);
+        }
+        str_buf_free(&log);
+    }
+    str_buf_free(&src);
+
+    return ok;
+}
+
+// Creates a shader object from the SPIR-V module and specializes its main entry point with the given constants.
+static bool load_spirv_shader(Shader *shader, GLenum type, const StrBuf *spirv, const unsigned int *const_ids,
+                              const unsigned int *const_values, int num_consts, const LogSources *sources,
+                              unsigned int *out) {
+    unsigned int id = glCreateShader(type);
+    glShaderBinary(1, &id, GL_SHADER_BINARY_FORMAT_SPIR_V, spirv->data, (GLsizei)spirv->len);
+    glSpecializeShader(id, "main", num_consts, const_ids, const_values);
+
+    int compiled = GL_FALSE;
+    glGetShaderiv(id, GL_COMPILE_STATUS, &compiled);
+    if (compiled != GL_TRUE) {
+        ERRORF("Failed to specialize the SPIR-V of %s.\n", shader->user_frag_shader_path);
+        shader_add_log_diagnostics(shader, id, sources);
+        glDeleteShader(id);
+        return false;
+    }
+    *out = id;
+
+    return true;
+}
+
+// Sets up the shader without any GL objects, e.g for validating its sources without a context.
+static void shader_init(Shader *shader, SourceCache *source_cache, const char *user_frag_shader_path,
+                        const ShaderDefine *cli_defines, int num_cli_defines, bool compute) {
+    shader->user_frag_shader_path = user_frag_shader_path;
+    shader->source_cache = source_cache;
+    shader->compute = compute;
+    shader->cli_defines = cli_defines;
+    shader->num_cli_defines = num_cli_defines;
+    shader->defines_src = {};
+    shader->expanded_src = {};
+    shader->line_map = {};
+    shader->num_diagnostics = 0;
+    shader->failed = false;
+    for (int i = 0; i < SHADER_MAX_BUFFERS; i++) {
+        shader->buffer_paths[i][0] = '\0';
+        shader->buffer_compute[i] = false;
+    }
+    shader->num_textures = 0;
+    shader->num_params = 0;
+    shader->num_deps = 0;
+    shader->outdated = true;
+    shader->vert_shader = 0;
+    shader->spirv = false;
+    shader->num_uniforms = 0;
+    shader->compiled = false;
+    shader->time_varying = true;
+}
+
+void shader_create(Shader *shader, SourceCache *source_cache, const char *user_frag_shader_path,
+                   const ShaderDefine *cli_defines, int num_cli_defines, bool compute, bool spirv) {
+    shader_init(shader, source_cache, user_frag_shader_path, cli_defines, num_cli_defines, compute);
+    shader->spirv = spirv;
+
+    // A program can't mix SPIR-V and GLSL shaders, so SPIR-V programs need a SPIR-V vertex shader too.
+    unsigned int vert_shader = 0;
+    bool vert_ok = true;
+    const char *srcs[] = {s_vert_shader_src};
+    const char *names[] = {VERTEX_SHADER_NAME};
+    LogSources sources = {srcs, names, 1};
+    if (!compute && spirv) {
+        StrBuf spirv_src = {};
+        vert_ok = spirv_get(shader, GLSL_STAGE_VERTEX, &sources, &spirv_src) &&
+                  load_spirv_shader(shader, GL_VERTEX_SHADER, &spirv_src, nullptr, nullptr, 0, &sources, &vert_shader);
+        str_buf_free(&spirv_src);
+    } else if (!compute) {
+        vert_ok = compile_shader(GL_VERTEX_SHADER, srcs, 1, &vert_shader);
+        if (!vert_ok) {
+            shader_add_log_diagnostics(shader, vert_shader, &sources);
+        }
+    }
+    if (!vert_ok) {
+        ERRORF("Failed to create the vertex shader.\n");
+        exit(EXIT_FAILURE);
+    }
+    shader->vert_shader = vert_shader;
+
+    shader_compile(shader);
+}
+
+static bool is_ident_char(char ch, bool first) {
+    return isalpha((unsigned char)ch) || ch == '_' || (!first && isdigit((unsigned char)ch));
+}
+
+static const char *skip_blanks(const char *str, const char *end) {
+    while (str < end && (*str == ' ' || *str == '\t')) {
+        str++;
+    }
+    return str;
+}
+
+// Sets define from the name and value strings, trimming trailing blanks off the value. An empty value is 1.
+static bool shader_define_set(ShaderDefine *define, const char *name, size_t name_len, const char *value,
+                              size_t value_len) {
+    if (name_len == 0 || name_len >= SHADER_DEFINE_MAX_NAME) {
+        return false;
+    }
+    for (size_t i = 0; i < name_len; i++) {
+        if (!is_ident_char(name[i], i == 0)) {
+            return false;
+        }
+    }
+
+    while (value_len > 0 && isspace((unsigned char)value[value_len - 1])) {
+        value_len--;
+    }
+    if (value_len == 0) {
+        value = "1";
+        value_len = 1;
+    }
+    if (value_len >= SHADER_DEFINE_MAX_VALUE) {
+        return false;
+    }
+
+    memcpy(define->name, name, name_len);
+    define->name[name_len] = '\0';
+    memcpy(define->value, value, value_len);
+    define->value[value_len] = '\0';
+
+    return true;
+}
+
+bool shader_define_parse(ShaderDefine *define, const char *str) {
+    const char *eq = strchr(str, '=');
+    if (eq == nullptr) {
+        return shader_define_set(define, str, strlen(str), "", 0);
+    }
+
+    return shader_define_set(define, str, eq - str, eq + 1, strlen(eq + 1));
+}
+
+// Matches word at str followed by a blank or the end of the line, returning the position after it.
+static const char *match_word(const char *str, const char *end, const char *word) {
+    size_t len = strlen(word);
+    if ((size_t)(end - str) < len || strncmp(str, word, len) != 0) {
+        return nullptr;
+    }
+    str += len;
+    if (str < end && *str != ' ' && *str != '\t') {
+        return nullptr;
+    }
+
+    return skip_blanks(str, end);
+}
+
+// Matches a "#pragma shdy DIRECTIVE ARGS" line, returning the start of ARGS or nullptr if the line isn't one.
+static const char *match_pragma(const char *line, const char *end, const char *directive) {
+    const char *str = skip_blanks(line, end);
+    if (str == end || *str != '#') {
+        return nullptr;
+    }
+    str = skip_blanks(str + 1, end);
+    if ((str = match_word(str, end, "pragma")) == nullptr || (str = match_word(str, end, "shdy")) == nullptr) {
+        return nullptr;
+    }
+
+    return match_word(str, end, directive);
+}
+
+// Parses a "#pragma shdy define NAME VALUE" line. Returns 1 if parsed, 0 if the line isn't one and -1 if it is
+// but it's malformed.
+static int parse_pragma_define(const char *line, const char *end, ShaderDefine *define) {
+    const char *str = match_pragma(line, end, "define");
+    if (str == nullptr) {
+        return 0;
+    }
+
+    const char *name = str;
+    while (str < end && *str != ' ' && *str != '\t' && *str != '\r') {
+        str++;
+    }
+    const char *value = skip_blanks(str, end);
+
+    return shader_define_set(define, name, str - name, value, end - value) ? 1 : -1;
+}
+
+static int find_define(const ShaderDefine *defines, int num_defines, const char *name) {
+    for (int i = 0; i < num_defines; i++) {
+        if (strcmp(defines[i].name, name) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+bool shader_build_defines(Shader *shader, const char *user_src, StrBuf *out) {
+    ShaderDefine defines[SHADER_MAX_DEFINES];
+    int num_defines = 0;
+    bool ok = true;
+
+    for (int i = 0; i < shader->num_cli_defines && i < SHADER_MAX_DEFINES; i++) {
+        defines[num_defines++] = shader->cli_defines[i];
+    }
+
+    for (const char *line = user_src; *line != '\0';) {
+        const char *end = strchr(line, '\n');
+        if (end == nullptr) {
+            end = line + strlen(line);
+        }
+
+        ShaderDefine define;
+        int parsed = parse_pragma_define(line, end, &define);
+        if (parsed < 0) {
+            ERRORF("Invalid #pragma shdy define, expected NAME [VALUE]: %.*s\n", (int)(end - line), line);
+            ok = false;
+        } else if (parsed > 0) {
+            int existing = find_define(defines, num_defines, define.name);
+            if (existing >= shader->num_cli_defines) {
+                ERRORF("#pragma shdy define %s is defined more than once.\n", define.name);
+                ok = false;
+            } else if (existing < 0 && num_defines == SHADER_MAX_DEFINES) {
+                ERRORF("Too many defines, the maximum is %d.\n", SHADER_MAX_DEFINES);
+                ok = false;
+            } else if (existing < 0) {
+                defines[num_defines++] = define;
+            }
+        }
+
+        line = *end == '\0' ? end : end + 1;
+    }
+
+    for (int i = 0; i < num_defines; i++) {
+        str_buf_appendf(out, "#define %s %s\n", defines[i].name, defines[i].value);
+    }
+    if (out->data == nullptr) {
+        str_buf_append(out, "", 0);
+    }
+
+    return ok;
+}
+
+// Parses the optionally quoted path at str into out, relative to the directory of root_path unless it's absolute.
+// Returns false if the path is empty.
+static bool parse_pragma_path(const char *root_path, const char *str, const char *end, char *out) {
+    const char *path_end = end;
+    while (path_end > str && isspace((unsigned char)path_end[-1])) {
+        path_end--;
+    }
+    if (path_end - str >= 2 && *str == '"' && path_end[-1] == '"') {
+        str++;
+        path_end--;
+    }
+    if (str == path_end) {
+        return false;
+    }
+
+    const char *slash = strrchr(root_path, '/');
+    int path_len = (int)(path_end - str);
+    if (*str == '/' || slash == nullptr) {
+        snprintf(out, PATH_MAX, "%.*s", path_len, str);
+    } else {
+        snprintf(out, PATH_MAX, "%.*s/%.*s", (int)(slash - root_path), root_path, path_len, str);
+    }
+
+    return true;
+}
+
+// Reads the "#pragma shdy buffer N PATH" and "#pragma shdy compute N PATH" lines of the expanded user source into
+// out_paths, which is left empty for undeclared buffers, and out_compute. Paths are relative to the directory of
+// the root shader file.
+static bool parse_buffer_pragmas(const char *root_path, const char *user_src,
+                                 char out_paths[SHADER_MAX_BUFFERS][PATH_MAX], bool out_compute[SHADER_MAX_BUFFERS]) {
+    bool ok = true;
+
+    for (int i = 0; i < SHADER_MAX_BUFFERS; i++) {
+        out_paths[i][0] = '\0';
+        out_compute[i] = false;
+    }
+
+    for (const char *line = user_src; *line != '\0';) {
+        const char *end = strchr(line, '\n');
+        if (end == nullptr) {
+            end = line + strlen(line);
+        }
+
+        const char *str = match_pragma(line, end, "buffer");
+        bool compute = false;
+        if (str == nullptr) {
+            str = match_pragma(line, end, "compute");
+            compute = true;
+        }
+        if (str != nullptr) {
+            int index = str < end ? *str - '0' : -1;
+            char path[PATH_MAX];
+
+            if (index < 0 || index >= SHADER_MAX_BUFFERS || (str + 1 < end && !isspace((unsigned char)str[1])) ||
+                !parse_pragma_path(root_path, skip_blanks(str + 1, end), end, path)) {
+                ERRORF("Invalid #pragma shdy %s, expected an index from 0 to %d and a path: %.*s\n",
+                       compute ? "compute" : "buffer", SHADER_MAX_BUFFERS - 1, (int)(end - line), line);
+                ok = false;
+            } else if (out_paths[index][0] != '\0') {
+                ERRORF("#pragma shdy buffer %d is declared more than once.\n", index);
+                ok = false;
+            } else {
+                memcpy(out_paths[index], path, PATH_MAX);
+                out_compute[index] = compute;
+            }
+        }
+
+        line = *end == '\0' ? end : end + 1;
+    }
+
+    return ok;
+}
+
+bool shader_texture_parse(ShaderTexture *texture, const char *str) {
+    const char *eq = strchr(str, '=');
+    if (eq == nullptr || eq == str || eq - str >= SHADER_TEXTURE_MAX_NAME || eq[1] == '\0') {
+        return false;
+    }
+    for (const char *ch = str; ch < eq; ch++) {
+        if (!is_ident_char(*ch, ch == str)) {
+            return false;
+        }
+    }
+
+    snprintf(texture->name, sizeof(texture->name), "%.*s", (int)(eq - str), str);
+    snprintf(texture->path, sizeof(texture->path), "%s", eq + 1);
+
+    return true;
+}
+
+// Reads the "#pragma shdy texture NAME PATH" lines of the expanded user source into out_textures. Paths are relative
+// to the directory of the root shader file.
+static bool parse_texture_pragmas(const char *root_path, const char *user_src,
+                                  ShaderTexture out_textures[SHADER_MAX_TEXTURES], int *out_num_textures) {
+    bool ok = true;
+    int num_textures = 0;
+
+    for (const char *line = user_src; *line != '\0';) {
+        const char *end = strchr(line, '\n');
+        if (end == nullptr) {
+            end = line + strlen(line);
+        }
+
+        const char *str = match_pragma(line, end, "texture");
+        if (str != nullptr) {
+            const char *name = str;
+            while (str < end && is_ident_char(*str, str == name)) {
+                str++;
+            }
+            size_t name_len = str - name;
+
+            ShaderTexture texture;
+            bool valid = name_len > 0 && name_len < SHADER_TEXTURE_MAX_NAME && str < end &&
+                         (*str == ' ' || *str == '\t') && parse_pragma_path(root_path, skip_blanks(str, end), end,
+                                                                           texture.path);
+            if (valid) {
+                snprintf(texture.name, sizeof(texture.name), "%.*s", (int)name_len, name);
+            }
+
+            if (!valid) {
+                ERRORF("Invalid #pragma shdy texture, expected NAME PATH: %.*s\n", (int)(end - line), line);
+                ok = false;
+            } else if (num_textures == SHADER_MAX_TEXTURES) {
+                ERRORF("Too many textures, the maximum is %d.\n", SHADER_MAX_TEXTURES);
+                ok = false;
+            } else {
+                bool duplicate = false;
+                for (int i = 0; i < num_textures; i++) {
+                    duplicate = duplicate || strcmp(out_textures[i].name, texture.name) == 0;
+                }
+                if (duplicate) {
+                    ERRORF("#pragma shdy texture %s is declared more than once.\n", texture.name);
+                    ok = false;
+                } else {
+                    out_textures[num_textures++] = texture;
+                }
+            }
+        }
+
+        line = *end == '\0' ? end : end + 1;
+    }
+
+    *out_num_textures = num_textures;
+
+    return ok;
+}
+
+static const struct {
+    const char *name;
+    int components;
+    bool integer;
+} s_param_types[] = {
+        {"float", 1, false},
+        {"vec2", 2, false},
+        {"vec3", 3, false},
+        {"vec4", 4, false},
+        {"int", 1, true},
+};
+
+// Parses a "uniform TYPE NAME; // @range MIN MAX" line into param. Returns 1 if parsed, 0 if the line has no
+// @range annotation and -1 if it does but it isn't a valid param.
+static int parse_param(const char *line, const char *end, ShaderParam *param) {
+    const char *comment = line;
+    while (comment + 1 < end && !(comment[0] == '/' && comment[1] == '/')) {
+        comment++;
+    }
+    if (comment + 1 >= end) {
+        return 0;
+    }
+    const char *str = match_word(skip_blanks(comment + 2, end), end, "@range");
+    if (str == nullptr) {
+        return 0;
+    }
+
+    // strtof() skips newlines, so make sure the range doesn't run into the next line.
+    char *num_end;
+    param->min = strtof(str, &num_end);
+    if (num_end == str || num_end > end) {
+        return -1;
+    }
+    str = num_end;
+    param->max = strtof(str, &num_end);
+    if (num_end == str || num_end > end || param->min > param->max) {
+        return -1;
+    }
+    str = num_end;
+    while (str < end && isspace((unsigned char)*str)) {
+        str++;
+    }
+    if (str != end) {
+        return -1;
+    }
+
+    str = skip_blanks(line, comment);
+    if ((str = match_word(str, comment, "uniform")) == nullptr) {
+        return -1;
+    }
+    const char *precision;
+    if ((precision = match_word(str, comment, "lowp")) != nullptr ||
+        (precision = match_word(str, comment, "mediump")) != nullptr ||
+        (precision = match_word(str, comment, "highp")) != nullptr) {
+        str = precision;
+    }
+
+    const char *type_end = nullptr;
+    for (int i = 0; i < ARRAY_LEN(s_param_types) && type_end == nullptr; i++) {
+        type_end = match_word(str, comment, s_param_types[i].name);
+        param->components = s_param_types[i].components;
+        param->integer = s_param_types[i].integer;
+    }
+    if (type_end == nullptr) {
+        return -1;
+    }
+
+    const char *name = type_end;
+    str = name;
+    while (str < comment && is_ident_char(*str, str == name)) {
+        str++;
+    }
+    size_t name_len = str - name;
+    if (name_len == 0 || name_len >= SHADER_PARAM_MAX_NAME) {
+        return -1;
+    }
+    memcpy(param->name, name, name_len);
+    param->name[name_len] = '\0';
+
+    return 1;
+}
+
+// Reads the @range annotated uniforms of the expanded user source into out_params.
+static bool parse_params(const char *user_src, ShaderParam out_params[SHADER_MAX_PARAMS], int *out_num_params) {
+    bool ok = true;
+    int num_params = 0;
+
+    for (const char *line = user_src; *line != '\0';) {
+        const char *end = strchr(line, '\n');
+        if (end == nullptr) {
+            end = line + strlen(line);
+        }
+
+        ShaderParam param;
+        int parsed = parse_param(line, end, &param);
+        if (parsed < 0) {
+            ERRORF("Invalid @range annotation, expected uniform float, int or vecN NAME; // @range MIN MAX: %.*s\n",
+                   (int)(end - line), line);
+            ok = false;
+        } else if (parsed > 0 && num_params == SHADER_MAX_PARAMS) {
+            ERRORF("Too many params, the maximum is %d.\n", SHADER_MAX_PARAMS);
+            ok = false;
+        } else if (parsed > 0) {
+            out_params[num_params++] = param;
+        }
+
+        line = *end == '\0' ? end : end + 1;
+    }
+
+    *out_num_params = num_params;
+
+    return ok;
+}
+
+bool shader_depends_on(Shader *shader, int file_index) {
+    for (int i = 0; i < shader->num_deps; i++) {
+        if (shader->deps[i] == file_index) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static bool link_program(unsigned int program, const unsigned int *shaders, int count) {
+    for (int i = 0; i < count; i++) {
+        glAttachShader(program, shaders[i]);
+    }
+
+    glLinkProgram(program);
+    int linked = GL_TRUE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+    return linked == GL_TRUE;
+}
+
+// Returns the preamble shader object for the stage and define set, compiling it if it isn't cached, or 0 if it fails
+// to compile, adding its errors to the diagnostics of shader. Each distinct define set gets its own object, so
+// switching between a few of them on reload doesn't recompile the preamble.
+static unsigned int preamble_shader(Shader *shader, GLenum type, const char *defines_src) {
+    for (int i = 0; i < PREAMBLE_CACHE_SIZE; i++) {
+        PreambleCacheEntry *entry = &s_preamble_cache[i];
+        if (entry->defines_src != nullptr && entry->type == type && strcmp(entry->defines_src, defines_src) == 0) {
+            return entry->shader;
+        }
+    }
+
+    double start = get_time_ms();
+
+    const char *srcs[] = {
+        type == GL_COMPUTE_SHADER ? s_glsl_compute_version_src : s_glsl_version_src,
+        defines_src,
+        s_preamble_decls_src,
+        s_preamble_lib_src
+    };
+    const char *names[] = {PREAMBLE_DEFINES_NAME, PREAMBLE_DEFINES_NAME, PREAMBLE_DECLS_NAME, PREAMBLE_LIB_NAME};
+    // Only fails for a define the preamble can't be built with, which the next reload may fix, so it isn't cached.
+    unsigned int preamble;
+    if (!compile_shader(type, srcs, ARRAY_LEN(srcs), &preamble)) {
+        ERRORF("Failed to compile the shdy preamble for %s.\n", shader->user_frag_shader_path);
+        LogSources sources = {srcs, names, ARRAY_LEN(srcs)};
+        shader_add_log_diagnostics(shader, preamble, &sources);
+        glDeleteShader(preamble);
+        return 0;
+    }
+
+    // Evict the oldest entry once full. Deleting a shader object that's still attached to a program is deferred
+    // by GL, so the current program is unaffected.
+    PreambleCacheEntry *entry = &s_preamble_cache[s_preamble_cache_next];
+    s_preamble_cache_next = (s_preamble_cache_next + 1) % PREAMBLE_CACHE_SIZE;
+    if (entry->defines_src != nullptr) {
+        glDeleteShader(entry->shader);
+        free(entry->defines_src);
+    }
+    entry->type = type;
+    entry->defines_src = strdup(defines_src);
+    entry->shader = preamble;
+
+    INFOF("Compiled shdy preamble in %.2fms.\n", get_time_ms() - start);
+
+    return preamble;
+}
+
+bool shader_build_program(Shader *shader, const char *defines_src, const char *user_src, bool inline_preamble,
+                          unsigned int *out_program, ShaderBuildStats *out_stats) {
+    double start = get_time_ms();
+
+    GLenum type = shader->compute ? GL_COMPUTE_SHADER : GL_FRAGMENT_SHADER;
+
+    // The user shader only gets the preamble declarations, the definitions come from the preamble shader object
+    // at link time so the driver doesn't parse and optimize them again on every reload.
+    const char *srcs[5];
+    const char *names[5];
+    unsigned int num_srcs = 0;
+    names[num_srcs] = PREAMBLE_DEFINES_NAME;
+    srcs[num_srcs++] = shader->compute ? s_glsl_compute_version_src : s_glsl_version_src;
+    names[num_srcs] = PREAMBLE_DEFINES_NAME;
+    srcs[num_srcs++] = defines_src;
+    names[num_srcs] = PREAMBLE_DECLS_NAME;
+    srcs[num_srcs++] = s_preamble_decls_src;
+    if (inline_preamble) {
+        names[num_srcs] = PREAMBLE_LIB_NAME;
+        srcs[num_srcs++] = s_preamble_lib_src;
+    }
+    names[num_srcs] = nullptr;
+    srcs[num_srcs++] = user_src;
+    LogSources sources = {srcs, names, (int)num_srcs};
+
+    // Warnings are collected from successful compiles too.
+    shader->num_diagnostics = 0;
+    unsigned int user_shader;
+    bool compiled = compile_shader(type, srcs, num_srcs, &user_shader);
+    if (!compiled) {
+        ERRORF("Failed to compile %s shader %s.\n", shader->compute ? "compute" : "fragment",
+               shader->user_frag_shader_path);
+    }
+    shader_add_log_diagnostics(shader, user_shader, &sources);
+    if (!compiled) {
+        glDeleteShader(user_shader);
+        return false;
+    }
+
+    double compiled_ms = get_time_ms();
+
+    unsigned int shaders[3];
+    int num_shaders = 0;
+    if (!shader->compute) {
+        shaders[num_shaders++] = shader->vert_shader;
+    }
+    shaders[num_shaders++] = user_shader;
+    if (!inline_preamble) {
+        shaders[num_shaders] = preamble_shader(shader, type, defines_src);
+        if (shaders[num_shaders++] == 0) {
+            glDeleteShader(user_shader);
+            return false;
+        }
+    }
+
+    // A failed link leaves the current program in place, like a failed compile.
+    unsigned int program = glCreateProgram();
+    if (!link_program(program, shaders, num_shaders)) {
+        ERRORF("Failed to link shader %s.\n", shader->user_frag_shader_path);
+        shader_add_log_diagnostics(shader, program, &sources);
+        glDeleteProgram(program);
+        glDeleteShader(user_shader);
+        return false;
+    }
+
+    // GLSL 3.30 can't set the binding in the shader, the block is inactive if the shader reads no inputs.
+    unsigned int inputs_index = glGetUniformBlockIndex(program, "ShdyInputs");
+    if (inputs_index != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, inputs_index, SHADER_INPUTS_BINDING);
+    }
+
+    glDeleteShader(user_shader);
+
+    if (out_stats != nullptr) {
+        out_stats->compile_ms = compiled_ms - start;
+        out_stats->link_ms = get_time_ms() - compiled_ms;
+    }
+    *out_program = program;
+
+    return true;
+}
+
+// Moves the "#define NAME VALUE" line of a preamble knob from defines_src to the specialization constant id, if its
+// value is an integer, so the knob doesn't change the SPIR-V source. Writes the remaining lines to out.
+static void spirv_specialize_defines(const char *defines_src, const char *name, unsigned int id, StrBuf *out,
+                                     unsigned int *const_ids, unsigned int *const_values, int *num_consts) {
+    size_t name_len = strlen(name);
+    for (const char *line = defines_src; *line != '\0';) {
+        const char *newline = strchr(line, '\n');
+        const char *next = newline != nullptr ? newline + 1 : line + strlen(line);
+
+        int value;
+        int len = 0;
+        if (strncmp(line, "#define ", 8) == 0 && strncmp(line + 8, name, name_len) == 0 &&
+            sscanf(line + 8 + name_len, " %d%n", &value, &len) == 1 && line + 8 + name_len + len == newline) {
+            const_ids[*num_consts] = id;
+            const_values[*num_consts] = (unsigned int)value;
+            (*num_consts)++;
+        } else {
+            str_buf_append(out, line, next - line);
+        }
+
+        line = next;
+    }
+}
+
+// Builds the program from the SPIR-V of the preamble and user source, see spirv_get(). Uniform locations can't be
+// looked up by name in a SPIR-V program, so they're written to out_uniforms from the module's debug names.
+static bool shader_build_spirv_program(Shader *shader, const char *defines_src, const char *user_src,
+                                       unsigned int *out_program, ShaderUniform *out_uniforms, int *out_num_uniforms,
+                                       ShaderBuildStats *out_stats) {
+    double start = get_time_ms();
+
+    unsigned int const_ids[1];
+    unsigned int const_values[1];
+    int num_consts = 0;
+    StrBuf spirv_defines_src = {};
+    str_buf_append(&spirv_defines_src, "", 0);
+    spirv_specialize_defines(defines_src, "SHDY_FBM_OCTAVES", SHADER_SPEC_FBM_OCTAVES, &spirv_defines_src, const_ids,
+                             const_values, &num_consts);
+
+    // A SPIR-V module has a single entry point per stage, so the preamble definitions are compiled in rather than
+    // linked from a shared shader object.
+    const char *srcs[] = {
+        shader->compute ? s_glsl_compute_version_src : s_glsl_version_src,
+        s_glsl_spirv_src,
+        spirv_defines_src.data,
+        s_preamble_decls_src,
+        s_preamble_lib_src,
+        user_src
+    };
+    const char *names[] = {
+        PREAMBLE_DEFINES_NAME, PREAMBLE_DEFINES_NAME, PREAMBLE_DEFINES_NAME, PREAMBLE_DECLS_NAME, PREAMBLE_LIB_NAME,
+        nullptr
+    };
+    LogSources sources = {srcs, names, ARRAY_LEN(srcs)};
+
+    shader->num_diagnostics = 0;
+    GLenum type = shader->compute ? GL_COMPUTE_SHADER : GL_FRAGMENT_SHADER;
+    StrBuf spirv = {};
+    unsigned int user_shader;
+    bool ok = spirv_get(shader, shader->compute ? GLSL_STAGE_COMPUTE : GLSL_STAGE_FRAGMENT, &sources, &spirv) &&
+              load_spirv_shader(shader, type, &spirv, const_ids, const_values, num_consts, &sources, &user_shader);
+    str_buf_free(&spirv_defines_src);
+    if (!ok) {
+        str_buf_free(&spirv);
+        return false;
+    }
+
+    double compiled_ms = get_time_ms();
+
+    unsigned int shaders[2];
+    int num_shaders = 0;
+    if (!shader->compute) {
+        shaders[num_shaders++] = shader->vert_shader;
+    }
+    shaders[num_shaders++] = user_shader;
+
+    unsigned int program = glCreateProgram();
+    if (!link_program(program, shaders, num_shaders)) {
+        ERRORF("Failed to link shader %s.\n", shader->user_frag_shader_path);
+        shader_add_log_diagnostics(shader, program, &sources);
+        glDeleteProgram(program);
+        glDeleteShader(user_shader);
+        str_buf_free(&spirv);
+        return false;
+    }
+    glDeleteShader(user_shader);
+
+    *out_num_uniforms = spirv_reflect_uniforms(&spirv, out_uniforms, SHADER_MAX_UNIFORMS);
+    str_buf_free(&spirv);
+
+    if (out_stats != nullptr) {
+        out_stats->compile_ms = compiled_ms - start;
+        out_stats->link_ms = get_time_ms() - compiled_ms;
+    }
+    *out_program = program;
+
+    return true;
+}
+
+static void program_cache_evict(ProgramCacheEntry *entry) {
+    glDeleteProgram(entry->program);
+    s_program_cache_size -= entry->size;
+    free(entry->defines_src);
+    entry->defines_src = nullptr;
+}
+
+// Deletes the least recently used programs no shader is using until extra_size more bytes fit, and a free entry is
+// left if need_entry is set. Programs in use are never deleted, so the cache may stay over its limits.
+static void program_cache_trim(size_t extra_size, bool need_entry) {
+    while (true) {
+        ProgramCacheEntry *lru = nullptr;
+        bool has_free = false;
+        for (int i = 0; i < PROGRAM_CACHE_MAX_PROGRAMS; i++) {
+            ProgramCacheEntry *entry = &s_program_cache[i];
+            if (entry->defines_src == nullptr) {
+                has_free = true;
+            } else if (!entry->in_use && (lru == nullptr || entry->last_used < lru->last_used)) {
+                lru = entry;
+            }
+        }
+
+        bool over = s_program_cache_size + extra_size > PROGRAM_CACHE_MAX_BYTES || (need_entry && !has_free);
+        if (!over || lru == nullptr) {
+            return;
+        }
+        program_cache_evict(lru);
+    }
+}
+
+// Returns the cached program built from the source and defines for the kind of pass and marks it as used, or nullptr
+// if there is none. A program in use by another shader isn't shared, current is the program of the shader asking.
+static ProgramCacheEntry *program_cache_find(const char *defines_src, uint64_t src_hash, bool compute, bool spirv,
+                                             unsigned int current) {
+    for (int i = 0; i < PROGRAM_CACHE_MAX_PROGRAMS; i++) {
+        ProgramCacheEntry *entry = &s_program_cache[i];
+        if (entry->defines_src != nullptr && entry->src_hash == src_hash && entry->compute == compute &&
+            entry->spirv == spirv && (!entry->in_use || entry->program == current) &&
+            strcmp(entry->defines_src, defines_src) == 0) {
+            entry->in_use = true;
+            entry->last_used = ++s_program_cache_clock;
+            return entry;
+        }
+    }
+
+    return nullptr;
+}
+
+// Adds a program just built for a shader, as in use. The program isn't cached if every entry is in use.
+static void program_cache_add(const char *defines_src, uint64_t src_hash, bool compute, bool spirv,
+                              unsigned int program, const ShaderUniform *uniforms, int num_uniforms,
+                              const float (*param_values)[4], int num_params, size_t src_len) {
+    int binary_len = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binary_len);
+    size_t size = binary_len > 0 ? (size_t)binary_len : src_len;
+
+    program_cache_trim(size, true);
+    ProgramCacheEntry *entry = nullptr;
+    for (int i = 0; i < PROGRAM_CACHE_MAX_PROGRAMS && entry == nullptr; i++) {
+        if (s_program_cache[i].defines_src == nullptr) {
+            entry = &s_program_cache[i];
+        }
+    }
+    if (entry == nullptr) {
+        return;
+    }
+
+    entry->defines_src = strdup(defines_src);
+    entry->src_hash = src_hash;
+    entry->compute = compute;
+    entry->spirv = spirv;
+    entry->program = program;
+    entry->size = size;
+    memcpy(entry->uniforms, uniforms, num_uniforms * sizeof(ShaderUniform));
+    entry->num_uniforms = num_uniforms;
+    memcpy(entry->param_values, param_values, num_params * sizeof(entry->param_values[0]));
+    entry->in_use = true;
+    entry->last_used = ++s_program_cache_clock;
+    s_program_cache_size += size;
+}
+
+// Called once a shader stops using its program, which is kept for the next shader built from the same source if
+// it's cached and deleted otherwise.
+static void program_cache_release(unsigned int program) {
+    for (int i = 0; i < PROGRAM_CACHE_MAX_PROGRAMS; i++) {
+        ProgramCacheEntry *entry = &s_program_cache[i];
+        if (entry->defines_src != nullptr && entry->program == program) {
+            entry->in_use = false;
+            program_cache_trim(0, false);
+            return;
+        }
+    }
+
+    glDeleteProgram(program);
+}
+
+// Returns true if src contains name as a whole identifier. Comments aren't skipped, which errs on the side of a
+// match.
+static bool source_uses_identifier(const char *src, const char *name) {
+    size_t len = strlen(name);
+    for (const char *str = strstr(src, name); str != nullptr; str = strstr(str + len, name)) {
+        bool starts = str == src || !is_ident_char(str[-1], false);
+        bool ends = !is_ident_char(str[len], false);
+        if (starts && ends) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Writes src to out with every use of the identifier from replaced by to.
+static void source_replace_identifier(const char *src, const char *from, const char *to, StrBuf *out) {
+    size_t from_len = strlen(from);
+    size_t to_len = strlen(to);
+    const char *start = src;
+    for (const char *str = strstr(src, from); str != nullptr; str = strstr(str + from_len, from)) {
+        if ((str != src && is_ident_char(str[-1], false)) || is_ident_char(str[from_len], false)) {
+            continue;
+        }
+        str_buf_append(out, start, str - start);
+        str_buf_append(out, to, to_len);
+        start = str + from_len;
+    }
+    str_buf_append(out, start, strlen(start));
+}
+
+// What shader_parse() reads from the expanded source, applied to the shader once its program is built.
+typedef struct {
+    StrBuf defines_src;
+    char buffer_paths[SHADER_MAX_BUFFERS][PATH_MAX];
+    bool buffer_compute[SHADER_MAX_BUFFERS];
+    ShaderTexture textures[SHADER_MAX_TEXTURES];
+    int num_textures;
+    ShaderParam params[SHADER_MAX_PARAMS];
+    int num_params;
+} ShaderParse;
+
+// Adds an error for each file the shader depends on that couldn't be read, on the line including it if there is one.
+static void shader_add_read_errors(Shader *shader) {
+    SourceCache *source_cache = shader->source_cache;
+    for (int i = 0; i < shader->num_deps; i++) {
+        int index = shader->deps[i];
+        if (source_cache->files[index].readable) {
+            continue;
+        }
+
+        bool included = false;
+        for (int j = 0; j < shader->num_deps; j++) {
+            const SourceFile *file = &source_cache->files[shader->deps[j]];
+            for (int k = 0; file->readable && k < file->num_includes; k++) {
+                if (file->includes[k].file_index == index) {
+                    shader_add_error(shader, shader->deps[j], file->includes[k].line, "Failed to read included file %s",
+                                     source_cache->files[index].path);
+                    included = true;
+                }
+            }
+        }
+        if (!included) {
+            shader_add_error(shader, index, 0, "Failed to read file");
+        }
+    }
+}
+
+// Expands the user source into expanded_src and parses its defines, pragmas and params into out, adding diagnostics
+// for anything that fails. Doesn't need a GL context.
+static bool shader_parse(Shader *shader, ShaderParse *out) {
+    shader->num_diagnostics = 0;
+    out->defines_src = {};
+
+    int root = source_cache_add(shader->source_cache, shader->user_frag_shader_path);
+    if (root < 0) {
+        shader_add_error(shader, -1, 0, "Too many source files, limit is %d", SOURCE_CACHE_MAX_FILES);
+        return false;
+    }
+
+    // The dependencies are updated even if expanding fails, so a missing include is still watched.
+    StrBuf *user_frag_shader_src = &shader->expanded_src;
+    str_buf_clear(user_frag_shader_src);
+    if (!source_cache_expand(shader->source_cache, root, user_frag_shader_src, shader->deps, &shader->num_deps,
+                             SHADER_MAX_DEPS, &shader->line_map)) {
+        ERRORF("Failed to read shader %s.\n", shader->user_frag_shader_path);
+        shader_add_read_errors(shader);
+        return false;
+    }
+
+    const char *root_path = shader->source_cache->files[root].path;
+    const char *src = user_frag_shader_src->data;
+    bool defines_ok = shader_build_defines(shader, src, &out->defines_src);
+    bool buffers_ok = parse_buffer_pragmas(root_path, src, out->buffer_paths, out->buffer_compute);
+    bool textures_ok = parse_texture_pragmas(root_path, src, out->textures, &out->num_textures);
+    bool params_ok = parse_params(src, out->params, &out->num_params);
+    if (!defines_ok || !buffers_ok || !textures_ok || !params_ok) {
+        shader_add_error(shader, root, 0, "Invalid #pragma shdy or @range annotation");
+        str_buf_free(&out->defines_src);
+        return false;
+    }
+
+    return true;
+}
+
+#define SHADER_VALIDATE_SRCS 4
+
+// Fills srcs and names with the parts of the source glslang parses. The preamble definitions aren't needed to parse,
+// only their declarations.
+static void shader_validate_srcs(Shader *shader, const char *defines_src, const char **srcs, const char **names) {
+    names[0] = PREAMBLE_DEFINES_NAME;
+    srcs[0] = shader->compute ? s_glsl_compute_version_src : s_glsl_version_src;
+    names[1] = PREAMBLE_DEFINES_NAME;
+    srcs[1] = defines_src;
+    names[2] = PREAMBLE_DECLS_NAME;
+    srcs[2] = s_preamble_decls_src;
+    names[3] = nullptr;
+    srcs[3] = shader->expanded_src.data;
+}
+
+// Writes the source glslang parses to out.
+static void shader_validate_src(Shader *shader, const char *defines_src, StrBuf *out) {
+    const char *srcs[SHADER_VALIDATE_SRCS];
+    const char *names[SHADER_VALIDATE_SRCS];
+    shader_validate_srcs(shader, defines_src, srcs, names);
+    for (int i = 0; i < SHADER_VALIDATE_SRCS; i++) {
+        str_buf_append(out, srcs[i], strlen(srcs[i]));
+    }
+}
+
+// Adds the diagnostics of glslang's info log for an invalid source.
+static void shader_add_validate_log(Shader *shader, const char *defines_src, StrBuf *log) {
+    ERRORF("Failed to validate %s.\n", shader->user_frag_shader_path);
+    const char *srcs[SHADER_VALIDATE_SRCS];
+    const char *names[SHADER_VALIDATE_SRCS];
+    shader_validate_srcs(shader, defines_src, srcs, names);
+    LogSources sources = {srcs, names, SHADER_VALIDATE_SRCS};
+    shader_add_info_log(shader, log->data != nullptr ? log->data : (char *)"", &sources);
+}
+
+// Parses the user source with glslang, if shdy is built with it, so broken sources are rejected without waiting on
+// the driver. Doesn't need a GL context.
+static bool shader_validate(Shader *shader, const char *defines_src) {
+    if (!glslang_available()) {
+        return true;
+    }
+
+    StrBuf src = {};
+    shader_validate_src(shader, defines_src, &src);
+    StrBuf log = {};
+    bool valid = glsl_validate(src.data, shader->compute ? GLSL_STAGE_COMPUTE : GLSL_STAGE_FRAGMENT, &log);
+    if (!valid) {
+        shader_add_validate_log(shader, defines_src, &log);
+    }
+    str_buf_free(&log);
+    str_buf_free(&src);
+
+    return valid;
+}
+
+// A parsed source waiting on its validation before its program is built.
+struct ShaderCompile {
+    ShaderParse parse;
+    GlslValidation *validation;
+};
+
+static void shader_compile_cancel(Shader *shader) {
+    if (shader->pending == nullptr) {
+        return;
+    }
+
+    glsl_validation_cancel(shader->pending->validation);
+    str_buf_free(&shader->pending->parse.defines_src);
+    free(shader->pending);
+    shader->pending = nullptr;
+}
+
+// Hashes the expanded source of the parsed shader and returns its program from the program cache, or nullptr.
+static ProgramCacheEntry *shader_find_program(Shader *shader, const ShaderParse *parse, uint64_t *out_src_hash) {
+    // No define lines and none at all are the same program.
+    const char *defines_src = parse->defines_src.data != nullptr ? parse->defines_src.data : "";
+    *out_src_hash = hash_bytes(shader->expanded_src.data, shader->expanded_src.len);
+
+    return program_cache_find(defines_src, *out_src_hash, shader->compute, shader->spirv,
+                              shader->compiled ? shader->program : 0);
+}
+
+// Builds the program of the parsed and validated source and applies it and parse to the shader, or applies the cached
+// entry, which was validated and built from the same source. The warnings of that build aren't repeated.
+static bool shader_compile_parsed(Shader *shader, ShaderParse *parse, ProgramCacheEntry *entry, uint64_t src_hash) {
+    StrBuf *user_frag_shader_src = &shader->expanded_src;
+    const char *defines_src = parse->defines_src.data != nullptr ? parse->defines_src.data : "";
+
+    // Tiles are drawn at the origin of their own target, shdyFragCoord adds uTileOffset back so the shader still
+    // sees the position in the whole image.
+    const char *build_src = user_frag_shader_src->data;
+    StrBuf frag_coord_src = {};
+    if (entry == nullptr && !shader->compute && source_uses_identifier(build_src, "gl_FragCoord")) {
+        source_replace_identifier(build_src, "gl_FragCoord", "shdyFragCoord", &frag_coord_src);
+        build_src = frag_coord_src.data;
+    }
+
+    unsigned int program;
+    ShaderBuildStats stats;
+    ShaderUniform uniforms[SHADER_MAX_UNIFORMS];
+    int num_uniforms = 0;
+    GLenum type = shader->compute ? GL_COMPUTE_SHADER : GL_FRAGMENT_SHADER;
+    bool built;
+    if (entry != nullptr) {
+        program = entry->program;
+        memcpy(uniforms, entry->uniforms, entry->num_uniforms * sizeof(ShaderUniform));
+        num_uniforms = entry->num_uniforms;
+        built = true;
+    } else if (shader->spirv) {
+        built = shader_build_spirv_program(shader, parse->defines_src.data, build_src, &program, uniforms,
+                                           &num_uniforms, &stats);
+    } else {
+        // Make sure the shared preamble is built before any user shader so its one-off cost isn't counted below.
+        built = preamble_shader(shader, type, parse->defines_src.data) != 0 &&
+                shader_build_program(shader, parse->defines_src.data, build_src, false, &program, &stats);
+    }
+    str_buf_free(&frag_coord_src);
+    if (!built) {
+        str_buf_free(&parse->defines_src);
+        return false;
+    }
+
+    // Every member of a std140 block stays active, so the time-varying inputs are looked for in the source instead.
+    // A program that reads none of them renders the same image every frame and only needs to be redrawn on resize,
+    // reload or input.
+    const char *user_src = user_frag_shader_src->data;
+    bool time_varying = source_uses_identifier(user_src, "uTime") || source_uses_identifier(user_src, "uTimeDelta") ||
+                        source_uses_identifier(user_src, "uFrame") || source_uses_identifier(user_src, "uDate");
+
+    str_buf_free(&shader->defines_src);
+    shader->defines_src = parse->defines_src;
+    memcpy(shader->buffer_paths, parse->buffer_paths, sizeof(parse->buffer_paths));
+    memcpy(shader->buffer_compute, parse->buffer_compute, sizeof(parse->buffer_compute));
+    memcpy(shader->textures, parse->textures, parse->num_textures * sizeof(ShaderTexture));
+    shader->num_textures = parse->num_textures;
+
+    if (entry != nullptr) {
+        INFOF("Shader %s loaded from the program cache.\n", shader->user_frag_shader_path);
+    } else {
+        INFOF("Shader %s compiled successfully in %.2fms (compile %.2fms, link %.2fms).\n",
+              shader->user_frag_shader_path, stats.compile_ms + stats.link_ms, stats.compile_ms, stats.link_ms);
+    }
+
+    if (shader->compiled && shader->program != program) {
+        program_cache_release(shader->program);
+    }
+    shader->compiled = false;
+
+    shader->program = program;
+    memcpy(shader->uniforms, uniforms, num_uniforms * sizeof(ShaderUniform));
+    shader->num_uniforms = num_uniforms;
+    shader->uniform_noise_texture_loc = shader_uniform_location(shader, "uShdyNoiseTex");
+    shader->compiled = true;
+    shader->failed = false;
+
+    for (int i = 0; i < SHADER_MAX_BUFFERS; i++) {
+        char name[] = "uBuffer0";
+        name[sizeof(name) - 2] = (char)('0' + i);
+        shader->uniform_buffer_locs[i] = shader_uniform_location(shader, name);
+        if (shader->uniform_buffer_locs[i] != -1) {
+            glProgramUniform1i(program, shader->uniform_buffer_locs[i], SHADER_BUFFER_TEXTURE_UNIT + i);
+        }
+    }
+
+    // The noise textures are opt-in, they're only generated once a shader uses one of the shdy*Tex functions.
+    if (shader->uniform_noise_texture_loc != -1) {
+        noise_texture_get();
+        glProgramUniform1i(program, shader->uniform_noise_texture_loc, NOISE_TEXTURE_UNIT);
+    }
+
+    // Params start from the uniform's initializer, or 0, unless the previous program had one with the same name and
+    // type, so tweaked values survive an edit.
+    float initial_values[SHADER_MAX_PARAMS][4] = {};
+    if (entry != nullptr) {
+        memcpy(initial_values, entry->param_values, parse->num_params * sizeof(initial_values[0]));
+    }
+    for (int i = 0; i < parse->num_params; i++) {
+        ShaderParam *param = &parse->params[i];
+        param->location = shader_uniform_location(shader, param->name);
+        if (entry == nullptr && param->location != -1) {
+            if (param->integer) {
+                int value;
+                glGetUniformiv(program, param->location, &value);
+                initial_values[i][0] = (float)value;
+            } else {
+                glGetUniformfv(program, param->location, initial_values[i]);
+            }
+        }
+
+        ShaderParam *prev = shader_find_param(shader, param->name);
+        if (prev != nullptr && prev->components == param->components && prev->integer == param->integer) {
+            memcpy(param->value, prev->value, sizeof(param->value));
+        } else {
+            memcpy(param->value, initial_values[i], sizeof(param->value));
+        }
+    }
+    if (entry == nullptr) {
+        program_cache_add(defines_src, src_hash, shader->compute, shader->spirv, program, uniforms, num_uniforms,
+                          initial_values, parse->num_params, user_frag_shader_src->len);
+    }
+    memcpy(shader->params, parse->params, parse->num_params * sizeof(ShaderParam));
+    shader->num_params = parse->num_params;
+    for (int i = 0; i < parse->num_params; i++) {
+        shader_set_param(shader, &shader->params[i], shader->params[i].value);
+    }
+
+    shader->time_varying = time_varying;
+    if (!shader->time_varying) {
+        INFOF("Shader %s is static, redrawing on changes only.\n", shader->user_frag_shader_path);
+    }
+
+    return true;
+}
+
+bool shader_compile(Shader *shader) {
+    shader_compile_cancel(shader);
+    shader->outdated = false;
+    shader->failed = true;
+
+    ShaderParse parse;
+    if (!shader_parse(shader, &parse)) {
+        return false;
+    }
+
+    uint64_t src_hash;
+    ProgramCacheEntry *entry = shader_find_program(shader, &parse, &src_hash);
+    if (entry == nullptr && !shader_validate(shader, parse.defines_src.data)) {
+        str_buf_free(&parse.defines_src);
+        return false;
+    }
+
+    return shader_compile_parsed(shader, &parse, entry, src_hash);
+}
+
+bool shader_compile_start(Shader *shader) {
+    shader_compile_cancel(shader);
+    shader->outdated = false;
+    shader->failed = true;
+
+    ShaderParse parse;
+    if (!shader_parse(shader, &parse)) {
+        return true;
+    }
+
+    uint64_t src_hash;
+    ProgramCacheEntry *entry = shader_find_program(shader, &parse, &src_hash);
+    if (entry != nullptr || !glslang_available()) {
+        shader_compile_parsed(shader, &parse, entry, src_hash);
+        return true;
+    }
+
+    StrBuf src = {};
+    shader_validate_src(shader, parse.defines_src.data, &src);
+    GlslValidation *validation =
+            glsl_validation_start(src.data, src.len, shader->compute ? GLSL_STAGE_COMPUTE : GLSL_STAGE_FRAGMENT);
+    str_buf_free(&src);
+    // With the validation threads backed up, the source is validated here instead.
+    if (validation == nullptr) {
+        if (!shader_validate(shader, parse.defines_src.data)) {
+            str_buf_free(&parse.defines_src);
+            return true;
+        }
+        shader_compile_parsed(shader, &parse, nullptr, src_hash);
+        return true;
+    }
+
+    shader->pending = (ShaderCompile *)malloc(sizeof(ShaderCompile));
+    if (shader->pending == nullptr) {
+        ERRORF("Failed to malloc() the compile of %s.\n", shader->user_frag_shader_path);
+        exit(EXIT_FAILURE);
+    }
+    shader->pending->parse = parse;
+    shader->pending->validation = validation;
+
+    return false;
+}
+
+bool shader_compile_finish(Shader *shader, bool wait) {
+    ShaderCompile *pending = shader->pending;
+    while (wait && !glsl_validation_done(pending->validation)) {
+        glsl_validation_clear_events(true);
+    }
+    if (!glsl_validation_done(pending->validation)) {
+        return false;
+    }
+    shader->pending = nullptr;
+
+    StrBuf log = {};
+    if (glsl_validation_finish(pending->validation, &log)) {
+        // The cache is looked up again, another pass may have built the same program in the meantime.
+        uint64_t src_hash;
+        ProgramCacheEntry *entry = shader_find_program(shader, &pending->parse, &src_hash);
+        shader_compile_parsed(shader, &pending->parse, entry, src_hash);
+    } else {
+        shader_add_validate_log(shader, pending->parse.defines_src.data, &log);
+        str_buf_free(&pending->parse.defines_src);
+    }
+    str_buf_free(&log);
+    free(pending);
+
+    return true;
+}
+
+// Translates the image pass and its preamble to C++ and compiles it for the CPU renderer. Doesn't need a GL context,
+// the shader is never compiled for GL. Returns false and adds the diagnostics of the C++ compiler if it fails.
+static bool shader_compile_cpu(Shader *shader, CpuProgram **out_program) {
+    shader->outdated = false;
+    shader->failed = true;
+
+    ShaderParse parse;
+    if (!shader_parse(shader, &parse)) {
+        return false;
+    }
+    for (int i = 0; i < SHADER_MAX_BUFFERS; i++) {
+        if (parse.buffer_paths[i][0] != '\0') {
+            shader_add_error(shader, shader->deps[0], 0, "Buffer and compute passes can't be rendered on the CPU");
+            str_buf_free(&parse.defines_src);
+            return false;
+        }
+    }
+
+    const char *srcs[] = {
+        s_glsl_cpu_src,
+        parse.defines_src.data != nullptr ? parse.defines_src.data : "",
+        s_preamble_decls_src,
+        s_preamble_lib_src,
+        shader->expanded_src.data
+    };
+    const char *names[] = {
+        PREAMBLE_DEFINES_NAME, PREAMBLE_DEFINES_NAME, PREAMBLE_DECLS_NAME, PREAMBLE_LIB_NAME, nullptr
+    };
+    StrBuf src = {};
+    for (int i = 0; i < ARRAY_LEN(srcs); i++) {
+        str_buf_append(&src, srcs[i], strlen(srcs[i]));
+    }
+
+    double start = get_time_ms();
+    StrBuf log = {};
+    CpuProgram *program = cpu_program_create(src.data, &log);
+    str_buf_free(&src);
+    if (program == nullptr) {
+        ERRORF("Failed to compile %s for the CPU.\n", shader->user_frag_shader_path);
+        LogSources sources = {srcs, names, ARRAY_LEN(srcs)};
+        shader_add_info_log(shader, log.data != nullptr ? log.data : (char *)"", &sources);
+        str_buf_free(&log);
+        str_buf_free(&parse.defines_src);
+        return false;
+    }
+    str_buf_free(&log);
+    INFOF("Shader %s compiled for the CPU in %.2fms.\n", shader->user_frag_shader_path, get_time_ms() - start);
+
+    str_buf_free(&shader->defines_src);
+    shader->defines_src = parse.defines_src;
+    memcpy(shader->textures, parse.textures, parse.num_textures * sizeof(ShaderTexture));
+    shader->num_textures = parse.num_textures;
+
+    // Params start from the uniform's initializer, or 0. The program has no locations, the values are set on it
+    // before it renders.
+    for (int i = 0; i < parse.num_params; i++) {
+        ShaderParam *param = &parse.params[i];
+        memset(param->value, 0, sizeof(param->value));
+        param->location = -1;
+        cpu_program_get_uniform(program, param->name, param->value, param->components);
+    }
+    memcpy(shader->params, parse.params, parse.num_params * sizeof(ShaderParam));
+    shader->num_params = parse.num_params;
+
+    *out_program = program;
+    shader->failed = false;
+
+    return true;
+}
+
+int shader_uniform_location(const Shader *shader, const char *name) {
+    if (!shader->spirv) {
+        return glGetUniformLocation(shader->program, name);
+    }
+
+    for (int i = 0; i < shader->num_uniforms; i++) {
+        if (strcmp(shader->uniforms[i].name, name) == 0) {
+            return shader->uniforms[i].location;
+        }
+    }
+
+    return -1;
+}
+
+ShaderParam *shader_find_param(Shader *shader, const char *name) {
+    for (int i = 0; i < shader->num_params; i++) {
+        if (strcmp(shader->params[i].name, name) == 0) {
+            return &shader->params[i];
+        }
+    }
+
+    return nullptr;
+}
+
+void shader_set_param(Shader *shader, ShaderParam *param, const float *values) {
+    for (int i = 0; i < param->components; i++) {
+        float value = values[i] < param->min ? param->min : values[i] > param->max ? param->max : values[i];
+        param->value[i] = param->integer ? roundf(value) : value;
+    }
+
+    if (param->location == -1 || !shader->compiled) {
+        return;
+    }
+    if (param->integer) {
+        glProgramUniform1i(shader->program, param->location, (int)param->value[0]);
+        return;
+    }
+    switch (param->components) {
+        case 1:
+            glProgramUniform1fv(shader->program, param->location, 1, param->value);
+            break;
+        case 2:
+            glProgramUniform2fv(shader->program, param->location, 1, param->value);
+            break;
+        case 3:
+            glProgramUniform3fv(shader->program, param->location, 1, param->value);
+            break;
+        default:
+            glProgramUniform4fv(shader->program, param->location, 1, param->value);
+            break;
+    }
+}
+
+void shader_destroy(Shader *shader) {
+    shader_compile_cancel(shader);
+    if (shader->compiled) {
+        program_cache_release(shader->program);
+        shader->compiled = false;
+    }
+    glDeleteShader(shader->vert_shader);
+    str_buf_free(&shader->defines_src);
+    str_buf_free(&shader->expanded_src);
+    source_line_map_free(&shader->line_map);
+}
+
+static unsigned int s_inputs_buffer = 0;
+static char *s_inputs_mapped = nullptr;
+static GLsync s_inputs_fences[SHADER_INPUTS_RING_SIZE];
+static int s_inputs_slot = -1;
+static int s_inputs_stride = 0;
+
+static_assert(offsetof(ShaderInputs, resolution) == 32 && offsetof(ShaderInputs, time) == 48 &&
+              offsetof(ShaderInputs, frame) == 56 && sizeof(ShaderInputs) == 64,
+              "ShaderInputs must match the std140 layout of ShdyInputs");
+
+static void shader_inputs_create() {
+    int alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    s_inputs_stride = ((int)sizeof(ShaderInputs) + alignment - 1) / alignment * alignment;
+
+    // Persistently mapped, so each update is a plain memcpy with no map or buffer upload call.
+    GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &s_inputs_buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, s_inputs_buffer);
+    glBufferStorage(GL_UNIFORM_BUFFER, s_inputs_stride * SHADER_INPUTS_RING_SIZE, nullptr, flags);
+    s_inputs_mapped = (char *)glMapBufferRange(GL_UNIFORM_BUFFER, 0, s_inputs_stride * SHADER_INPUTS_RING_SIZE,
+                                               flags);
+    if (s_inputs_mapped == nullptr) {
+        ERRORF("Failed to map the shader inputs buffer.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < SHADER_INPUTS_RING_SIZE; i++) {
+        s_inputs_fences[i] = nullptr;
+    }
+}
+
+void shader_inputs_update(const ShaderInputs *inputs) {
+    if (s_inputs_buffer == 0) {
+        shader_inputs_create();
+    }
+
+    // The draws reading the previous slot have all been submitted by now.
+    if (s_inputs_slot >= 0) {
+        s_inputs_fences[s_inputs_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    s_inputs_slot = (s_inputs_slot + 1) % SHADER_INPUTS_RING_SIZE;
+
+    // Only waits when the CPU is SHADER_INPUTS_RING_SIZE frames ahead of the GPU.
+    GLsync fence = s_inputs_fences[s_inputs_slot];
+    if (fence != nullptr) {
+        while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {
+        }
+        glDeleteSync(fence);
+        s_inputs_fences[s_inputs_slot] = nullptr;
+    }
+
+    int offset = s_inputs_slot * s_inputs_stride;
+    memcpy(s_inputs_mapped + offset, inputs, sizeof(ShaderInputs));
+    glBindBufferRange(GL_UNIFORM_BUFFER, SHADER_INPUTS_BINDING, s_inputs_buffer, offset, sizeof(ShaderInputs));
+}
+
+void shader_inputs_set_date(ShaderInputs *inputs) {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    struct tm local;
+    localtime_r(&tv.tv_sec, &local);
+
+    inputs->date[0] = (float)(local.tm_year + 1900);
+    inputs->date[1] = (float)local.tm_mon;
+    inputs->date[2] = (float)local.tm_mday;
+    inputs->date[3] = (float)(local.tm_hour * 3600 + local.tm_min * 60 + local.tm_sec) + (float)tv.tv_usec / 1e6f;
+}
+
+static const char *print_size_str_tbl[] = {
+        "",             // PRINTING_DISABLED
+        "720p",         // PRINT_SIZE_720P
+        "1080p",        // PRINT_SIZE_1080P
+        "4k",           // PRINT_SIZE_4K
+        "5k",           // PRINT_SIZE_5K
+        "A3-150dpi",    // PRINT_SIZE_A3_150DPI
+        "A3-300dpi"     // PRINT_SIZE_A3_300DPI
+};
+
+static PrintSize print_size_from_str(const char *str) {
+    for (int i = 0; i < ARRAY_LEN(print_size_str_tbl); i++) {
+        if (strcmp(str, print_size_str_tbl[i]) == 0) {
+            return (PrintSize)i;
+        }
+    }
+
+    ERRORF("Print size %s is not valid.\n", str);
+
+    return PRINTING_DISABLED;
+}
+
+void print_size_get_dimensions(PrintSize print_size, int *out_width, int *out_height) {
+    switch (print_size) {
+        case PRINT_SIZE_720p:
+            *out_width = 1280;
+            *out_height = 720;
+            break;
+        case PRINT_SIZE_1080P:
+            *out_width = 1920;
+            *out_height = 1080;
+            break;
+        case PRINT_SIZE_4K:
+            *out_width = 3840;
+            *out_height = 2160;
+            break;
+        case PRINT_SIZE_5K:
+            *out_width = 5120;
+            *out_height = 2160;
+            break;
+        case PRINT_SIZE_A3_150DPI:
+            *out_width = 2480;
+            *out_height = 1754;
+            break;
+        case PRINT_SIZE_A3_300DPI:
+            *out_width = 4960;
+            *out_height = 3508;
+            break;
+        case PRINTING_DISABLED:
+        default:
+            *out_width = 0;
+            *out_height = 0;
+            break;
+    }
+}
+
+bool print_size_parse(const char *str, int *out_width, int *out_height) {
+    for (int i = 1; i < ARRAY_LEN(print_size_str_tbl); i++) {
+        if (strcmp(str, print_size_str_tbl[i]) == 0) {
+            print_size_get_dimensions((PrintSize)i, out_width, out_height);
+            return true;
+        }
+    }
+
+    int width, height;
+    char trailing;
+    if (sscanf(str, "%dx%d%c", &width, &height, &trailing) != 2 || width <= 0 || height <= 0) {
+        return false;
+    }
+    *out_width = width;
+    *out_height = height;
+
+    return true;
+}
+
+static void render_buffer_free_textures(RenderBuffer *buffer) {
+    if (buffer->textures[0] != 0) {
+        glDeleteFramebuffers(2, buffer->fbos);
+        glDeleteTextures(2, buffer->textures);
+        buffer->fbos[0] = buffer->fbos[1] = 0;
+        buffer->textures[0] = buffer->textures[1] = 0;
+    }
+}
+
+static void render_buffer_alloc_textures(RenderBuffer *buffer, int width, int height) {
+    render_buffer_free_textures(buffer);
+
+    glGenTextures(2, buffer->textures);
+    glGenFramebuffers(2, buffer->fbos);
+    for (int i = 0; i < 2; i++) {
+        glBindTexture(GL_TEXTURE_2D, buffer->textures[i]);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, buffer->fbos[i]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, buffer->textures[i], 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            ERRORF("Failure in call to glCheckFrameBufferStatus() returned framebuffer not complete\n");
+            exit(EXIT_FAILURE);
+        }
+
+        const float zero[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        glClearBufferfv(GL_COLOR, 0, zero);
+    }
+    buffer->current = 0;
+}
+
+// Matches the buffer passes to the buffers declared by the image shader, creating and destroying passes as
+// needed.
+static void shader_renderer_sync_buffers(ShaderRenderer *shader_renderer) {
+    for (int i = 0; i < SHADER_MAX_BUFFERS; i++) {
+        RenderBuffer *buffer = &shader_renderer->buffers[i];
+        const char *path = shader_renderer->shader.buffer_paths[i];
+        bool compute = shader_renderer->shader.buffer_compute[i];
+
+        if (buffer->active && (strcmp(buffer->path, path) != 0 || buffer->shader.compute != compute)) {
+            shader_destroy(&buffer->shader);
+            render_buffer_free_textures(buffer);
+            buffer->active = false;
+        }
+        if (!buffer->active && path[0] != '\0') {
+            INFOF("Adding %s pass %d: %s.\n", compute ? "compute" : "buffer", i, path);
+            memcpy(buffer->path, path, PATH_MAX);
+            buffer->fbos[0] = buffer->fbos[1] = 0;
+            buffer->textures[0] = buffer->textures[1] = 0;
+            buffer->current = 0;
+            buffer->active = true;
+            shader_create(&buffer->shader, &shader_renderer->source_cache, buffer->path, shader_renderer->defines,
+                          shader_renderer->num_defines, compute, shader_renderer->spirv);
+        }
+    }
+}
+
+static void render_texture_load(RenderTexture *texture) {
+    if (texture->load != nullptr) {
+        texture_load_cancel(texture->load);
+    }
+    texture->load = texture_load_start(texture->decl.path);
+}
+
+// Writes the textures of the -t options and the textures declared by the image shader that they don't override to
+// out_decls, returns their count.
+static int shader_renderer_texture_decls(ShaderRenderer *shader_renderer, ShaderTexture *out_decls) {
+    int num_decls = 0;
+    for (int i = 0; i < shader_renderer->num_cli_textures && i < SHADER_MAX_TEXTURES; i++) {
+        out_decls[num_decls++] = shader_renderer->cli_textures[i];
+    }
+    Shader *shader = &shader_renderer->shader;
+    for (int i = 0; i < shader->num_textures; i++) {
+        bool overridden = false;
+        for (int j = 0; j < shader_renderer->num_cli_textures; j++) {
+            overridden = overridden || strcmp(shader_renderer->cli_textures[j].name, shader->textures[i].name) == 0;
+        }
+        if (overridden) {
+            continue;
+        }
+        if (num_decls == SHADER_MAX_TEXTURES) {
+            ERRORF("Too many textures, the maximum is %d.\n", SHADER_MAX_TEXTURES);
+            break;
+        }
+        out_decls[num_decls++] = shader->textures[i];
+    }
+
+    return num_decls;
+}
+
+// Matches the textures to the -t options and the textures declared by the image shader, unloading the ones that
+// were removed and starting to load the ones that were added.
+static void shader_renderer_sync_textures(ShaderRenderer *shader_renderer) {
+    ShaderTexture decls[SHADER_MAX_TEXTURES];
+    int num_decls = shader_renderer_texture_decls(shader_renderer, decls);
+
+    bool declared[SHADER_MAX_TEXTURES] = {};
+    for (int i = 0; i < SHADER_MAX_TEXTURES; i++) {
+        RenderTexture *texture = &shader_renderer->textures[i];
+        if (!texture->active) {
+            continue;
+        }
+
+        int decl = -1;
+        for (int j = 0; j < num_decls && decl < 0; j++) {
+            if (strcmp(decls[j].name, texture->decl.name) == 0 && strcmp(decls[j].path, texture->decl.path) == 0) {
+                decl = j;
+            }
+        }
+        if (decl >= 0) {
+            declared[decl] = true;
+            continue;
+        }
+
+        if (texture->load != nullptr) {
+            texture_load_cancel(texture->load);
+        }
+        glDeleteTextures(1, &texture->texture);
+        texture->active = false;
+    }
+
+    for (int i = 0; i < num_decls; i++) {
+        if (declared[i]) {
+            continue;
+        }
+
+        RenderTexture *texture = nullptr;
+        for (int j = 0; j < SHADER_MAX_TEXTURES && texture == nullptr; j++) {
+            if (!shader_renderer->textures[j].active) {
+                texture = &shader_renderer->textures[j];
+            }
+        }
+
+        INFOF("Adding texture %s: %s.\n", decls[i].name, decls[i].path);
+        texture->active = true;
+        texture->decl = decls[i];
+        texture->texture = 0;
+        texture->width = 0;
+        texture->height = 0;
+        texture->load = nullptr;
+        render_texture_load(texture);
+    }
+}
+
+static void shader_set_texture_uniforms(Shader *shader, const RenderTexture *textures) {
+    if (!shader->compiled) {
+        return;
+    }
+
+    for (int i = 0; i < SHADER_MAX_TEXTURES; i++) {
+        int loc = textures[i].active ? shader_uniform_location(shader, textures[i].decl.name) : -1;
+        if (loc != -1) {
+            glProgramUniform1i(shader->program, loc, SHADER_TEXTURE_UNIT + i);
+        }
+    }
+}
+
+// Points the samplers named after each texture to its unit, in every pass.
+static void shader_renderer_set_texture_uniforms(ShaderRenderer *shader_renderer) {
+    shader_set_texture_uniforms(&shader_renderer->shader, shader_renderer->textures);
+    for (int i = 0; i < SHADER_MAX_BUFFERS; i++) {
+        if (shader_renderer->buffers[i].active) {
+            shader_set_texture_uniforms(&shader_renderer->buffers[i].shader, shader_renderer->textures);
+        }
+    }
+}
+
+static void shader_renderer_init(ShaderRenderer *shader_renderer, const ShaderDefine *defines, int num_defines,
+                                 const ShaderTexture *textures, int num_textures, bool spirv) {
+    shader_renderer->vao = 0;
+    shader_renderer->output_fbo = 0;
+    shader_renderer->output_texture = 0;
+    shader_renderer->output_width = 0;
+    shader_renderer->output_height = 0;
+    shader_renderer->source_cache.num_files = 0;
+    shader_renderer->defines = defines;
+    shader_renderer->num_defines = num_defines;
+    shader_renderer->spirv = spirv;
+    shader_renderer->cli_textures = textures;
+    shader_renderer->num_cli_textures = num_textures;
+    for (int i = 0; i < SHADER_MAX_BUFFERS; i++) {
+        shader_renderer->buffers[i].active = false;
+    }
+    for (int i = 0; i < SHADER_MAX_TEXTURES; i++) {
+        shader_renderer->textures[i].active = false;
+    }
+    shader_renderer->buffer_width = 0;
+    shader_renderer->buffer_height = 0;
+    shader_renderer->frame = 0;
+    shader_renderer->storage_buffer = 0;
+    for (int i = 0; i < 4; i++) {
+        shader_renderer->mouse[i] = 0.0f;
+    }
+    shader_renderer->last_elapsed_time = 0.0f;
+    shader_renderer->cpu_program = nullptr;
+    shader_renderer->print_threads = -1;
+}
+
+void shader_renderer_create(ShaderRenderer *shader_renderer, const char *frag_shader_path,
+                            const ShaderDefine *defines, int num_defines, const ShaderTexture *textures,
+                            int num_textures, bool spirv) {
+    // glSpecializeShader() is core since 4.6, the ARB_gl_spirv entry points aren't loaded.
+    if (spirv && !glslang_available()) {
+        ERRORF("SPIR-V needs shdy built with GLSLANG=1, compiling GLSL instead.\n");
+        spirv = false;
+    } else if (spirv && !GLAD_GL_VERSION_4_6) {
+        ERRORF("SPIR-V needs OpenGL 4.6, compiling GLSL instead.\n");
+        spirv = false;
+    }
+
+    // The fullscreen triangle has no vertex attributes, but core profiles still need a vertex array bound to draw.
+    unsigned int vao;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+
+    shader_renderer_init(shader_renderer, defines, num_defines, textures, num_textures, spirv);
+    shader_renderer->vao = vao;
+    shader_create(&shader_renderer->shader, &shader_renderer->source_cache, frag_shader_path, defines, num_defines,
+                  false, spirv);
+    shader_renderer_sync_buffers(shader_renderer);
+    shader_renderer_sync_textures(shader_renderer);
+    shader_renderer_set_texture_uniforms(shader_renderer);
+}
+
+void shader_renderer_create_cpu(ShaderRenderer *shader_renderer, const char *frag_shader_path,
+                                const ShaderDefine *defines, int num_defines, const ShaderTexture *textures,
+                                int num_textures) {
+    shader_renderer_init(shader_renderer, defines, num_defines, textures, num_textures, false);
+    shader_init(&shader_renderer->shader, &shader_renderer->source_cache, frag_shader_path, defines, num_defines,
+                false);
+    shader_compile_cpu(&shader_renderer->shader, &shader_renderer->cpu_program);
+}
+
+void shader_renderer_destroy(ShaderRenderer *shader_renderer) {
+    shader_destroy(&shader_renderer->shader);
+    for (int i = 0; i < SHADER_MAX_BUFFERS; i++) {
+        RenderBuffer *buffer = &shader_renderer->buffers[i];
+        if (buffer->active) {
+            shader_destroy(&buffer->shader);
+            render_buffer_free_textures(buffer);
+            buffer->active = false;
+        }
+    }
+    for (int i = 0; i < SHADER_MAX_TEXTURES; i++) {
+        RenderTexture *texture = &shader_renderer->textures[i];
+        if (texture->active) {
+            if (texture->load != nullptr) {
+                texture_load_cancel(texture->load);
+            }
+            glDeleteTextures(1, &texture->texture);
+            texture->active = false;
+        }
+    }
+
+    if (shader_renderer->storage_buffer != 0) {
+        glDeleteBuffers(1, &shader_renderer->storage_buffer);
+    }
+    if (shader_renderer->output_texture != 0) {
+        glDeleteFramebuffers(1, &shader_renderer->output_fbo);
+        glDeleteTextures(1, &shader_renderer->output_texture);
+    }
+    glDeleteVertexArrays(1, &shader_renderer->vao);
+    source_cache_destroy(&shader_renderer->source_cache);
+}
+
+// Writes the RGB pixels of a print, with rows stored bottom up, to output_path as a PNG.
+static void print_write(const char *output_path, int width, int height, const void *rgb) {
+    INFOF("Print rendering complete, writing pixel data to %s...\n", output_path);
+    stbi_flip_vertically_on_write(true);
+    int ret = stbi_write_png(output_path, width, height, 3, rgb, 3 * width);
+    if (ret == 0) {
+        ERRORF("stbi_write_png() failed to write image to: %s\n", output_path);
+        exit(EXIT_FAILURE);
+    }
+
+    INFOF("Print written to %s successfully!\n", output_path);
+}
+
+// Binds output_fbo with an RGB texture of the renderer's size attached, reusing the texture if the size is the same.
+static void shader_renderer_alloc_output(ShaderRenderer *shader_renderer) {
+    int width = shader_renderer->width;
+    int height = shader_renderer->height;
+
+    if (shader_renderer->output_texture == 0) {
+        glGenFramebuffers(1, &shader_renderer->output_fbo);
+        glGenTextures(1, &shader_renderer->output_texture);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, shader_renderer->output_fbo);
+    if (shader_renderer->output_width == width && shader_renderer->output_height == height) {
+        return;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, shader_renderer->output_texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, shader_renderer->output_texture, 0);
+
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        ERRORF("Failure in call to glCheckFrameBufferStatus() returned framebuffer not complete\n");
+        exit(EXIT_FAILURE);
+    }
+
+    shader_renderer->output_width = width;
+    shader_renderer->output_height = height;
+}
+
+static void shader_renderer_print_begin(ShaderRenderer *shader_renderer) {
+    INFOF("Rendering shader for print with dimensions %dx%d...\n", shader_renderer->width, shader_renderer->height);
+    shader_renderer_alloc_output(shader_renderer);
+}
+
+static void shader_renderer_print_end(ShaderRenderer *shader_renderer, const char *output_path) {
+    glFinish();
+
+    int width = shader_renderer->width;
+    int height = shader_renderer->height;
+
+    char *buffer = (char *)calloc(3, width * height);
+    if (buffer == nullptr) {
+        ERRORF("Failed to calloc() for image buffer.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Read back from the framebuffer rather than the bound texture, the noise texture may have replaced the
+    // print texture binding during the draw.
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, buffer);
+    GLenum err = glGetError();
+    if (err != GL_NO_ERROR) {
+      ERRORF("glReadPixels() failed with code: %d\n", err);
+      exit(EXIT_FAILURE);
+    }
+
+    print_write(output_path, width, height, buffer);
+    free(buffer);
+}
+
+// Sets the uniforms and textures of a pass, before it's drawn or dispatched.
+static void shader_renderer_begin_pass(ShaderRenderer *shader_renderer, Shader *shader) {
+    glUseProgram(shader->program);
+
+    if (shader->uniform_noise_texture_loc != -1) {
+        glActiveTexture(GL_TEXTURE0 + NOISE_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, noise_texture_get());
+    }
+    for (int i = 0; i < SHADER_MAX_BUFFERS; i++) {
+        RenderBuffer *buffer = &shader_renderer->buffers[i];
+        if (buffer->active && shader->uniform_buffer_locs[i] != -1) {
+            glActiveTexture(GL_TEXTURE0 + SHADER_BUFFER_TEXTURE_UNIT + i);
+            glBindTexture(GL_TEXTURE_2D, buffer->textures[buffer->current]);
+        }
+    }
+}
+
+// Reallocates and clears the buffer textures and the storage buffer, restarting the feedback from frame 0.
+static void shader_renderer_reset_buffers(ShaderRenderer *shader_renderer, int width, int height) {
+    bool has_compute = false;
+    for (int i = 0; i < SHADER_MAX_BUFFERS; i++) {
+        RenderBuffer *buffer = &shader_renderer->buffers[i];
+        if (buffer->active) {
+            render_buffer_alloc_textures(buffer, width, height);
+            has_compute = has_compute || buffer->shader.compute;
+        }
+    }
+
+    // The storage buffer is only allocated once a compute pass needs it.
+    if (has_compute) {
+        if (shader_renderer->storage_buffer == 0) {
+            glGenBuffers(1, &shader_renderer->storage_buffer);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, shader_renderer->storage_buffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, RENDER_STORAGE_SIZE, nullptr, GL_DYNAMIC_COPY);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, shader_renderer->storage_buffer);
+        glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, SHADER_STORAGE_BINDING, shader_renderer->storage_buffer);
+    }
+
+    shader_renderer->buffer_width = width;
+    shader_renderer->buffer_height = height;
+    shader_renderer->frame = 0;
+}
+
+// Fills the inputs of the next frame, drawn at elapsed_time.
+static void shader_renderer_frame_inputs(ShaderRenderer *shader_renderer, float elapsed_time, ShaderInputs *inputs) {
+    *inputs = {};
+    memcpy(inputs->mouse, shader_renderer->mouse, sizeof(inputs->mouse));
+    shader_inputs_set_date(inputs);
+    inputs->resolution[0] = (float)shader_renderer->width;
+    inputs->resolution[1] = (float)shader_renderer->height;
+    inputs->time = elapsed_time;
+    inputs->time_delta = shader_renderer->frame > 0 ? elapsed_time - shader_renderer->last_elapsed_time : 0.0f;
+    inputs->frame = shader_renderer->frame;
+}
+
+// Binds the texture inputs to their units in the current context.
+static void shader_renderer_bind_textures(ShaderRenderer *shader_renderer) {
+    // Textures still loading for the first time are left unbound, so they sample as black.
+    for (int i = 0; i < SHADER_MAX_TEXTURES; i++) {
+        if (shader_renderer->textures[i].active) {
+            glActiveTexture(GL_TEXTURE0 + SHADER_TEXTURE_UNIT + i);
+            glBindTexture(GL_TEXTURE_2D, shader_renderer->textures[i].texture);
+        }
+    }
+}
+
+// Draws or dispatches each buffer pass at the renderer's size.
+static void shader_renderer_draw_buffers(ShaderRenderer *shader_renderer) {
+    int width = shader_renderer->width;
+    int height = shader_renderer->height;
+
+    // Each buffer pass draws into the texture it isn't reading from and then flips, so passes after it see
+    // this frame's output and the pass itself sees the previous frame's.
+    for (int i = 0; i < SHADER_MAX_BUFFERS; i++) {
+        RenderBuffer *buffer = &shader_renderer->buffers[i];
+        if (!buffer->active || !buffer->shader.compiled) {
+            continue;
+        }
+
+        shader_renderer_begin_pass(shader_renderer, &buffer->shader);
+        if (buffer->shader.compute) {
+            // One invocation per pixel, the shader has to skip the ones past the edges of uOutput.
+            glBindImageTexture(SHADER_OUTPUT_IMAGE_UNIT, buffer->textures[1 - buffer->current], 0, GL_FALSE, 0,
+                               GL_WRITE_ONLY, GL_RGBA32F);
+            glDispatchCompute((width + SHADER_COMPUTE_LOCAL_SIZE - 1) / SHADER_COMPUTE_LOCAL_SIZE,
+                              (height + SHADER_COMPUTE_LOCAL_SIZE - 1) / SHADER_COMPUTE_LOCAL_SIZE, 1);
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT |
+                            GL_SHADER_STORAGE_BARRIER_BIT);
+        } else {
+            glBindFramebuffer(GL_FRAMEBUFFER, buffer->fbos[1 - buffer->current]);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        buffer->current = 1 - buffer->current;
+    }
+}
+
+void shader_renderer_draw(ShaderRenderer *shader_renderer, float elapsed_time) {
+    int width = shader_renderer->width;
+    int height = shader_renderer->height;
+
+    if (shader_renderer->buffer_width != width || shader_renderer->buffer_height != height) {
+        shader_renderer_reset_buffers(shader_renderer, width, height);
+    }
+
+    ShaderInputs inputs;
+    shader_renderer_frame_inputs(shader_renderer, elapsed_time, &inputs);
+    shader_inputs_update(&inputs);
+    shader_renderer->last_elapsed_time = elapsed_time;
+
+    glViewport(0, 0, width, height);
+    shader_renderer_bind_textures(shader_renderer);
+    shader_renderer_draw_buffers(shader_renderer);
+
+    // Until the shader first compiles there's nothing to draw, later failures keep drawing the last good program.
+    glBindFramebuffer(GL_FRAMEBUFFER, shader_renderer->output_fbo);
+    glClear(GL_COLOR_BUFFER_BIT);
+    if (shader_renderer->shader.compiled) {
+        shader_renderer_begin_pass(shader_renderer, &shader_renderer->shader);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+
+    shader_renderer->frame++;
+}
+
+bool shader_renderer_time_varying(ShaderRenderer *shader_renderer) {
+    // Buffer passes feed back into themselves, so they keep changing even without time-varying inputs.
+    for (int i = 0; i < SHADER_MAX_BUFFERS; i++) {
+        if (shader_renderer->buffers[i].active) {
+            return true;
+        }
+    }
+
+    return shader_renderer->shader.time_varying;
+}
+
+bool shader_renderer_update_textures(ShaderRenderer *shader_renderer, bool wait) {
+    bool finished = false;
+    size_t budget = wait ? SIZE_MAX : TEXTURE_UPLOAD_BUDGET;
+
+    texture_load_clear_events(false);
+    for (int i = 0; i < SHADER_MAX_TEXTURES; i++) {
+        RenderTexture *texture = &shader_renderer->textures[i];
+        if (!texture->active || texture->load == nullptr) {
+            continue;
+        }
+
+        TextureLoadState state = texture_load_update(texture->load, &budget);
+        while (wait && state == TEXTURE_LOAD_DECODING) {
+            texture_load_clear_events(true);
+            state = texture_load_update(texture->load, &budget);
+        }
+
+        if (state == TEXTURE_LOAD_FAILED) {
+            ERRORF("Failed to load texture %s, keeping the previous image.\n", texture->decl.name);
+            texture_load_cancel(texture->load);
+            texture->load = nullptr;
+        } else if (state == TEXTURE_LOAD_DONE) {
+            glDeleteTextures(1, &texture->texture);
+            texture->texture = texture_load_finish(texture->load, &texture->width, &texture->height);
+            texture->load = nullptr;
+            finished = true;
+            INFOF("Texture %s loaded (%dx%d).\n", texture->decl.name, texture->width, texture->height);
+        }
+    }
+
+    return finished;
+}
+
+bool shader_renderer_loading_textures(ShaderRenderer *shader_renderer) {
+    for (int i = 0; i < SHADER_MAX_TEXTURES; i++) {
+        if (shader_renderer->textures[i].active && shader_renderer->textures[i].load != nullptr) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Renders the print with the CPU program, the inputs are the same as the first frame of a GL print.
+static void shader_renderer_draw_to_print_cpu(ShaderRenderer *shader_renderer, const char *output_path) {
+    CpuProgram *program = shader_renderer->cpu_program;
+    int width = shader_renderer->width;
+    int height = shader_renderer->height;
+    INFOF("Rendering shader for print on the CPU with dimensions %dx%d...\n", width, height);
+
+    ShaderInputs inputs = {};
+    memcpy(inputs.mouse, shader_renderer->mouse, sizeof(inputs.mouse));
+    shader_inputs_set_date(&inputs);
+    float resolution[2] = {(float)width, (float)height};
+    float tile_offset[2] = {0.0f, 0.0f};
+    float time = 1.0f;
+    float time_delta = 0.0f;
+    float frame = 0.0f;
+    cpu_program_set_uniform(program, "uMouse", inputs.mouse, 4);
+    cpu_program_set_uniform(program, "uDate", inputs.date, 4);
+    cpu_program_set_uniform(program, "uResolution", resolution, 2);
+    cpu_program_set_uniform(program, "uTileOffset", tile_offset, 2);
+    cpu_program_set_uniform(program, "uTime", &time, 1);
+    cpu_program_set_uniform(program, "uTimeDelta", &time_delta, 1);
+    cpu_program_set_uniform(program, "uFrame", &frame, 1);
+
+    Shader *shader = &shader_renderer->shader;
+    for (int i = 0; i < shader->num_params; i++) {
+        ShaderParam *param = &shader->params[i];
+        cpu_program_set_uniform(program, param->name, param->value, param->components);
+    }
+
+    // The program keeps pointers to the texels, so they're only freed once it has rendered.
+    float *noise = (float *)malloc(NOISE_TEXTURE_SIZE * NOISE_TEXTURE_SIZE * 4 * sizeof(float));
+    if (noise == nullptr) {
+        ERRORF("Failed to malloc() for the noise texture.\n");
+        exit(EXIT_FAILURE);
+    }
+    noise_texture_generate(noise);
+    cpu_program_set_texture(program, "uShdyNoiseTex", noise, NOISE_TEXTURE_SIZE, NOISE_TEXTURE_SIZE);
+
+    ShaderTexture decls[SHADER_MAX_TEXTURES];
+    int num_decls = shader_renderer_texture_decls(shader_renderer, decls);
+    float *texels[SHADER_MAX_TEXTURES];
+    for (int i = 0; i < num_decls; i++) {
+        texels[i] = nullptr;
+        Image image;
+        if (!image_load(&image, decls[i].path)) {
+            ERRORF("Failed to load texture %s, it samples as black.\n", decls[i].name);
+            continue;
+        }
+
+        size_t num_values = (size_t)image.width * image.height * 4;
+        texels[i] = (float *)malloc(num_values * sizeof(float));
+        if (texels[i] == nullptr) {
+            ERRORF("Failed to malloc() for texture %s.\n", decls[i].name);
+            exit(EXIT_FAILURE);
+        }
+        if (image.format == IMAGE_RGBA32F) {
+            memcpy(texels[i], image.pixels, num_values * sizeof(float));
+        } else {
+            for (size_t j = 0; j < num_values; j++) {
+                texels[i][j] = (float)((uint8_t *)image.pixels)[j] / 255.0f;
+            }
+        }
+        cpu_program_set_texture(program, decls[i].name, texels[i], image.width, image.height);
+        INFOF("Texture %s loaded (%dx%d).\n", decls[i].name, image.width, image.height);
+        image_free(&image);
+    }
+
+    uint8_t *buffer = (uint8_t *)malloc((size_t)width * height * 3);
+    if (buffer == nullptr) {
+        ERRORF("Failed to malloc() for image buffer.\n");
+        exit(EXIT_FAILURE);
+    }
+    cpu_program_render(program, width, height, shader_renderer->print_threads < 0 ? 0 : shader_renderer->print_threads,
+                       buffer);
+    print_write(output_path, width, height, buffer);
+
+    free(buffer);
+    for (int i = 0; i < num_decls; i++) {
+        free(texels[i]);
+    }
+    free(noise);
+}
+
+typedef struct {
+    ShaderRenderer *shader_renderer;
+    ShaderInputs inputs;
+    GLFWwindow *contexts[TILE_SCHEDULER_MAX_THREADS];
+    unsigned int vaos[TILE_SCHEDULER_MAX_THREADS];
+    unsigned int textures[TILE_SCHEDULER_MAX_THREADS]; // A tile each, no two contexts render to the same object.
+    unsigned int fbos[TILE_SCHEDULER_MAX_THREADS];
+    unsigned int inputs_buffers[TILE_SCHEDULER_MAX_THREADS];
+    bool failed[TILE_SCHEDULER_MAX_THREADS]; // Set by the thread, which draws no more tiles once it is.
+    uint8_t *rgb;
+} PrintTiles;
+
+// Returns true if the context renders on the CPU, where the driver may not spread one draw across every core.
+static bool gl_software_renderer() {
+    const char *renderer = (const char *)glGetString(GL_RENDERER);
+    return renderer != nullptr && (strstr(renderer, "llvmpipe") != nullptr || strstr(renderer, "softpipe") != nullptr ||
+                                   strstr(renderer, "SwiftShader") != nullptr);
+}
+
+// Sets up the context of a thread to draw the image pass into a texture of its own, a tile at a time. Framebuffers
+// and vertex arrays aren't shared between contexts, the programs and textures are.
+static void print_tiles_begin(void *arg, int thread) {
+    auto *print = (PrintTiles *)arg;
+    ShaderRenderer *shader_renderer = print->shader_renderer;
+    glfwMakeContextCurrent(print->contexts[thread]);
+
+    glGenVertexArrays(1, &print->vaos[thread]);
+    glBindVertexArray(print->vaos[thread]);
+    glGenTextures(1, &print->textures[thread]);
+    glBindTexture(GL_TEXTURE_2D, print->textures[thread]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, PRINT_TILE_SIZE, PRINT_TILE_SIZE, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glGenFramebuffers(1, &print->fbos[thread]);
+    glBindFramebuffer(GL_FRAMEBUFFER, print->fbos[thread]);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, print->textures[thread], 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        ERRORF("Failure in call to glCheckFrameBufferStatus() returned framebuffer not complete\n");
+        print->failed[thread] = true;
+    }
+
+    // Each tile has its own uTileOffset, so every context updates its own copy of the inputs.
+    glGenBuffers(1, &print->inputs_buffers[thread]);
+    glBindBuffer(GL_UNIFORM_BUFFER, print->inputs_buffers[thread]);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(ShaderInputs), nullptr, GL_STREAM_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, SHADER_INPUTS_BINDING, print->inputs_buffers[thread]);
+
+    glEnable(GL_SCISSOR_TEST);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glPixelStorei(GL_PACK_ROW_LENGTH, shader_renderer->width);
+    shader_renderer_bind_textures(shader_renderer);
+    shader_renderer_begin_pass(shader_renderer, &shader_renderer->shader);
+}
+
+static void print_tiles_draw(void *arg, int thread, const Tile *tile) {
+    auto *print = (PrintTiles *)arg;
+    if (print->failed[thread]) {
+        return;
+    }
+
+    ShaderInputs inputs = print->inputs;
+    inputs.tile_offset[0] = (float)tile->x;
+    inputs.tile_offset[1] = (float)tile->y;
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ShaderInputs), &inputs);
+
+    // The viewport is the whole print shifted so the tile lands at the origin of the thread's texture. gl_FragCoord
+    // is relative to that origin, the shaders read shdyFragCoord in its place, which adds uTileOffset back.
+    ShaderRenderer *shader_renderer = print->shader_renderer;
+    glViewport(-tile->x, -tile->y, shader_renderer->width, shader_renderer->height);
+    glScissor(0, 0, tile->width, tile->height);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    // Reading the tile back waits for it, so the thread's busy time is the time the tile took to draw.
+    size_t offset = ((size_t)tile->y * shader_renderer->width + tile->x) * 3;
+    glReadPixels(0, 0, tile->width, tile->height, GL_RGB, GL_UNSIGNED_BYTE, print->rgb + offset);
+}
+
+static void print_tiles_end(void *arg, int thread) {
+    auto *print = (PrintTiles *)arg;
+    GLenum err = glGetError();
+    if (err != GL_NO_ERROR) {
+        ERRORF("Drawing print tiles failed with code: %d\n", err);
+        print->failed[thread] = true;
+    }
+
+    glDeleteBuffers(1, &print->inputs_buffers[thread]);
+    glDeleteFramebuffers(1, &print->fbos[thread]);
+    glDeleteTextures(1, &print->textures[thread]);
+    glDeleteVertexArrays(1, &print->vaos[thread]);
+    glfwMakeContextCurrent(nullptr);
+}
+
+// Draws the buffer passes in the renderer's context, then the image pass in tiles on num_threads threads, each with
+// its own context, and reads each tile back on the thread that drew it. Returns false if any thread failed to draw.
+static bool shader_renderer_draw_to_print_tiled(ShaderRenderer *shader_renderer, const char *output_path,
+                                                int num_threads) {
+    int width = shader_renderer->width;
+    int height = shader_renderer->height;
+
+    TileScheduler scheduler;
+    tile_scheduler_create(&scheduler, width, height, PRINT_TILE_SIZE, PRINT_TILE_SIZE, num_threads);
+    INFOF("Rendering shader for print with dimensions %dx%d in %d tiles on %d threads...\n", width, height,
+          scheduler.num_tiles, scheduler.num_threads);
+
+    if (shader_renderer->buffer_width != width || shader_renderer->buffer_height != height) {
+        shader_renderer_reset_buffers(shader_renderer, width, height);
+    }
+
+    PrintTiles print = {};
+    print.shader_renderer = shader_renderer;
+    shader_renderer_frame_inputs(shader_renderer, 1.0f, &print.inputs);
+    shader_inputs_update(&print.inputs);
+    shader_renderer->last_elapsed_time = 1.0f;
+
+    glViewport(0, 0, width, height);
+    shader_renderer_bind_textures(shader_renderer);
+    shader_renderer_draw_buffers(shader_renderer);
+    // The noise texture is created on first use, which has to happen in this context.
+    if (shader_renderer->shader.uniform_noise_texture_loc != -1) {
+        noise_texture_get();
+    }
+
+    print.rgb = (uint8_t *)malloc((size_t)width * height * 3);
+    if (print.rgb == nullptr) {
+        ERRORF("Failed to malloc() for image buffer.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // GLFW only creates contexts on the main thread, they're made current on the scheduler's threads. The hidden
+    // windows share the objects of the renderer's context.
+    GLFWwindow *main_context = glfwGetCurrentContext();
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    for (int i = 0; i < scheduler.num_threads; i++) {
+        print.contexts[i] = glfwCreateWindow(1, 1, "shdy tile", nullptr, main_context);
+        if (print.contexts[i] == nullptr) {
+            ERRORF("Failed to create the context of print thread %d.\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Other contexts only see the buffer passes, the texture and the uniforms once they've finished.
+    glFinish();
+
+    static const TileFns fns = {print_tiles_begin, print_tiles_draw, print_tiles_end};
+    tile_scheduler_run(&scheduler, &fns, &print);
+    tile_scheduler_report(&scheduler);
+    tile_scheduler_destroy(&scheduler);
+    shader_renderer->frame++;
+
+    for (int i = 0; i < TILE_SCHEDULER_MAX_THREADS; i++) {
+        if (print.contexts[i] != nullptr) {
+            glfwDestroyWindow(print.contexts[i]);
+        }
+    }
+    glfwMakeContextCurrent(main_context);
+
+    bool failed = false;
+    for (int i = 0; i < TILE_SCHEDULER_MAX_THREADS; i++) {
+        failed = failed || print.failed[i];
+    }
+    if (!failed) {
+        print_write(output_path, width, height, print.rgb);
+    }
+    free(print.rgb);
+
+    return !failed;
+}
+
+void shader_renderer_draw_to_print(ShaderRenderer *shader_renderer, const char *output_path) {
+    assert(output_path != nullptr);
+
+    if (shader_renderer->cpu_program != nullptr) {
+        shader_renderer_draw_to_print_cpu(shader_renderer, output_path);
+        return;
+    }
+    if (!shader_renderer->shader.compiled) {
+        ERRORF("Shader %s failed to compile, there is nothing to print.\n",
+               shader_renderer->shader.user_frag_shader_path);
+        exit(EXIT_FAILURE);
+    }
+
+    // A print has to show the textures, so wait for them rather than drawing while they stream in.
+    shader_renderer_update_textures(shader_renderer, true);
+
+    // Unless told otherwise, only software renderers draw in tiles, GPUs already spread one draw across all of it.
+    int num_threads = shader_renderer->print_threads;
+    if (num_threads < 0) {
+        num_threads = gl_software_renderer() ? 0 : 1;
+    }
+    if (num_threads == 0) {
+        num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (num_threads > 1) {
+        if (!shader_renderer_draw_to_print_tiled(shader_renderer, output_path, num_threads)) {
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+
+    shader_renderer_print_begin(shader_renderer);
+    shader_renderer_draw(shader_renderer, 1.0f);
+    shader_renderer_print_end(shader_renderer, output_path);
+}
+
+void shader_renderer_print_tiles_begin(ShaderRenderer *shader_renderer) {
+    if (!shader_renderer->shader.compiled) {
+        ERRORF("Shader %s failed to compile, there is nothing to print.\n",
+               shader_renderer->shader.user_frag_shader_path);
+        exit(EXIT_FAILURE);
+    }
+
+    int width = shader_renderer->width;
+    int height = shader_renderer->height;
+    shader_renderer_update_textures(shader_renderer, true);
+    shader_renderer_print_begin(shader_renderer);
+    if (shader_renderer->buffer_width != width || shader_renderer->buffer_height != height) {
+        shader_renderer_reset_buffers(shader_renderer, width, height);
+    }
+
+    shader_renderer_frame_inputs(shader_renderer, 1.0f, &shader_renderer->print_inputs);
+    shader_inputs_update(&shader_renderer->print_inputs);
+    shader_renderer->last_elapsed_time = 1.0f;
+
+    glViewport(0, 0, width, height);
+    shader_renderer_bind_textures(shader_renderer);
+    shader_renderer_draw_buffers(shader_renderer);
+    shader_renderer->frame++;
+
+    // Each tile is drawn at the origin of the output, see shader_renderer_print_tile().
+    glBindFramebuffer(GL_FRAMEBUFFER, shader_renderer->output_fbo);
+    shader_renderer_begin_pass(shader_renderer, &shader_renderer->shader);
+    glEnable(GL_SCISSOR_TEST);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+}
+
+void shader_renderer_print_tile(ShaderRenderer *shader_renderer, const Tile *tile, uint8_t *out_rgb) {
+    ShaderInputs inputs = shader_renderer->print_inputs;
+    inputs.tile_offset[0] = (float)tile->x;
+    inputs.tile_offset[1] = (float)tile->y;
+    shader_inputs_update(&inputs);
+
+    // Like the tiles of a print drawn on several threads, see print_tiles_draw().
+    glViewport(-tile->x, -tile->y, shader_renderer->width, shader_renderer->height);
+    glScissor(0, 0, tile->width, tile->height);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glReadPixels(0, 0, tile->width, tile->height, GL_RGB, GL_UNSIGNED_BYTE, out_rgb);
+    GLenum err = glGetError();
+    if (err != GL_NO_ERROR) {
+        ERRORF("Drawing print tile failed with code: %d\n", err);
+        exit(EXIT_FAILURE);
+    }
+}
+
+bool shader_renderer_draw_to_image(ShaderRenderer *shader_renderer, float elapsed_time, uint8_t *out_rgb) {
+    shader_renderer_update_textures(shader_renderer, true);
+    shader_renderer_alloc_output(shader_renderer);
+
+    // Like a print, every image restarts the feedback of the buffer passes rather than going on from the last one.
+    shader_renderer->buffer_width = 0;
+    shader_renderer->buffer_height = 0;
+    shader_renderer_draw(shader_renderer, elapsed_time);
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, shader_renderer->width, shader_renderer->height, GL_RGB, GL_UNSIGNED_BYTE, out_rgb);
+    GLenum err = glGetError();
+    if (err != GL_NO_ERROR) {
+        ERRORF("glReadPixels() failed with code: %d\n", err);
+        return false;
+    }
+
+    return true;
+}
+
+static void json_append_string(StrBuf *out, const char *str) {
+    str_buf_append(out, "\"", 1);
+    for (; *str != '\0'; str++) {
+        if (*str == '"' || *str == '\\') {
+            str_buf_appendf(out, "\\%c", *str);
+        } else if ((unsigned char)*str < 0x20) {
+            str_buf_appendf(out, "\\u%04x", (unsigned char)*str);
+        } else {
+            str_buf_append(out, str, 1);
+        }
+    }
+    str_buf_append(out, "\"", 1);
+}
+
+static void shader_append_diagnostics_json(Shader *shader, StrBuf *out) {
+    char path[PATH_MAX];
+    resolve_path(shader->user_frag_shader_path, path);
+    str_buf_append(out, "{\"shader\":", 10);
+    json_append_string(out, path);
+    str_buf_appendf(out, ",\"compiled\":%s,\"diagnostics\":[", shader->failed ? "false" : "true");
+
+    for (int i = 0; i < shader->num_diagnostics; i++) {
+        const ShaderDiagnostic *diagnostic = &shader->diagnostics[i];
+        const char *file = shader_diagnostic_path(shader, diagnostic);
+        str_buf_append(out, i == 0 ? "{\"file\":" : ",{\"file\":", i == 0 ? 8 : 9);
+        if (file != nullptr) {
+            json_append_string(out, file);
+        } else {
+            str_buf_append(out, "null", 4);
+        }
+        str_buf_appendf(out, ",\"line\":%d,\"column\":%d,\"severity\":\"%s\",\"message\":", diagnostic->line,
+                        diagnostic->column, diagnostic->severity == DIAGNOSTIC_WARNING ? "warning" : "error");
+        json_append_string(out, diagnostic->message);
+        str_buf_append(out, "}", 1);
+    }
+    str_buf_append(out, "]}", 2);
+}
+
+static void write_diagnostics(Shader *const *shaders, int num_shaders, const char *path) {
+    StrBuf json = {};
+    str_buf_append(&json, "{\"passes\":[", 11);
+    for (int i = 0; i < num_shaders; i++) {
+        if (i > 0) {
+            str_buf_append(&json, ",", 1);
+        }
+        shader_append_diagnostics_json(shaders[i], &json);
+    }
+    str_buf_append(&json, "]}\n", 3);
+
+    if (strcmp(path, "-") == 0) {
+        fwrite(json.data, 1, json.len, stdout);
+        fflush(stdout);
+        str_buf_free(&json);
+        return;
+    }
+
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *file = fopen(tmp_path, "w");
+    if (file == nullptr) {
+        ERRORF("Failed to open %s: %s.\n", tmp_path, strerror(errno));
+        str_buf_free(&json);
+        return;
+    }
+    bool written = fwrite(json.data, 1, json.len, file) == json.len;
+    if (fclose(file) != 0 || !written || rename(tmp_path, path) != 0) {
+        ERRORF("Failed to write diagnostics to %s: %s.\n", path, strerror(errno));
+        unlink(tmp_path);
+    }
+    str_buf_free(&json);
+}
+
+void shader_renderer_write_diagnostics(ShaderRenderer *shader_renderer, const char *path) {
+    Shader *shaders[1 + SHADER_MAX_BUFFERS] = {&shader_renderer->shader};
+    int num_shaders = 1;
+    for (int i = 0; i < SHADER_MAX_BUFFERS; i++) {
+        if (shader_renderer->buffers[i].active) {
+            shaders[num_shaders++] = &shader_renderer->buffers[i].shader;
+        }
+    }
+
+    write_diagnostics(shaders, num_shaders, path);
+}
+
+typedef struct {
+    Shader *shader;
+    const char *defines_src;
+    bool valid;
+} ValidateJob;
+
+static void validate_job_run(void *arg) {
+    auto *job = (ValidateJob *)arg;
+    job->valid = shader_validate(job->shader, job->defines_src);
+}
+
+bool shader_renderer_check(const char *frag_shader_path, const ShaderDefine *defines, int num_defines,
+                           const char *diagnostics_path) {
+    auto *source_cache = (SourceCache *)calloc(1, sizeof(SourceCache));
+    auto *shaders = (Shader *)calloc(1 + SHADER_MAX_BUFFERS, sizeof(Shader));
+    auto *parses = (ShaderParse *)calloc(1 + SHADER_MAX_BUFFERS, sizeof(ShaderParse));
+    if (source_cache == nullptr || shaders == nullptr || parses == nullptr) {
+        ERRORF("Failed to calloc() shaders to check.\n");
+        exit(EXIT_FAILURE);
+    }
 
-    INFOF("Watching file %s for changes...\n", filepath);
+    // The sources are read and parsed in order, since the passes share the source cache.
+    ValidateJob jobs[1 + SHADER_MAX_BUFFERS];
+    int num_shaders = 0;
+    const char *path = frag_shader_path;
+    bool compute = false;
+    for (int i = -1; i < SHADER_MAX_BUFFERS; i++) {
+        if (i >= 0) {
+            path = parses[0].buffer_paths[i];
+            compute = parses[0].buffer_compute[i];
+            if (!jobs[0].valid || path[0] == '\0') {
+                continue;
+            }
+        }
+
+        Shader *shader = &shaders[num_shaders];
+        shader_init(shader, source_cache, path, defines, num_defines, compute);
+        jobs[num_shaders].shader = shader;
+        jobs[num_shaders].valid = shader_parse(shader, &parses[num_shaders]);
+        jobs[num_shaders].defines_src = parses[num_shaders].defines_src.data;
+        num_shaders++;
+    }
+
+    // Then glslang checks every pass at once, destroying the pool waits for the jobs.
+    ThreadPool thread_pool;
+    thread_pool_create(&thread_pool, num_shaders);
+    for (int i = 0; i < num_shaders; i++) {
+        if (jobs[i].valid) {
+            thread_pool_submit(&thread_pool, validate_job_run, &jobs[i]);
+        }
+    }
+    thread_pool_destroy(&thread_pool);
+
+    bool valid = true;
+    Shader *shader_ptrs[1 + SHADER_MAX_BUFFERS] = {};
+    for (int i = 0; i < num_shaders; i++) {
+        shaders[i].failed = !jobs[i].valid;
+        valid = valid && jobs[i].valid;
+        shader_ptrs[i] = &shaders[i];
+    }
+    if (diagnostics_path != nullptr) {
+        write_diagnostics(shader_ptrs, num_shaders, diagnostics_path);
+    }
+    if (valid) {
+        INFOF("Shader %s is valid, checked %d pass(es) with glslang.\n", frag_shader_path, num_shaders);
+    }
+
+    for (int i = 0; i < num_shaders; i++) {
+        str_buf_free(&parses[i].defines_src);
+        str_buf_free(&shaders[i].expanded_src);
+        source_line_map_free(&shaders[i].line_map);
+    }
+    source_cache_destroy(source_cache);
+    free(parses);
+    free(shaders);
+    free(source_cache);
+
+    return valid;
+}
+
+void shader_renderer_invalidate(ShaderRenderer *shader_renderer, const char *path) {
+    // The previous image is kept until the new one is uploaded.
+    for (int i = 0; i < SHADER_MAX_TEXTURES; i++) {
+        RenderTexture *texture = &shader_renderer->textures[i];
+        if (texture->active && strcmp(texture->decl.path, path) == 0) {
+            render_texture_load(texture);
+        }
+    }
+
+    int file_index = source_cache_update(&shader_renderer->source_cache, path);
+    if (file_index < 0) {
+        return;
+    }
+
+    if (shader_depends_on(&shader_renderer->shader, file_index)) {
+        shader_renderer->shader.outdated = true;
+    }
+    for (int i = 0; i < SHADER_MAX_BUFFERS; i++) {
+        RenderBuffer *buffer = &shader_renderer->buffers[i];
+        if (buffer->active && shader_depends_on(&buffer->shader, file_index)) {
+            buffer->shader.outdated = true;
+        }
+    }
+}
+
+bool shader_renderer_reload(ShaderRenderer *shader_renderer, bool wait) {
+    glsl_validation_clear_events(false);
+
+    // Every outdated pass starts validating before any of them is waited for.
+    Shader *image = &shader_renderer->shader;
+    bool image_done = image->outdated && shader_compile_start(image);
+    bool reloaded = false;
+    for (int i = 0; i < SHADER_MAX_BUFFERS; i++) {
+        RenderBuffer *buffer = &shader_renderer->buffers[i];
+        if (buffer->active && buffer->shader.outdated) {
+            reloaded = shader_compile_start(&buffer->shader) || reloaded;
+        }
+    }
+
+    if (image->pending != nullptr) {
+        image_done = shader_compile_finish(image, wait);
+    }
+    if (image_done && !image->failed) {
+        shader_renderer_sync_buffers(shader_renderer);
+        shader_renderer_sync_textures(shader_renderer);
+    }
+    reloaded = reloaded || image_done;
+    for (int i = 0; i < SHADER_MAX_BUFFERS; i++) {
+        RenderBuffer *buffer = &shader_renderer->buffers[i];
+        if (buffer->active && buffer->shader.pending != nullptr) {
+            reloaded = shader_compile_finish(&buffer->shader, wait) || reloaded;
+        }
+    }
+
+    // Restart the feedback from frame 0, the buffers may hold state the new shaders don't expect.
+    if (reloaded) {
+        shader_renderer->buffer_width = 0;
+        shader_renderer->buffer_height = 0;
+        shader_renderer_set_texture_uniforms(shader_renderer);
+    }
+
+    return reloaded;
+}
+
+bool shader_renderer_set_param(ShaderRenderer *shader_renderer, const char *name, const float *values, int count) {
+    Shader *shaders[1 + SHADER_MAX_BUFFERS] = {&shader_renderer->shader};
+    int num_shaders = 1;
+    for (int i = 0; i < SHADER_MAX_BUFFERS; i++) {
+        if (shader_renderer->buffers[i].active) {
+            shaders[num_shaders++] = &shader_renderer->buffers[i].shader;
+        }
+    }
+
+    bool found = false;
+    for (int i = 0; i < num_shaders; i++) {
+        ShaderParam *param = shader_find_param(shaders[i], name);
+        if (param == nullptr) {
+            continue;
+        }
+        if (param->components != count) {
+            ERRORF("Param %s takes %d value(s), got %d.\n", name, param->components, count);
+            return false;
+        }
+        shader_set_param(shaders[i], param, values);
+        found = true;
+    }
+
+    if (!found) {
+        ERRORF("No shader declares a param named %s.\n", name);
+    }
+
+    return found;
+}
+
+bool shader_renderer_load_params(ShaderRenderer *shader_renderer, const char *src) {
+    bool any_set = false;
+
+    for (const char *line = src; *line != '\0';) {
+        const char *end = strchr(line, '\n');
+        if (end == nullptr) {
+            end = line + strlen(line);
+        }
+
+        const char *str = line;
+        while (str < end && isspace((unsigned char)*str)) {
+            str++;
+        }
+        const char *name = str;
+        while (str < end && is_ident_char(*str, str == name)) {
+            str++;
+        }
+        size_t name_len = str - name;
+
+        // Values are separated by blanks or commas, with an optional = after the name.
+        float values[4];
+        int count = 0;
+        bool valid = name_len > 0 && name_len < SHADER_PARAM_MAX_NAME;
+        while (valid) {
+            while (str < end && (isspace((unsigned char)*str) || *str == ',' || (*str == '=' && count == 0))) {
+                str++;
+            }
+            if (str == end || *str == '#') {
+                break;
+            }
+            char *num_end;
+            float value = strtof(str, &num_end);
+            valid = num_end != str && num_end <= end && count < ARRAY_LEN(values);
+            if (valid) {
+                values[count++] = value;
+                str = num_end;
+            }
+        }
+
+        bool blank = name_len == 0 && (str == end || *str == '#');
+        if (!blank && (!valid || count == 0)) {
+            ERRORF("Invalid param line, expected NAME VALUE...: %.*s\n", (int)(end - line), line);
+        } else if (!blank) {
+            char param_name[SHADER_PARAM_MAX_NAME];
+            snprintf(param_name, sizeof(param_name), "%.*s", (int)name_len, name);
+            any_set = shader_renderer_set_param(shader_renderer, param_name, values, count) || any_set;
+        }
+
+        line = *end == '\0' ? end : end + 1;
+    }
+
+    return any_set;
+}
+
+void params_sidecar_path(const char *frag_shader_path, char *out) {
+    const char *slash = strrchr(frag_shader_path, '/');
+    const char *ext = strrchr(frag_shader_path, '.');
+    int len = ext != nullptr && (slash == nullptr || ext > slash + 1) ? (int)(ext - frag_shader_path)
+                                                                       : (int)strlen(frag_shader_path);
+    snprintf(out, PATH_MAX, "%.*s.params", len, frag_shader_path);
+}
+
+bool shader_renderer_load_params_file(ShaderRenderer *shader_renderer, const char *path) {
+    if (access(path, F_OK) != 0) {
+        return false;
+    }
+
+    StrBuf src = {};
+    bool any_set = file_read(path, &src) && shader_renderer_load_params(shader_renderer, src.data);
+    str_buf_free(&src);
+    if (any_set) {
+        INFOF("Params loaded from %s.\n", path);
+    }
+
+    return any_set;
+}
+
+void params_input_create(ParamsInput *params_input, int fd) {
+    params_input->fd = fd;
+    params_input->len = 0;
+    params_input->eof = false;
+}
+
+bool params_input_read(ParamsInput *params_input, ShaderRenderer *shader_renderer) {
+    char *buffer = params_input->buffer;
+    ssize_t len = read(params_input->fd, buffer + params_input->len, sizeof(params_input->buffer) - 1 -
+                       params_input->len);
+    if (len < 0) {
+        if (errno == EAGAIN || errno == EINTR) {
+            return false;
+        }
+        ERRORF("Failure in call to read() on params input: %s.\n", strerror(errno));
+        len = 0;
+    }
+    params_input->len += len;
+    params_input->eof = len == 0;
+
+    // Only apply complete lines, unless the input ended or the line doesn't fit in the buffer.
+    size_t applied = params_input->len;
+    if (!params_input->eof && params_input->len < sizeof(params_input->buffer) - 1) {
+        while (applied > 0 && buffer[applied - 1] != '\n') {
+            applied--;
+        }
+    }
+    if (applied == 0) {
+        return false;
+    }
+
+    char rest = buffer[applied];
+    buffer[applied] = '\0';
+    bool any_set = shader_renderer_load_params(shader_renderer, buffer);
+    buffer[applied] = rest;
+    params_input->len -= applied;
+    memmove(buffer, buffer + applied, params_input->len);
+
+    return any_set;
+}
+
+void file_watcher_create(FileWatcher *file_watcher) {
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+        ERRORF("Failure in call to inotify_init(): %s.\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    int debounce_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (debounce_fd < 0) {
+        ERRORF("Failure in call to timerfd_create(): %s.\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    file_watcher->fd = fd;
+    file_watcher->debounce_fd = debounce_fd;
+    file_watcher->num_files = 0;
+    file_watcher->num_dirs = 0;
+    file_watcher->modified = false;
 }
 
 void file_watcher_destroy(FileWatcher *file_watcher) {
-    inotify_rm_watch(file_watcher->fd, file_watcher->wd);
+    for (int i = 0; i < file_watcher->num_dirs; i++) {
+        inotify_rm_watch(file_watcher->fd, file_watcher->dirs[i].wd);
+    }
+    close(file_watcher->debounce_fd);
     close(file_watcher->fd);
 }
 
-void file_watcher_poll(FileWatcher *file_watcher) {
-    struct pollfd pfd = {file_watcher->fd, POLLIN, 0};
+static int file_watcher_add_dir(FileWatcher *file_watcher, const char *dirpath) {
+    for (int i = 0; i < file_watcher->num_dirs; i++) {
+        if (strcmp(file_watcher->dirs[i].path, dirpath) == 0) {
+            return i;
+        }
+    }
 
-    if (poll(&pfd, 1, 0) == 1) {
-        if (pfd.revents & POLLIN) {
-            int avail;
-            ioctl(file_watcher->fd, FIONREAD, &avail);
+    if (file_watcher->num_dirs == FILE_WATCHER_MAX_DIRS) {
+        ERRORF("Unable to watch directory %s, limit of %d directories reached.\n", dirpath, FILE_WATCHER_MAX_DIRS);
+        return -1;
+    }
 
-            char buffer[avail];
-            read(file_watcher->fd, buffer, avail);
+    // Watch the directory rather than the file itself, editors that save by writing a new file and renaming
+    // it over the old one would otherwise leave us watching an inode that no longer exists.
+    int wd = inotify_add_watch(file_watcher->fd, dirpath, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+    if (wd < 0) {
+        ERRORF("Failure in call to inotify_add_watch() for %s: %s.\n", dirpath, strerror(errno));
+        return -1;
+    }
 
-            int offset = 0;
-            while (offset < avail) {
-                auto *event = (struct inotify_event*)(buffer + offset);
+    WatchedDir *dir = &file_watcher->dirs[file_watcher->num_dirs];
+    snprintf(dir->path, sizeof(dir->path), "%s", dirpath);
+    dir->wd = wd;
 
-                if (event->mask & IN_CLOSE_WRITE) {
-                    file_watcher->modified = true;
-                    INFOF("File %s change detected!\n", file_watcher->filepath);
-                }
+    return file_watcher->num_dirs++;
+}
+
+int file_watcher_add(FileWatcher *file_watcher, const char *filepath) {
+    // Resolve the directory rather than the file so files that don't exist yet can still be tracked.
+    char dirpath[PATH_MAX];
+    const char *name = split_path(filepath, dirpath);
+
+    char abs_dirpath[PATH_MAX];
+    if (realpath(dirpath, abs_dirpath) == nullptr) {
+        ERRORF("Failure in call to realpath() for %s: %s.\n", dirpath, strerror(errno));
+        return -1;
+    }
+
+    for (int i = 0; i < file_watcher->num_files; i++) {
+        WatchedFile *file = &file_watcher->files[i];
+        if (strcmp(file_watcher->dirs[file->dir_index].path, abs_dirpath) == 0 && strcmp(file->name, name) == 0) {
+            return i;
+        }
+    }
+
+    if (file_watcher->num_files == FILE_WATCHER_MAX_FILES) {
+        ERRORF("Unable to watch file %s, limit of %d files reached.\n", filepath, FILE_WATCHER_MAX_FILES);
+        return -1;
+    }
+
+    int dir_index = file_watcher_add_dir(file_watcher, abs_dirpath);
+    if (dir_index < 0) {
+        return -1;
+    }
+
+    WatchedFile *file = &file_watcher->files[file_watcher->num_files];
+    snprintf(file->path, sizeof(file->path), "%s", filepath);
+    snprintf(file->name, sizeof(file->name), "%s", name);
+    file->dir_index = dir_index;
+    file->pending = false;
+    file->changed = false;
+
+    INFOF("Watching file %s for changes...\n", filepath);
+
+    return file_watcher->num_files++;
+}
+
+static WatchedFile *file_watcher_find(FileWatcher *file_watcher, int wd, const char *name) {
+    for (int i = 0; i < file_watcher->num_files; i++) {
+        WatchedFile *file = &file_watcher->files[i];
+        if (file_watcher->dirs[file->dir_index].wd == wd && strcmp(file->name, name) == 0) {
+            return file;
+        }
+    }
+
+    return nullptr;
+}
+
+void file_watcher_read(FileWatcher *file_watcher) {
+    // Sized for a burst of events and aligned so the events can be read in place.
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    bool any_pending = false;
+
+    while (true) {
+        ssize_t len = read(file_watcher->fd, buffer, sizeof(buffer));
+        if (len <= 0) {
+            if (len < 0 && errno != EAGAIN && errno != EINTR) {
+                ERRORF("Failure in call to read() on inotify fd: %s.\n", strerror(errno));
+            }
+            break;
+        }
+
+        for (char *ptr = buffer; ptr < buffer + len;) {
+            auto *event = (struct inotify_event*)ptr;
 
-                offset += sizeof(struct inotify_event) + event->len;
+            if (event->len > 0) {
+                WatchedFile *file = file_watcher_find(file_watcher, event->wd, event->name);
+                if (file != nullptr) {
+                    file->pending = true;
+                    any_pending = true;
+                }
             }
+
+            ptr += sizeof(struct inotify_event) + event->len;
+        }
+    }
+
+    if (any_pending) {
+        // (Re)start the debounce timer, a save usually arrives as a burst of create, write and rename events.
+        struct itimerspec spec = {};
+        spec.it_value.tv_sec = FILE_WATCHER_DEBOUNCE_MS / 1000;
+        spec.it_value.tv_nsec = (FILE_WATCHER_DEBOUNCE_MS % 1000) * 1000000L;
+        if (timerfd_settime(file_watcher->debounce_fd, 0, &spec, nullptr) < 0) {
+            ERRORF("Failure in call to timerfd_settime(): %s.\n", strerror(errno));
+        }
+    }
+}
+
+void file_watcher_flush(FileWatcher *file_watcher) {
+    uint64_t expirations;
+    read(file_watcher->debounce_fd, &expirations, sizeof(expirations));
+
+    for (int i = 0; i < file_watcher->num_files; i++) {
+        WatchedFile *file = &file_watcher->files[i];
+        if (file->pending) {
+            file->pending = false;
+            file->changed = true;
+            file_watcher->modified = true;
+            INFOF("File %s change detected!\n", file->path);
         }
+    }
+}
+
+void file_watcher_clear(FileWatcher *file_watcher) {
+    for (int i = 0; i < file_watcher->num_files; i++) {
+        file_watcher->files[i].changed = false;
+    }
+    file_watcher->modified = false;
+}
+
+void event_loop_add_fd(EventLoop *event_loop, int fd, unsigned int event) {
+    struct epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u32 = event;
+    if (epoll_ctl(event_loop->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        ERRORF("Failure in call to epoll_ctl(): %s.\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+}
+
+void event_loop_create(EventLoop *event_loop, FileWatcher *file_watcher, int input_fd) {
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        ERRORF("Failure in call to epoll_create1(): %s.\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd < 0) {
+        ERRORF("Failure in call to timerfd_create(): %s.\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    event_loop->epoll_fd = epoll_fd;
+    event_loop->timer_fd = timer_fd;
+    event_loop->window_fd = window_native_event_fd();
+    event_loop->input_fd = input_fd;
+    event_loop->frame_interval_ns = 0;
+
+    event_loop_add_fd(event_loop, timer_fd, EVENT_FRAME);
+    event_loop_add_fd(event_loop, file_watcher->fd, EVENT_FILE);
+    event_loop_add_fd(event_loop, file_watcher->debounce_fd, EVENT_FILE_SETTLED);
+    if (event_loop->window_fd >= 0) {
+        event_loop_add_fd(event_loop, event_loop->window_fd, EVENT_WINDOW);
     } else {
-        file_watcher->modified = false;
+        INFOF("No native window event fd, window events will be polled every %dms.\n",
+              EVENT_LOOP_WINDOW_FALLBACK_TIMEOUT_MS);
+    }
+    if (input_fd >= 0) {
+        event_loop_add_fd(event_loop, input_fd, EVENT_INPUT);
+    }
+}
+
+void event_loop_destroy(EventLoop *event_loop) {
+    close(event_loop->timer_fd);
+    close(event_loop->epoll_fd);
+}
+
+void event_loop_remove_input(EventLoop *event_loop) {
+    if (event_loop->input_fd < 0) {
+        return;
+    }
+
+    if (epoll_ctl(event_loop->epoll_fd, EPOLL_CTL_DEL, event_loop->input_fd, nullptr) < 0) {
+        ERRORF("Failure in call to epoll_ctl(): %s.\n", strerror(errno));
+    }
+    event_loop->input_fd = -1;
+}
+
+void event_loop_set_frame_interval(EventLoop *event_loop, long interval_ns) {
+    if (event_loop->frame_interval_ns == interval_ns) {
+        return;
+    }
+
+    struct itimerspec spec = {};
+    spec.it_interval.tv_sec = interval_ns / 1000000000L;
+    spec.it_interval.tv_nsec = interval_ns % 1000000000L;
+    spec.it_value = spec.it_interval;
+    if (timerfd_settime(event_loop->timer_fd, 0, &spec, nullptr) < 0) {
+        ERRORF("Failure in call to timerfd_settime(): %s.\n", strerror(errno));
+        return;
+    }
+
+    event_loop->frame_interval_ns = interval_ns;
+}
+
+unsigned int event_loop_wait(EventLoop *event_loop, Window *window) {
+    // Process anything already queued and flush pending requests, otherwise we could block on window
+    // events that were read off the connection before the call to epoll_wait().
+    window_poll_events(window);
+    if (window->dirty || !window_is_open(window)) {
+        return EVENT_WINDOW;
+    }
+
+    int timeout = event_loop->window_fd >= 0 ? -1 : EVENT_LOOP_WINDOW_FALLBACK_TIMEOUT_MS;
+
+    struct epoll_event events[8];
+    int num_events = epoll_wait(event_loop->epoll_fd, events, ARRAY_LEN(events), timeout);
+    if (num_events < 0) {
+        if (errno != EINTR) {
+            ERRORF("Failure in call to epoll_wait(): %s.\n", strerror(errno));
+        }
+        return EVENT_NONE;
     }
+
+    unsigned int flags = num_events == 0 ? EVENT_WINDOW : EVENT_NONE;
+    for (int i = 0; i < num_events; i++) {
+        flags |= events[i].data.u32;
+    }
+
+    if (flags & EVENT_FRAME) {
+        uint64_t expirations;
+        read(event_loop->timer_fd, &expirations, sizeof(expirations));
+    }
+    if (flags & EVENT_WINDOW) {
+        window_poll_events(window);
+    }
+
+    return flags;
 }
 
 static struct option long_options[] = {
@@ -585,6 +4300,20 @@ static struct option long_options[] = {
         {"fullscreen", no_argument, nullptr, 'f'},
         {"print-size", required_argument, nullptr, 'p'},
         {"output", required_argument, nullptr, 'o'},
+        {"benchmark", no_argument, nullptr, 'b'},
+        {"define", required_argument, nullptr, 'D'},
+        {"params", required_argument, nullptr, 'P'},
+        {"texture", required_argument, nullptr, 't'},
+        {"diagnostics", required_argument, nullptr, 'd'},
+        {"check", no_argument, nullptr, 'c'},
+        {"spirv", no_argument, nullptr, 'S'},
+        {"cpu", no_argument, nullptr, 'C'},
+        {"tile-threads", required_argument, nullptr, 'T'},
+        {"workers", required_argument, nullptr, 'W'},
+        {"server", required_argument, nullptr, 'r'},
+        {"server-jobs", required_argument, nullptr, 'j'},
+        {"server-queue", required_argument, nullptr, 'q'},
+        {"connect", required_argument, nullptr, 'k'},
         { "help", no_argument, nullptr, 'H'},
         { nullptr }
 };
@@ -614,10 +4343,39 @@ static void print_help() {
     printf("\t\t\t\tValid values are 720p,1080p,4k,5k,A3-150dpi,A3-300dpi.\n");
     printf("--output [FILEPATH]\t\tSets the output image filepath for print.\n");
     printf("\t\t\t\tDefaults to shdy_print.png.\n");
+    printf("--benchmark\t\t\tRuns benchmarks with the shader and prints the results.\n");
+    printf("\t\t\t\tDefaults to false.\n");
+    printf("--define [NAME[=VALUE]]\t\tDefines NAME as VALUE, or 1, ahead of the preamble. Can be repeated.\n");
+    printf("\t\t\t\tOverrides any #pragma shdy define of the same NAME in the shader.\n");
+    printf("--params [FILEPATH]\t\tSets the file of param values to load and watch, - reads them from stdin.\n");
+    printf("\t\t\t\tDefaults to the shader FILEPATH with a .params extension.\n");
+    printf("--texture [NAME=FILEPATH]\tLoads the PNG, JPEG or HDR image as the sampler2D NAME. Can be repeated.\n");
+    printf("\t\t\t\tOverrides any #pragma shdy texture of the same NAME in the shader.\n");
+    printf("--diagnostics [FILEPATH]\tWrites the errors and warnings of each compile as JSON, - for stdout.\n");
+    printf("\t\t\t\tDefaults to disabled.\n");
+    printf("--check\t\t\t\tChecks the shader and its passes with glslang, without a GL context, and exits.\n");
+    printf("\t\t\t\tOnly available if shdy is built with GLSLANG=1.\n");
+    printf("--spirv\t\t\t\tCompiles the shader to SPIR-V with glslang and caches it, needs OpenGL 4.6.\n");
+    printf("\t\t\t\tDefaults to false, only available if shdy is built with GLSLANG=1.\n");
+    printf("--cpu\t\t\t\tRenders the print on the CPU by compiling the shader to C++, without OpenGL.\n");
+    printf("\t\t\t\tDefaults to false, needs a C++17 compiler, $CXX or c++.\n");
+    printf("--tile-threads [INTEGER]\tDraws the print in tiles on INTEGER threads, each with its own context.\n");
+    printf("\t\t\t\t0 uses one per core. Defaults to one per core on software renderers and with\n");
+    printf("\t\t\t\t--cpu, otherwise the print is drawn at once.\n");
+    printf("--workers [INTEGER]\t\tDraws the print in tiles on INTEGER worker processes, each with its own context.\n");
+    printf("\t\t\t\tDefaults to drawing the print in this process.\n");
+    printf("--server [SOCKET]\t\tServes render requests on the Unix domain SOCKET, --shader isn't needed.\n");
+    printf("--server-jobs [INTEGER]\t\tSets the number of images the server encodes and sends at once.\n");
+    printf("\t\t\t\tDefaults to 2.\n");
+    printf("--server-queue [INTEGER]\tSets the number of unanswered requests past which the server is busy.\n");
+    printf("\t\t\t\tDefaults to 16.\n");
+    printf("--connect [SOCKET]\t\tRenders the print with the server on SOCKET rather than in this process.\n");
 }
 
 static int opt_requires_arg(int opt) {
-    return (opt == 's' || opt == 'w' || opt == 'h' || opt == 'o' || opt == 'p');
+    return (opt == 's' || opt == 'w' || opt == 'h' || opt == 'o' || opt == 'p' || opt == 'D' || opt == 'P' ||
+            opt == 't' || opt == 'd' || opt == 'T' || opt == 'W' || opt == 'r' || opt == 'j' || opt == 'q' ||
+            opt == 'k');
 }
 
 void cli_opts_parse(CliOpts *cli_opts, int argc, char **argv) {
@@ -627,14 +4385,30 @@ void cli_opts_parse(CliOpts *cli_opts, int argc, char **argv) {
             CLI_OPTS_DEFAULT_HEIGHT,
             CLI_OPTS_DEFAULT_FULLSCREEN,
             CLI_OPTS_DEFAULT_PRINT_SIZE,
-            CLI_OPTS_DEFAULT_OUTPUT_IMAGE_PATH
+            CLI_OPTS_DEFAULT_OUTPUT_IMAGE_PATH,
+            CLI_OPTS_DEFAULT_BENCHMARK,
+            {},
+            0,
+            nullptr,
+            {},
+            0,
+            nullptr,
+            false,
+            false,
+            false,
+            CLI_OPTS_DEFAULT_TILE_THREADS,
+            CLI_OPTS_DEFAULT_WORKERS,
+            nullptr,
+            CLI_OPTS_DEFAULT_SERVER_JOBS,
+            CLI_OPTS_DEFAULT_SERVER_QUEUE,
+            nullptr
     };
 
     opterr = 0;
     bool has_error = false;
 
     while (true) {
-        char ch = getopt_long(argc, argv, "s:w:h:fp:o:H", long_options, nullptr);
+        char ch = getopt_long(argc, argv, "s:w:h:fp:o:bD:P:t:d:cSCT:W:r:j:q:k:H", long_options, nullptr);
 
         if (ch == -1) {
             break;
@@ -687,6 +4461,120 @@ void cli_opts_parse(CliOpts *cli_opts, int argc, char **argv) {
                 // TODO: Maybe validate '.png' extension is used.
                 opts.output_image_path = optarg;
                 break;
+            case 'b':
+                opts.benchmark = true;
+                break;
+            case 'D':
+                if (opts.num_defines == SHADER_MAX_DEFINES) {
+                    ERRORF("Too many defines, the maximum is %d.\n", SHADER_MAX_DEFINES);
+                    has_error = true;
+                    break;
+                }
+                if (!shader_define_parse(&opts.defines[opts.num_defines], optarg)) {
+                    ERRORF("Invalid arg for define: %s, must be NAME or NAME=VALUE.\n", optarg);
+                    has_error = true;
+                    break;
+                }
+                opts.num_defines++;
+                break;
+            case 'P':
+                if (str_is_empty(optarg)) {
+                    ERRORF("Arg for params path is an empty string.\n");
+                    has_error = true;
+                }
+                opts.params_path = optarg;
+                break;
+            case 't':
+                if (opts.num_textures == SHADER_MAX_TEXTURES) {
+                    ERRORF("Too many textures, the maximum is %d.\n", SHADER_MAX_TEXTURES);
+                    has_error = true;
+                    break;
+                }
+                if (!shader_texture_parse(&opts.textures[opts.num_textures], optarg)) {
+                    ERRORF("Invalid arg for texture: %s, must be NAME=FILEPATH.\n", optarg);
+                    has_error = true;
+                    break;
+                }
+                opts.num_textures++;
+                break;
+            case 'd':
+                if (str_is_empty(optarg)) {
+                    ERRORF("Arg for diagnostics path is an empty string.\n");
+                    has_error = true;
+                }
+                opts.diagnostics_path = optarg;
+                break;
+            case 'c':
+                opts.check = true;
+                break;
+            case 'S':
+                opts.spirv = true;
+                break;
+            case 'C':
+                opts.cpu = true;
+                break;
+            case 'T': {
+                char *end;
+                long num_threads = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || num_threads < 0 || num_threads > TILE_SCHEDULER_MAX_THREADS) {
+                    ERRORF("Invalid arg for tile threads: %s, must be an integer from 0 to %d.\n", optarg,
+                           TILE_SCHEDULER_MAX_THREADS);
+                    has_error = true;
+                    break;
+                }
+                opts.tile_threads = (int)num_threads;
+                break;
+            }
+            case 'W': {
+                char *end;
+                long num_workers = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || num_workers < 1 || num_workers > PRINT_WORKERS_MAX) {
+                    ERRORF("Invalid arg for workers: %s, must be an integer from 1 to %d.\n", optarg,
+                           PRINT_WORKERS_MAX);
+                    has_error = true;
+                    break;
+                }
+                opts.workers = (int)num_workers;
+                break;
+            }
+            case 'r':
+                if (str_is_empty(optarg)) {
+                    ERRORF("Arg for server socket path is an empty string.\n");
+                    has_error = true;
+                }
+                opts.server_path = optarg;
+                break;
+            case 'j': {
+                char *end;
+                long num_jobs = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || num_jobs < 1 || num_jobs > SERVER_MAX_JOBS) {
+                    ERRORF("Invalid arg for server jobs: %s, must be an integer from 1 to %d.\n", optarg,
+                           SERVER_MAX_JOBS);
+                    has_error = true;
+                    break;
+                }
+                opts.server_jobs = (int)num_jobs;
+                break;
+            }
+            case 'q': {
+                char *end;
+                long max_queue = strtol(optarg, &end, 10);
+                if (end == optarg || *end != '\0' || max_queue < 1 || max_queue > SERVER_MAX_QUEUE) {
+                    ERRORF("Invalid arg for server queue: %s, must be an integer from 1 to %d.\n", optarg,
+                           SERVER_MAX_QUEUE);
+                    has_error = true;
+                    break;
+                }
+                opts.server_queue = (int)max_queue;
+                break;
+            }
+            case 'k':
+                if (str_is_empty(optarg)) {
+                    ERRORF("Arg for server socket path is an empty string.\n");
+                    has_error = true;
+                }
+                opts.connect_path = optarg;
+                break;
             case 'H':
                 print_help();
                 exit(EXIT_SUCCESS);
@@ -707,7 +4595,7 @@ void cli_opts_parse(CliOpts *cli_opts, int argc, char **argv) {
         }
     }
 
-    if (opts.frag_shader_path == nullptr) {
+    if (opts.frag_shader_path == nullptr && opts.server_path == nullptr) {
         ERRORF("Shader filepath option must be provided, e.g --shader [FILEPATH].\n");
         exit(EXIT_FAILURE);
     }
@@ -718,4 +4606,20 @@ void cli_opts_parse(CliOpts *cli_opts, int argc, char **argv) {
     cli_opts->fullscreen = opts.fullscreen;
     cli_opts->print_size = opts.print_size;
     cli_opts->output_image_path = opts.output_image_path;
+    cli_opts->benchmark = opts.benchmark;
+    memcpy(cli_opts->defines, opts.defines, sizeof(opts.defines));
+    cli_opts->num_defines = opts.num_defines;
+    cli_opts->params_path = opts.params_path;
+    memcpy(cli_opts->textures, opts.textures, sizeof(opts.textures));
+    cli_opts->num_textures = opts.num_textures;
+    cli_opts->diagnostics_path = opts.diagnostics_path;
+    cli_opts->check = opts.check;
+    cli_opts->spirv = opts.spirv;
+    cli_opts->cpu = opts.cpu;
+    cli_opts->tile_threads = opts.tile_threads;
+    cli_opts->workers = opts.workers;
+    cli_opts->server_path = opts.server_path;
+    cli_opts->server_jobs = opts.server_jobs;
+    cli_opts->server_queue = opts.server_queue;
+    cli_opts->connect_path = opts.connect_path;
 }
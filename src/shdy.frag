@@ -1,93 +1,122 @@
 R"(
-#version 330
-
+// Declarations of the shdy preamble, prepended to every user shader. The definitions live in shdy_lib.frag,
+// which is compiled once into its own shader object and linked alongside the user shader.
+
+#ifdef SHDY_COMPUTE
+// Compute passes run one invocation per pixel and write the pixel to uOutput instead of fragColor.
+layout(local_size_x = SHDY_LOCAL_SIZE, local_size_y = SHDY_LOCAL_SIZE) in;
+layout(rgba32f, binding = SHDY_OUTPUT_IMAGE_UNIT) uniform writeonly image2D uOutput;
+#else
 out vec4 fragColor;
-
-uniform vec2 uResolution;
-uniform float uTime;
+#endif
+
+// Built-in inputs, shared by every pass and updated once per frame.
+#ifdef SHDY_SPIRV
+#define SHDY_INPUTS_LAYOUT layout(std140, binding = SHDY_INPUTS_BINDING)
+#else
+#define SHDY_INPUTS_LAYOUT layout(std140)
+#endif
+SHDY_INPUTS_LAYOUT uniform ShdyInputs {
+    vec4 uMouse; // Cursor (xy) and last click (zw) in pixels, zw is negative once the button is released.
+    vec4 uDate; // Year, month (0-11), day (1-31) and seconds since midnight.
+    vec2 uResolution;
+    vec2 uTileOffset; // Offset of the tile being drawn in pixels, when drawn in tiles.
+    float uTime;
+    float uTimeDelta;
+    int uFrame;
+};
+
+#ifndef SHDY_COMPUTE
+// Replaces gl_FragCoord in user shaders, so it's the position in the whole image when a print tile is drawn at the
+// origin of its own target.
+#define shdyFragCoord (gl_FragCoord + vec4(uTileOffset, 0.0, 0.0))
+#endif
+
+uniform sampler2D uShdyNoiseTex;
+
+// Latest output of each buffer pass declared with #pragma shdy buffer N PATH. A pass reading its own buffer
+// gets the previous frame.
+uniform sampler2D uBuffer0;
+uniform sampler2D uBuffer1;
+uniform sampler2D uBuffer2;
+uniform sampler2D uBuffer3;
+
+// Octave count of the shdyFracNoise2d(p) variants. Define it with -D or #pragma shdy define to change it, the
+// loop bound is then a compile-time constant that the driver can unroll.
+#ifndef SHDY_FBM_OCTAVES
+#ifdef SHDY_SPIRV
+layout(constant_id = SHDY_FBM_OCTAVES_ID) const int SHDY_FBM_OCTAVES = 6;
+#else
+#define SHDY_FBM_OCTAVES 6
+#endif
+#endif
 
 const float PI = 3.14159265359;
 const float TWOPI = 6.28318530718;
 
 // Transforms the given fragCoord from pixels into a normalized form for a landscape orientation.
 // The normalized form is in the range Y = [-1.0..+1.0] and X will differ based on the width.
-vec2 shdyNormCoordLandscape(in vec2 fragCoord) {
-    return 2.0*(fragCoord - 0.5*uResolution) / uResolution.y;
-}
+vec2 shdyNormCoordLandscape(in vec2 fragCoord);
 
 // Transforms the given fragCoord from pixels into a normalized form for a portrait orientation.
 // The normalized form is in the range X = [-1.0..+1.0] and Y will differ based on the height.
-vec2 shdyNormCoordPortrait(in vec2 fragCoord) {
-    return 2.0*(fragCoord - 0.5*uResolution) / uResolution.x;
-}
+vec2 shdyNormCoordPortrait(in vec2 fragCoord);
 
 // 2d transformations.
+vec2 shdyTranslate2d(in vec2 p, in vec2 t);
+mat2 shdyRotMat2d(in float angle);
+vec2 shdyRotate2d(in vec2 p, in float angle);
+mat2 shdyScaleMat2d(in vec2 scale);
+vec2 shdyScale2d(in vec2 p, in vec2 scale);
 
-vec2 shdyTranslate2d(in vec2 p, in vec2 t) {
-    return p - t;
-}
-
-mat2 shdyRotMat2d(in float angle) {
-    return mat2(cos(angle), sin(angle),
-                -sin(angle), cos(angle));
-}
-
-vec2 shdyRotate2d(in vec2 p, in float angle) {
-    return p*shdyRotMat2d(angle);
-}
-
-mat2 shdyScaleMat2d(in vec2 scale) {
-    return mat2(scale.x, 0.0,
-                0.0, scale.y);
-}
+// Returns a pseudorandom float from a given 2d point.
+highp float shdyRand2d(in vec2 p);
 
-vec2 shdyScale2d(in vec2 p, in vec2 scale) {
-    return p*shdyScaleMat2d(scale);
-}
+// Returns 2d value noise.
+float shdyNoise2d(in vec2 p);
 
-// RNG and noise functions.
+// Returns 2d fractal value noise.
+float shdyFracNoise2d(in vec2 p, in int octaves);
+float shdyFracNoise2d(in vec2 p); // SHDY_FBM_OCTAVES octaves.
 
-// Returns a pseudorandom float from a given 2d point.
-highp float shdyRand2d(in vec2 p) {
-    const highp float a = 12.9898;
-    const highp float b = 78.233;
-    const highp float ampl = 43758.5453;
-    highp float freq = dot(p, vec2(a, b));
-    return fract(sin(freq)*ampl);
-}
+// Integer hashes (PCG), cheaper than shdyRand2d and without its precision artifacts at large coordinates.
+uint shdyPcg(in uint v);
+uvec2 shdyPcg2d(in uvec2 v);
+uvec3 shdyPcg3d(in uvec3 v);
+uvec4 shdyPcg4d(in uvec4 v);
 
-// Returns 2d value noise.
-float shdyNoise2d(in vec2 p) {
-    vec2 i = floor(p);
-    vec2 f = smoothstep(0.0, 1.0, fract(p));
+// Returns a pseudorandom float in the range [0.0..1.0) from the bits of the given point.
+float shdyHash1d(in float p);
+float shdyHash2d(in vec2 p);
+float shdyHash3d(in vec3 p);
+float shdyHash4d(in vec4 p);
 
-    float bl = shdyRand2d(i);
-    float br = shdyRand2d(i + vec2(1.0, 0.0));
-    float b = mix(bl, br, f.x);
+// Returns 2d value noise in the range [0.0..1.0], using the integer hash.
+float shdyValueNoise2d(in vec2 p);
 
-    float tl = shdyRand2d(i + vec2(0.0, 1.0));
-    float tr = shdyRand2d(i + vec2(1.0, 1.0));
-    float t = mix(tl, tr, f.x);
+// Returns gradient (Perlin) noise in the range [-1.0..+1.0].
+float shdyGradNoise2d(in vec2 p);
+float shdyGradNoise3d(in vec3 p);
+float shdyGradNoise4d(in vec4 p);
 
-    return mix(b, t, f.y);
-}
+// Returns simplex noise in the range [-1.0..+1.0].
+float shdySimplexNoise2d(in vec2 p);
+float shdySimplexNoise3d(in vec3 p);
+float shdySimplexNoise4d(in vec4 p);
 
-// Returns 2d fractal value noise.
-float shdyFracNoise2d(in vec2 p, in int octaves) {
-    float v = 0.0;
-    float a = 0.5;
-    vec2 shift = vec2(100);
+// Texture backed noise, trading the ALU cost of the functions above for a texture fetch. The textures are
+// generated once, the first time a shader uses one of these.
 
-    mat2 rot = shdyRotMat2d(0.5);
+// Returns 2d value noise in the range [0.0..1.0], tiles every 256 units.
+float shdyNoise2dTex(in vec2 p);
 
-    for (int i = 0; i < octaves; i++) {
-        v += a*shdyNoise2d(p);
-        p = rot*p*2.0 + shift;
-        a *= 0.5;
-    }
+// Returns 2d fractal value noise using shdyNoise2dTex.
+float shdyFracNoise2dTex(in vec2 p, in int octaves);
+float shdyFracNoise2dTex(in vec2 p); // SHDY_FBM_OCTAVES octaves.
 
-    return v;
-}
+// Returns 2d gradient noise in the range [-1.0..+1.0], tiles every 32 units.
+float shdyGradNoise2dTex(in vec2 p);
 
-#line 0
+// Returns the distances to the closest (x) and second closest (y) Worley feature points, tiles every 32 units.
+vec2 shdyWorley2dTex(in vec2 p);
 )"
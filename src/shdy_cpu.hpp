@@ -0,0 +1,702 @@
+R"CPU(
+// Runtime of the CPU renderer, prepended to every shader translated to C++ by cpu_renderer.cpp. Implements the GLSL
+// types and built-in functions the shdy preamble and user shaders use, one invocation per call of main().
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace shdy_cpu {
+
+typedef unsigned int uint;
+
+// Scalar operands of the vector operators take the component type of the vector rather than being deduced, so
+// vec3(1.0)*2 converts the 2 like GLSL does.
+template<typename T> struct ShdyId { typedef T type; };
+template<typename T> using ShdyScalar = typename ShdyId<T>::type;
+
+template<typename T, int N> struct ShdyVecData;
+template<typename T> struct ShdyVecData<T, 2> { T x, y; };
+template<typename T> struct ShdyVecData<T, 3> { T x, y, z; };
+template<typename T> struct ShdyVecData<T, 4> { T x, y, z, w; };
+
+template<typename T, int N, int... I> struct ShdySwizzle;
+
+template<typename T, int N> struct ShdyVec : ShdyVecData<T, N> {
+    ShdyVec() {
+        for (int i = 0; i < N; i++) (*this)[i] = T();
+    }
+    explicit ShdyVec(T s) {
+        for (int i = 0; i < N; i++) (*this)[i] = s;
+    }
+    // GLSL converts int and uint vectors to float vectors implicitly, any other conversion needs a constructor.
+    template<typename U, typename std::enable_if<!std::is_same<U, T>::value && std::is_same<T, float>::value,
+                                                 int>::type = 0>
+    ShdyVec(const ShdyVec<U, N> &v) {
+        for (int i = 0; i < N; i++) (*this)[i] = T(v[i]);
+    }
+    template<typename U, typename std::enable_if<!std::is_same<U, T>::value && !std::is_same<T, float>::value,
+                                                 int>::type = 0>
+    explicit ShdyVec(const ShdyVec<U, N> &v) {
+        for (int i = 0; i < N; i++) (*this)[i] = T(v[i]);
+    }
+    template<typename U, int M, typename std::enable_if<(M > N), int>::type = 0>
+    explicit ShdyVec(const ShdyVec<U, M> &v) {
+        for (int i = 0; i < N; i++) (*this)[i] = T(v[i]);
+    }
+    template<typename A, typename B, typename... R> ShdyVec(const A &a, const B &b, const R &...r) {
+        int i = 0;
+        fill(i, a);
+        fill(i, b);
+        (fill(i, r), ...);
+    }
+
+    T &operator[](int i) { return (&this->x)[i]; }
+    const T &operator[](int i) const { return (&this->x)[i]; }
+    static int length() { return N; }
+
+    template<int... I> ShdyVec<T, sizeof...(I)> swz() const { return ShdyVec<T, sizeof...(I)>((*this)[I]...); }
+    template<int... I> ShdySwizzle<T, N, I...> swz_ref() { return ShdySwizzle<T, N, I...>{*this}; }
+
+private:
+    template<typename U> void fill(int &i, const U &s) {
+        if (i < N) (*this)[i++] = T(s);
+    }
+    template<typename U, int M> void fill(int &i, const ShdyVec<U, M> &v) {
+        for (int j = 0; j < M && i < N; j++) (*this)[i++] = T(v[j]);
+    }
+};
+
+// A multi-component swizzle being assigned to, e.g v.xy = ... or v.zw += ...
+template<typename T, int N, int... I> struct ShdySwizzle {
+    typedef ShdyVec<T, sizeof...(I)> Value;
+    ShdyVec<T, N> &v;
+
+    Value get() const { return Value(v[I]...); }
+    operator Value() const { return get(); }
+    ShdySwizzle &operator=(const Value &value) {
+        const int index[] = {I...};
+        for (int i = 0; i < (int)sizeof...(I); i++) v[index[i]] = value[i];
+        return *this;
+    }
+    template<typename U> ShdySwizzle &operator+=(const U &u) { return *this = get() + u; }
+    template<typename U> ShdySwizzle &operator-=(const U &u) { return *this = get() - u; }
+    template<typename U> ShdySwizzle &operator*=(const U &u) { return *this = get()*u; }
+    template<typename U> ShdySwizzle &operator/=(const U &u) { return *this = get()/u; }
+    template<typename U> ShdySwizzle &operator%=(const U &u) { return *this = get() % u; }
+    template<typename U> ShdySwizzle &operator&=(const U &u) { return *this = get() & u; }
+    template<typename U> ShdySwizzle &operator|=(const U &u) { return *this = get() | u; }
+    template<typename U> ShdySwizzle &operator^=(const U &u) { return *this = get() ^ u; }
+    template<typename U> ShdySwizzle &operator<<=(const U &u) { return *this = get() << u; }
+    template<typename U> ShdySwizzle &operator>>=(const U &u) { return *this = get() >> u; }
+};
+
+typedef ShdyVec<float, 2> vec2;
+typedef ShdyVec<float, 3> vec3;
+typedef ShdyVec<float, 4> vec4;
+typedef ShdyVec<int, 2> ivec2;
+typedef ShdyVec<int, 3> ivec3;
+typedef ShdyVec<int, 4> ivec4;
+typedef ShdyVec<uint, 2> uvec2;
+typedef ShdyVec<uint, 3> uvec3;
+typedef ShdyVec<uint, 4> uvec4;
+typedef ShdyVec<bool, 2> bvec2;
+typedef ShdyVec<bool, 3> bvec3;
+typedef ShdyVec<bool, 4> bvec4;
+
+#define SHDY_VEC_OP(op, assign_op)                                                                                    \
+    template<typename T, int N> ShdyVec<T, N> operator op(const ShdyVec<T, N> &a, const ShdyVec<T, N> &b) {          \
+        ShdyVec<T, N> r;                                                                                             \
+        for (int i = 0; i < N; i++) r[i] = a[i] op b[i];                                                             \
+        return r;                                                                                                    \
+    }                                                                                                                \
+    template<typename T, int N> ShdyVec<T, N> operator op(const ShdyVec<T, N> &a, ShdyScalar<T> b) {                 \
+        ShdyVec<T, N> r;                                                                                             \
+        for (int i = 0; i < N; i++) r[i] = a[i] op b;                                                                \
+        return r;                                                                                                    \
+    }                                                                                                                \
+    template<typename T, int N> ShdyVec<T, N> operator op(ShdyScalar<T> a, const ShdyVec<T, N> &b) {                 \
+        ShdyVec<T, N> r;                                                                                             \
+        for (int i = 0; i < N; i++) r[i] = a op b[i];                                                                \
+        return r;                                                                                                    \
+    }                                                                                                                \
+    template<typename T, int N> ShdyVec<T, N> &operator assign_op(ShdyVec<T, N> &a, const ShdyVec<T, N> &b) {        \
+        for (int i = 0; i < N; i++) a[i] assign_op b[i];                                                             \
+        return a;                                                                                                    \
+    }                                                                                                                \
+    template<typename T, int N> ShdyVec<T, N> &operator assign_op(ShdyVec<T, N> &a, ShdyScalar<T> b) {               \
+        for (int i = 0; i < N; i++) a[i] assign_op b;                                                                \
+        return a;                                                                                                    \
+    }
+
+SHDY_VEC_OP(+, +=)
+SHDY_VEC_OP(-, -=)
+SHDY_VEC_OP(*, *=)
+SHDY_VEC_OP(/, /=)
+SHDY_VEC_OP(%, %=)
+SHDY_VEC_OP(&, &=)
+SHDY_VEC_OP(|, |=)
+SHDY_VEC_OP(^, ^=)
+SHDY_VEC_OP(<<, <<=)
+SHDY_VEC_OP(>>, >>=)
+
+#undef SHDY_VEC_OP
+
+template<typename T, int N> ShdyVec<T, N> operator-(const ShdyVec<T, N> &a) {
+    ShdyVec<T, N> r;
+    for (int i = 0; i < N; i++) r[i] = -a[i];
+    return r;
+}
+template<typename T, int N> ShdyVec<T, N> operator+(const ShdyVec<T, N> &a) { return a; }
+template<typename T, int N> ShdyVec<T, N> operator~(const ShdyVec<T, N> &a) {
+    ShdyVec<T, N> r;
+    for (int i = 0; i < N; i++) r[i] = ~a[i];
+    return r;
+}
+template<typename T, int N> ShdyVec<T, N> &operator++(ShdyVec<T, N> &a) { return a += T(1); }
+template<typename T, int N> ShdyVec<T, N> &operator--(ShdyVec<T, N> &a) { return a -= T(1); }
+template<typename T, int N> bool operator==(const ShdyVec<T, N> &a, const ShdyVec<T, N> &b) {
+    for (int i = 0; i < N; i++) {
+        if (a[i] != b[i]) return false;
+    }
+    return true;
+}
+template<typename T, int N> bool operator!=(const ShdyVec<T, N> &a, const ShdyVec<T, N> &b) { return !(a == b); }
+
+// Column major like GLSL, c[i] is the ith column.
+template<int N> struct ShdyMat {
+    ShdyVec<float, N> c[N];
+
+    ShdyMat() {}
+    explicit ShdyMat(float s) {
+        for (int i = 0; i < N; i++) c[i][i] = s;
+    }
+    template<int M, typename std::enable_if<M != N, int>::type = 0> explicit ShdyMat(const ShdyMat<M> &m) {
+        for (int i = 0; i < N; i++) {
+            for (int j = 0; j < N; j++) c[i][j] = i < M && j < M ? m[i][j] : float(i == j);
+        }
+    }
+    template<typename A, typename B, typename... R> ShdyMat(const A &a, const B &b, const R &...r) {
+        int i = 0;
+        fill(i, a);
+        fill(i, b);
+        (fill(i, r), ...);
+    }
+
+    ShdyVec<float, N> &operator[](int i) { return c[i]; }
+    const ShdyVec<float, N> &operator[](int i) const { return c[i]; }
+    static int length() { return N; }
+
+private:
+    template<typename U> void fill(int &i, const U &s) {
+        if (i < N*N) c[i/N][i % N] = float(s), i++;
+    }
+    template<typename U, int M> void fill(int &i, const ShdyVec<U, M> &v) {
+        for (int j = 0; j < M; j++) fill(i, v[j]);
+    }
+};
+
+typedef ShdyMat<2> mat2;
+typedef ShdyMat<3> mat3;
+typedef ShdyMat<4> mat4;
+typedef mat2 mat2x2;
+typedef mat3 mat3x3;
+typedef mat4 mat4x4;
+
+template<int N> ShdyVec<float, N> operator*(const ShdyMat<N> &m, const ShdyVec<float, N> &v) {
+    ShdyVec<float, N> r;
+    for (int i = 0; i < N; i++) r += m[i]*v[i];
+    return r;
+}
+template<int N> ShdyVec<float, N> operator*(const ShdyVec<float, N> &v, const ShdyMat<N> &m) {
+    ShdyVec<float, N> r;
+    for (int i = 0; i < N; i++) {
+        float sum = 0.0f;
+        for (int j = 0; j < N; j++) sum += v[j]*m[i][j];
+        r[i] = sum;
+    }
+    return r;
+}
+template<int N> ShdyMat<N> operator*(const ShdyMat<N> &a, const ShdyMat<N> &b) {
+    ShdyMat<N> r;
+    for (int i = 0; i < N; i++) r[i] = a*b[i];
+    return r;
+}
+#define SHDY_MAT_OP(op, assign_op)                                                                                    \
+    template<int N> ShdyMat<N> operator op(const ShdyMat<N> &a, float s) {                                           \
+        ShdyMat<N> r;                                                                                                \
+        for (int i = 0; i < N; i++) r[i] = a[i] op s;                                                                \
+        return r;                                                                                                    \
+    }                                                                                                                \
+    template<int N> ShdyMat<N> operator op(float s, const ShdyMat<N> &a) {                                           \
+        ShdyMat<N> r;                                                                                                \
+        for (int i = 0; i < N; i++) r[i] = s op a[i];                                                                \
+        return r;                                                                                                    \
+    }                                                                                                                \
+    template<int N> ShdyMat<N> &operator assign_op(ShdyMat<N> &a, float s) {                                         \
+        for (int i = 0; i < N; i++) a[i] assign_op s;                                                                \
+        return a;                                                                                                    \
+    }
+SHDY_MAT_OP(+, +=)
+SHDY_MAT_OP(-, -=)
+SHDY_MAT_OP(*, *=)
+SHDY_MAT_OP(/, /=)
+#undef SHDY_MAT_OP
+template<int N> ShdyMat<N> operator+(const ShdyMat<N> &a, const ShdyMat<N> &b) {
+    ShdyMat<N> r;
+    for (int i = 0; i < N; i++) r[i] = a[i] + b[i];
+    return r;
+}
+template<int N> ShdyMat<N> operator-(const ShdyMat<N> &a, const ShdyMat<N> &b) {
+    ShdyMat<N> r;
+    for (int i = 0; i < N; i++) r[i] = a[i] - b[i];
+    return r;
+}
+template<int N> ShdyMat<N> operator-(const ShdyMat<N> &a) { return a*-1.0f; }
+template<int N> ShdyMat<N> &operator+=(ShdyMat<N> &a, const ShdyMat<N> &b) { return a = a + b; }
+template<int N> ShdyMat<N> &operator-=(ShdyMat<N> &a, const ShdyMat<N> &b) { return a = a - b; }
+template<int N> ShdyMat<N> &operator*=(ShdyMat<N> &a, const ShdyMat<N> &b) { return a = a*b; }
+template<int N> ShdyVec<float, N> &operator*=(ShdyVec<float, N> &v, const ShdyMat<N> &m) { return v = v*m; }
+
+// Built-in functions. Each applies to floats and, component-wise, to float vectors.
+#define SHDY_FN1(name, expr)                                                                                          \
+    inline float name(float x) { return expr; }                                                                      \
+    template<int N> ShdyVec<float, N> name(const ShdyVec<float, N> &v) {                                             \
+        ShdyVec<float, N> r;                                                                                         \
+        for (int i = 0; i < N; i++) r[i] = name(v[i]);                                                               \
+        return r;                                                                                                    \
+    }
+
+SHDY_FN1(radians, x*0.01745329251994329577f)
+SHDY_FN1(degrees, x*57.2957795130823208768f)
+SHDY_FN1(sin, std::sin(x))
+SHDY_FN1(cos, std::cos(x))
+SHDY_FN1(tan, std::tan(x))
+SHDY_FN1(asin, std::asin(x))
+SHDY_FN1(acos, std::acos(x))
+SHDY_FN1(sinh, std::sinh(x))
+SHDY_FN1(cosh, std::cosh(x))
+SHDY_FN1(tanh, std::tanh(x))
+SHDY_FN1(asinh, std::asinh(x))
+SHDY_FN1(acosh, std::acosh(x))
+SHDY_FN1(atanh, std::atanh(x))
+SHDY_FN1(exp, std::exp(x))
+SHDY_FN1(log, std::log(x))
+SHDY_FN1(exp2, std::exp2(x))
+SHDY_FN1(log2, std::log2(x))
+SHDY_FN1(sqrt, std::sqrt(x))
+SHDY_FN1(inversesqrt, 1.0f/std::sqrt(x))
+SHDY_FN1(floor, std::floor(x))
+SHDY_FN1(ceil, std::ceil(x))
+SHDY_FN1(trunc, std::trunc(x))
+SHDY_FN1(round, std::round(x))
+SHDY_FN1(roundEven, std::nearbyint(x))
+SHDY_FN1(fract, x - std::floor(x))
+
+#undef SHDY_FN1
+
+inline float atan(float y_over_x) { return std::atan(y_over_x); }
+inline float atan(float y, float x) { return std::atan2(y, x); }
+template<int N> ShdyVec<float, N> atan(const ShdyVec<float, N> &v) {
+    ShdyVec<float, N> r;
+    for (int i = 0; i < N; i++) r[i] = std::atan(v[i]);
+    return r;
+}
+template<int N> ShdyVec<float, N> atan(const ShdyVec<float, N> &y, const ShdyVec<float, N> &x) {
+    ShdyVec<float, N> r;
+    for (int i = 0; i < N; i++) r[i] = std::atan2(y[i], x[i]);
+    return r;
+}
+
+inline float abs(float x) { return std::fabs(x); }
+inline int abs(int x) { return x < 0 ? -x : x; }
+inline float sign(float x) { return x > 0.0f ? 1.0f : x < 0.0f ? -1.0f : 0.0f; }
+inline int sign(int x) { return x > 0 ? 1 : x < 0 ? -1 : 0; }
+template<typename T, int N> ShdyVec<T, N> abs(const ShdyVec<T, N> &v) {
+    ShdyVec<T, N> r;
+    for (int i = 0; i < N; i++) r[i] = abs(v[i]);
+    return r;
+}
+template<typename T, int N> ShdyVec<T, N> sign(const ShdyVec<T, N> &v) {
+    ShdyVec<T, N> r;
+    for (int i = 0; i < N; i++) r[i] = sign(v[i]);
+    return r;
+}
+
+// Two argument functions taking a float or vector, and a vector or float for the second argument.
+#define SHDY_FN2(name, expr)                                                                                          \
+    inline float name(float x, float y) { return expr; }                                                             \
+    template<int N> ShdyVec<float, N> name(const ShdyVec<float, N> &a, const ShdyVec<float, N> &b) {                 \
+        ShdyVec<float, N> r;                                                                                         \
+        for (int i = 0; i < N; i++) r[i] = name(a[i], b[i]);                                                         \
+        return r;                                                                                                    \
+    }                                                                                                                \
+    template<int N> ShdyVec<float, N> name(const ShdyVec<float, N> &a, float y) {                                    \
+        ShdyVec<float, N> r;                                                                                         \
+        for (int i = 0; i < N; i++) r[i] = name(a[i], y);                                                            \
+        return r;                                                                                                    \
+    }
+
+SHDY_FN2(pow, std::pow(x, y))
+SHDY_FN2(mod, x - y*std::floor(x/y))
+
+#undef SHDY_FN2
+
+inline float step(float edge, float x) { return x < edge ? 0.0f : 1.0f; }
+template<int N> ShdyVec<float, N> step(const ShdyVec<float, N> &edge, const ShdyVec<float, N> &x) {
+    ShdyVec<float, N> r;
+    for (int i = 0; i < N; i++) r[i] = step(edge[i], x[i]);
+    return r;
+}
+template<int N> ShdyVec<float, N> step(float edge, const ShdyVec<float, N> &x) {
+    return step(ShdyVec<float, N>(edge), x);
+}
+
+template<typename A, typename B, typename std::enable_if<std::is_arithmetic<A>::value &&
+                                                         std::is_arithmetic<B>::value, int>::type = 0>
+typename std::common_type<A, B>::type min(A a, B b) {
+    return b < a ? b : a;
+}
+template<typename A, typename B, typename std::enable_if<std::is_arithmetic<A>::value &&
+                                                         std::is_arithmetic<B>::value, int>::type = 0>
+typename std::common_type<A, B>::type max(A a, B b) {
+    return a < b ? b : a;
+}
+template<typename A, typename B, typename C, typename std::enable_if<std::is_arithmetic<A>::value, int>::type = 0>
+typename std::common_type<A, B, C>::type clamp(A x, B lo, C hi) {
+    return min(max(x, lo), hi);
+}
+template<typename T, int N> ShdyVec<T, N> min(const ShdyVec<T, N> &a, const ShdyVec<T, N> &b) {
+    ShdyVec<T, N> r;
+    for (int i = 0; i < N; i++) r[i] = min(a[i], b[i]);
+    return r;
+}
+template<typename T, int N> ShdyVec<T, N> min(const ShdyVec<T, N> &a, ShdyScalar<T> b) {
+    return min(a, ShdyVec<T, N>(b));
+}
+template<typename T, int N> ShdyVec<T, N> max(const ShdyVec<T, N> &a, const ShdyVec<T, N> &b) {
+    ShdyVec<T, N> r;
+    for (int i = 0; i < N; i++) r[i] = max(a[i], b[i]);
+    return r;
+}
+template<typename T, int N> ShdyVec<T, N> max(const ShdyVec<T, N> &a, ShdyScalar<T> b) {
+    return max(a, ShdyVec<T, N>(b));
+}
+template<typename T, int N> ShdyVec<T, N> clamp(const ShdyVec<T, N> &x, const ShdyVec<T, N> &lo,
+                                                const ShdyVec<T, N> &hi) {
+    return min(max(x, lo), hi);
+}
+template<typename T, int N> ShdyVec<T, N> clamp(const ShdyVec<T, N> &x, ShdyScalar<T> lo, ShdyScalar<T> hi) {
+    return min(max(x, lo), hi);
+}
+
+inline float mix(float a, float b, float t) { return a*(1.0f - t) + b*t; }
+inline float mix(float a, float b, bool t) { return t ? b : a; }
+template<int N> ShdyVec<float, N> mix(const ShdyVec<float, N> &a, const ShdyVec<float, N> &b,
+                                      const ShdyVec<float, N> &t) {
+    return a*(1.0f - t) + b*t;
+}
+template<int N> ShdyVec<float, N> mix(const ShdyVec<float, N> &a, const ShdyVec<float, N> &b, float t) {
+    return a*(1.0f - t) + b*t;
+}
+template<typename T, int N> ShdyVec<T, N> mix(const ShdyVec<T, N> &a, const ShdyVec<T, N> &b,
+                                              const ShdyVec<bool, N> &t) {
+    ShdyVec<T, N> r;
+    for (int i = 0; i < N; i++) r[i] = t[i] ? b[i] : a[i];
+    return r;
+}
+
+inline float smoothstep(float e0, float e1, float x) {
+    float t = clamp((x - e0)/(e1 - e0), 0.0f, 1.0f);
+    return t*t*(3.0f - 2.0f*t);
+}
+template<int N> ShdyVec<float, N> smoothstep(const ShdyVec<float, N> &e0, const ShdyVec<float, N> &e1,
+                                             const ShdyVec<float, N> &x) {
+    ShdyVec<float, N> r;
+    for (int i = 0; i < N; i++) r[i] = smoothstep(e0[i], e1[i], x[i]);
+    return r;
+}
+template<int N> ShdyVec<float, N> smoothstep(float e0, float e1, const ShdyVec<float, N> &x) {
+    ShdyVec<float, N> r;
+    for (int i = 0; i < N; i++) r[i] = smoothstep(e0, e1, x[i]);
+    return r;
+}
+
+inline float fma(float a, float b, float c) { return a*b + c; }
+template<int N> ShdyVec<float, N> fma(const ShdyVec<float, N> &a, const ShdyVec<float, N> &b,
+                                      const ShdyVec<float, N> &c) {
+    return a*b + c;
+}
+inline float modf(float x, float &i) {
+    i = std::trunc(x);
+    return x - i;
+}
+
+inline float dot(float a, float b) { return a*b; }
+template<int N> float dot(const ShdyVec<float, N> &a, const ShdyVec<float, N> &b) {
+    float sum = 0.0f;
+    for (int i = 0; i < N; i++) sum += a[i]*b[i];
+    return sum;
+}
+inline float length(float x) { return std::fabs(x); }
+template<int N> float length(const ShdyVec<float, N> &v) { return std::sqrt(dot(v, v)); }
+inline float distance(float a, float b) { return std::fabs(a - b); }
+template<int N> float distance(const ShdyVec<float, N> &a, const ShdyVec<float, N> &b) { return length(a - b); }
+inline float normalize(float x) { return sign(x); }
+template<int N> ShdyVec<float, N> normalize(const ShdyVec<float, N> &v) { return v/length(v); }
+inline vec3 cross(const vec3 &a, const vec3 &b) {
+    return vec3(a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x);
+}
+template<typename T> T faceforward(const T &n, const T &i, const T &nref) { return dot(nref, i) < 0.0f ? n : -n; }
+template<typename T> T reflect(const T &i, const T &n) { return i - 2.0f*dot(n, i)*n; }
+template<typename T> T refract(const T &i, const T &n, float eta) {
+    float d = dot(n, i);
+    float k = 1.0f - eta*eta*(1.0f - d*d);
+    return k < 0.0f ? T(0.0f) : eta*i - (eta*d + std::sqrt(k))*n;
+}
+
+#define SHDY_CMP(name, op)                                                                                            \
+    template<typename T, int N> ShdyVec<bool, N> name(const ShdyVec<T, N> &a, const ShdyVec<T, N> &b) {              \
+        ShdyVec<bool, N> r;                                                                                          \
+        for (int i = 0; i < N; i++) r[i] = a[i] op b[i];                                                             \
+        return r;                                                                                                    \
+    }
+SHDY_CMP(lessThan, <)
+SHDY_CMP(lessThanEqual, <=)
+SHDY_CMP(greaterThan, >)
+SHDY_CMP(greaterThanEqual, >=)
+SHDY_CMP(equal, ==)
+SHDY_CMP(notEqual, !=)
+#undef SHDY_CMP
+
+template<int N> bool any(const ShdyVec<bool, N> &v) {
+    for (int i = 0; i < N; i++) {
+        if (v[i]) return true;
+    }
+    return false;
+}
+template<int N> bool all(const ShdyVec<bool, N> &v) {
+    for (int i = 0; i < N; i++) {
+        if (!v[i]) return false;
+    }
+    return true;
+}
+// not() of GLSL, not is a keyword in C++.
+template<int N> ShdyVec<bool, N> shdy_not(const ShdyVec<bool, N> &v) {
+    ShdyVec<bool, N> r;
+    for (int i = 0; i < N; i++) r[i] = !v[i];
+    return r;
+}
+
+inline bool isnan(float x) { return std::isnan(x); }
+inline bool isinf(float x) { return std::isinf(x); }
+template<int N> ShdyVec<bool, N> isnan(const ShdyVec<float, N> &v) {
+    ShdyVec<bool, N> r;
+    for (int i = 0; i < N; i++) r[i] = std::isnan(v[i]);
+    return r;
+}
+template<int N> ShdyVec<bool, N> isinf(const ShdyVec<float, N> &v) {
+    ShdyVec<bool, N> r;
+    for (int i = 0; i < N; i++) r[i] = std::isinf(v[i]);
+    return r;
+}
+
+template<typename To, typename From> To shdy_bit_cast(From from) {
+    To to;
+    memcpy(&to, &from, sizeof(to));
+    return to;
+}
+#define SHDY_BITS(name, To, From)                                                                                     \
+    inline To name(From x) { return shdy_bit_cast<To>(x); }                                                          \
+    template<int N> ShdyVec<To, N> name(const ShdyVec<From, N> &v) {                                                 \
+        ShdyVec<To, N> r;                                                                                            \
+        for (int i = 0; i < N; i++) r[i] = shdy_bit_cast<To>(v[i]);                                                  \
+        return r;                                                                                                    \
+    }
+SHDY_BITS(floatBitsToInt, int, float)
+SHDY_BITS(floatBitsToUint, uint, float)
+SHDY_BITS(intBitsToFloat, float, int)
+SHDY_BITS(uintBitsToFloat, float, uint)
+#undef SHDY_BITS
+
+// Every pixel is its own invocation, so there are no neighbours to take derivatives from.
+template<typename T> T dFdx(const T &) { return T(0.0f); }
+template<typename T> T dFdy(const T &) { return T(0.0f); }
+template<typename T> T fwidth(const T &) { return T(0.0f); }
+
+template<int N> ShdyMat<N> transpose(const ShdyMat<N> &m) {
+    ShdyMat<N> r;
+    for (int i = 0; i < N; i++) {
+        for (int j = 0; j < N; j++) r[i][j] = m[j][i];
+    }
+    return r;
+}
+template<int N> ShdyMat<N> matrixCompMult(const ShdyMat<N> &a, const ShdyMat<N> &b) {
+    ShdyMat<N> r;
+    for (int i = 0; i < N; i++) r[i] = a[i]*b[i];
+    return r;
+}
+inline float determinant(const mat2 &m) { return m[0][0]*m[1][1] - m[1][0]*m[0][1]; }
+inline float determinant(const mat3 &m) { return dot(m[0], cross(m[1], m[2])); }
+inline float determinant(const mat4 &m) {
+    float sum = 0.0f;
+    for (int i = 0; i < 4; i++) {
+        mat3 minor;
+        for (int j = 0, col = 0; j < 4; j++) {
+            if (j == i) continue;
+            minor[col++] = vec3(m[j].y, m[j].z, m[j].w);
+        }
+        sum += (i % 2 == 0 ? 1.0f : -1.0f)*m[i].x*determinant(minor);
+    }
+    return sum;
+}
+// Gauss-Jordan elimination with partial pivoting.
+template<int N> ShdyMat<N> inverse(const ShdyMat<N> &m) {
+    ShdyMat<N> a = transpose(m);
+    ShdyMat<N> r(1.0f);
+    for (int col = 0; col < N; col++) {
+        int pivot = col;
+        for (int row = col + 1; row < N; row++) {
+            if (std::fabs(a[row][col]) > std::fabs(a[pivot][col])) pivot = row;
+        }
+        ShdyVec<float, N> tmp = a[col];
+        a[col] = a[pivot];
+        a[pivot] = tmp;
+        tmp = r[col];
+        r[col] = r[pivot];
+        r[pivot] = tmp;
+
+        float scale = 1.0f/a[col][col];
+        a[col] *= scale;
+        r[col] *= scale;
+        for (int row = 0; row < N; row++) {
+            if (row == col) continue;
+            float f = a[row][col];
+            a[row] -= a[col]*f;
+            r[row] -= r[col]*f;
+        }
+    }
+    return transpose(r);
+}
+
+// RGBA float texels, rows bottom up, sampled with linear filtering and repeat wrapping.
+struct sampler2D {
+    const float *texels = nullptr;
+    int width = 0;
+    int height = 0;
+};
+
+inline vec4 texelFetch(const sampler2D &s, const ivec2 &p, int) {
+    if (s.texels == nullptr) return vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    int x = p.x < 0 ? 0 : p.x >= s.width ? s.width - 1 : p.x;
+    int y = p.y < 0 ? 0 : p.y >= s.height ? s.height - 1 : p.y;
+    const float *t = s.texels + ((size_t)y*s.width + x)*4;
+    return vec4(t[0], t[1], t[2], t[3]);
+}
+inline vec4 texture(const sampler2D &s, const vec2 &uv) {
+    if (s.texels == nullptr) return vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    float u = uv.x*s.width - 0.5f;
+    float v = uv.y*s.height - 0.5f;
+    float fu = std::floor(u);
+    float fv = std::floor(v);
+    float tx = u - fu;
+    float ty = v - fv;
+    long long x0 = (long long)fu % s.width;
+    long long y0 = (long long)fv % s.height;
+    x0 += x0 < 0 ? s.width : 0;
+    y0 += y0 < 0 ? s.height : 0;
+    int x1 = (int)(x0 + 1 == s.width ? 0 : x0 + 1);
+    int y1 = (int)(y0 + 1 == s.height ? 0 : y0 + 1);
+    vec4 bl = texelFetch(s, ivec2((int)x0, (int)y0), 0);
+    vec4 br = texelFetch(s, ivec2(x1, (int)y0), 0);
+    vec4 tl = texelFetch(s, ivec2((int)x0, y1), 0);
+    vec4 tr = texelFetch(s, ivec2(x1, y1), 0);
+    return mix(mix(bl, br, tx), mix(tl, tr, tx), ty);
+}
+// There are no mipmaps, the bias and level are ignored.
+inline vec4 texture(const sampler2D &s, const vec2 &uv, float) { return texture(s, uv); }
+inline vec4 textureLod(const sampler2D &s, const vec2 &uv, float) { return texture(s, uv); }
+inline ivec2 textureSize(const sampler2D &s, int) { return ivec2(s.width, s.height); }
+
+// Built-in inputs of a fragment shader invocation, the translated shader derives from it.
+struct ShdyBuiltins {
+    vec4 gl_FragCoord;
+    bool gl_FrontFacing = true;
+};
+
+// Thrown by discard, the pixel is written as transparent black.
+struct ShdyDiscard {};
+
+// Tags the binding function generated for each uniform declaration, see ShdyBinder.
+template<int I> struct ShdyTag {};
+
+// Sets or gets the uniform with the given name, each uniform declaration is passed to bind() in turn.
+struct ShdyBinder {
+    const char *name;
+    float *values;
+    int count;
+    bool get;
+    const float *texels;
+    int width;
+    int height;
+    bool found;
+
+    template<typename T> void value(T &v, int i) {
+        if (get) {
+            values[i] = (float)v;
+        } else {
+            v = (T)values[i];
+        }
+    }
+    void bind(const char *uniform_name, float &v) { bind_components(uniform_name, &v, 1); }
+    void bind(const char *uniform_name, int &v) { bind_components(uniform_name, &v, 1); }
+    void bind(const char *uniform_name, uint &v) { bind_components(uniform_name, &v, 1); }
+    void bind(const char *uniform_name, bool &v) { bind_components(uniform_name, &v, 1); }
+    template<typename T, int N> void bind(const char *uniform_name, ShdyVec<T, N> &v) {
+        bind_components(uniform_name, &v[0], N);
+    }
+    void bind(const char *uniform_name, sampler2D &s) {
+        if (strcmp(uniform_name, name) == 0 && texels != nullptr) {
+            s.texels = texels;
+            s.width = width;
+            s.height = height;
+            found = true;
+        }
+    }
+    // Matrices, arrays and structs can't be set.
+    template<typename T> void bind(const char *, T &) {}
+
+private:
+    template<typename T> void bind_components(const char *uniform_name, T *v, int n) {
+        if (strcmp(uniform_name, name) != 0 || texels != nullptr || count != n) return;
+        for (int i = 0; i < n; i++) value(v[i], i);
+        found = true;
+    }
+};
+
+// Runs the shader S for rows [y_begin, y_end) of an image width pixels wide, writing the RGBA of each pixel to
+// out_rgba. The shader object is constructed per pixel, so its globals start from their initializers each
+// invocation like on the GPU.
+template<typename S> void shdy_render(int width, int y_begin, int y_end, float *out_rgba) {
+    for (int y = y_begin; y < y_end; y++) {
+        for (int x = 0; x < width; x++) {
+            // Globals without an initializer start at zero, like they do on GL drivers.
+            S shader = S();
+            shader.gl_FragCoord = vec4((float)x + 0.5f, (float)y + 0.5f, 0.5f, 1.0f);
+            vec4 color(0.0f);
+            try {
+                shader.main();
+                color = shader.fragColor;
+            } catch (const ShdyDiscard &) {
+            }
+            memcpy(out_rgba, &color, sizeof(color));
+            out_rgba += 4;
+        }
+    }
+}
+
+} // namespace shdy_cpu
+
+#define layout(...)
+)CPU"
@@ -0,0 +1,400 @@
+R"(
+// Transforms the given fragCoord from pixels into a normalized form for a landscape orientation.
+// The normalized form is in the range Y = [-1.0..+1.0] and X will differ based on the width.
+vec2 shdyNormCoordLandscape(in vec2 fragCoord) {
+    return 2.0*(fragCoord - 0.5*uResolution) / uResolution.y;
+}
+
+// Transforms the given fragCoord from pixels into a normalized form for a portrait orientation.
+// The normalized form is in the range X = [-1.0..+1.0] and Y will differ based on the height.
+vec2 shdyNormCoordPortrait(in vec2 fragCoord) {
+    return 2.0*(fragCoord - 0.5*uResolution) / uResolution.x;
+}
+
+// 2d transformations.
+
+vec2 shdyTranslate2d(in vec2 p, in vec2 t) {
+    return p - t;
+}
+
+mat2 shdyRotMat2d(in float angle) {
+    return mat2(cos(angle), sin(angle),
+                -sin(angle), cos(angle));
+}
+
+vec2 shdyRotate2d(in vec2 p, in float angle) {
+    return p*shdyRotMat2d(angle);
+}
+
+mat2 shdyScaleMat2d(in vec2 scale) {
+    return mat2(scale.x, 0.0,
+                0.0, scale.y);
+}
+
+vec2 shdyScale2d(in vec2 p, in vec2 scale) {
+    return p*shdyScaleMat2d(scale);
+}
+
+// RNG and noise functions.
+
+// Returns a pseudorandom float from a given 2d point.
+highp float shdyRand2d(in vec2 p) {
+    const highp float a = 12.9898;
+    const highp float b = 78.233;
+    const highp float ampl = 43758.5453;
+    highp float freq = dot(p, vec2(a, b));
+    return fract(sin(freq)*ampl);
+}
+
+// Returns 2d value noise.
+float shdyNoise2d(in vec2 p) {
+    vec2 i = floor(p);
+    vec2 f = smoothstep(0.0, 1.0, fract(p));
+
+    float bl = shdyRand2d(i);
+    float br = shdyRand2d(i + vec2(1.0, 0.0));
+    float b = mix(bl, br, f.x);
+
+    float tl = shdyRand2d(i + vec2(0.0, 1.0));
+    float tr = shdyRand2d(i + vec2(1.0, 1.0));
+    float t = mix(tl, tr, f.x);
+
+    return mix(b, t, f.y);
+}
+
+// Returns 2d fractal value noise.
+float shdyFracNoise2d(in vec2 p, in int octaves) {
+    float v = 0.0;
+    float a = 0.5;
+    vec2 shift = vec2(100);
+
+    mat2 rot = shdyRotMat2d(0.5);
+
+    for (int i = 0; i < octaves; i++) {
+        v += a*shdyNoise2d(p);
+        p = rot*p*2.0 + shift;
+        a *= 0.5;
+    }
+
+    return v;
+}
+
+float shdyFracNoise2d(in vec2 p) {
+    float v = 0.0;
+    float a = 0.5;
+    vec2 shift = vec2(100);
+
+    mat2 rot = shdyRotMat2d(0.5);
+
+    for (int i = 0; i < SHDY_FBM_OCTAVES; i++) {
+        v += a*shdyNoise2d(p);
+        p = rot*p*2.0 + shift;
+        a *= 0.5;
+    }
+
+    return v;
+}
+
+// Integer hashes, see "Hash Functions for GPU Rendering" by Jarzynski and Olano.
+
+uint shdyPcg(in uint v) {
+    uint state = v*747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state)*277803737u;
+    return (word >> 22u) ^ word;
+}
+
+uvec2 shdyPcg2d(in uvec2 v) {
+    v = v*1664525u + 1013904223u;
+    v.x += v.y*1664525u;
+    v.y += v.x*1664525u;
+    v = v ^ (v >> 16u);
+    v.x += v.y*1664525u;
+    v.y += v.x*1664525u;
+    v = v ^ (v >> 16u);
+    return v;
+}
+
+uvec3 shdyPcg3d(in uvec3 v) {
+    v = v*1664525u + 1013904223u;
+    v.x += v.y*v.z;
+    v.y += v.z*v.x;
+    v.z += v.x*v.y;
+    v ^= v >> 16u;
+    v.x += v.y*v.z;
+    v.y += v.z*v.x;
+    v.z += v.x*v.y;
+    return v;
+}
+
+uvec4 shdyPcg4d(in uvec4 v) {
+    v = v*1664525u + 1013904223u;
+    v.x += v.y*v.w;
+    v.y += v.z*v.x;
+    v.z += v.x*v.y;
+    v.w += v.y*v.z;
+    v ^= v >> 16u;
+    v.x += v.y*v.w;
+    v.y += v.z*v.x;
+    v.z += v.x*v.y;
+    v.w += v.y*v.z;
+    return v;
+}
+
+// Maps the top 24 bits of a hash to [0.0..1.0), exactly representable as a float.
+float shdyUintToUnit(in uint v) {
+    return float(v >> 8u)*(1.0/16777216.0);
+}
+
+vec2 shdyUintToUnit(in uvec2 v) {
+    return vec2(v >> 8u)*(1.0/16777216.0);
+}
+
+vec3 shdyUintToUnit(in uvec3 v) {
+    return vec3(v >> 8u)*(1.0/16777216.0);
+}
+
+vec4 shdyUintToUnit(in uvec4 v) {
+    return vec4(v >> 8u)*(1.0/16777216.0);
+}
+
+float shdyHash1d(in float p) {
+    return shdyUintToUnit(shdyPcg(floatBitsToUint(p)));
+}
+
+float shdyHash2d(in vec2 p) {
+    return shdyUintToUnit(shdyPcg2d(floatBitsToUint(p)).x);
+}
+
+float shdyHash3d(in vec3 p) {
+    return shdyUintToUnit(shdyPcg3d(floatBitsToUint(p)).x);
+}
+
+float shdyHash4d(in vec4 p) {
+    return shdyUintToUnit(shdyPcg4d(floatBitsToUint(p)).x);
+}
+
+// Hash based noise. Lattice points are hashed as integers so the result is stable at any coordinate.
+// The gradient and simplex noise results are scaled by factors measured over many samples so the output
+// spans roughly [-1.0..+1.0].
+
+float shdyValueNoise2d(in vec2 p) {
+    vec2 i = floor(p);
+    vec2 f = smoothstep(0.0, 1.0, fract(p));
+    uvec2 c = uvec2(ivec2(i));
+
+    float bl = shdyUintToUnit(shdyPcg2d(c).x);
+    float br = shdyUintToUnit(shdyPcg2d(c + uvec2(1u, 0u)).x);
+    float tl = shdyUintToUnit(shdyPcg2d(c + uvec2(0u, 1u)).x);
+    float tr = shdyUintToUnit(shdyPcg2d(c + uvec2(1u, 1u)).x);
+
+    return mix(mix(bl, br, f.x), mix(tl, tr, f.x), f.y);
+}
+
+// Pseudorandom gradients with components in the range [-1.0..+1.0].
+vec2 shdyGradient2d(in ivec2 i) {
+    return shdyUintToUnit(shdyPcg2d(uvec2(i)))*2.0 - 1.0;
+}
+
+vec3 shdyGradient3d(in ivec3 i) {
+    return shdyUintToUnit(shdyPcg3d(uvec3(i)))*2.0 - 1.0;
+}
+
+vec4 shdyGradient4d(in ivec4 i) {
+    return shdyUintToUnit(shdyPcg4d(uvec4(i)))*2.0 - 1.0;
+}
+
+float shdyGradNoise2d(in vec2 p) {
+    vec2 i = floor(p);
+    vec2 f = fract(p);
+    vec2 u = f*f*f*(f*(f*6.0 - 15.0) + 10.0);
+    ivec2 c = ivec2(i);
+
+    float bl = dot(shdyGradient2d(c), f);
+    float br = dot(shdyGradient2d(c + ivec2(1, 0)), f - vec2(1.0, 0.0));
+    float tl = dot(shdyGradient2d(c + ivec2(0, 1)), f - vec2(0.0, 1.0));
+    float tr = dot(shdyGradient2d(c + ivec2(1, 1)), f - vec2(1.0, 1.0));
+
+    return 1.2*mix(mix(bl, br, u.x), mix(tl, tr, u.x), u.y);
+}
+
+float shdyGradNoise3d(in vec3 p) {
+    vec3 i = floor(p);
+    vec3 f = fract(p);
+    vec3 u = f*f*f*(f*(f*6.0 - 15.0) + 10.0);
+    ivec3 c = ivec3(i);
+
+    // Weighted sum over the corners of the cell, equivalent to the nested mix() of the 2d version.
+    float v = 0.0;
+    for (int j = 0; j < 8; j++) {
+        ivec3 o = ivec3(j, j >> 1, j >> 2) & 1;
+        vec3 w = mix(1.0 - u, u, vec3(o));
+        v += w.x*w.y*w.z*dot(shdyGradient3d(c + o), f - vec3(o));
+    }
+
+    return 1.2*v;
+}
+
+float shdyGradNoise4d(in vec4 p) {
+    vec4 i = floor(p);
+    vec4 f = fract(p);
+    vec4 u = f*f*f*(f*(f*6.0 - 15.0) + 10.0);
+    ivec4 c = ivec4(i);
+
+    float v = 0.0;
+    for (int j = 0; j < 16; j++) {
+        ivec4 o = ivec4(j, j >> 1, j >> 2, j >> 3) & 1;
+        vec4 w = mix(1.0 - u, u, vec4(o));
+        v += w.x*w.y*w.z*w.w*dot(shdyGradient4d(c + o), f - vec4(o));
+    }
+
+    return 1.15*v;
+}
+
+// Simplex noise, based on "Simplex noise demystified" by Stefan Gustavson with the permutation table
+// replaced by the integer hash.
+
+float shdySimplexNoise2d(in vec2 p) {
+    const float F2 = 0.366025403784; // (sqrt(3) - 1) / 2
+    const float G2 = 0.211324865405; // (3 - sqrt(3)) / 6
+
+    vec2 i = floor(p + dot(p, vec2(F2)));
+    vec2 x0 = p - i + dot(i, vec2(G2));
+    vec2 o = x0.x > x0.y ? vec2(1.0, 0.0) : vec2(0.0, 1.0);
+    vec2 x1 = x0 - o + G2;
+    vec2 x2 = x0 - 1.0 + 2.0*G2;
+    ivec2 c = ivec2(i);
+
+    vec3 t = max(0.5 - vec3(dot(x0, x0), dot(x1, x1), dot(x2, x2)), 0.0);
+    t *= t;
+    t *= t;
+    vec3 n = vec3(dot(shdyGradient2d(c), x0),
+                  dot(shdyGradient2d(c + ivec2(o)), x1),
+                  dot(shdyGradient2d(c + 1), x2));
+
+    return 72.0*dot(t, n);
+}
+
+float shdySimplexNoise3d(in vec3 p) {
+    const float F3 = 1.0/3.0;
+    const float G3 = 1.0/6.0;
+
+    vec3 i = floor(p + dot(p, vec3(F3)));
+    vec3 x0 = p - i + dot(i, vec3(G3));
+
+    vec3 g = step(x0.yzx, x0.xyz);
+    vec3 l = 1.0 - g;
+    vec3 i1 = min(g.xyz, l.zxy);
+    vec3 i2 = max(g.xyz, l.zxy);
+
+    vec3 x1 = x0 - i1 + G3;
+    vec3 x2 = x0 - i2 + 2.0*G3;
+    vec3 x3 = x0 - 1.0 + 3.0*G3;
+    ivec3 c = ivec3(i);
+
+    vec4 t = max(0.6 - vec4(dot(x0, x0), dot(x1, x1), dot(x2, x2), dot(x3, x3)), 0.0);
+    t *= t;
+    t *= t;
+    vec4 n = vec4(dot(shdyGradient3d(c), x0),
+                  dot(shdyGradient3d(c + ivec3(i1)), x1),
+                  dot(shdyGradient3d(c + ivec3(i2)), x2),
+                  dot(shdyGradient3d(c + 1), x3));
+
+    return 26.0*dot(t, n);
+}
+
+float shdySimplexNoise4d(in vec4 p) {
+    const float F4 = 0.309016994375; // (sqrt(5) - 1) / 4
+    const float G4 = 0.138196601125; // (5 - sqrt(5)) / 20
+
+    vec4 i = floor(p + dot(p, vec4(F4)));
+    vec4 x0 = p - i + dot(i, vec4(G4));
+
+    // Rank the components of x0 to find which simplex the point is in.
+    vec4 rank;
+    vec3 is_x = step(x0.yzw, x0.xxx);
+    vec3 is_yz = step(x0.zww, x0.yyz);
+    rank.x = is_x.x + is_x.y + is_x.z;
+    rank.yzw = 1.0 - is_x;
+    rank.y += is_yz.x + is_yz.y;
+    rank.zw += 1.0 - is_yz.xy;
+    rank.z += is_yz.z;
+    rank.w += 1.0 - is_yz.z;
+
+    vec4 i3 = clamp(rank, 0.0, 1.0);
+    vec4 i2 = clamp(rank - 1.0, 0.0, 1.0);
+    vec4 i1 = clamp(rank - 2.0, 0.0, 1.0);
+
+    vec4 x1 = x0 - i1 + G4;
+    vec4 x2 = x0 - i2 + 2.0*G4;
+    vec4 x3 = x0 - i3 + 3.0*G4;
+    vec4 x4 = x0 - 1.0 + 4.0*G4;
+    ivec4 c = ivec4(i);
+
+    vec3 t0 = max(0.6 - vec3(dot(x0, x0), dot(x1, x1), dot(x2, x2)), 0.0);
+    vec2 t1 = max(0.6 - vec2(dot(x3, x3), dot(x4, x4)), 0.0);
+    t0 *= t0;
+    t0 *= t0;
+    t1 *= t1;
+    t1 *= t1;
+    vec3 n0 = vec3(dot(shdyGradient4d(c), x0),
+                   dot(shdyGradient4d(c + ivec4(i1)), x1),
+                   dot(shdyGradient4d(c + ivec4(i2)), x2));
+    vec2 n1 = vec2(dot(shdyGradient4d(c + ivec4(i3)), x3),
+                   dot(shdyGradient4d(c + 1), x4));
+
+    return 25.0*(dot(t0, n0) + dot(t1, n1));
+}
+
+// Texture backed noise.
+
+const float SHDY_NOISE_TEX_SIZE = 256.0;
+const float SHDY_NOISE_TEX_CELLS = 32.0;
+
+float shdyNoise2dTex(in vec2 p) {
+    // The texture holds one random value per texel. Offsetting the lookup by the smoothed fraction lets the
+    // bilinear filter do the smoothstep interpolation of value noise in a single fetch.
+    vec2 i = floor(p);
+    vec2 f = smoothstep(0.0, 1.0, fract(p));
+    return texture(uShdyNoiseTex, (i + f + 0.5)/SHDY_NOISE_TEX_SIZE).r;
+}
+
+float shdyFracNoise2dTex(in vec2 p, in int octaves) {
+    float v = 0.0;
+    float a = 0.5;
+    vec2 shift = vec2(100);
+
+    mat2 rot = shdyRotMat2d(0.5);
+
+    for (int i = 0; i < octaves; i++) {
+        v += a*shdyNoise2dTex(p);
+        p = rot*p*2.0 + shift;
+        a *= 0.5;
+    }
+
+    return v;
+}
+
+float shdyFracNoise2dTex(in vec2 p) {
+    float v = 0.0;
+    float a = 0.5;
+    vec2 shift = vec2(100);
+
+    mat2 rot = shdyRotMat2d(0.5);
+
+    for (int i = 0; i < SHDY_FBM_OCTAVES; i++) {
+        v += a*shdyNoise2dTex(p);
+        p = rot*p*2.0 + shift;
+        a *= 0.5;
+    }
+
+    return v;
+}
+
+float shdyGradNoise2dTex(in vec2 p) {
+    return texture(uShdyNoiseTex, p/SHDY_NOISE_TEX_CELLS).g;
+}
+
+vec2 shdyWorley2dTex(in vec2 p) {
+    return texture(uShdyNoiseTex, p/SHDY_NOISE_TEX_CELLS).ba;
+}
+)"
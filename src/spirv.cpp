@@ -0,0 +1,113 @@
+#include "shdy.h"
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+// Opcodes, decorations and storage classes of the SPIR-V specification used below.
+enum {
+    SPIRV_OP_NAME = 5,
+    SPIRV_OP_VARIABLE = 59,
+    SPIRV_OP_DECORATE = 71,
+    SPIRV_DECORATION_LOCATION = 30,
+    SPIRV_STORAGE_UNIFORM_CONSTANT = 0
+};
+
+#define SPIRV_HEADER_WORDS 5
+
+bool spirv_cache_load(uint64_t key, StrBuf *out) {
+    char path[PATH_MAX];
+    if (!cache_file_path("spirv", key, "spv", path) || access(path, R_OK) != 0 || !file_read(path, out)) {
+        return false;
+    }
+
+    // A truncated or foreign file is treated as a miss, it's overwritten once the source is compiled again.
+    if (out->len < SPIRV_HEADER_WORDS * sizeof(uint32_t) || out->len % sizeof(uint32_t) != 0 ||
+        *(const uint32_t *)out->data != SPIRV_MAGIC) {
+        ERRORF("Ignoring invalid cached SPIR-V %s.\n", path);
+        str_buf_clear(out);
+        return false;
+    }
+
+    return true;
+}
+
+void spirv_cache_store(uint64_t key, const StrBuf *spirv) {
+    char path[PATH_MAX];
+    if (!cache_file_path("spirv", key, "spv", path)) {
+        return;
+    }
+
+    // Written to a temporary file first, so other shdy instances never load a partial module.
+    char tmp_path[PATH_MAX + 16];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", path, (int)getpid());
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == nullptr) {
+        ERRORF("Failed to open %s: %s.\n", tmp_path, strerror(errno));
+        return;
+    }
+    bool written = fwrite(spirv->data, 1, spirv->len, file) == spirv->len;
+    if (fclose(file) != 0 || !written || rename(tmp_path, path) != 0) {
+        ERRORF("Failed to cache SPIR-V in %s: %s.\n", path, strerror(errno));
+        unlink(tmp_path);
+    }
+}
+
+int spirv_reflect_uniforms(const StrBuf *spirv, ShaderUniform *out, int max) {
+    const auto *words = (const uint32_t *)spirv->data;
+    size_t num_words = spirv->len / sizeof(uint32_t);
+    if (num_words < SPIRV_HEADER_WORDS) {
+        return 0;
+    }
+
+    // Ids are below the bound in the header, names and locations are looked up by id once the variables are known.
+    // Every id is the result of an instruction, so a bound past the number of words comes from a corrupt module.
+    uint32_t bound = words[3];
+    if (bound > num_words) {
+        ERRORF("SPIR-V module has an id bound of %u in %zu words, it's corrupt.\n", bound, num_words);
+        return 0;
+    }
+    auto *names = (const char **)calloc(bound, sizeof(const char *));
+    auto *locations = (int *)malloc(bound * sizeof(int));
+    if (names == nullptr || locations == nullptr) {
+        ERRORF("Failed to alloc() SPIR-V reflection tables.\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(locations, 0xff, bound * sizeof(int));
+
+    int count = 0;
+    for (size_t i = SPIRV_HEADER_WORDS; i < num_words;) {
+        uint32_t opcode = words[i] & 0xffff;
+        uint32_t len = words[i] >> 16;
+        if (len == 0 || i + len > num_words) {
+            break;
+        }
+        const uint32_t *operands = words + i + 1;
+
+        // The name is a NUL terminated string in the words after the id, a corrupt module may not terminate it.
+        if (opcode == SPIRV_OP_NAME && len >= 3 && operands[0] < bound &&
+            memchr(operands + 1, '\0', (len - 2) * sizeof(uint32_t)) != nullptr) {
+            names[operands[0]] = (const char *)(operands + 1);
+        } else if (opcode == SPIRV_OP_DECORATE && len >= 4 && operands[0] < bound &&
+                   operands[1] == SPIRV_DECORATION_LOCATION) {
+            locations[operands[0]] = (int)operands[2];
+        } else if (opcode == SPIRV_OP_VARIABLE && len >= 4 && operands[1] < bound &&
+                   operands[2] == SPIRV_STORAGE_UNIFORM_CONSTANT) {
+            // Uniforms outside a block, including samplers, are UniformConstant variables. Names and decorations
+            // come before the variables in a module.
+            uint32_t id = operands[1];
+            if (names[id] != nullptr && locations[id] >= 0 && count < max) {
+                snprintf(out[count].name, sizeof(out[count].name), "%s", names[id]);
+                out[count].location = locations[id];
+                count++;
+            }
+        }
+
+        i += len;
+    }
+
+    free(locations);
+    free(names);
+
+    return count;
+}
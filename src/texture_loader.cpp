@@ -0,0 +1,155 @@
+#include "shdy.h"
+#include <cstdlib>
+#include <cstring>
+#include <glad/glad.h>
+
+struct TextureLoad {
+    AsyncJob decode;
+    char path[PATH_MAX];
+    bool decoded; // Written by the loader thread before the decode is done.
+    Image image;
+    int uploaded_rows;
+    unsigned int pbo;
+    unsigned int texture;
+};
+
+static AsyncQueue s_decode_queue = ASYNC_QUEUE_INIT;
+
+int texture_load_event_fd() {
+    return async_queue_event_fd(&s_decode_queue);
+}
+
+void texture_load_clear_events(bool wait) {
+    async_queue_clear_events(&s_decode_queue, wait);
+}
+
+static void texture_load_free(AsyncJob *job) {
+    auto *load = (TextureLoad *)job;
+    image_free(&load->image);
+    free(load);
+}
+
+static void texture_load_decode(AsyncJob *job) {
+    auto *load = (TextureLoad *)job;
+
+    double start = get_time_ms();
+    load->decoded = image_load(&load->image, load->path);
+    if (load->decoded) {
+        INFOF("Decoded %dx%d texture %s in %.2fms.\n", load->image.width, load->image.height, load->path,
+              get_time_ms() - start);
+    }
+}
+
+TextureLoad *texture_load_start(const char *path) {
+    auto *load = (TextureLoad *)calloc(1, sizeof(TextureLoad));
+    if (load == nullptr) {
+        ERRORF("Failed to calloc() texture load for %s.\n", path);
+        return nullptr;
+    }
+    snprintf(load->path, sizeof(load->path), "%s", path);
+
+    if (!async_job_start(&s_decode_queue, &load->decode, texture_load_decode, texture_load_free)) {
+        ERRORF("Unable to load texture %s, the loader queue is full.\n", path);
+        free(load);
+        return nullptr;
+    }
+
+    return load;
+}
+
+// Creates the texture with its full mip chain, once the size of the image is known.
+static void texture_load_alloc_texture(TextureLoad *load) {
+    int width = load->image.width;
+    int height = load->image.height;
+    int levels = 1;
+    while ((width | height) >> levels) {
+        levels++;
+    }
+
+    glGenTextures(1, &load->texture);
+    glBindTexture(GL_TEXTURE_2D, load->texture);
+    glTexStorage2D(GL_TEXTURE_2D, levels, load->image.format == IMAGE_RGBA32F ? GL_RGBA16F : GL_RGBA8, width,
+                   height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+    glGenBuffers(1, &load->pbo);
+}
+
+TextureLoadState texture_load_update(TextureLoad *load, size_t *budget) {
+    if (!async_job_done(&load->decode)) {
+        return TEXTURE_LOAD_DECODING;
+    }
+    if (!load->decoded) {
+        return TEXTURE_LOAD_FAILED;
+    }
+
+    Image *image = &load->image;
+    if (load->texture == 0) {
+        texture_load_alloc_texture(load);
+    }
+
+    // Copy the rows into a freshly orphaned pixel buffer so the driver can transfer them to the texture
+    // asynchronously, rather than copying the whole image synchronously in glTexSubImage2D().
+    size_t row_size = image_row_size(image);
+    size_t remaining_rows = image->height - load->uploaded_rows;
+    int rows = (int)(*budget / row_size < remaining_rows ? *budget / row_size : remaining_rows);
+    if (rows == 0 && load->uploaded_rows < image->height) {
+        return TEXTURE_LOAD_UPLOADING;
+    }
+
+    if (rows > 0) {
+        size_t size = rows * row_size;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, load->pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        void *mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+                                        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (mapped == nullptr) {
+            ERRORF("Failed to map the pixel buffer for texture %s.\n", load->path);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            return TEXTURE_LOAD_FAILED;
+        }
+        memcpy(mapped, (char *)image->pixels + load->uploaded_rows * row_size, size);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+        glBindTexture(GL_TEXTURE_2D, load->texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, load->uploaded_rows, image->width, rows, GL_RGBA,
+                        image->format == IMAGE_RGBA32F ? GL_FLOAT : GL_UNSIGNED_BYTE, nullptr);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        load->uploaded_rows += rows;
+        *budget -= size;
+    }
+
+    if (load->uploaded_rows < image->height) {
+        return TEXTURE_LOAD_UPLOADING;
+    }
+
+    glBindTexture(GL_TEXTURE_2D, load->texture);
+    glGenerateMipmap(GL_TEXTURE_2D);
+
+    return TEXTURE_LOAD_DONE;
+}
+
+unsigned int texture_load_finish(TextureLoad *load, int *out_width, int *out_height) {
+    unsigned int texture = load->texture;
+    *out_width = load->image.width;
+    *out_height = load->image.height;
+
+    glDeleteBuffers(1, &load->pbo);
+    texture_load_free(&load->decode);
+
+    return texture;
+}
+
+void texture_load_cancel(TextureLoad *load) {
+    if (load->texture != 0) {
+        glDeleteTextures(1, &load->texture);
+        glDeleteBuffers(1, &load->pbo);
+    }
+
+    async_job_cancel(&load->decode);
+}
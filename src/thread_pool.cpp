@@ -0,0 +1,165 @@
+#include "shdy.h"
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// States of an AsyncJob.
+enum {
+    ASYNC_JOB_RUNNING = 0,
+    ASYNC_JOB_FINISHED,
+    ASYNC_JOB_CANCELLED
+};
+
+static void *thread_pool_worker(void *arg) {
+    auto *thread_pool = (ThreadPool *)arg;
+
+    pthread_mutex_lock(&thread_pool->mutex);
+    while (true) {
+        while (thread_pool->num_jobs == 0 && !thread_pool->stopping) {
+            pthread_cond_wait(&thread_pool->cond, &thread_pool->mutex);
+        }
+        if (thread_pool->num_jobs == 0) {
+            break;
+        }
+
+        ThreadPoolJob job = thread_pool->jobs[thread_pool->head];
+        thread_pool->head = (thread_pool->head + 1) % THREAD_POOL_MAX_JOBS;
+        thread_pool->num_jobs--;
+
+        pthread_mutex_unlock(&thread_pool->mutex);
+        job.fn(job.arg);
+        pthread_mutex_lock(&thread_pool->mutex);
+    }
+    pthread_mutex_unlock(&thread_pool->mutex);
+
+    return nullptr;
+}
+
+void thread_pool_create(ThreadPool *thread_pool, int num_threads) {
+    if (num_threads <= 0) {
+        num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+    if (num_threads > THREAD_POOL_MAX_THREADS) {
+        num_threads = THREAD_POOL_MAX_THREADS;
+    }
+
+    pthread_mutex_init(&thread_pool->mutex, nullptr);
+    pthread_cond_init(&thread_pool->cond, nullptr);
+    thread_pool->head = 0;
+    thread_pool->num_jobs = 0;
+    thread_pool->stopping = false;
+    thread_pool->num_threads = 0;
+
+    for (int i = 0; i < num_threads; i++) {
+        int err = pthread_create(&thread_pool->threads[i], nullptr, thread_pool_worker, thread_pool);
+        if (err != 0) {
+            ERRORF("Failure in call to pthread_create(): %s.\n", strerror(err));
+            exit(EXIT_FAILURE);
+        }
+        thread_pool->num_threads++;
+    }
+}
+
+void thread_pool_destroy(ThreadPool *thread_pool) {
+    pthread_mutex_lock(&thread_pool->mutex);
+    thread_pool->stopping = true;
+    pthread_cond_broadcast(&thread_pool->cond);
+    pthread_mutex_unlock(&thread_pool->mutex);
+
+    for (int i = 0; i < thread_pool->num_threads; i++) {
+        pthread_join(thread_pool->threads[i], nullptr);
+    }
+    thread_pool->num_threads = 0;
+
+    pthread_cond_destroy(&thread_pool->cond);
+    pthread_mutex_destroy(&thread_pool->mutex);
+}
+
+bool thread_pool_submit(ThreadPool *thread_pool, ThreadPoolFn fn, void *arg) {
+    pthread_mutex_lock(&thread_pool->mutex);
+    if (thread_pool->num_jobs == THREAD_POOL_MAX_JOBS || thread_pool->stopping) {
+        pthread_mutex_unlock(&thread_pool->mutex);
+        return false;
+    }
+
+    int tail = (thread_pool->head + thread_pool->num_jobs) % THREAD_POOL_MAX_JOBS;
+    thread_pool->jobs[tail].fn = fn;
+    thread_pool->jobs[tail].arg = arg;
+    thread_pool->num_jobs++;
+    pthread_cond_signal(&thread_pool->cond);
+    pthread_mutex_unlock(&thread_pool->mutex);
+
+    return true;
+}
+
+int async_queue_event_fd(AsyncQueue *queue) {
+    if (queue->event_fd < 0) {
+        queue->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (queue->event_fd < 0) {
+            ERRORF("Failure in call to eventfd(): %s.\n", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    return queue->event_fd;
+}
+
+void async_queue_clear_events(AsyncQueue *queue, bool wait) {
+    int fd = async_queue_event_fd(queue);
+    if (wait) {
+        struct pollfd pfd = {fd, POLLIN, 0};
+        while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {
+        }
+    }
+
+    uint64_t count;
+    read(fd, &count, sizeof(count));
+}
+
+static void async_job_run(void *arg) {
+    auto *job = (AsyncJob *)arg;
+    // Read first, the render thread may free the job as soon as it's finished.
+    int event_fd = job->queue->event_fd;
+    job->run(job);
+
+    // Whoever is second, this thread or a cancel on the render thread, frees the job.
+    if (__atomic_exchange_n(&job->state, ASYNC_JOB_FINISHED, __ATOMIC_ACQ_REL) == ASYNC_JOB_CANCELLED) {
+        job->free(job);
+        return;
+    }
+
+    uint64_t one = 1;
+    write(event_fd, &one, sizeof(one));
+}
+
+bool async_job_start(AsyncQueue *queue, AsyncJob *job, AsyncJobFn run, AsyncJobFn free) {
+    if (!queue->started) {
+        thread_pool_create(&queue->pool, 0);
+        queue->started = true;
+    }
+    // Created here rather than by the first job to finish, so only the render thread ever creates it.
+    async_queue_event_fd(queue);
+
+    job->queue = queue;
+    job->run = run;
+    job->free = free;
+    job->state = ASYNC_JOB_RUNNING;
+
+    return thread_pool_submit(&queue->pool, async_job_run, job);
+}
+
+bool async_job_done(const AsyncJob *job) {
+    return __atomic_load_n(&job->state, __ATOMIC_ACQUIRE) == ASYNC_JOB_FINISHED;
+}
+
+void async_job_cancel(AsyncJob *job) {
+    if (__atomic_exchange_n(&job->state, ASYNC_JOB_CANCELLED, __ATOMIC_ACQ_REL) == ASYNC_JOB_FINISHED) {
+        job->free(job);
+    }
+}
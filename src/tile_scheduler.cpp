@@ -0,0 +1,170 @@
+#include "shdy.h"
+#include <cstdlib>
+#include <unistd.h>
+
+typedef struct {
+    TileScheduler *scheduler;
+    int thread;
+} TileJob;
+
+// Moves the back half of the tiles left in the busiest other queue to the empty queue of thread. Returns false once
+// every queue is empty.
+static bool tile_scheduler_steal(TileScheduler *scheduler, int thread) {
+    while (true) {
+        int victim = -1;
+        int most = 0;
+        for (int i = 0; i < scheduler->num_threads; i++) {
+            TileQueue *queue = &scheduler->queues[i];
+            pthread_mutex_lock(&queue->mutex);
+            int remaining = queue->tail - queue->head;
+            pthread_mutex_unlock(&queue->mutex);
+            if (i != thread && remaining > most) {
+                victim = i;
+                most = remaining;
+            }
+        }
+        if (victim == -1) {
+            return false;
+        }
+
+        // The victim may have drawn some of them since, then look again.
+        TileQueue *queue = &scheduler->queues[victim];
+        pthread_mutex_lock(&queue->mutex);
+        int remaining = queue->tail - queue->head;
+        int tail = queue->tail;
+        int head = tail - (remaining + 1) / 2;
+        if (remaining > 0) {
+            queue->tail = head;
+        }
+        pthread_mutex_unlock(&queue->mutex);
+        if (remaining <= 0) {
+            continue;
+        }
+
+        TileQueue *own = &scheduler->queues[thread];
+        pthread_mutex_lock(&own->mutex);
+        own->head = head;
+        own->tail = tail;
+        own->num_stolen += tail - head;
+        pthread_mutex_unlock(&own->mutex);
+        return true;
+    }
+}
+
+static void tile_job_run(void *arg) {
+    auto *job = (TileJob *)arg;
+    TileScheduler *scheduler = job->scheduler;
+    TileQueue *queue = &scheduler->queues[job->thread];
+
+    if (scheduler->fns->begin != nullptr) {
+        scheduler->fns->begin(scheduler->arg, job->thread);
+    }
+
+    while (true) {
+        pthread_mutex_lock(&queue->mutex);
+        int index = queue->head < queue->tail ? queue->head++ : -1;
+        pthread_mutex_unlock(&queue->mutex);
+        if (index == -1) {
+            if (!tile_scheduler_steal(scheduler, job->thread)) {
+                break;
+            }
+            continue;
+        }
+
+        double start_ms = get_time_ms();
+        scheduler->fns->draw(scheduler->arg, job->thread, &scheduler->tiles[index]);
+        queue->busy_ms += get_time_ms() - start_ms;
+        queue->num_drawn++;
+    }
+
+    if (scheduler->fns->end != nullptr) {
+        scheduler->fns->end(scheduler->arg, job->thread);
+    }
+}
+
+void tile_scheduler_create(TileScheduler *scheduler, int width, int height, int tile_width, int tile_height,
+                           int num_threads) {
+    if (num_threads <= 0) {
+        num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (num_threads < 1) {
+        num_threads = 1;
+    }
+    if (num_threads > TILE_SCHEDULER_MAX_THREADS) {
+        num_threads = TILE_SCHEDULER_MAX_THREADS;
+    }
+
+    int cols = (width + tile_width - 1) / tile_width;
+    int rows = (height + tile_height - 1) / tile_height;
+    scheduler->tiles = (Tile *)malloc((size_t)cols * rows * sizeof(Tile));
+    if (scheduler->tiles == nullptr) {
+        ERRORF("Failed to malloc() tiles.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    scheduler->num_tiles = 0;
+    for (int y = 0; y < height; y += tile_height) {
+        for (int x = 0; x < width; x += tile_width) {
+            Tile *tile = &scheduler->tiles[scheduler->num_tiles++];
+            tile->x = x;
+            tile->y = y;
+            tile->width = x + tile_width < width ? tile_width : width - x;
+            tile->height = y + tile_height < height ? tile_height : height - y;
+        }
+    }
+
+    scheduler->num_threads = num_threads;
+    for (int i = 0; i < num_threads; i++) {
+        pthread_mutex_init(&scheduler->queues[i].mutex, nullptr);
+    }
+    scheduler->fns = nullptr;
+    scheduler->arg = nullptr;
+    scheduler->elapsed_ms = 0.0;
+}
+
+void tile_scheduler_destroy(TileScheduler *scheduler) {
+    for (int i = 0; i < scheduler->num_threads; i++) {
+        pthread_mutex_destroy(&scheduler->queues[i].mutex);
+    }
+    free(scheduler->tiles);
+    scheduler->tiles = nullptr;
+    scheduler->num_tiles = 0;
+}
+
+void tile_scheduler_run(TileScheduler *scheduler, const TileFns *fns, void *arg) {
+    scheduler->fns = fns;
+    scheduler->arg = arg;
+
+    // Neighbouring tiles tend to cost about the same, so each thread starts on its own band of the image.
+    for (int i = 0; i < scheduler->num_threads; i++) {
+        TileQueue *queue = &scheduler->queues[i];
+        queue->head = (int)((long)scheduler->num_tiles * i / scheduler->num_threads);
+        queue->tail = (int)((long)scheduler->num_tiles * (i + 1) / scheduler->num_threads);
+        queue->num_drawn = 0;
+        queue->num_stolen = 0;
+        queue->busy_ms = 0.0;
+    }
+
+    double start_ms = get_time_ms();
+    TileJob jobs[TILE_SCHEDULER_MAX_THREADS];
+    ThreadPool thread_pool;
+    thread_pool_create(&thread_pool, scheduler->num_threads);
+    for (int i = 0; i < scheduler->num_threads; i++) {
+        jobs[i].scheduler = scheduler;
+        jobs[i].thread = i;
+        thread_pool_submit(&thread_pool, tile_job_run, &jobs[i]);
+    }
+    thread_pool_destroy(&thread_pool);
+    scheduler->elapsed_ms = get_time_ms() - start_ms;
+}
+
+void tile_scheduler_report(const TileScheduler *scheduler) {
+    INFOF("Drew %d tiles on %d threads in %.3fms.\n", scheduler->num_tiles, scheduler->num_threads,
+          scheduler->elapsed_ms);
+    for (int i = 0; i < scheduler->num_threads; i++) {
+        const TileQueue *queue = &scheduler->queues[i];
+        double utilization = scheduler->elapsed_ms > 0.0 ? queue->busy_ms / scheduler->elapsed_ms * 100.0 : 0.0;
+        INFOF("Thread %2d drew %4d tiles (%4d stolen), busy %10.3fms, %5.1f%% utilization.\n", i, queue->num_drawn,
+              queue->num_stolen, queue->busy_ms, utilization);
+    }
+}
@@ -0,0 +1,16 @@
+// Kept in its own translation unit as the native X11 headers clash with the names declared in shdy.h
+// (e.g Window).
+
+#define GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+#define GLFW_EXPOSE_NATIVE_X11
+#include <GLFW/glfw3native.h>
+
+int window_native_event_fd() {
+    Display *display = glfwGetX11Display();
+    if (display == nullptr) {
+        return -1;
+    }
+
+    return ConnectionNumber(display);
+}